@@ -0,0 +1,110 @@
+///@brief: Command line client of accel_daemon, sends images from one or more connections and writes the edge maps
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <iomanip>
+#include <filesystem>
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include "image_formats.h"
+#include "accel_client.h"
+#include "bench_stats.h"
+
+namespace fs = std::filesystem;
+
+int main(int argc, char* argv[]) {
+    JobParams params;
+    int clients = 1;
+    std::vector<std::string> images;
+    bool options_ok = argc >= 4;
+    for (int i = 3; options_ok && i < argc; i++) {
+        std::string flag = argv[i];
+        if (flag.compare(0, 2, "--") != 0) {
+            images.push_back(flag);
+        } else if (flag == "--input-format" && i + 1 < argc) {
+            params.input_format = parse_input_format(argv[++i]);
+            options_ok = params.input_format >= 0;
+        } else if (flag == "--output-format" && i + 1 < argc) {
+            params.output_format = parse_output_format(argv[++i]);
+            options_ok = params.output_format >= 0;
+        } else if (flag == "--stages" && i + 1 < argc) {
+            params.stages.flags = parse_edge_stages(argv[++i]);
+            options_ok = params.stages.flags >= 0;
+        } else if (flag == "--mask-threshold" && i + 1 < argc) {
+            params.stages.mask_threshold = std::atoi(argv[++i]);
+            options_ok = params.stages.mask_threshold >= 1 && params.stages.mask_threshold <= 255;
+        } else if (flag == "--clients" && i + 1 < argc) {
+            clients = std::atoi(argv[++i]);
+            options_ok = clients >= 1;
+        } else {
+            options_ok = false;
+        }
+        if (!options_ok) {
+            std::cerr << "[ERROR] BAD OPTION: " << flag << std::endl;
+        }
+    }
+    if (!options_ok || images.empty()) {
+        std::cout << "USAGE: " << argv[0] << " <SOCKET_PATH> <OUTPUT_DIR> <IMAGE>... [OPTIONS]" << std::endl;
+        std::cout << "  --input-format rgb32|rgb888|luma8   KERNEL INPUT LAYOUT (DEFAULT rgb888)" << std::endl;
+        std::cout << "  --output-format NAME                rgb32, gray8, bit1 OR rle (DEFAULT gray8)" << std::endl;
+        std::cout << "  --stages LIST                       OPTIONAL KERNEL STAGES: gauss3,gauss5,nms,threshold OR canny (DEFAULT none)" << std::endl;
+        std::cout << "  --mask-threshold N                  EDGE VALUE SET IN THE bit1 / rle MASKS (DEFAULT 64)" << std::endl;
+        std::cout << "  --clients N                         CONNECTIONS SENDING IN PARALLEL, THE DAEMON BATCHES THEIR JOBS (DEFAULT 1)" << std::endl;
+        return 1;
+    }
+    const std::string socket_path = argv[1];
+    const std::string output_dir = argv[2];
+    fs::create_directories(output_dir);
+    std::cout << std::fixed << std::setprecision(3);
+
+    std::mutex report_mutex;
+    StageStats round_trip;
+    StageStats queued;
+    int failed = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < clients; t++) {
+        threads.emplace_back([&, t] {
+            try {
+                AccelClient client(socket_path);
+                int imread_flags = (params.input_format == INPUT_FORMAT_LUMA8) ? cv::IMREAD_GRAYSCALE : cv::IMREAD_COLOR;
+                for (size_t i = t; i < images.size(); i += clients) {
+                    cv::Mat image = cv::imread(images[i], imread_flags);
+                    std::string name = fs::path(images[i]).filename().string();
+                    JobResult result;
+                    if (!image.empty()) result = client.run(image, params);
+                    std::lock_guard<std::mutex> lock(report_mutex);
+                    if (image.empty() || result.status != ACCEL_JOB_OK) {
+                        std::cerr << "[ERROR] JOB FAILED: " << images[i] << " (STATUS " << result.status << ")" << std::endl;
+                        failed++;
+                        continue;
+                    }
+                    cv::imwrite(output_dir + "/out_fpga_" + name, result.edges);
+                    round_trip.add(result.round_trip_ms);
+                    queued.add(result.queue_ms);
+                    std::cout << "[INFO] " << name << ": ROUND TRIP " << result.round_trip_ms << " MS, QUEUED " << result.queue_ms
+                              << " MS, RUN " << result.run_ms << " MS, BATCH OF " << result.batch_jobs << std::endl;
+                }
+            } catch (const std::exception& e) {
+                std::lock_guard<std::mutex> lock(report_mutex);
+                std::cerr << "[ERROR] " << e.what() << std::endl;
+                failed++;
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+    double wall_time_ms = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count() / 1000.0;
+
+    std::cout << "=================================================" << std::endl;
+    std::cout << std::left << std::setw(25) << "JOBS:" << round_trip.samples_ms.size() << " OK, " << failed << " FAILED" << std::endl;
+    std::cout << std::left << std::setw(25) << "WALL TIME:" << wall_time_ms << " MS" << std::endl;
+    std::cout << std::left << std::setw(25) << "ROUND TRIP P50 / P95:" << round_trip.percentile(50) << " / " << round_trip.percentile(95) << " MS" << std::endl;
+    std::cout << std::left << std::setw(25) << "QUEUED P50 / P95:" << queued.percentile(50) << " / " << queued.percentile(95) << " MS" << std::endl;
+    std::cout << "=================================================" << std::endl;
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,185 @@
+#ifndef ACCEL_CLIENT_H
+#define ACCEL_CLIENT_H
+
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <opencv2/opencv.hpp>
+
+#include "image_formats.h"
+#include "edge_mask.h"
+#include "accel_protocol.h"
+
+struct JobParams {
+    int input_format = INPUT_FORMAT_RGB888;
+    int output_format = OUTPUT_FORMAT_GRAY8;
+    EdgeStages stages;
+};
+
+struct JobResult {
+    int status = ACCEL_JOB_FAILED;
+    cv::Mat edges;                  /// (h - 2) x (w - 2), masks decoded to 0 / 255, valid until the next run()
+    size_t output_bytes = 0;        /// bytes the server wrote, the compressed size for bit1 / rle
+    int batch_jobs = 0;
+    double queue_ms = 0.0;
+    double run_ms = 0.0;
+    double round_trip_ms = 0.0;     /// request sent to reply received, as the client saw it
+};
+
+///@brief: One connection to accel_daemon. The input and output travel in two memfds the client keeps for its
+/// whole life and grows when a job needs more, the server maps them, so no pixel goes through the socket.
+/// Decoding straight into input_image() skips the one copy run() otherwise makes. Not thread safe, use one
+/// client per thread
+class AccelClient {
+public:
+    explicit AccelClient(const std::string& socket_path) {
+        fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        struct sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+        if (fd < 0 || connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+            if (fd >= 0) close(fd);
+            throw std::runtime_error("cannot connect to accel_daemon at " + socket_path);
+        }
+        /// The server only maps buffers that cannot shrink, reserve() still grows them
+        input.fd = memfd_create("accel_job_input", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        output.fd = memfd_create("accel_job_output", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (input.fd < 0 || output.fd < 0 || fcntl(input.fd, F_ADD_SEALS, F_SEAL_SHRINK) != 0 ||
+            fcntl(output.fd, F_ADD_SEALS, F_SEAL_SHRINK) != 0) {
+            input.release();
+            output.release();
+            close(fd);
+            throw std::runtime_error("cannot create sealed job buffers");
+        }
+    }
+
+    ~AccelClient() {
+        input.release();
+        output.release();
+        close(fd);
+    }
+
+    AccelClient(const AccelClient&) = delete;
+    AccelClient& operator=(const AccelClient&) = delete;
+
+    ///@brief: An image of the given size and type (CV_8UC3 / CV_8UC1) living in the shared input buffer
+    cv::Mat input_image(int height, int width, int type) {
+        size_t bytes = (size_t)height * width * (type == CV_8UC1 ? 1 : 3);
+        input.reserve(bytes);
+        return cv::Mat(height, width, type, input.map);
+    }
+
+    ///@brief: Runs one image and waits for the reply. image is CV_8UC3 (BGR) for the rgb32 / rgb888 layouts and
+    /// CV_8UC1 for luma8. Throws when the connection is lost, a rejected job comes back with its status
+    JobResult run(const cv::Mat& image, const JobParams& params) {
+        JobRequest request;
+        std::memset(&request, 0, sizeof(request));
+        request.magic = ACCEL_JOB_MAGIC;
+        request.job_id = next_job_id++;
+        request.height = image.rows;
+        request.width = image.cols;
+        request.input_format = params.input_format;
+        request.output_format = params.output_format;
+        request.stages = params.stages.flags;
+        request.low_threshold = params.stages.low_threshold;
+        request.high_threshold = params.stages.high_threshold;
+        request.mask_threshold = params.stages.mask_threshold;
+
+        JobResult result;
+        if (image.rows < 3 || image.cols < 3 || image.channels() != job_input_channels(params.input_format)) {
+            result.status = ACCEL_JOB_BAD_REQUEST;
+            return result;
+        }
+        size_t in_bytes = job_input_bytes(image.rows, image.cols, params.input_format);
+        size_t out_bytes = job_output_bytes(image.rows, image.cols, params.output_format);
+        if (image.data != input.map) {
+            input.reserve(in_bytes);
+            size_t row_bytes = (size_t)image.cols * image.channels();
+            for (int r = 0; r < image.rows; r++) {
+                std::memcpy(static_cast<unsigned char*>(input.map) + r * row_bytes, image.ptr<unsigned char>(r), row_bytes);
+            }
+        }
+        output.reserve(out_bytes);
+
+        auto sent = std::chrono::high_resolution_clock::now();
+        int fds[2] = { input.fd, output.fd };
+        if (!send_job_message(fd, &request, sizeof(request), fds, 2)) {
+            throw std::runtime_error("accel_daemon connection lost");
+        }
+        JobReply reply;
+        int reply_fds[2];
+        int reply_fd_count = 0;
+        if (receive_job_message(fd, &reply, sizeof(reply), reply_fds, reply_fd_count) != (ssize_t)sizeof(reply) ||
+            reply.magic != ACCEL_JOB_MAGIC || reply.job_id != request.job_id) {
+            throw std::runtime_error("accel_daemon connection lost");
+        }
+        result.round_trip_ms = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - sent).count() / 1000.0;
+        result.status = reply.status;
+        result.output_bytes = reply.output_bytes;
+        result.batch_jobs = reply.batch_jobs;
+        result.queue_ms = reply.queue_ms;
+        result.run_ms = reply.run_ms;
+        if (result.status != ACCEL_JOB_OK) return result;
+
+        int out_height = image.rows - 2;
+        int out_width = image.cols - 2;
+        unsigned char* buffer = static_cast<unsigned char*>(output.map);
+        if (is_mask_output(params.output_format)) {
+            mask_storage.create(out_height, out_width, CV_8UC1);
+            for (int r = 0; r < out_height; r++) {
+                unpack_mask_row(buffer, out_height, out_width, params.output_format, r, mask_storage.ptr<unsigned char>(r));
+            }
+            result.edges = mask_storage;
+        } else {
+            result.edges = cv::Mat(out_height, out_width, CV_8UC1, buffer);
+        }
+        return result;
+    }
+
+private:
+    ///@brief: A memfd and its mapping, grown by whole pages
+    struct SharedBuffer {
+        int fd = -1;
+        void* map = nullptr;
+        size_t bytes = 0;
+
+        void reserve(size_t needed) {
+            if (needed <= bytes) return;
+            size_t page = sysconf(_SC_PAGESIZE);
+            size_t grown = ((needed + page - 1) / page) * page;
+            if (map) munmap(map, bytes);
+            map = nullptr;
+            bytes = 0;
+            void* mapped = MAP_FAILED;
+            if (ftruncate(fd, grown) == 0) {
+                mapped = mmap(nullptr, grown, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            }
+            if (mapped == MAP_FAILED) {
+                throw std::runtime_error("cannot grow the shared job buffer");
+            }
+            map = mapped;
+            bytes = grown;
+        }
+
+        void release() {
+            if (map) munmap(map, bytes);
+            if (fd >= 0) close(fd);
+        }
+    };
+
+    int fd = -1;
+    uint32_t next_job_id = 1;
+    SharedBuffer input;
+    SharedBuffer output;
+    cv::Mat mask_storage;
+};
+
+#endif
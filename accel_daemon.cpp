@@ -0,0 +1,98 @@
+///@brief: Long running server that opens the card and loads the xclbin once, then serves edge detection jobs
+/// from local clients over a UNIX socket (accel_protocol.h, accel_client.h)
+#include <iostream>
+#include <string>
+#include <memory>
+#include <chrono>
+#include <iomanip>
+#include <csignal>
+#include <pthread.h>
+
+#include "image_formats.h"
+#include "accel_device.h"
+#include "batch_pipeline.h"
+#include "accel_server.h"
+
+int main(int argc, char* argv[]) {
+    ServerConfig config;
+    std::string device_name = "xrt";
+    EdgeKernel edge_kernel;
+    bool options_ok = argc >= 3;
+    for (int i = 3; options_ok && i < argc; i++) {
+        std::string flag = argv[i];
+        if (flag == "--device" && i + 1 < argc) {
+            device_name = argv[++i];
+            options_ok = device_name == "xrt" || device_name == "sw";
+        } else if (flag == "--queue-depth" && i + 1 < argc) {
+            config.queue_depth = std::atoi(argv[++i]);
+            options_ok = config.queue_depth >= 1;
+        } else if (flag == "--max-batch" && i + 1 < argc) {
+            config.max_batch = std::atoi(argv[++i]);
+            options_ok = config.max_batch >= 1 && config.max_batch <= MAX_BATCH_IMAGES;
+        } else if (flag == "--max-pipelines" && i + 1 < argc) {
+            config.max_pipelines = std::atoi(argv[++i]);
+            options_ok = config.max_pipelines >= 1;
+        } else if (flag == "--operator" && i + 1 < argc) {
+            edge_kernel.edge_operator = parse_edge_operator(argv[++i]);
+            options_ok = edge_kernel.edge_operator >= 0;
+        } else if (flag == "--magnitude" && i + 1 < argc) {
+            edge_kernel.magnitude = parse_edge_magnitude(argv[++i]);
+            options_ok = edge_kernel.magnitude >= 0;
+        } else {
+            options_ok = false;
+        }
+        if (!options_ok) {
+            std::cerr << "[ERROR] BAD OPTION: " << flag << std::endl;
+        }
+    }
+    if (!options_ok) {
+        std::cout << "USAGE: " << argv[0] << " <XCLBIN_PATH> <SOCKET_PATH> [OPTIONS]" << std::endl;
+        std::cout << "  --device xrt|sw                     sw RUNS THE BIT-EXACT CPU ENGINE, NO CARD NEEDED (DEFAULT xrt)" << std::endl;
+        std::cout << "  --queue-depth N                     KERNEL RUNS KEPT IN FLIGHT PER JOB FORMAT (DEFAULT 2)" << std::endl;
+        std::cout << "  --max-batch N                       JOBS PACKED INTO ONE image_process_batch RUN (DEFAULT 16)" << std::endl;
+        std::cout << "  --max-pipelines N                   JOB FORMATS KEPT OPEN ON THE DEVICE AT ONCE (DEFAULT 8)" << std::endl;
+        std::cout << "  --operator NAME / --magnitude l1|l2 KERNEL SPECIALIZATION, AS IN host_app (DEFAULT sobel3 / l1)" << std::endl;
+        return 1;
+    }
+    config.socket_path = argv[2];
+    std::cout << std::fixed << std::setprecision(3);
+
+    /// SIGINT / SIGTERM are taken by sigwait below, every thread started after this inherits the mask
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    try {
+        std::cout << "[INFO] INITIALIZING XRT DEVICE AND LOADING XCLBIN..." << std::endl;
+        auto setup_start = std::chrono::high_resolution_clock::now();
+        std::unique_ptr<AccelDevice> device;
+        if (device_name == "sw") {
+            device.reset(new SoftwareAccelDevice(SoftwareAccelDevice::Latency(), "sw", edge_kernel));
+        } else {
+            /// One CU, the dispatcher keeps it fed with batch runs
+            device = std::move(open_xrt_compute_units(argv[1], 1, edge_kernel)[0]);
+        }
+        std::cout << "[INFO] XRT SETUP/LOAD TIME: " << elapsed_ms(setup_start, std::chrono::high_resolution_clock::now())
+                  << " MS, PAID ONCE FOR ALL JOBS" << std::endl;
+
+        AccelServer server(*device, config);
+        server.start();
+        std::cout << "[INFO] KERNEL: " << edge_kernel_name(edge_kernel, device->supports_batch() && config.max_batch > 1) << std::endl;
+        std::cout << "[INFO] LISTENING ON " << config.socket_path << std::endl;
+
+        int signal_number = 0;
+        sigwait(&signals, &signal_number);
+        std::cout << "[INFO] SHUTTING DOWN ON SIGNAL " << signal_number << std::endl;
+        server.stop();
+
+        ServerStats stats = server.stats();
+        std::cout << "[INFO] SERVED " << stats.jobs << " JOBS IN " << stats.dispatches << " DISPATCHES AND " << stats.runs
+                  << " KERNEL RUNS, " << stats.rejected << " REJECTED" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "[ERROR] XRT/RUNTIME ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
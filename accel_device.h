@@ -0,0 +1,494 @@
+#ifndef ACCEL_DEVICE_H
+#define ACCEL_DEVICE_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <chrono>
+#include <CL/cl_ext_xilinx.h>
+
+#include <xrt/xrt_kernel.h>
+#include <xrt/xrt_bo.h>
+#include <xrt/xrt_device.h>
+
+#include "image_formats.h"
+#include "cpu_engine.h"
+#include "image_process_ref.h"
+
+///@brief: Scalar arguments of one image_process invocation
+struct KernelArgs {
+    int height = 0;
+    int width = 0;
+    int input_format = INPUT_FORMAT_RGB888;
+    int output_format = OUTPUT_FORMAT_GRAY8;
+    EdgeStages stages;
+    ImageRoi roi;               /// dense image by default
+};
+
+///@brief: Submit/sync/wait interface over the accelerator. Work is organised in slots, each slot owns
+/// one input/output buffer pair and at most one run in flight. start() never blocks, wait() blocks until
+/// the slot's run has completed, the syncs block like xrt::bo::sync.
+class AccelDevice {
+public:
+    virtual ~AccelDevice() {}
+    virtual void allocate(int slot, size_t in_bytes, size_t out_bytes) = 0;
+    virtual unsigned char* input_map(int slot) = 0;
+    virtual unsigned char* output_map(int slot) = 0;
+    virtual void sync_input(int slot, size_t bytes) = 0;
+    ///@brief: Runs the slot on bytes of host memory instead of its input buffer, so sync_input DMAs straight from
+    /// it with no pack copy. host_ptr must be DATASET_ALIGN (4 KiB) aligned and stay valid until the slot is
+    /// attached elsewhere, a DatasetReader payload. nullptr goes back to the slot's own input buffer
+    virtual void attach_input(int slot, unsigned char* host_ptr, size_t bytes) = 0;
+    virtual void start(int slot, const KernelArgs& args) = 0;
+    ///@brief: One image_process_batch run over the slot's buffers, images laid out as the descriptors say
+    virtual void start_batch(int slot, const std::vector<ImageDescriptor>& descriptors, int input_format, int output_format, const EdgeStages& stages) = 0;
+    virtual bool supports_batch() const = 0;
+    ///@brief: One image_process_pyramid run: args.height x args.width and its 2x2 averaged halvings, `levels` of them
+    /// written at pyramid_level_offset in the slot's output buffer. Plain sobel on a dense image, of args.stages only
+    /// mask_threshold is used
+    virtual void start_pyramid(int slot, const KernelArgs& args, int levels) = 0;
+    virtual bool supports_pyramid() const = 0;
+    virtual void wait(int slot) = 0;
+    virtual void sync_output(int slot, size_t bytes) = 0;
+    ///@brief: Part of the output buffer, for the mask formats whose size is only known after the run
+    virtual void sync_output_range(int slot, size_t offset, size_t bytes) = 0;
+    ///@brief: The slot's buffer for the Gx / Gy planes of EDGE_STAGE_GRADIENTS runs (gradient_buffer_bytes),
+    /// filled by start() only, image_process_batch has no gradient port
+    virtual void allocate_gradients(int slot, size_t bytes) = 0;
+    virtual unsigned char* gradient_map(int slot) = 0;
+    virtual void sync_gradients(int slot, size_t bytes) = 0;
+    virtual std::string name() const = 0;
+};
+
+///@brief: image_process on an Alveo card through XRT. image_process_batch is used when the xclbin has it.
+/// kernel_name may select a single compute unit ("image_process:{image_process_2}"), buffers are then placed
+/// in the memory banks connected to that CU through its group_id
+class XrtAccelDevice : public AccelDevice {
+public:
+    XrtAccelDevice(const std::string& xclbin_path, const std::string& kernel_name = "image_process")
+        : device(0), kernel_label(kernel_name)
+    {
+        auto uuid = device.load_xclbin(xclbin_path);
+        open_kernels(uuid, kernel_name, "image_process_batch", "image_process_pyramid");
+    }
+
+    ///@brief: One CU of an xclbin already loaded on xrt_device
+    XrtAccelDevice(const xrt::device& xrt_device, const xrt::uuid& uuid, const std::string& kernel_name, const std::string& batch_kernel_name,
+                   const std::string& pyramid_kernel_name = "image_process_pyramid")
+        : device(xrt_device), kernel_label(kernel_name)
+    {
+        open_kernels(uuid, kernel_name, batch_kernel_name, pyramid_kernel_name);
+    }
+
+    void allocate(int slot, size_t in_bytes, size_t out_bytes) override {
+        if ((int)slots.size() <= slot) slots.resize(slot + 1);
+        slots[slot].bo_in = xrt::bo(device, in_bytes, xrt::bo::flags::cacheable, kernel.group_id(0));
+        slots[slot].bo_out = xrt::bo(device, out_bytes, xrt::bo::flags::cacheable, kernel.group_id(1));
+        /// The pyramid sub-buffers point into the old bo_out
+        slots[slot].level_bos.clear();
+        /// grad_img needs a buffer on every run, one burst until gradients are asked for
+        if (slots[slot].grad_bytes == 0) {
+            allocate_gradients(slot, BURST_BYTES);
+        }
+    }
+
+    void allocate_gradients(int slot, size_t bytes) override {
+        slots[slot].bo_grad = xrt::bo(device, bytes, xrt::bo::flags::cacheable, kernel.group_id(2));
+        slots[slot].grad_bytes = bytes;
+    }
+
+    unsigned char* gradient_map(int slot) override { return slots[slot].bo_grad.map<unsigned char*>(); }
+
+    void sync_gradients(int slot, size_t bytes) override {
+        slots[slot].bo_grad.sync(XCL_BO_SYNC_BO_FROM_DEVICE, bytes, 0);
+    }
+
+    unsigned char* input_map(int slot) override { return slots[slot].bo_in.map<unsigned char*>(); }
+    unsigned char* output_map(int slot) override { return slots[slot].bo_out.map<unsigned char*>(); }
+
+    void sync_input(int slot, size_t bytes) override {
+        input_bo(slots[slot]).sync(XCL_BO_SYNC_BO_TO_DEVICE, bytes, 0);
+    }
+
+    ///@brief: A user pointer buffer over the host memory, XRT pins the pages and DMAs from them in place
+    void attach_input(int slot, unsigned char* host_ptr, size_t bytes) override {
+        Slot& s = slots[slot];
+        s.bo_user = host_ptr ? xrt::bo(device, host_ptr, bytes, kernel.group_id(0)) : xrt::bo();
+        s.user_input = host_ptr != nullptr;
+    }
+
+    void start(int slot, const KernelArgs& args) override {
+        Slot& s = slots[slot];
+        s.run = kernel(input_bo(s), s.bo_out, s.bo_grad, args.height, args.width, args.input_format, args.output_format,
+                       args.stages.flags, args.stages.low_threshold, args.stages.high_threshold, args.stages.mask_threshold,
+                       args.roi.x, args.roi.y, args.roi.in_stride, args.roi.out_stride);
+    }
+
+    void start_batch(int slot, const std::vector<ImageDescriptor>& descriptors, int input_format, int output_format, const EdgeStages& stages) override {
+        if (!has_batch_kernel) {
+            throw std::runtime_error("xclbin has no image_process_batch kernel");
+        }
+        Slot& s = slots[slot];
+        size_t table_bytes = descriptors.size() * sizeof(ImageDescriptor);
+        if (s.descriptor_bytes < table_bytes) {
+            s.bo_descriptors = xrt::bo(device, MAX_BATCH_IMAGES * sizeof(ImageDescriptor), xrt::bo::flags::cacheable, batch_kernel.group_id(2));
+            s.descriptor_bytes = MAX_BATCH_IMAGES * sizeof(ImageDescriptor);
+        }
+        std::memcpy(s.bo_descriptors.map<unsigned char*>(), descriptors.data(), table_bytes);
+        s.bo_descriptors.sync(XCL_BO_SYNC_BO_TO_DEVICE, table_bytes, 0);
+        s.run = batch_kernel(input_bo(s), s.bo_out, s.bo_descriptors, (int)descriptors.size(), input_format, output_format,
+                             stages.flags, stages.low_threshold, stages.high_threshold, stages.mask_threshold);
+    }
+
+    bool supports_batch() const override { return has_batch_kernel; }
+
+    ///@brief: Each level goes to the kernel as a sub-buffer of the output buffer, the levels that are off get level 0's.
+    /// The sub-buffers are made on the first pyramid run of a slot and reused until the layout or bo_out changes
+    void start_pyramid(int slot, const KernelArgs& args, int levels) override {
+        if (!has_pyramid_kernel) {
+            throw std::runtime_error("xclbin has no image_process_pyramid kernel");
+        }
+        Slot& s = slots[slot];
+        if (s.level_bos.empty() || s.level_height != args.height || s.level_width != args.width ||
+            s.level_format != args.output_format || s.level_count != levels) {
+            s.level_bos.clear();
+            for (int level = 0; level < PYRAMID_MAX_LEVELS; level++) {
+                int used_level = level < levels ? level : 0;
+                s.level_bos.push_back(xrt::bo(s.bo_out, pyramid_level_bytes(args.output_format, args.height, args.width, used_level),
+                                              pyramid_level_offset(args.output_format, args.height, args.width, used_level)));
+            }
+            s.level_height = args.height;
+            s.level_width = args.width;
+            s.level_format = args.output_format;
+            s.level_count = levels;
+        }
+        s.run = pyramid_kernel(input_bo(s), s.level_bos[0], s.level_bos[1], s.level_bos[2], args.height, args.width, args.input_format,
+                               args.output_format, levels, args.stages.mask_threshold);
+    }
+
+    bool supports_pyramid() const override { return has_pyramid_kernel; }
+
+    void wait(int slot) override { slots[slot].run.wait(); }
+
+    void sync_output(int slot, size_t bytes) override {
+        slots[slot].bo_out.sync(XCL_BO_SYNC_BO_FROM_DEVICE, bytes, 0);
+    }
+
+    void sync_output_range(int slot, size_t offset, size_t bytes) override {
+        slots[slot].bo_out.sync(XCL_BO_SYNC_BO_FROM_DEVICE, bytes, offset);
+    }
+
+    std::string name() const override { return kernel_label; }
+
+private:
+    void open_kernels(const xrt::uuid& uuid, const std::string& kernel_name, const std::string& batch_kernel_name,
+                      const std::string& pyramid_kernel_name) {
+        kernel = xrt::kernel(device, uuid, kernel_name);
+        try {
+            batch_kernel = xrt::kernel(device, uuid, batch_kernel_name);
+            has_batch_kernel = true;
+        } catch (const std::exception&) {
+            has_batch_kernel = false;
+        }
+        try {
+            pyramid_kernel = xrt::kernel(device, uuid, pyramid_kernel_name);
+            has_pyramid_kernel = true;
+        } catch (const std::exception&) {
+            has_pyramid_kernel = false;
+        }
+    }
+
+    struct Slot {
+        xrt::bo bo_in;
+        xrt::bo bo_out;
+        xrt::bo bo_grad;
+        size_t grad_bytes = 0;
+        xrt::bo bo_user;            /// attach_input's buffer, used instead of bo_in while user_input is set
+        bool user_input = false;
+        xrt::bo bo_descriptors;
+        size_t descriptor_bytes = 0;
+        std::vector<xrt::bo> level_bos;    /// start_pyramid's sub-buffers of bo_out, for the layout below
+        int level_height = 0;
+        int level_width = 0;
+        int level_format = 0;
+        int level_count = 0;
+        xrt::run run;
+    };
+
+    static xrt::bo& input_bo(Slot& s) { return s.user_input ? s.bo_user : s.bo_in; }
+
+    xrt::device device;
+    std::string kernel_label;
+    xrt::kernel kernel;
+    xrt::kernel batch_kernel;
+    bool has_batch_kernel = false;
+    xrt::kernel pyramid_kernel;
+    bool has_pyramid_kernel = false;
+    std::vector<Slot> slots;
+};
+
+///@brief: Loads the xclbin once and opens every compute unit of the kernel specialization edge_kernel in it
+/// (at most max_units, 0 = all), image_process for the default sobel. The i-th CU of the matching batch kernel,
+/// if any, is paired with the i-th single image CU, and so is the i-th image_process_pyramid CU
+inline std::vector<std::unique_ptr<AccelDevice> > open_xrt_compute_units(const std::string& xclbin_path, int max_units,
+                                                                         const EdgeKernel& edge_kernel = EdgeKernel()) {
+    xrt::device device(0);
+    xrt::xclbin xclbin(xclbin_path);
+    xrt::uuid uuid = device.load_xclbin(xclbin);
+    std::string kernel_name = edge_kernel_name(edge_kernel, false);
+    std::string batch_kernel_name = edge_kernel_name(edge_kernel, true);
+
+    const std::string pyramid_kernel_name = "image_process_pyramid";
+
+    std::vector<std::string> cus;
+    std::vector<std::string> batch_cus;
+    std::vector<std::string> pyramid_cus;
+    for (const xrt::xclbin::kernel& kernel : xclbin.get_kernels()) {
+        for (const xrt::xclbin::ip& cu : kernel.get_cus()) {
+            if (kernel.get_name() == kernel_name) cus.push_back(cu.get_name());
+            if (kernel.get_name() == batch_kernel_name) batch_cus.push_back(cu.get_name());
+            if (kernel.get_name() == pyramid_kernel_name) pyramid_cus.push_back(cu.get_name());
+        }
+    }
+    std::sort(cus.begin(), cus.end());
+    std::sort(batch_cus.begin(), batch_cus.end());
+    std::sort(pyramid_cus.begin(), pyramid_cus.end());
+
+    std::vector<std::unique_ptr<AccelDevice> > units;
+    if (cus.empty()) {
+        /// Older xclbins without kernel metadata, let XRT pick the CU
+        units.emplace_back(new XrtAccelDevice(device, uuid, kernel_name, batch_kernel_name));
+        return units;
+    }
+    for (size_t i = 0; i < cus.size() && (max_units <= 0 || (int)i < max_units); i++) {
+        std::string batch_name = i < batch_cus.size() ? batch_kernel_name + ":{" + batch_cus[i] + "}" : batch_kernel_name;
+        std::string pyramid_name = i < pyramid_cus.size() ? pyramid_kernel_name + ":{" + pyramid_cus[i] + "}" : pyramid_kernel_name;
+        units.emplace_back(new XrtAccelDevice(device, uuid, kernel_name + ":{" + cus[i] + "}", batch_name, pyramid_name));
+    }
+    return units;
+}
+
+///@brief: Software stand-in for the card. Buffers live in host memory, runs execute one at a time on a
+/// worker thread (like a single compute unit) with the bit-exact CPU engine, and each stage can be given
+/// a simulated cost so that overlap between DMA and kernel time can be observed without hardware.
+/// With no simulated cost this is the CPU fallback used when no card is present. edge_kernel stands in for
+/// the kernel specialization the card would run.
+class SoftwareAccelDevice : public AccelDevice {
+public:
+    struct Latency {
+        double dma_gbps = 0.0;      /// 0 = syncs complete immediately
+        double kernel_mpps = 0.0;   /// 0 = runs take only the reference compute time
+        double launch_us = 0.0;     /// fixed cost added to every run
+    };
+
+    SoftwareAccelDevice() : SoftwareAccelDevice(Latency()) {}
+
+    explicit SoftwareAccelDevice(const Latency& latency_config, const std::string& unit_name = "sw",
+                                 const EdgeKernel& kernel_specialization = EdgeKernel())
+        : latency(latency_config), label(unit_name), edge_kernel(kernel_specialization),
+          worker(&SoftwareAccelDevice::worker_loop, this) {}
+
+    ~SoftwareAccelDevice() override {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        work_ready.notify_all();
+        worker.join();
+    }
+
+    void allocate(int slot, size_t in_bytes, size_t out_bytes) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        if ((int)slots.size() <= slot) slots.resize(slot + 1);
+        slots[slot].in.assign(in_bytes, 0);
+        slots[slot].out.assign(out_bytes, 0);
+    }
+
+    unsigned char* input_map(int slot) override { return slots[slot].in.data(); }
+    unsigned char* output_map(int slot) override { return slots[slot].out.data(); }
+
+    void allocate_gradients(int slot, size_t bytes) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        if ((int)slots.size() <= slot) slots.resize(slot + 1);
+        slots[slot].grad.assign(bytes, 0);
+    }
+
+    unsigned char* gradient_map(int slot) override { return slots[slot].grad.data(); }
+    void sync_gradients(int slot, size_t bytes) override { (void)slot; simulate_dma(bytes); }
+
+    void sync_input(int slot, size_t bytes) override { (void)slot; simulate_dma(bytes); }
+
+    void attach_input(int slot, unsigned char* host_ptr, size_t bytes) override {
+        (void)bytes;
+        std::lock_guard<std::mutex> lock(mutex);
+        slots[slot].user_in = host_ptr;
+    }
+    void sync_output(int slot, size_t bytes) override { (void)slot; simulate_dma(bytes); }
+    void sync_output_range(int slot, size_t offset, size_t bytes) override { (void)slot; (void)offset; simulate_dma(bytes); }
+
+    void start(int slot, const KernelArgs& args) override {
+        ImageDescriptor descriptor = {0, 0, (unsigned int)args.height, (unsigned int)args.width, (unsigned int)args.roi.x,
+                                      (unsigned int)args.roi.y, (unsigned int)args.roi.in_stride, (unsigned int)args.roi.out_stride};
+        start_batch(slot, std::vector<ImageDescriptor>(1, descriptor), args.input_format, args.output_format, args.stages);
+    }
+
+    void start_batch(int slot, const std::vector<ImageDescriptor>& descriptors, int input_format, int output_format, const EdgeStages& stages) override {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            slots[slot].descriptors = descriptors;
+            slots[slot].input_format = input_format;
+            slots[slot].output_format = output_format;
+            slots[slot].stages = stages;
+            slots[slot].pyramid_levels = 0;
+            slots[slot].done = false;
+            queue.push_back(slot);
+        }
+        work_ready.notify_all();
+    }
+
+    bool supports_batch() const override { return true; }
+
+    void start_pyramid(int slot, const KernelArgs& args, int levels) override {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ImageDescriptor descriptor = {0, 0, (unsigned int)args.height, (unsigned int)args.width, 0, 0, 0, 0};
+            slots[slot].descriptors.assign(1, descriptor);
+            slots[slot].input_format = args.input_format;
+            slots[slot].output_format = args.output_format;
+            slots[slot].stages = args.stages;
+            slots[slot].pyramid_levels = levels;
+            slots[slot].done = false;
+            queue.push_back(slot);
+        }
+        work_ready.notify_all();
+    }
+
+    bool supports_pyramid() const override { return true; }
+
+    void wait(int slot) override {
+        std::unique_lock<std::mutex> lock(mutex);
+        run_done.wait(lock, [&] { return slots[slot].done; });
+    }
+
+    std::string name() const override { return label; }
+
+private:
+    struct Slot {
+        std::vector<unsigned char> in;
+        std::vector<unsigned char> out;
+        std::vector<unsigned char> grad;
+        const unsigned char* user_in = nullptr;     /// attach_input's memory, read instead of `in` when set
+        std::vector<ImageDescriptor> descriptors;
+        int input_format = INPUT_FORMAT_RGB888;
+        int output_format = OUTPUT_FORMAT_GRAY8;
+        EdgeStages stages;
+        int pyramid_levels = 0;     /// > 0 for a start_pyramid run
+        bool done = true;
+    };
+
+    void simulate_dma(size_t bytes) {
+        if (latency.dma_gbps > 0.0) {
+            std::this_thread::sleep_for(std::chrono::duration<double>(bytes / (latency.dma_gbps * 1e9)));
+        }
+    }
+
+    void worker_loop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            work_ready.wait(lock, [&] { return stopping || !queue.empty(); });
+            if (queue.empty()) return;
+            int slot = queue.front();
+            queue.pop_front();
+            Slot& s = slots[slot];
+            lock.unlock();
+
+            /// The launch cost is paid once per run, however many images it carries
+            auto run_start = std::chrono::steady_clock::now();
+            double run_s = latency.launch_us * 1e-6;
+            for (const ImageDescriptor& descriptor : s.descriptors) {
+                const unsigned char* in = (s.user_in ? s.user_in : s.in.data()) + (size_t)descriptor.in_offset * BURST_BYTES;
+                unsigned char* out = s.out.data() + (size_t)descriptor.out_offset * BURST_BYTES;
+                if (s.pyramid_levels > 0) {
+                    /// Every level on the reference model. The card computes the coarser levels beside the first, so the
+                    /// simulated cost is that of the input pixels alone
+                    image_pyramid_reference(in, out, descriptor.height, descriptor.width, s.input_format, s.output_format,
+                                            s.pyramid_levels, s.stages.mask_threshold);
+                    if (latency.kernel_mpps > 0.0) {
+                        run_s += (double)descriptor.height * descriptor.width / (latency.kernel_mpps * 1e6);
+                    }
+                    continue;
+                }
+                ImageRoi roi;
+                roi.x = descriptor.roi_x;
+                roi.y = descriptor.roi_y;
+                roi.in_stride = descriptor.in_stride;
+                roi.out_stride = descriptor.out_stride;
+                if (roi.in_stride != 0) {
+                    roi_scratch.resize(input_buffer_bytes(s.input_format, descriptor.height * descriptor.width));
+                    gather_roi_input(in, roi, s.input_format, descriptor.height, descriptor.width, roi_scratch.data());
+                    in = roi_scratch.data();
+                }
+                /// The mask formats and spaced out rows are packed from a GRAY8 plane, MAG_ORIENT rows are spaced
+                /// by the reference model, which has the orientation bins
+                int out_height = descriptor.height - 2;
+                int out_width = descriptor.width - 2;
+                bool mag_orient = s.output_format == OUTPUT_FORMAT_MAG_ORIENT;
+                bool packed_output = is_mask_output(s.output_format) || (roi.out_stride != 0 && !mag_orient);
+                int output_format = packed_output ? OUTPUT_FORMAT_GRAY8 : s.output_format;
+                unsigned char* edges = out;
+                if (packed_output) {
+                    mask_scratch.resize(output_buffer_bytes(OUTPUT_FORMAT_GRAY8, out_height * out_width));
+                    edges = mask_scratch.data();
+                }
+                ImageRoi out_roi;
+                out_roi.out_stride = mag_orient ? roi.out_stride : 0;
+                /// Like the kernel, only a single image run fills the gradient buffer
+                unsigned char* grad = (s.descriptors.size() == 1 && !s.grad.empty()) ? s.grad.data() : nullptr;
+                if (s.stages.flags == 0 && !mag_orient && edge_kernel.edge_operator == EDGE_OPERATOR_SOBEL3 &&
+                    edge_kernel.magnitude == EDGE_MAGNITUDE_L1) {
+                    image_process_cpu(in, edges, descriptor.height, descriptor.width, s.input_format, output_format);
+                } else {
+                    /// The SIMD engine only has the plain sobel path, the other operators, the optional stages and
+                    /// the orientation / gradient outputs run on the reference model
+                    image_process_reference(in, edges, descriptor.height, descriptor.width, s.input_format, output_format,
+                                            s.stages.flags, s.stages.low_threshold, s.stages.high_threshold,
+                                            edge_kernel.edge_operator, edge_kernel.magnitude, 0, out_roi, grad);
+                }
+                if (packed_output) {
+                    pack_edge_rows(edges, out_height, out_width, s.output_format, s.stages.mask_threshold, roi.out_stride, out);
+                }
+                if (latency.kernel_mpps > 0.0) {
+                    run_s += (double)descriptor.height * descriptor.width / (latency.kernel_mpps * 1e6);
+                }
+            }
+            std::this_thread::sleep_until(run_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                                          std::chrono::duration<double>(run_s)));
+
+            lock.lock();
+            s.done = true;
+            run_done.notify_all();
+        }
+    }
+
+    Latency latency;
+    std::string label;
+    EdgeKernel edge_kernel;
+    std::vector<unsigned char> mask_scratch;    /// worker thread only
+    std::vector<unsigned char> roi_scratch;     /// worker thread only
+    std::deque<Slot> slots;     /// deque so growing it never moves a slot the worker is running
+    std::deque<int> queue;
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable run_done;
+    std::thread worker;
+};
+
+#endif
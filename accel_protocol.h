@@ -0,0 +1,125 @@
+#ifndef ACCEL_PROTOCOL_H
+#define ACCEL_PROTOCOL_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "image_formats.h"
+
+///@brief: Job API of accel_daemon. Clients connect to a SOCK_SEQPACKET UNIX socket and send one JobRequest per
+/// job together with two memfds (SCM_RIGHTS): the input image and the buffer the reply is written to. The
+/// input is the decoded image as cv::Mat rows, height x width BGR for the rgb32 / rgb888 kernel layouts or gray
+/// for luma8, rows back to back. The server answers every request with a JobReply, in completion order, jobs of
+/// one connection complete in the order they were sent. Both memfds must be created with MFD_ALLOW_SEALING and
+/// carry F_SEAL_SHRINK (growing is still allowed), the server maps them and rejects unsealed buffers with
+/// ACCEL_JOB_BAD_BUFFER, as a buffer truncated under a live mapping would fault the server.
+
+#define ACCEL_JOB_MAGIC 0x4a534f53u     /// "SOSJ"
+
+///@brief: JobReply::status
+#define ACCEL_JOB_OK 0
+#define ACCEL_JOB_BAD_REQUEST 1         /// unknown format, image below 3x3 or above KERNEL_MAX_WIDTH, missing buffers
+#define ACCEL_JOB_BAD_BUFFER 2          /// a buffer smaller than the job needs, not mappable or without F_SEAL_SHRINK
+#define ACCEL_JOB_FAILED 3              /// the device run threw
+
+struct JobRequest {
+    uint32_t magic;
+    uint32_t job_id;                    /// echoed in the reply
+    int32_t height;
+    int32_t width;
+    int32_t input_format;
+    int32_t output_format;
+    int32_t stages;
+    int32_t low_threshold;
+    int32_t high_threshold;
+    int32_t mask_threshold;
+};
+
+struct JobReply {
+    uint32_t magic;
+    uint32_t job_id;
+    int32_t status;
+    uint32_t output_bytes;              /// bytes written to the output buffer
+    int32_t batch_jobs;                 /// jobs dispatched together with this one
+    int32_t reserved;
+    double queue_ms;                    /// received to dispatched
+    double run_ms;                      /// this job's share of the H2D, kernel and D2H time
+};
+
+///@brief: Channels of the input image the request's input_format expects
+inline int job_input_channels(int input_format) {
+    return (input_format == INPUT_FORMAT_LUMA8) ? 1 : 3;
+}
+
+inline size_t job_input_bytes(int height, int width, int input_format) {
+    return (size_t)height * width * job_input_channels(input_format);
+}
+
+///@brief: Reply layout: the (h - 2) x (w - 2) 8-bit edge plane for rgb32 / gray8, the kernel's bytes for the bit1 /
+/// rle masks (decoded with edge_mask.h). This is what the output buffer has to hold
+inline size_t job_output_bytes(int height, int width, int output_format) {
+    if (is_mask_output(output_format)) {
+        return output_buffer_bytes(output_format, height - 2, width - 2);
+    }
+    return (size_t)(height - 2) * (width - 2);
+}
+
+///@brief: Sends one message with up to two file descriptors attached, false if the peer is gone
+inline bool send_job_message(int socket_fd, const void* data, size_t bytes, const int* fds, int fd_count) {
+    struct iovec iov;
+    iov.iov_base = const_cast<void*>(data);
+    iov.iov_len = bytes;
+    struct msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    char control[CMSG_SPACE(sizeof(int) * 2)];
+    if (fd_count > 0) {
+        std::memset(control, 0, sizeof(control));
+        message.msg_control = control;
+        message.msg_controllen = CMSG_SPACE(sizeof(int) * fd_count);
+        struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+        std::memcpy(CMSG_DATA(header), fds, sizeof(int) * fd_count);
+    }
+    return sendmsg(socket_fd, &message, MSG_NOSIGNAL) == (ssize_t)bytes;
+}
+
+///@brief: Receives one message and the descriptors attached to it (up to two, fd_count set). Returns the message
+/// size, 0 when the peer closed the connection, -1 on error
+inline ssize_t receive_job_message(int socket_fd, void* data, size_t bytes, int* fds, int& fd_count) {
+    struct iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = bytes;
+    struct msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    char control[CMSG_SPACE(sizeof(int) * 2)];
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    ssize_t received = recvmsg(socket_fd, &message, MSG_CMSG_CLOEXEC);
+    fd_count = 0;
+    if (received <= 0) return received;
+    for (struct cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+        if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+            int count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (int k = 0; k < count; k++) {
+                int fd;
+                std::memcpy(&fd, CMSG_DATA(header) + k * sizeof(int), sizeof(int));
+                if (fd_count < 2) fds[fd_count++] = fd;
+                else close(fd);
+            }
+        }
+    }
+    return received;
+}
+
+#endif
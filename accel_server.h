@@ -0,0 +1,419 @@
+#ifndef ACCEL_SERVER_H
+#define ACCEL_SERVER_H
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <tuple>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <opencv2/opencv.hpp>
+
+#include "image_formats.h"
+#include "accel_device.h"
+#include "batch_pipeline.h"
+#include "accel_protocol.h"
+
+struct ServerConfig {
+    std::string socket_path;
+    int queue_depth = 2;            /// runs in flight per job format
+    int max_batch = 16;             /// jobs packed into one image_process_batch run, 1 = one job per run
+    int max_height = 1080;          /// slot sizing, larger jobs grow their slot once
+    int max_width = 1920;
+    int max_pipelines = 8;          /// format combinations kept open, the least recently used one hands its slots on
+};
+
+struct ServerStats {
+    long long jobs = 0;             /// jobs run on the device
+    long long rejected = 0;         /// answered with an error status without a run
+    long long dispatches = 0;       /// groups of jobs handed to the device together
+    long long runs = 0;             /// kernel invocations
+};
+
+///@brief: Keeps one device open and serves jobs from local clients (accel_protocol.h). Each connection has a
+/// thread that maps the job buffers and queues the job. One dispatcher thread takes the queued jobs with the
+/// same formats, stages and thresholds as the oldest one and runs them as one group through a BatchPipeline, so
+/// jobs that arrive while the device is busy go out together in image_process_batch runs of up to max_batch
+/// images. A job is only taken while no earlier job of its connection stays queued, which keeps every
+/// connection's replies in send order. Pipelines are created per formats and stage flags on first use and keep
+/// their device buffers, the thresholds are set per group, so steady state jobs neither open the device nor
+/// allocate. At most max_pipelines are open, each on its own range of queue_depth slots.
+class AccelServer {
+public:
+    AccelServer(AccelDevice& accel_device, const ServerConfig& server_config) : device(accel_device), config(server_config) {}
+
+    ~AccelServer() { stop(); }
+
+    ///@brief: Binds the socket (replacing a stale socket file) and starts serving, throws if the socket cannot be bound
+    void start() {
+        listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        struct sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (listen_fd < 0 || config.socket_path.size() >= sizeof(address.sun_path)) {
+            throw std::runtime_error("cannot create socket " + config.socket_path);
+        }
+        std::strcpy(address.sun_path, config.socket_path.c_str());
+        unlink(config.socket_path.c_str());
+        if (bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listen_fd, 64) != 0) {
+            close(listen_fd);
+            listen_fd = -1;
+            throw std::runtime_error("cannot listen on " + config.socket_path + ": " + std::strerror(errno));
+        }
+        stopping = false;
+        dispatcher = std::thread(&AccelServer::dispatch_loop, this);
+        acceptor = std::thread(&AccelServer::accept_loop, this);
+    }
+
+    ///@brief: Closes the socket and every connection, finishes the group on the device, drops queued jobs
+    void stop() {
+        if (listen_fd < 0) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            for (const std::weak_ptr<Connection>& weak : connections) {
+                std::shared_ptr<Connection> connection = weak.lock();
+                if (connection) shutdown(connection->fd, SHUT_RDWR);
+            }
+        }
+        job_ready.notify_all();
+        shutdown(listen_fd, SHUT_RDWR);
+        acceptor.join();
+        dispatcher.join();
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            readers_done.wait(lock, [&] { return active_readers == 0; });
+        }
+        queue.clear();
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(config.socket_path.c_str());
+    }
+
+    ServerStats stats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return counters;
+    }
+
+private:
+    struct Connection {
+        int fd;
+        std::mutex send_mutex;      /// replies of one connection come from the reader and the dispatcher
+        explicit Connection(int socket_fd) : fd(socket_fd) {}
+        ~Connection() { close(fd); }
+
+        void reply(const JobReply& message) {
+            std::lock_guard<std::mutex> lock(send_mutex);
+            send_job_message(fd, &message, sizeof(message), nullptr, 0);
+        }
+    };
+
+    ///@brief: A mapped job, the mappings are released with it
+    struct Job {
+        std::shared_ptr<Connection> connection;
+        JobRequest request;
+        void* in_map = MAP_FAILED;
+        void* out_map = MAP_FAILED;
+        size_t in_bytes = 0;
+        size_t out_bytes = 0;
+        cv::Mat image;
+        int status = ACCEL_JOB_OK;      /// a rejected job is answered in its place in the queue
+        std::chrono::high_resolution_clock::time_point received;
+
+        ~Job() {
+            if (in_map != MAP_FAILED) munmap(in_map, in_bytes);
+            if (out_map != MAP_FAILED) munmap(out_map, out_bytes);
+        }
+    };
+
+    typedef std::tuple<int, int, int> PipelineKey;
+    typedef std::tuple<int, int, int, int, int, int> GroupKey;
+
+    struct PipelineEntry {
+        std::unique_ptr<BatchPipeline> pipeline;
+        int first_slot = -1;            /// -1 until a slot range is assigned
+        long long last_used = 0;
+    };
+
+    static PipelineKey pipeline_key(const JobRequest& request) {
+        return PipelineKey(request.input_format, request.output_format, request.stages);
+    }
+
+    static GroupKey group_key(const JobRequest& request) {
+        return GroupKey(request.input_format, request.output_format, request.stages, request.low_threshold,
+                        request.high_threshold, request.mask_threshold);
+    }
+
+    static JobReply make_reply(const JobRequest& request, int status) {
+        JobReply reply;
+        std::memset(&reply, 0, sizeof(reply));
+        reply.magic = ACCEL_JOB_MAGIC;
+        reply.job_id = request.job_id;
+        reply.status = status;
+        return reply;
+    }
+
+    void accept_loop() {
+        while (true) {
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping) {
+                if (fd >= 0) close(fd);
+                return;
+            }
+            if (fd < 0) continue;
+            std::shared_ptr<Connection> connection(new Connection(fd));
+            connections.erase(std::remove_if(connections.begin(), connections.end(),
+                                             [](const std::weak_ptr<Connection>& weak) { return weak.expired(); }),
+                              connections.end());
+            connections.push_back(connection);
+            /// Readers are detached, stop() waits for the count to drop instead of joining them
+            active_readers++;
+            std::thread(&AccelServer::read_loop, this, connection).detach();
+        }
+    }
+
+    void read_loop(std::shared_ptr<Connection> connection) {
+        while (true) {
+            JobRequest request;
+            int fds[2];
+            int fd_count = 0;
+            ssize_t received = receive_job_message(connection->fd, &request, sizeof(request), fds, fd_count);
+            if (received <= 0) break;
+
+            std::shared_ptr<Job> job(new Job());
+            job->received = std::chrono::high_resolution_clock::now();
+            job->request = request;
+            job->connection = connection;
+            int status = validate(received, request, fd_count);
+            if (status == ACCEL_JOB_OK) {
+                status = map_buffers(*job, fds);
+            }
+            for (int k = 0; k < fd_count; k++) close(fds[k]);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                job->status = status;
+                if (status != ACCEL_JOB_OK) counters.rejected++;
+                queue.push_back(job);
+            }
+            job_ready.notify_all();
+        }
+        connection.reset();
+        std::lock_guard<std::mutex> lock(mutex);
+        active_readers--;
+        readers_done.notify_all();
+    }
+
+    static int validate(ssize_t received, const JobRequest& request, int fd_count) {
+        if (received != (ssize_t)sizeof(JobRequest) || request.magic != ACCEL_JOB_MAGIC || fd_count != 2 ||
+            request.height < 3 || request.width < 3 || request.width > KERNEL_MAX_WIDTH ||
+            request.input_format < INPUT_FORMAT_RGB32 || request.input_format > INPUT_FORMAT_LUMA8 ||
+            request.output_format < OUTPUT_FORMAT_RGB32 || request.output_format > OUTPUT_FORMAT_RLE ||
+            (request.output_format == OUTPUT_FORMAT_RLE && request.height - 2 > RLE_MAX_ROWS)) {
+            return ACCEL_JOB_BAD_REQUEST;
+        }
+        return ACCEL_JOB_OK;
+    }
+
+    static int map_buffers(Job& job, const int* fds) {
+        const JobRequest& request = job.request;
+        job.in_bytes = job_input_bytes(request.height, request.width, request.input_format);
+        job.out_bytes = job_output_bytes(request.height, request.width, request.output_format);
+        /// Without F_SEAL_SHRINK the client could truncate a buffer under the mapping and the server would take
+        /// SIGBUS on the next access
+        int in_seals = fcntl(fds[0], F_GET_SEALS);
+        int out_seals = fcntl(fds[1], F_GET_SEALS);
+        if (in_seals < 0 || out_seals < 0 || !(in_seals & F_SEAL_SHRINK) || !(out_seals & F_SEAL_SHRINK)) {
+            return ACCEL_JOB_BAD_BUFFER;
+        }
+        struct stat in_stat;
+        struct stat out_stat;
+        if (fstat(fds[0], &in_stat) != 0 || fstat(fds[1], &out_stat) != 0 ||
+            (size_t)in_stat.st_size < job.in_bytes || (size_t)out_stat.st_size < job.out_bytes) {
+            return ACCEL_JOB_BAD_BUFFER;
+        }
+        job.in_map = mmap(nullptr, job.in_bytes, PROT_READ, MAP_SHARED, fds[0], 0);
+        job.out_map = mmap(nullptr, job.out_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fds[1], 0);
+        if (job.in_map == MAP_FAILED || job.out_map == MAP_FAILED) {
+            return ACCEL_JOB_BAD_BUFFER;
+        }
+        int type = job_input_channels(request.input_format) == 1 ? CV_8UC1 : CV_8UC3;
+        job.image = cv::Mat(request.height, request.width, type, job.in_map);
+        return ACCEL_JOB_OK;
+    }
+
+    ///@brief: Pipeline of one format combination on its own range of device slots. A new combination takes a
+    /// released range, a new one while fewer than max_pipelines are open, else the least recently used pipeline's
+    /// range, whose buffers the new pool reallocates
+    BatchPipeline& pipeline_for(const PipelineKey& key) {
+        PipelineEntry& entry = pipelines[key];
+        entry.last_used = ++pipeline_uses;
+        if (entry.pipeline) return *entry.pipeline;
+
+        if (entry.first_slot < 0 && !free_slots.empty()) {
+            entry.first_slot = free_slots.back();
+            free_slots.pop_back();
+        } else if (entry.first_slot < 0 && (int)pipelines.size() <= std::max(1, config.max_pipelines)) {
+            entry.first_slot = next_slot;
+            next_slot += config.queue_depth;
+        } else if (entry.first_slot < 0) {
+            std::map<PipelineKey, PipelineEntry>::iterator oldest = pipelines.end();
+            for (std::map<PipelineKey, PipelineEntry>::iterator it = pipelines.begin(); it != pipelines.end(); ++it) {
+                if (it->second.first_slot >= 0 && (oldest == pipelines.end() || it->second.last_used < oldest->second.last_used)) {
+                    oldest = it;
+                }
+            }
+            entry.first_slot = oldest->second.first_slot;
+            pipelines.erase(oldest);
+        }
+
+        PipelineConfig pipeline_config;
+        pipeline_config.queue_depth = config.queue_depth;
+        pipeline_config.input_format = std::get<0>(key);
+        pipeline_config.output_format = std::get<1>(key);
+        pipeline_config.stages.flags = std::get<2>(key);
+        pipeline_config.max_height = config.max_height;
+        pipeline_config.max_width = config.max_width;
+        pipeline_config.first_slot = entry.first_slot;
+        pipeline_config.images_per_run = device.supports_batch() ? config.max_batch : 1;
+        pipeline_config.decode_masks = false;
+        entry.pipeline.reset(new BatchPipeline(device, pipeline_config));
+        return *entry.pipeline;
+    }
+
+    ///@brief: Drops a pipeline whose run failed, its slots go to the next new combination
+    void release_pipeline(const PipelineKey& key) {
+        std::map<PipelineKey, PipelineEntry>::iterator it = pipelines.find(key);
+        if (it == pipelines.end()) return;
+        if (it->second.first_slot >= 0) free_slots.push_back(it->second.first_slot);
+        pipelines.erase(it);
+    }
+
+    void dispatch_loop() {
+        while (true) {
+            std::vector<std::shared_ptr<Job> > group;
+            std::vector<std::shared_ptr<Job> > rejected;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                job_ready.wait(lock, [&] { return stopping || !queue.empty(); });
+                if (stopping) return;
+                while (!queue.empty() && queue.front()->status != ACCEL_JOB_OK) {
+                    rejected.push_back(queue.front());
+                    queue.pop_front();
+                }
+                /// Everything queued that can share runs with the oldest job, unless an earlier job of the same
+                /// connection keeps its place, so each connection's jobs still complete in send order
+                if (!queue.empty()) {
+                    GroupKey key = group_key(queue.front()->request);
+                    std::set<const Connection*> held;
+                    for (std::deque<std::shared_ptr<Job> >::iterator it = queue.begin(); it != queue.end(); ) {
+                        const Connection* connection = (*it)->connection.get();
+                        if ((*it)->status == ACCEL_JOB_OK && group_key((*it)->request) == key && !held.count(connection)) {
+                            group.push_back(*it);
+                            it = queue.erase(it);
+                        } else {
+                            held.insert(connection);
+                            ++it;
+                        }
+                    }
+                }
+            }
+            for (const std::shared_ptr<Job>& job : rejected) {
+                job->connection->reply(make_reply(job->request, job->status));
+            }
+            if (!group.empty()) run_group(group);
+        }
+    }
+
+    void run_group(const std::vector<std::shared_ptr<Job> >& group) {
+        auto dispatched = std::chrono::high_resolution_clock::now();
+        const JobRequest& first = group[0]->request;
+        size_t next_job = 0;
+        size_t answered = 0;
+        BatchReport report;
+        try {
+            BatchPipeline& pipeline = pipeline_for(pipeline_key(first));
+            pipeline.set_thresholds(first.low_threshold, first.high_threshold, first.mask_threshold);
+            report = pipeline.run(
+                [&](BatchInput& input) {
+                    if (next_job == group.size()) return false;
+                    input.image = group[next_job]->image;
+                    input.tag = next_job++;
+                    return true;
+                },
+                [&](const BatchOutput& output) {
+                    Job& job = *group[output.tag];
+                    JobReply reply = make_reply(job.request, ACCEL_JOB_OK);
+                    unsigned char* out = static_cast<unsigned char*>(job.out_map);
+                    if (output.compressed) {
+                        std::memcpy(out, output.compressed, output.compressed_bytes);
+                        reply.output_bytes = output.compressed_bytes;
+                    } else {
+                        for (int r = 0; r < output.edges.rows; r++) {
+                            std::memcpy(out + (size_t)r * output.edges.cols, output.edges.ptr<unsigned char>(r), output.edges.cols);
+                        }
+                        reply.output_bytes = (size_t)output.edges.rows * output.edges.cols;
+                    }
+                    reply.batch_jobs = group.size();
+                    reply.queue_ms = elapsed_ms(job.received, dispatched);
+                    reply.run_ms = output.metrics.total_time_ms;
+                    {
+                        /// Counted before the reply, so stats() seen after a reply includes its job
+                        std::lock_guard<std::mutex> lock(mutex);
+                        counters.jobs++;
+                    }
+                    job.connection->reply(reply);
+                    answered++;
+                });
+        } catch (const std::exception& e) {
+            std::cerr << "[ERROR] DEVICE RUN FAILED: " << e.what() << std::endl;
+            /// Outputs arrive in job order, the jobs after the last answered one are failed and the pipeline
+            /// is rebuilt on reallocated slots for the next group
+            for (size_t k = answered; k < group.size(); k++) {
+                group[k]->connection->reply(make_reply(group[k]->request, ACCEL_JOB_FAILED));
+            }
+            release_pipeline(pipeline_key(first));
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        counters.dispatches++;
+        counters.runs += report.runs;
+    }
+
+    AccelDevice& device;
+    ServerConfig config;
+    int listen_fd = -1;
+    bool stopping = false;
+    std::thread acceptor;
+    std::thread dispatcher;
+    int active_readers = 0;
+    std::vector<std::weak_ptr<Connection> > connections;
+    std::deque<std::shared_ptr<Job> > queue;
+    std::map<PipelineKey, PipelineEntry> pipelines;     /// dispatcher thread only
+    std::vector<int> free_slots;                        /// first slots of released ranges
+    int next_slot = 0;
+    long long pipeline_uses = 0;
+    ServerStats counters;
+    std::mutex mutex;
+    std::condition_variable job_ready;
+    std::condition_variable readers_done;
+};
+
+#endif
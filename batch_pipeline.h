@@ -0,0 +1,470 @@
+#ifndef BATCH_PIPELINE_H
+#define BATCH_PIPELINE_H
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+
+#include <opencv2/opencv.hpp>
+
+#include "image_formats.h"
+#include "edge_mask.h"
+#include "accel_device.h"
+#include "buffer_pool.h"
+#include "dataset.h"
+#include "trace.h"
+
+struct PerformanceMetrics {
+    double h2d_time_ms = 0.0;
+    double kernel_time_ms = 0.0;
+    double device_time_ms = 0.0;    /// kernel_time_ms less the time queued behind earlier runs
+    double d2h_time_ms = 0.0;
+    double total_time_ms = 0.0;
+    int pixels_processed = 0;
+    int allocations = 0;        /// device buffer allocations this image caused
+    size_t bytes_copied = 0;    /// host side copies, packing into the mapped input plus any output narrowing
+    size_t d2h_bytes = 0;       /// output bytes read back from the device
+};
+
+inline double elapsed_ms(std::chrono::high_resolution_clock::time_point start, std::chrono::high_resolution_clock::time_point stop) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count() / 1000.0;
+}
+
+///@brief: Lays out a decoded image in the kernel input format, RGB888 and LUMA8 are straight row copies.
+/// dst is normally the mapped device input buffer. Returns the number of bytes written
+inline size_t pack_input_image(const cv::Mat& image, int input_format, unsigned char* dst) {
+    int height = image.rows;
+    int width = image.cols;
+
+    if (input_format == INPUT_FORMAT_RGB32) {
+        unsigned int* dst_words = reinterpret_cast<unsigned int*>(dst);
+        for (int i = 0; i < height; i++) {
+            for (int j = 0; j < width; j++) {
+                cv::Vec3b pixel = image.at<cv::Vec3b>(i, j);
+                dst_words[i * width + j] = (pixel[2] << 16) | (pixel[1] << 8) | pixel[0];
+            }
+        }
+        return (size_t)height * width * sizeof(unsigned int);
+    }
+
+    size_t row_bytes = (size_t)width * input_bytes_per_pixel(input_format);
+    if (image.isContinuous()) {
+        std::memcpy(dst, image.data, row_bytes * height);
+        return row_bytes * height;
+    }
+    for (int i = 0; i < height; i++) {
+        std::memcpy(dst + i * row_bytes, image.ptr(i), row_bytes);
+    }
+    return row_bytes * height;
+}
+
+///@brief: cv::Mat over the kernel output. GRAY8 wraps the buffer in place, RGB32 and the edge values of MAG_ORIENT
+/// are narrowed and BIT1 / RLE are decoded to 0 / 255 into `storage`, and the bytes written there are added to bytes_copied
+inline cv::Mat output_image_view(unsigned char* buffer, int out_height, int out_width, int output_format, cv::Mat& storage, size_t& bytes_copied) {
+    if (output_format == OUTPUT_FORMAT_GRAY8) {
+        return cv::Mat(out_height, out_width, CV_8UC1, buffer);
+    }
+    storage.create(out_height, out_width, CV_8UC1);
+    bytes_copied += (size_t)out_height * out_width;
+    if (is_mask_output(output_format)) {
+        for (int r = 0; r < out_height; r++) {
+            unpack_mask_row(buffer, out_height, out_width, output_format, r, storage.ptr<unsigned char>(r));
+        }
+        return storage;
+    }
+    if (output_format == OUTPUT_FORMAT_MAG_ORIENT) {
+        for (int r = 0; r < out_height; r++) {
+            unsigned char* row = storage.ptr<unsigned char>(r);
+            const unsigned char* pairs = buffer + (size_t)r * out_width * 2;
+            for (int c = 0; c < out_width; c++) {
+                row[c] = pairs[c * 2];
+            }
+        }
+        return storage;
+    }
+    const unsigned int* words = reinterpret_cast<const unsigned int*>(buffer);
+    for (int r = 0; r < out_height; r++) {
+        unsigned char* row = storage.ptr<unsigned char>(r);
+        for (int c = 0; c < out_width; c++) {
+            row[c] = words[r * out_width + c] & 0xFF;
+        }
+    }
+    return storage;
+}
+
+///@brief: The orientation_bin plane of a MAG_ORIENT output, taken out of the high bytes into `storage`
+inline cv::Mat orientation_view(const unsigned char* buffer, int out_height, int out_width, cv::Mat& storage, size_t& bytes_copied) {
+    storage.create(out_height, out_width, CV_8UC1);
+    bytes_copied += (size_t)out_height * out_width;
+    for (int r = 0; r < out_height; r++) {
+        unsigned char* row = storage.ptr<unsigned char>(r);
+        const unsigned char* pairs = buffer + (size_t)r * out_width * 2;
+        for (int c = 0; c < out_width; c++) {
+            row[c] = pairs[c * 2 + 1];
+        }
+    }
+    return storage;
+}
+
+///@brief: CV_16SC1 views of the Gx and Gy planes in a gradient buffer, no copy
+inline void gradient_views(unsigned char* buffer, int out_height, int out_width, cv::Mat& gradient_x, cv::Mat& gradient_y) {
+    gradient_x = cv::Mat(out_height, out_width, CV_16SC1, buffer);
+    gradient_y = cv::Mat(out_height, out_width, CV_16SC1, buffer + gradient_plane_bytes(out_height * out_width));
+}
+
+///@brief: Reads one image's output back, `buffer` is its mapped output at `offset` in the device buffer. The mask
+/// formats only transfer what the kernel filled: BIT1 its bits, RLE the row table first and then the runs it
+/// lists. Returns the bytes transferred
+inline size_t sync_edge_output(AccelDevice& device, int slot, const unsigned char* buffer, size_t offset, int out_height, int out_width,
+                               int output_format) {
+    if (output_format != OUTPUT_FORMAT_RLE) {
+        size_t bytes = output_buffer_bytes(output_format, out_height * out_width);
+        device.sync_output_range(slot, offset, bytes);
+        return bytes;
+    }
+    size_t table_bytes = rle_table_bytes(out_height);
+    device.sync_output_range(slot, offset, table_bytes);
+    size_t run_bytes = edge_output_used_bytes(buffer, out_height, out_width, output_format) - table_bytes;
+    if (run_bytes > 0) {
+        device.sync_output_range(slot, offset + table_bytes, run_bytes);
+    }
+    return table_bytes + run_bytes;
+}
+
+struct PipelineConfig {
+    int queue_depth = 4;
+    int input_format = INPUT_FORMAT_RGB888;
+    int output_format = OUTPUT_FORMAT_GRAY8;
+    int max_height = 1080;      /// buffer pool sizing, larger images grow their slot
+    int max_width = 1920;
+    int first_slot = 0;         /// device slots first_slot .. first_slot + queue_depth - 1 belong to this pipeline
+    int images_per_run = 1;     /// > 1 packs that many images into each run of image_process_batch
+    EdgeStages stages;
+    bool decode_masks = true;   /// false hands BIT1 / RLE outputs over as they are, in BatchOutput::compressed
+};
+
+///@brief: An image to process, either decoded (`image`) or already in the pipeline's input layout (`packed`,
+/// height x width pixels, input_buffer_bytes long, e.g. a DatasetReader payload). A packed input on a 4 KiB
+/// boundary that runs alone is DMAd in place through attach_input, otherwise it is copied into the slot
+struct BatchInput {
+    std::string name;
+    cv::Mat image;
+    unsigned char* packed = nullptr;
+    int height = 0;             /// of `packed`
+    int width = 0;
+    int tag = 0;                /// handed back unchanged in BatchOutput
+};
+
+///@brief: Handed to the output callback, every Mat and `compressed` are only valid during the callback.
+/// With decode_masks off, mask outputs leave `edges` empty and point `compressed` at the kernel's bytes
+struct BatchOutput {
+    std::string name;
+    int tag = 0;
+    cv::Mat edges;
+    cv::Mat orientation;            /// OUTPUT_FORMAT_MAG_ORIENT: orientation_bin of every edge pixel, CV_8UC1
+    cv::Mat gradient_x;             /// EDGE_STAGE_GRADIENTS: signed Gx / Gy, CV_16SC1 views of the device buffer
+    cv::Mat gradient_y;
+    const unsigned char* compressed = nullptr;
+    size_t compressed_bytes = 0;
+    PerformanceMetrics metrics;
+};
+
+struct BatchReport {
+    std::vector<PerformanceMetrics> images;
+    long long total_pixels = 0;
+    double wall_time_ms = 0.0;
+    int peak_in_flight = 0;
+    int runs = 0;                   /// kernel invocations, fewer than images when runs carry several images
+    double busy_time_ms = 0.0;      /// time with at least one run in flight on the device
+    int setup_allocations = 0;      /// buffer pool allocations made before the first image
+
+    double sustained_mpps() const {
+        return wall_time_ms > 0.0 ? (total_pixels / (wall_time_ms / 1000.0)) / 1000000.0 : 0.0;
+    }
+};
+
+///@brief: Keeps up to queue_depth runs in flight. While run k executes on the device the host retires
+/// run k - depth + 1 (wait, D2H, output callback) and uploads image k + 1, so the DMA and host work of
+/// neighbouring images overlaps with the kernel. Outputs are delivered in submission order.
+/// kernel_time_ms of an image is measured from its start() to the return of its wait(), so it includes
+/// the time spent queued behind earlier runs. device_time_ms starts at the later of start() and the return
+/// of the previous run's wait(), the device runs a pipeline's runs in order, so it leaves that queueing out.
+/// With images_per_run > 1 a run carries several images packed back to back in one buffer pair and goes
+/// through image_process_batch, the run's times are then split over its images by pixel count. Slots are
+/// still sized for one max_height x max_width image, small images fit many to a slot without growing it.
+/// EDGE_STAGE_GRADIENTS needs image_process's gradient port, every run then carries one image.
+class BatchPipeline {
+public:
+    typedef std::function<bool(BatchInput&)> InputSource;
+    typedef std::function<void(const BatchOutput&)> OutputSink;
+
+    BatchPipeline(AccelDevice& accel_device, const PipelineConfig& pipeline_config)
+        : device(accel_device), config(pipeline_config), slots(std::max(1, pipeline_config.queue_depth)),
+          pool(accel_device, slots.size(), pipeline_config.max_height, pipeline_config.max_width,
+               pipeline_config.input_format, pipeline_config.output_format, pipeline_config.first_slot)
+    {
+        if (gradients()) {
+            for (int slot = 0; slot < pool.slot_count(); slot++) {
+                pool.reserve_gradients(slot, gradient_buffer_bytes(config.max_height - 2, config.max_width - 2));
+            }
+        }
+        setup_allocations = pool.allocation_count();
+    }
+
+    ///@brief: Pulls images from next_input until it returns false, images that failed to load (empty, no packed
+    /// pixels) are skipped
+    BatchReport run(const InputSource& next_input, const OutputSink& on_output) {
+        BatchReport report;
+        report.setup_allocations = setup_allocations;
+        int depth = slots.size();
+        int next_slot = 0;
+        in_flight = 0;
+        auto batch_start = std::chrono::high_resolution_clock::now();
+
+        bool more_input = true;
+        while (more_input) {
+            if (slots[next_slot].busy) {
+                retire(next_slot, on_output, report);
+            }
+            std::vector<BatchInput> group;
+            while ((int)group.size() < images_per_run()) {
+                BatchInput input;
+                if (!next_input(input)) {
+                    more_input = false;
+                    break;
+                }
+                if (input.image.empty() && !input.packed) continue;
+                group.push_back(input);
+            }
+            if (group.empty()) break;
+
+            submit(next_slot, group, report);
+            next_slot = (next_slot + 1) % depth;
+        }
+
+        for (int k = 0; k < depth; k++) {
+            int slot = (next_slot + k) % depth;
+            if (slots[slot].busy) {
+                retire(slot, on_output, report);
+            }
+        }
+
+        report.wall_time_ms = elapsed_ms(batch_start, std::chrono::high_resolution_clock::now());
+        return report;
+    }
+
+    ///@brief: Thresholds of the following run() calls, the stage flags and the buffers stay those of the config
+    void set_thresholds(int low_threshold, int high_threshold, int mask_threshold) {
+        config.stages.low_threshold = low_threshold;
+        config.stages.high_threshold = high_threshold;
+        config.stages.mask_threshold = mask_threshold;
+    }
+
+private:
+    struct SlotImage {
+        std::string name;
+        int tag = 0;
+        KernelArgs args;
+        size_t in_offset = 0;
+        size_t out_offset = 0;
+        double share = 1.0;         /// fraction of the run's pixels
+        PerformanceMetrics metrics;
+        cv::Mat output_storage;
+        cv::Mat orientation_storage;
+    };
+
+    struct Slot {
+        bool busy = false;
+        std::vector<SlotImage> images;
+        size_t out_bytes = 0;
+        std::vector<ImageDescriptor> descriptors;
+        std::chrono::high_resolution_clock::time_point submit_time;
+        uint64_t trace_start = 0;
+    };
+
+    bool gradients() const {
+        return (config.stages.flags & EDGE_STAGE_GRADIENTS) != 0;
+    }
+
+    int images_per_run() const {
+        return gradients() ? 1 : std::max(1, std::min(config.images_per_run, MAX_BATCH_IMAGES));
+    }
+
+    void submit(int index, const std::vector<BatchInput>& group, BatchReport& report) {
+        Slot& slot = slots[index];
+        slot.images.resize(group.size());
+        slot.descriptors.resize(group.size());
+
+        size_t in_bytes = 0;
+        size_t out_bytes = 0;
+        long long run_pixels = 0;
+        for (size_t k = 0; k < group.size(); k++) {
+            SlotImage& image = slot.images[k];
+            image.name = group[k].name;
+            image.tag = group[k].tag;
+            image.args.height = group[k].packed ? group[k].height : group[k].image.rows;
+            image.args.width = group[k].packed ? group[k].width : group[k].image.cols;
+            image.args.input_format = config.input_format;
+            image.args.output_format = config.output_format;
+            image.args.stages = config.stages;
+            image.metrics = PerformanceMetrics();
+            image.metrics.pixels_processed = image.args.height * image.args.width;
+            run_pixels += image.metrics.pixels_processed;
+
+            /// Every image starts on a burst boundary of the shared buffers
+            image.in_offset = in_bytes;
+            image.out_offset = out_bytes;
+            in_bytes += input_buffer_bytes(config.input_format, image.metrics.pixels_processed);
+            out_bytes += output_buffer_bytes(config.output_format, image.args.height - 2, image.args.width - 2);
+
+            ImageDescriptor& descriptor = slot.descriptors[k];
+            descriptor = ImageDescriptor();
+            descriptor.in_offset = image.in_offset / BURST_BYTES;
+            descriptor.out_offset = image.out_offset / BURST_BYTES;
+            descriptor.height = image.args.height;
+            descriptor.width = image.args.width;
+        }
+        slot.out_bytes = out_bytes;
+        for (SlotImage& image : slot.images) {
+            image.share = (double)image.metrics.pixels_processed / run_pixels;
+        }
+
+        /// A lone page aligned packed input is not copied at all, the slot runs on it and its input buffer is not grown
+        bool in_place = group.size() == 1 && group[0].packed && reinterpret_cast<uintptr_t>(group[0].packed) % DATASET_ALIGN == 0;
+        if (pool.reserve(index, in_place ? 0 : in_bytes, out_bytes)) {
+            slot.images[0].metrics.allocations++;
+        }
+        if (gradients() && pool.reserve_gradients(index, gradient_buffer_bytes(slot.images[0].args.height - 2, slot.images[0].args.width - 2))) {
+            slot.images[0].metrics.allocations++;
+        }
+
+        /// Pack straight into the mapped device buffer, no staging copy
+        pool.attach_input(index, in_place ? group[0].packed : nullptr, in_place ? in_bytes : 0);
+        auto h2d_start = std::chrono::high_resolution_clock::now();
+        if (!in_place) {
+            TRACE_SPAN("pack", in_bytes);
+            for (size_t k = 0; k < group.size(); k++) {
+                unsigned char* dst = pool.input(index) + slot.images[k].in_offset;
+                if (group[k].packed) {
+                    size_t bytes = input_buffer_bytes(config.input_format, slot.images[k].metrics.pixels_processed);
+                    std::memcpy(dst, group[k].packed, bytes);
+                    slot.images[k].metrics.bytes_copied += bytes;
+                } else {
+                    slot.images[k].metrics.bytes_copied += pack_input_image(group[k].image, config.input_format, dst);
+                }
+            }
+        }
+        {
+            TRACE_SPAN("h2d", in_bytes);
+            device.sync_input(pool.device_slot(index), in_bytes);
+        }
+        auto h2d_stop = std::chrono::high_resolution_clock::now();
+        double h2d_time_ms = elapsed_ms(h2d_start, h2d_stop);
+        for (SlotImage& image : slot.images) {
+            image.metrics.h2d_time_ms = h2d_time_ms * image.share;
+        }
+
+        slot.submit_time = std::chrono::high_resolution_clock::now();
+        slot.trace_start = trace_now_ns();
+        if (slot.images.size() == 1) {
+            device.start(pool.device_slot(index), slot.images[0].args);
+        } else {
+            device.start_batch(pool.device_slot(index), slot.descriptors, config.input_format, config.output_format, config.stages);
+        }
+        slot.busy = true;
+
+        report.runs++;
+        if (in_flight == 0) {
+            busy_start = slot.submit_time;
+        }
+        in_flight++;
+        report.peak_in_flight = std::max(report.peak_in_flight, in_flight);
+    }
+
+    void retire(int index, const OutputSink& on_output, BatchReport& report) {
+        Slot& slot = slots[index];
+        device.wait(pool.device_slot(index));
+        auto kernel_stop = std::chrono::high_resolution_clock::now();
+        double kernel_time_ms = elapsed_ms(slot.submit_time, kernel_stop);
+        double device_time_ms = elapsed_ms(std::max(slot.submit_time, last_finish), kernel_stop);
+        last_finish = kernel_stop;
+        /// Like kernel_time_ms the span runs from start() to the return of wait(), queueing included
+        trace_record("kernel", slot.trace_start, slot.images.size());
+
+        /// The pixel formats come back in one transfer, the mask formats image by image with only the bytes written
+        uint64_t d2h_trace_start = trace_now_ns();
+        auto d2h_start = std::chrono::high_resolution_clock::now();
+        bool mask_output = is_mask_output(config.output_format);
+        if (!mask_output) {
+            device.sync_output(pool.device_slot(index), slot.out_bytes);
+        }
+        size_t d2h_bytes = 0;
+        for (SlotImage& image : slot.images) {
+            int out_height = image.args.height - 2;
+            int out_width = image.args.width - 2;
+            image.metrics.d2h_bytes = mask_output ? sync_edge_output(device, pool.device_slot(index), pool.output(index) + image.out_offset,
+                                                                     image.out_offset, out_height, out_width, config.output_format)
+                                                  : output_buffer_bytes(config.output_format, out_height * out_width);
+            if (gradients()) {
+                size_t grad_bytes = gradient_buffer_bytes(out_height, out_width);
+                device.sync_gradients(pool.device_slot(index), grad_bytes);
+                image.metrics.d2h_bytes += grad_bytes;
+            }
+            d2h_bytes += image.metrics.d2h_bytes;
+        }
+        auto d2h_stop = std::chrono::high_resolution_clock::now();
+        double d2h_time_ms = elapsed_ms(d2h_start, d2h_stop);
+        trace_record("d2h", d2h_trace_start, d2h_bytes);
+
+        for (SlotImage& image : slot.images) {
+            image.metrics.kernel_time_ms = kernel_time_ms * image.share;
+            image.metrics.device_time_ms = device_time_ms * image.share;
+            image.metrics.d2h_time_ms = d2h_time_ms * image.share;
+            image.metrics.total_time_ms = image.metrics.h2d_time_ms + image.metrics.kernel_time_ms + image.metrics.d2h_time_ms;
+
+            BatchOutput output;
+            output.name = image.name;
+            output.tag = image.tag;
+            unsigned char* buffer = pool.output(index) + image.out_offset;
+            if (mask_output && !config.decode_masks) {
+                output.compressed = buffer;
+                output.compressed_bytes = edge_output_used_bytes(buffer, image.args.height - 2, image.args.width - 2, config.output_format);
+            } else {
+                TRACE_SPAN("unpack");
+                output.edges = output_image_view(buffer, image.args.height - 2, image.args.width - 2,
+                                                 config.output_format, image.output_storage, image.metrics.bytes_copied);
+                if (config.output_format == OUTPUT_FORMAT_MAG_ORIENT) {
+                    output.orientation = orientation_view(buffer, image.args.height - 2, image.args.width - 2,
+                                                          image.orientation_storage, image.metrics.bytes_copied);
+                }
+            }
+            if (gradients()) {
+                gradient_views(pool.gradients(index), image.args.height - 2, image.args.width - 2, output.gradient_x, output.gradient_y);
+            }
+            output.metrics = image.metrics;
+            on_output(output);
+
+            report.images.push_back(image.metrics);
+            report.total_pixels += image.metrics.pixels_processed;
+        }
+        slot.busy = false;
+        in_flight--;
+        if (in_flight == 0) {
+            report.busy_time_ms += elapsed_ms(busy_start, kernel_stop);
+        }
+    }
+
+    AccelDevice& device;
+    PipelineConfig config;
+    std::vector<Slot> slots;
+    BufferPool pool;
+    int setup_allocations = 0;
+    int in_flight = 0;
+    std::chrono::high_resolution_clock::time_point busy_start;
+    std::chrono::high_resolution_clock::time_point last_finish;     /// wait() return of the last retired run
+};
+
+#endif
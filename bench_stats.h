@@ -0,0 +1,106 @@
+#ifndef BENCH_STATS_H
+#define BENCH_STATS_H
+
+#include <vector>
+#include <string>
+#include <map>
+#include <cmath>
+#include <algorithm>
+#include <ostream>
+
+///@brief: Latency samples of one pipeline stage, percentiles use the nearest-rank method
+struct StageStats {
+    std::vector<double> samples_ms;
+
+    void add(double ms) { samples_ms.push_back(ms); }
+
+    double percentile(double p) const {
+        if (samples_ms.empty()) return 0.0;
+        std::vector<double> sorted = samples_ms;
+        std::sort(sorted.begin(), sorted.end());
+        int rank = (int)std::ceil(p / 100.0 * sorted.size());
+        return sorted[std::max(0, std::min(rank, (int)sorted.size()) - 1)];
+    }
+
+    double mean() const {
+        double sum = 0.0;
+        for (double ms : samples_ms) sum += ms;
+        return samples_ms.empty() ? 0.0 : sum / samples_ms.size();
+    }
+};
+
+///@brief: Measured repeats of one engine over the whole dataset, warm-up runs are not included
+struct EngineResult {
+    std::string name;
+    std::string detail;                         /// e.g. the CPU ISA or the xclbin
+    std::vector<std::string> stage_order;       /// stages in pipeline order for reporting
+    std::map<std::string, StageStats> stages;
+    long long images = 0;
+    long long pixels = 0;
+    long long bytes_moved = 0;                  /// input read plus output written, H2D + D2H for a device
+    double wall_time_ms = 0.0;
+
+    void add_sample(const std::string& stage, double ms) {
+        if (stages.find(stage) == stages.end()) stage_order.push_back(stage);
+        stages[stage].add(ms);
+    }
+
+    double sustained_mpps() const {
+        return wall_time_ms > 0.0 ? (pixels / (wall_time_ms / 1000.0)) / 1000000.0 : 0.0;
+    }
+
+    double bandwidth_gbps() const {
+        return wall_time_ms > 0.0 ? (bytes_moved / (wall_time_ms / 1000.0)) / 1e9 : 0.0;
+    }
+};
+
+inline std::string json_escape(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') escaped += '\\';
+        escaped += c;
+    }
+    return escaped;
+}
+
+///@brief: One JSON document per run, `config` holds the run parameters as already formatted key/value pairs
+inline void write_results_json(std::ostream& out, const std::vector<std::pair<std::string, std::string>>& config,
+                               const std::vector<EngineResult>& results) {
+    out << "{\n  \"config\": {";
+    for (size_t i = 0; i < config.size(); i++) {
+        out << (i ? ", " : "") << "\"" << json_escape(config[i].first) << "\": \"" << json_escape(config[i].second) << "\"";
+    }
+    out << "},\n  \"engines\": [";
+    for (size_t e = 0; e < results.size(); e++) {
+        const EngineResult& result = results[e];
+        out << (e ? "," : "") << "\n    {\"name\": \"" << json_escape(result.name) << "\", \"detail\": \"" << json_escape(result.detail)
+            << "\", \"images\": " << result.images << ", \"pixels\": " << result.pixels << ", \"bytes_moved\": " << result.bytes_moved
+            << ", \"wall_time_ms\": " << result.wall_time_ms << ", \"sustained_mpps\": " << result.sustained_mpps()
+            << ", \"bandwidth_gbps\": " << result.bandwidth_gbps() << ",\n     \"stages\": {";
+        for (size_t s = 0; s < result.stage_order.size(); s++) {
+            const std::string& stage = result.stage_order[s];
+            const StageStats& stats = result.stages.at(stage);
+            out << (s ? ", " : "") << "\n       \"" << json_escape(stage) << "\": {\"count\": " << stats.samples_ms.size()
+                << ", \"mean_ms\": " << stats.mean() << ", \"p50_ms\": " << stats.percentile(50) << ", \"p95_ms\": " << stats.percentile(95)
+                << ", \"p99_ms\": " << stats.percentile(99) << ", \"max_ms\": " << stats.percentile(100) << "}";
+        }
+        out << "}}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+///@brief: One row per engine and stage, engine totals repeated on every row so rows can be filtered independently
+inline void write_results_csv(std::ostream& out, const std::vector<EngineResult>& results) {
+    out << "engine,detail,stage,count,mean_ms,p50_ms,p95_ms,p99_ms,max_ms,images,pixels,bytes_moved,wall_time_ms,sustained_mpps\n";
+    for (const EngineResult& result : results) {
+        for (const std::string& stage : result.stage_order) {
+            const StageStats& stats = result.stages.at(stage);
+            out << result.name << "," << result.detail << "," << stage << "," << stats.samples_ms.size() << "," << stats.mean() << ","
+                << stats.percentile(50) << "," << stats.percentile(95) << "," << stats.percentile(99) << "," << stats.percentile(100) << ","
+                << result.images << "," << result.pixels << "," << result.bytes_moved << "," << result.wall_time_ms << ","
+                << result.sustained_mpps() << "\n";
+        }
+    }
+}
+
+#endif
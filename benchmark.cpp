@@ -0,0 +1,393 @@
+///@brief: Benchmark driver, runs every selected engine over the same decoded dataset
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <memory>
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include "image_formats.h"
+#include "image_process_ref.h"
+#include "cpu_engine.h"
+#include "opencv_engine.h"
+#include "accel_device.h"
+#include "batch_pipeline.h"
+#include "bench_stats.h"
+#include "dataset.h"
+
+namespace fs = std::filesystem;
+
+struct BenchOptions {
+    std::vector<std::string> engines = {"cpu", "opencv"};
+    std::string xclbin_path;
+    int warmup = 1;
+    int repeat = 5;
+    int input_format = INPUT_FORMAT_RGB888;
+    int output_format = OUTPUT_FORMAT_GRAY8;
+    int queue_depth = 1;        /// 1 keeps device stage latencies free of queueing
+    int images_per_run = 1;
+    CpuEngineOptions cpu;
+    std::string json_path;
+    std::string csv_path;
+};
+
+///@brief: One decoded image. `color` feeds OpenCV, `packed` is the kernel input layout for the other engines
+struct DatasetImage {
+    std::string name;
+    cv::Mat color;
+    cv::Mat input;
+    std::vector<unsigned char> packed;
+};
+
+std::vector<std::string> split_list(const std::string& text) {
+    std::vector<std::string> items;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+bool parse_bench_options(int argc, char* argv[], int first, BenchOptions& options) {
+    for (int i = first; i < argc; i++) {
+        std::string flag = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "[ERROR] MISSING VALUE FOR: " << flag << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+        if (flag == "--engines") {
+            options.engines = split_list(value);
+        } else if (flag == "--xclbin") {
+            options.xclbin_path = value;
+        } else if (flag == "--warmup") {
+            options.warmup = std::max(0, std::atoi(value.c_str()));
+        } else if (flag == "--repeat") {
+            options.repeat = std::max(1, std::atoi(value.c_str()));
+        } else if (flag == "--input-format") {
+            options.input_format = parse_input_format(value);
+        } else if (flag == "--output-format") {
+            options.output_format = parse_output_format(value);
+        } else if (flag == "--queue-depth") {
+            options.queue_depth = std::max(1, std::atoi(value.c_str()));
+        } else if (flag == "--images-per-run") {
+            options.images_per_run = std::max(1, std::min(MAX_BATCH_IMAGES, std::atoi(value.c_str())));
+        } else if (flag == "--threads") {
+            options.cpu.threads = std::atoi(value.c_str());
+        } else if (flag == "--isa") {
+            options.cpu.isa = (value == "scalar") ? CPU_ISA_SCALAR : (value == "avx2") ? CPU_ISA_AVX2 : (value == "avx512") ? CPU_ISA_AVX512 : CPU_ISA_AUTO;
+        } else if (flag == "--json") {
+            options.json_path = value;
+        } else if (flag == "--csv") {
+            options.csv_path = value;
+        } else {
+            std::cerr << "[ERROR] UNKNOWN OPTION: " << flag << std::endl;
+            return false;
+        }
+    }
+    if (options.input_format < 0 || options.output_format < 0) {
+        std::cerr << "[ERROR] UNKNOWN INPUT OR OUTPUT FORMAT" << std::endl;
+        return false;
+    }
+    /// The CPU engines compare pixel for pixel, the bit1 / rle masks and magori are measured with host_app
+    if (!cpu_engine_supports(options.output_format)) {
+        std::cerr << "[ERROR] BENCHMARK OUTPUT FORMAT MUST BE rgb32 OR gray8" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+///@brief: Decodes and packs every image once, so no engine is charged for decode
+std::vector<DatasetImage> load_dataset(const std::string& input_dir, int input_format) {
+    std::vector<fs::path> files;
+    for (const auto& entry : fs::directory_iterator(input_dir)) {
+        std::string extension = entry.path().extension().string();
+        if (entry.is_regular_file() && (extension == ".jpg" || extension == ".jpeg" || extension == ".png")) {
+            files.push_back(entry.path());
+        }
+    }
+    std::sort(files.begin(), files.end());
+
+    std::vector<DatasetImage> dataset;
+    for (const fs::path& path : files) {
+        DatasetImage image;
+        image.name = path.filename().string();
+        image.color = cv::imread(path.string(), cv::IMREAD_COLOR);
+        if (image.color.empty() || image.color.rows < 3 || image.color.cols < 3) {
+            std::cerr << "[WARNING] SKIPPING UNREADABLE IMAGE: " << path.string() << std::endl;
+            continue;
+        }
+        if (input_format == INPUT_FORMAT_LUMA8) {
+            cv::cvtColor(image.color, image.input, cv::COLOR_BGR2GRAY);
+        } else {
+            image.input = image.color;
+        }
+        image.packed.assign(input_buffer_bytes(input_format, image.color.rows * image.color.cols), 0);
+        pack_input_image(image.input, input_format, image.packed.data());
+        dataset.push_back(image);
+    }
+    return dataset;
+}
+
+///@brief: The images of a make_dataset container, already packed, so nothing is decoded. The container's layout
+/// replaces input_format
+std::vector<DatasetImage> load_dataset_container(const std::string& path, int& input_format) {
+    DatasetReader reader(path);
+    if (reader.kind() != DATASET_KIND_INPUT) {
+        throw std::runtime_error("not an input dataset: " + path);
+    }
+    input_format = reader.format();
+    std::vector<DatasetImage> dataset;
+    cv::Mat storage;
+    for (size_t i = 0; i < reader.size(); i++) {
+        DatasetImage image;
+        image.name = reader.name(i);
+        image.input = reader.image(i, storage).clone();
+        if (input_format == INPUT_FORMAT_LUMA8) {
+            cv::cvtColor(image.input, image.color, cv::COLOR_GRAY2BGR);
+        } else {
+            image.color = image.input;
+        }
+        image.packed.assign(reader.payload(i), reader.payload(i) + reader.entry(i).bytes);
+        dataset.push_back(image);
+    }
+    return dataset;
+}
+
+///@brief: Runs `pass` warmup + repeat times over the dataset. Only the measured passes record samples
+/// (record is true) and count towards the wall time
+void measure(EngineResult& result, const BenchOptions& options, const std::function<void(bool record)>& pass) {
+    for (int run = 0; run < options.warmup; run++) {
+        pass(false);
+    }
+    for (int run = 0; run < options.repeat; run++) {
+        auto start = std::chrono::high_resolution_clock::now();
+        pass(true);
+        result.wall_time_ms += elapsed_ms(start, std::chrono::high_resolution_clock::now());
+    }
+}
+
+void count_image(EngineResult& result, const DatasetImage& image, size_t bytes_moved) {
+    result.images++;
+    result.pixels += (long long)image.color.rows * image.color.cols;
+    result.bytes_moved += bytes_moved;
+}
+
+size_t image_output_bytes(const DatasetImage& image, int output_format) {
+    return output_buffer_bytes(output_format, image.color.rows - 2, image.color.cols - 2);
+}
+
+///@brief: image_process on a device through the batch pipeline, stages are H2D (pack + sync), kernel and D2H
+EngineResult run_device_engine(const std::string& name, AccelDevice& device, const std::vector<DatasetImage>& dataset, const BenchOptions& options) {
+    EngineResult result;
+    result.name = name;
+    result.detail = (name == "fpga") ? options.xclbin_path : cpu_isa_name(cpu_detect_isa());
+
+    PipelineConfig config;
+    config.queue_depth = options.queue_depth;
+    config.input_format = options.input_format;
+    config.output_format = options.output_format;
+    config.images_per_run = options.images_per_run;
+    for (const DatasetImage& image : dataset) {
+        config.max_height = std::max(config.max_height, image.color.rows);
+        config.max_width = std::max(config.max_width, image.color.cols);
+    }
+    BatchPipeline pipeline(device, config);
+
+    measure(result, options, [&](bool record) {
+        size_t next_image = 0;
+        BatchReport report = pipeline.run(
+            [&](BatchInput& input) {
+                if (next_image == dataset.size()) return false;
+                input.name = dataset[next_image].name;
+                input.image = dataset[next_image++].input;
+                return true;
+            },
+            [](const BatchOutput&) {});
+        if (!record) return;
+        for (size_t i = 0; i < report.images.size(); i++) {
+            const PerformanceMetrics& metrics = report.images[i];
+            result.add_sample("h2d", metrics.h2d_time_ms);
+            result.add_sample("kernel", metrics.kernel_time_ms);
+            result.add_sample("d2h", metrics.d2h_time_ms);
+            result.add_sample("total", metrics.total_time_ms);
+            count_image(result, dataset[i], input_buffer_bytes(options.input_format, metrics.pixels_processed) +
+                                            image_output_bytes(dataset[i], options.output_format));
+        }
+    });
+    return result;
+}
+
+///@brief: A function with the image_process buffer signature run straight on the packed dataset
+EngineResult run_buffer_engine(const std::string& name, const std::string& detail, const std::vector<DatasetImage>& dataset, const BenchOptions& options,
+                               const std::function<void(const unsigned char*, unsigned char*, int, int)>& engine) {
+    EngineResult result;
+    result.name = name;
+    result.detail = detail;
+
+    size_t max_out_bytes = 0;
+    for (const DatasetImage& image : dataset) {
+        max_out_bytes = std::max(max_out_bytes, image_output_bytes(image, options.output_format));
+    }
+    std::vector<unsigned char> output(max_out_bytes);
+
+    measure(result, options, [&](bool record) {
+        for (const DatasetImage& image : dataset) {
+            auto start = std::chrono::high_resolution_clock::now();
+            engine(image.packed.data(), output.data(), image.color.rows, image.color.cols);
+            double compute_ms = elapsed_ms(start, std::chrono::high_resolution_clock::now());
+            if (record) {
+                result.add_sample("compute", compute_ms);
+                count_image(result, image, image.packed.size() + image_output_bytes(image, options.output_format));
+            }
+        }
+    });
+    return result;
+}
+
+///@brief: openCV_app's pipeline (cvtColor, two cv::Sobel, addWeighted) on the decoded color images
+EngineResult run_opencv_engine(const std::vector<DatasetImage>& dataset, const BenchOptions& options) {
+    EngineResult result;
+    result.name = "opencv";
+    result.detail = "cv::Sobel";
+
+    measure(result, options, [&](bool record) {
+        for (const DatasetImage& image : dataset) {
+            cv::Mat output;
+            auto start = std::chrono::high_resolution_clock::now();
+            process_image_opencv(image.color, output);
+            double compute_ms = elapsed_ms(start, std::chrono::high_resolution_clock::now());
+            if (record) {
+                result.add_sample("compute", compute_ms);
+                count_image(result, image, image.color.total() * image.color.elemSize() + output.total() * output.elemSize());
+            }
+        }
+    });
+    return result;
+}
+
+void print_engine_result(const EngineResult& result) {
+    std::cout << "--- " << result.name << " (" << result.detail << ") ---" << std::endl;
+    std::cout << std::left << std::setw(25) << "IMAGES MEASURED:" << result.images << std::endl;
+    std::cout << std::left << std::setw(25) << "PIXELS MEASURED:" << result.pixels << std::endl;
+    std::cout << std::left << std::setw(25) << "SUSTAINED THROUGHPUT:" << result.sustained_mpps() << " MPPS" << std::endl;
+    std::cout << std::left << std::setw(25) << "BYTES MOVED:" << result.bytes_moved << " B (" << result.bandwidth_gbps() << " GB/S)" << std::endl;
+    std::cout << std::left << std::setw(10) << "STAGE" << std::right << std::setw(12) << "P50 MS" << std::setw(12) << "P95 MS"
+              << std::setw(12) << "P99 MS" << std::setw(12) << "MEAN MS" << std::endl;
+    for (const std::string& stage : result.stage_order) {
+        const StageStats& stats = result.stages.at(stage);
+        std::cout << std::left << std::setw(10) << stage << std::right << std::setw(12) << stats.percentile(50) << std::setw(12)
+                  << stats.percentile(95) << std::setw(12) << stats.percentile(99) << std::setw(12) << stats.mean() << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    if (argc < 2 || !parse_bench_options(argc, argv, 2, options)) {
+        std::cout << "USAGE: " << argv[0] << " <INPUT_DIR | DATASET> [OPTIONS]" << std::endl;
+        std::cout << "  --engines LIST                      COMMA SEPARATED: fpga,sw,cpu,opencv,reference (DEFAULT cpu,opencv)" << std::endl;
+        std::cout << "  --xclbin PATH                       XCLBIN FOR THE fpga ENGINE" << std::endl;
+        std::cout << "  --warmup N / --repeat N             UNMEASURED AND MEASURED PASSES OVER THE DATASET (DEFAULT 1 / 5)" << std::endl;
+        std::cout << "  --input-format rgb32|rgb888|luma8   KERNEL INPUT LAYOUT (DEFAULT rgb888)" << std::endl;
+        std::cout << "  --output-format rgb32|gray8         KERNEL OUTPUT LAYOUT (DEFAULT gray8)" << std::endl;
+        std::cout << "  --queue-depth N                     DEVICE RUNS IN FLIGHT (DEFAULT 1)" << std::endl;
+        std::cout << "  --images-per-run N                  DEVICE IMAGES PER image_process_batch RUN (DEFAULT 1)" << std::endl;
+        std::cout << "  --threads N / --isa scalar|avx2|avx512   CPU ENGINE SETTINGS (DEFAULT ALL THREADS / BEST ISA)" << std::endl;
+        std::cout << "  --json PATH / --csv PATH            MACHINE READABLE RESULTS" << std::endl;
+        return 1;
+    }
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::vector<DatasetImage> dataset;
+    try {
+        dataset = fs::is_regular_file(argv[1]) ? load_dataset_container(argv[1], options.input_format) : load_dataset(argv[1], options.input_format);
+    } catch (const std::exception& e) {
+        std::cerr << "[ERROR] " << e.what() << std::endl;
+        return 1;
+    }
+    if (dataset.empty()) {
+        std::cout << "[WARNING] NO IMAGES FOUND IN INPUT DIRECTORY: " << argv[1] << std::endl;
+        return 1;
+    }
+    std::cout << "[INFO] BENCHMARKING " << dataset.size() << " IMAGES, " << options.warmup << " WARM-UP AND "
+              << options.repeat << " MEASURED PASSES" << std::endl;
+
+    std::vector<EngineResult> results;
+    try {
+        for (const std::string& engine : options.engines) {
+            std::cout << "[INFO] RUNNING ENGINE: " << engine << std::endl;
+            if (engine == "fpga") {
+                if (options.xclbin_path.empty()) {
+                    std::cerr << "[ERROR] ENGINE fpga NEEDS --xclbin" << std::endl;
+                    return 1;
+                }
+                XrtAccelDevice device(options.xclbin_path);
+                results.push_back(run_device_engine(engine, device, dataset, options));
+            } else if (engine == "sw") {
+                SoftwareAccelDevice device;
+                results.push_back(run_device_engine(engine, device, dataset, options));
+            } else if (engine == "cpu") {
+                int isa = (options.cpu.isa == CPU_ISA_AUTO) ? cpu_detect_isa() : std::min(options.cpu.isa, cpu_detect_isa());
+                results.push_back(run_buffer_engine(engine, cpu_isa_name(isa), dataset, options,
+                    [&](const unsigned char* in, unsigned char* out, int height, int width) {
+                        image_process_cpu(in, out, height, width, options.input_format, options.output_format, options.cpu);
+                    }));
+            } else if (engine == "reference") {
+                results.push_back(run_buffer_engine(engine, "scalar", dataset, options,
+                    [&](const unsigned char* in, unsigned char* out, int height, int width) {
+                        image_process_reference(in, out, height, width, options.input_format, options.output_format);
+                    }));
+            } else if (engine == "opencv") {
+                results.push_back(run_opencv_engine(dataset, options));
+            } else {
+                std::cerr << "[ERROR] UNKNOWN ENGINE: " << engine << std::endl;
+                return 1;
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "[ERROR] XRT/RUNTIME ERROR: " << e.what() << std::endl;
+        return 1;
+    }
+
+    std::cout << "=================================================" << std::endl;
+    std::cout << "              BENCHMARK SUMMARY" << std::endl;
+    std::cout << "=================================================" << std::endl;
+    for (const EngineResult& result : results) {
+        print_engine_result(result);
+    }
+    std::cout << "=================================================" << std::endl;
+
+    std::vector<std::pair<std::string, std::string>> config = {
+        {"input_dir", argv[1]},
+        {"images", std::to_string(dataset.size())},
+        {"warmup", std::to_string(options.warmup)},
+        {"repeat", std::to_string(options.repeat)},
+        {"input_format", input_format_name(options.input_format)},
+        {"output_format", output_format_name(options.output_format)},
+        {"queue_depth", std::to_string(options.queue_depth)},
+        {"images_per_run", std::to_string(options.images_per_run)},
+        {"cpu_threads", std::to_string(options.cpu.threads)},
+    };
+    if (!options.json_path.empty()) {
+        std::ofstream json(options.json_path);
+        json << std::fixed << std::setprecision(4);
+        write_results_json(json, config, results);
+        std::cout << "[INFO] WROTE JSON RESULTS: " << options.json_path << std::endl;
+    }
+    if (!options.csv_path.empty()) {
+        std::ofstream csv(options.csv_path);
+        csv << std::fixed << std::setprecision(4);
+        write_results_csv(csv, results);
+        std::cout << "[INFO] WROTE CSV RESULTS: " << options.csv_path << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,83 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <vector>
+#include <algorithm>
+
+#include "image_formats.h"
+#include "accel_device.h"
+
+///@brief: Device buffers of every slot, allocated once for the largest expected image and reused for the
+/// whole batch. An image larger than a slot's capacity grows that slot, which is the only allocation after
+/// construction, so allocation_count() stays flat at steady state. Pool slot k is device slot first_slot + k,
+/// so several pools can share one device.
+class BufferPool {
+public:
+    BufferPool(AccelDevice& accel_device, int slot_count, int max_height, int max_width, int input_format, int output_format, int first_slot = 0)
+        : device(accel_device), capacity(std::max(1, slot_count)), first(first_slot)
+    {
+        size_t in_bytes = input_buffer_bytes(input_format, max_height * max_width);
+        size_t out_bytes = output_buffer_bytes(output_format, max_height - 2, max_width - 2);
+        for (int slot = 0; slot < (int)capacity.size(); slot++) {
+            grow(slot, in_bytes, out_bytes);
+        }
+    }
+
+    ///@brief: Makes sure the slot can hold the given sizes, returns true if it had to reallocate
+    bool reserve(int slot, size_t in_bytes, size_t out_bytes) {
+        Capacity& current = capacity[slot];
+        if (in_bytes <= current.in_bytes && out_bytes <= current.out_bytes) {
+            return false;
+        }
+        grow(slot, std::max(in_bytes, current.in_bytes), std::max(out_bytes, current.out_bytes));
+        return true;
+    }
+
+    ///@brief: Makes sure the slot's gradient buffer holds bytes, returns true if it had to reallocate
+    bool reserve_gradients(int slot, size_t bytes) {
+        Capacity& current = capacity[slot];
+        if (bytes <= current.grad_bytes) {
+            return false;
+        }
+        device.allocate_gradients(first + slot, bytes);
+        bytes_allocated += bytes - current.grad_bytes;
+        current.grad_bytes = bytes;
+        allocations++;
+        return true;
+    }
+
+    ///@brief: Runs the slot on host memory instead of its input buffer, nullptr goes back (AccelDevice::attach_input)
+    void attach_input(int slot, unsigned char* host_ptr, size_t bytes) { device.attach_input(first + slot, host_ptr, bytes); }
+
+    unsigned char* input(int slot) { return device.input_map(first + slot); }
+    unsigned char* output(int slot) { return device.output_map(first + slot); }
+    unsigned char* gradients(int slot) { return device.gradient_map(first + slot); }
+    int device_slot(int slot) const { return first + slot; }
+
+    int slot_count() const { return capacity.size(); }
+    int allocation_count() const { return allocations; }
+    size_t allocated_bytes() const { return bytes_allocated; }
+
+private:
+    struct Capacity {
+        size_t in_bytes = 0;
+        size_t out_bytes = 0;
+        size_t grad_bytes = 0;
+    };
+
+    void grow(int slot, size_t in_bytes, size_t out_bytes) {
+        device.allocate(first + slot, in_bytes, out_bytes);
+        bytes_allocated += in_bytes + out_bytes - capacity[slot].in_bytes - capacity[slot].out_bytes;
+        capacity[slot].in_bytes = in_bytes;
+        capacity[slot].out_bytes = out_bytes;
+        allocations++;
+    }
+
+    AccelDevice& device;
+    std::vector<Capacity> capacity;
+    int first = 0;
+    int allocations = 0;
+    size_t bytes_allocated = 0;
+};
+
+#endif
@@ -0,0 +1,234 @@
+#ifndef CODEC_POOL_H
+#define CODEC_POOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
+#include <stdexcept>
+
+#include "dataset.h"
+
+///@brief: Bounded producer / consumer stages around the accelerator: decode workers that load and pack images
+/// ahead of submission and encode workers that write results behind it. Every hand-off is a BoundedQueue, so
+/// the images held in memory stay bounded however large the input directory is, and each queue reports its
+/// occupancy to size the pools: a decode queue that is mostly empty means the device waits on decode (add
+/// decode workers), one that is mostly full means the device is the bottleneck. The same holds for encode
+
+///@brief: Occupancy of one queue over its life, time weighted
+struct QueueStats {
+    size_t capacity = 0;
+    long long items = 0;            /// pushed over the queue's life
+    size_t peak = 0;
+    double mean_occupancy = 0.0;
+    double empty_ms = 0.0;          /// time with nothing queued, the consumer side may be starving
+    double full_ms = 0.0;           /// time at capacity, producers block
+    double lifetime_ms = 0.0;
+};
+
+template <class T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t queue_capacity)
+        : capacity(std::max<size_t>(1, queue_capacity)), created(std::chrono::steady_clock::now()), last_change(created) {}
+
+    ///@brief: Blocks while the queue is full, returns false (item dropped) once it is closed
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [&] { return closed || items.size() < capacity; });
+        if (closed) return false;
+        account();
+        items.push_back(std::move(item));
+        pushed++;
+        peak = std::max(peak, items.size());
+        not_empty.notify_one();
+        return true;
+    }
+
+    ///@brief: Blocks while the queue is empty, returns false once it is closed and drained
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [&] { return closed || !items.empty(); });
+        if (items.empty()) return false;
+        account();
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    ///@brief: No more pushes, waiting producers give up and consumers drain what is left
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+
+    QueueStats stats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        account();
+        QueueStats stats;
+        stats.capacity = capacity;
+        stats.items = pushed;
+        stats.peak = peak;
+        stats.lifetime_ms = std::chrono::duration<double, std::milli>(last_change - created).count();
+        stats.mean_occupancy = stats.lifetime_ms > 0.0 ? occupancy_ms / stats.lifetime_ms : 0.0;
+        stats.empty_ms = empty_ms;
+        stats.full_ms = full_ms;
+        return stats;
+    }
+
+private:
+    ///@brief: Charges the time since the last change to the current occupancy, under the lock
+    void account() {
+        auto now = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(now - last_change).count();
+        occupancy_ms += ms * items.size();
+        if (items.empty()) empty_ms += ms;
+        if (items.size() == capacity) full_ms += ms;
+        last_change = now;
+    }
+
+    size_t capacity;
+    std::deque<T> items;
+    bool closed = false;
+    std::mutex mutex;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+    long long pushed = 0;
+    size_t peak = 0;
+    double occupancy_ms = 0.0;
+    double empty_ms = 0.0;
+    double full_ms = 0.0;
+    std::chrono::steady_clock::time_point created;
+    std::chrono::steady_clock::time_point last_change;
+};
+
+///@brief: Runs produce(index, item) for index 0 .. count - 1 over `workers` threads and queues the items it
+/// accepts (returns true for) in roughly index order. next() hands them out until all are done
+template <class T>
+class ProducerPool {
+public:
+    typedef std::function<bool(size_t index, T& item)> Produce;
+
+    ProducerPool(int workers, size_t queue_capacity, size_t count, const Produce& produce) : queue(queue_capacity), running(std::max(1, workers)) {
+        for (int w = 0; w < std::max(1, workers); w++) {
+            threads.emplace_back([this, count, produce] {
+                for (size_t index = next_index++; index < count; index = next_index++) {
+                    T item;
+                    if (produce(index, item) && !queue.push(std::move(item))) break;
+                }
+                if (--running == 0) queue.close();
+            });
+        }
+    }
+
+    ~ProducerPool() {
+        queue.close();
+        for (std::thread& thread : threads) thread.join();
+    }
+
+    ///@brief: Blocks for the next item, false once every index has been produced and handed out
+    bool next(T& item) { return queue.pop(item); }
+
+    QueueStats stats() { return queue.stats(); }
+    int worker_count() const { return threads.size(); }
+
+private:
+    BoundedQueue<T> queue;
+    std::atomic<size_t> next_index{0};
+    std::atomic<int> running;
+    std::vector<std::thread> threads;
+};
+
+///@brief: `workers` threads running consume(item) on every submitted item, submit() blocks while `queue_capacity`
+/// items are waiting. finish() waits for the queued items to be consumed
+template <class T>
+class ConsumerPool {
+public:
+    typedef std::function<void(T& item)> Consume;
+
+    ConsumerPool(int workers, size_t queue_capacity, const Consume& consume) : queue(queue_capacity) {
+        for (int w = 0; w < std::max(1, workers); w++) {
+            threads.emplace_back([this, consume] {
+                T item;
+                while (queue.pop(item)) {
+                    consume(item);
+                }
+            });
+        }
+    }
+
+    ~ConsumerPool() { finish(); }
+
+    void submit(T item) { queue.push(std::move(item)); }
+
+    void finish() {
+        queue.close();
+        for (std::thread& thread : threads) {
+            if (thread.joinable()) thread.join();
+        }
+    }
+
+    QueueStats stats() { return queue.stats(); }
+    int worker_count() const { return threads.size(); }
+
+private:
+    BoundedQueue<T> queue;
+    std::vector<std::thread> threads;
+};
+
+///@brief: A fixed set of page aligned host buffers that decode workers pack into ahead of submission. Page
+/// alignment lets BatchPipeline run a slot straight on one (AccelDevice::attach_input). acquire() blocks
+/// until a buffer is released, so the set bounds the packed images held at once
+class PackedBufferPool {
+public:
+    PackedBufferPool(size_t count, size_t bytes_per_buffer) : free_buffers(count), buffer_bytes(dataset_align(bytes_per_buffer)) {
+        for (size_t i = 0; i < count; i++) {
+            unsigned char* buffer = static_cast<unsigned char*>(std::aligned_alloc(DATASET_ALIGN, buffer_bytes));
+            if (!buffer) {
+                throw std::runtime_error("cannot allocate packed input buffers");
+            }
+            buffers.push_back(buffer);
+            free_buffers.push(buffer);
+        }
+    }
+
+    ~PackedBufferPool() {
+        free_buffers.close();
+        for (unsigned char* buffer : buffers) std::free(buffer);
+    }
+
+    PackedBufferPool(const PackedBufferPool&) = delete;
+    PackedBufferPool& operator=(const PackedBufferPool&) = delete;
+
+    ///@brief: Blocks until a buffer is free, nullptr once the pool is shut down
+    unsigned char* acquire() {
+        unsigned char* buffer = nullptr;
+        return free_buffers.pop(buffer) ? buffer : nullptr;
+    }
+
+    void release(unsigned char* buffer) {
+        if (buffer) free_buffers.push(buffer);
+    }
+
+    ///@brief: Wakes and fails every waiting acquire()
+    void shutdown() { free_buffers.close(); }
+
+    size_t bytes() const { return buffer_bytes; }
+    size_t count() const { return buffers.size(); }
+
+private:
+    BoundedQueue<unsigned char*> free_buffers;
+    std::vector<unsigned char*> buffers;
+    size_t buffer_bytes;
+};
+
+#endif
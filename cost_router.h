@@ -0,0 +1,303 @@
+#ifndef COST_ROUTER_H
+#define COST_ROUTER_H
+
+#include <map>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <functional>
+#include <algorithm>
+#include <cmath>
+
+#include "image_formats.h"
+#include "accel_device.h"
+#include "batch_pipeline.h"
+#include "codec_pool.h"
+
+///@brief: Routes each image to the accelerator or to the CPU engine, whichever is predicted to finish it first.
+/// The prediction comes from a cost model fitted online from the timings of the images already done:
+///   accelerator  h2d fixed + h2d per byte * input bytes + launch + kernel per pixel * pixels
+///                + d2h fixed + d2h per byte * output bytes
+///   CPU          fixed + pixels / CPU MPPS
+/// Each backend also carries the predicted time of the images already routed to it and not yet done (divided
+/// over its parallel lanes), so a batch is split between the two and neither sits idle while the other has a
+/// queue. That term is the only place queueing is counted: the kernel line is fitted on device_time_ms, which
+/// leaves out the wait behind earlier runs. Until both backends have min_samples timings the images alternate
+/// between them, and every explore_every-th image goes to the backend the model did not pick, so the model
+/// follows a change in load. Old samples are forgotten geometrically (decay) for the same reason. The first
+/// image on each backend pays its buffer allocations and is not fitted.
+
+#define ROUTE_ACCEL 0
+#define ROUTE_CPU 1
+
+#define ROUTE_MODE_ACCEL 0          /// every image on the accelerator, no router
+#define ROUTE_MODE_CPU 1            /// every image on the CPU engine
+#define ROUTE_MODE_AUTO 2           /// cost model
+
+inline const char* route_backend_name(int backend) {
+    return backend == ROUTE_CPU ? "cpu" : "fpga";
+}
+
+///@brief: Command line names, -1 for an unknown name
+inline int parse_route_mode(const std::string& name) {
+    return (name == "fpga") ? ROUTE_MODE_ACCEL : (name == "cpu") ? ROUTE_MODE_CPU : (name == "auto") ? ROUTE_MODE_AUTO : -1;
+}
+
+///@brief: Least squares line y = intercept + slope * x over samples weighted by decay^age. While the samples do not
+/// tell a slope (one size, or a negative fit from noise) the line is flat at their mean: that is optimistic for
+/// larger images, so the router tries them and learns the slope. Neither term is allowed below zero
+struct OnlineLinearFit {
+    double decay = 0.98;
+    double weight = 0.0;
+    double sum_x = 0.0;
+    double sum_y = 0.0;
+    double sum_xx = 0.0;
+    double sum_xy = 0.0;
+    long long samples = 0;
+
+    void add(double x, double y) {
+        weight = weight * decay + 1.0;
+        sum_x = sum_x * decay + x;
+        sum_y = sum_y * decay + y;
+        sum_xx = sum_xx * decay + x * x;
+        sum_xy = sum_xy * decay + x * y;
+        samples++;
+    }
+
+    double slope() const {
+        double variance = weight * sum_xx - sum_x * sum_x;
+        if (samples < 2 || variance <= 1e-9 * weight * sum_xx) {
+            return 0.0;
+        }
+        return std::max(0.0, (weight * sum_xy - sum_x * sum_y) / variance);
+    }
+
+    double intercept() const {
+        return weight > 0.0 ? std::max(0.0, (sum_y - slope() * sum_x) / weight) : 0.0;
+    }
+
+    double predict(double x) const { return intercept() + slope() * x; }
+};
+
+struct RouterConfig {
+    int mode = ROUTE_MODE_AUTO;
+    int input_format = INPUT_FORMAT_RGB888;
+    int output_format = OUTPUT_FORMAT_GRAY8;
+    int accel_lanes = 1;            /// images the accelerator works on at once, queue depth x CUs
+    int cpu_lanes = 1;              /// images the CPU backend works on at once
+    int min_samples = 3;            /// images per backend before the model decides, the first one is not fitted
+    int explore_every = 16;         /// 0 = never route against the model
+    double decay = 0.98;
+};
+
+///@brief: The fitted model in the units it is usually quoted in
+struct CostModel {
+    double h2d_ns_per_byte = 0.0;
+    double kernel_ns_per_pixel = 0.0;
+    double d2h_ns_per_byte = 0.0;
+    double accel_fixed_ms = 0.0;    /// launch plus the fixed part of both transfers
+    double cpu_mpps = 0.0;
+    double cpu_fixed_ms = 0.0;
+    long long accel_samples = 0;
+    long long cpu_samples = 0;
+};
+
+struct RouteStats {
+    long long images[2] = {0, 0};
+    long long pixels[2] = {0, 0};
+    long long warmup = 0;           /// routed before the model had min_samples on both backends
+    long long explored = 0;         /// routed against the model
+    long long modelled[2] = {0, 0}; /// completed images routed by the model, the ones below are over these
+    double predicted_ms[2] = {0.0, 0.0};
+    double observed_ms[2] = {0.0, 0.0};
+    double abs_error_ms[2] = {0.0, 0.0};
+};
+
+class CostRouter {
+public:
+    explicit CostRouter(const RouterConfig& router_config) : config(router_config) {
+        for (OnlineLinearFit* fit : { &h2d, &kernel, &d2h, &cpu }) {
+            fit->decay = config.decay;
+        }
+    }
+
+    ///@brief: Picks the backend for image `id` (height x width) and books its predicted time there until complete(id)
+    int route(int id, int height, int width) {
+        std::lock_guard<std::mutex> lock(mutex);
+        long long pixels = (long long)height * width;
+        double predicted[2] = { predict_accel(height, width), predict_cpu(height, width) };
+        int backend = ROUTE_ACCEL;
+        bool modelled = false;
+        if (config.mode == ROUTE_MODE_CPU) {
+            backend = ROUTE_CPU;
+        } else if (config.mode == ROUTE_MODE_AUTO) {
+            long long known_accel = kernel.samples + pending_count[ROUTE_ACCEL] + warmed_up[ROUTE_ACCEL];
+            long long known_cpu = cpu.samples + pending_count[ROUTE_CPU] + warmed_up[ROUTE_CPU];
+            if (known_accel < config.min_samples || known_cpu < config.min_samples) {
+                backend = known_cpu < known_accel ? ROUTE_CPU : ROUTE_ACCEL;
+                stats.warmup++;
+            } else {
+                double accel_finish = pending_ms[ROUTE_ACCEL] / std::max(1, config.accel_lanes) + predicted[ROUTE_ACCEL];
+                double cpu_finish = pending_ms[ROUTE_CPU] / std::max(1, config.cpu_lanes) + predicted[ROUTE_CPU];
+                backend = cpu_finish < accel_finish ? ROUTE_CPU : ROUTE_ACCEL;
+                modelled = true;
+                decisions++;
+                if (config.explore_every > 0 && decisions % config.explore_every == 0) {
+                    backend = 1 - backend;
+                    stats.explored++;
+                }
+            }
+        }
+        Pending entry = { backend, predicted[backend], height, width, modelled };
+        pending[id] = entry;
+        pending_ms[backend] += entry.predicted_ms;
+        pending_count[backend]++;
+        stats.images[backend]++;
+        stats.pixels[backend] += pixels;
+        return backend;
+    }
+
+    ///@brief: Image `id` is done, its timings refine the model of the backend it ran on
+    void complete(int id, const PerformanceMetrics& metrics) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = pending.find(id);
+        if (found == pending.end()) return;
+        const Pending& entry = found->second;
+        int backend = entry.backend;
+        pending_ms[backend] = std::max(0.0, pending_ms[backend] - entry.predicted_ms);
+        pending_count[backend]--;
+
+        long long pixels = (long long)entry.height * entry.width;
+        double observed_ms = metrics.h2d_time_ms + metrics.device_time_ms + metrics.d2h_time_ms;
+        if (entry.modelled) {
+            stats.modelled[backend]++;
+            stats.predicted_ms[backend] += entry.predicted_ms;
+            stats.observed_ms[backend] += observed_ms;
+            stats.abs_error_ms[backend] += std::fabs(observed_ms - entry.predicted_ms);
+        }
+        pending.erase(found);
+        if (!warmed_up[backend]) {
+            warmed_up[backend] = true;
+            return;
+        }
+        if (backend == ROUTE_ACCEL) {
+            h2d.add(input_buffer_bytes(config.input_format, pixels), metrics.h2d_time_ms);
+            kernel.add(pixels, metrics.device_time_ms);
+            d2h.add(metrics.d2h_bytes, metrics.d2h_time_ms);
+        } else {
+            cpu.add(pixels, observed_ms);
+        }
+    }
+
+    ///@brief: Predicted milliseconds for a height x width image on `backend` with the current model
+    double predict_ms(int backend, int height, int width) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return backend == ROUTE_CPU ? predict_cpu(height, width) : predict_accel(height, width);
+    }
+
+    CostModel model() {
+        std::lock_guard<std::mutex> lock(mutex);
+        CostModel current;
+        current.h2d_ns_per_byte = h2d.slope() * 1e6;
+        current.kernel_ns_per_pixel = kernel.slope() * 1e6;
+        current.d2h_ns_per_byte = d2h.slope() * 1e6;
+        current.accel_fixed_ms = h2d.intercept() + kernel.intercept() + d2h.intercept();
+        current.cpu_mpps = cpu.slope() > 0.0 ? 1e-3 / cpu.slope() : 0.0;
+        current.cpu_fixed_ms = cpu.intercept();
+        current.accel_samples = kernel.samples;
+        current.cpu_samples = cpu.samples;
+        return current;
+    }
+
+    RouteStats statistics() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+    ///@brief: The largest square image the CPU is predicted to finish sooner than an idle accelerator, 0 if none
+    int crossover_side() {
+        std::lock_guard<std::mutex> lock(mutex);
+        int side = 0;
+        for (int s = 3; s <= 8192; s *= 2) {
+            if (predict_cpu(s, s) < predict_accel(s, s)) side = s;
+        }
+        return side;
+    }
+
+private:
+    struct Pending {
+        int backend;
+        double predicted_ms;
+        int height;
+        int width;
+        bool modelled;
+    };
+
+    double predict_accel(int height, int width) const {
+        long long pixels = (long long)height * width;
+        return h2d.predict(input_buffer_bytes(config.input_format, pixels)) + kernel.predict(pixels) +
+               d2h.predict(output_buffer_bytes(config.output_format, (long long)(height - 2) * (width - 2)));
+    }
+
+    double predict_cpu(int height, int width) const {
+        return cpu.predict((double)height * width);
+    }
+
+    RouterConfig config;
+    std::mutex mutex;
+    OnlineLinearFit h2d;            /// ms over input bytes
+    OnlineLinearFit kernel;         /// ms over input pixels, device_time_ms
+    OnlineLinearFit d2h;            /// ms over output bytes
+    OnlineLinearFit cpu;            /// ms over input pixels, pack to unpack
+    std::map<int, Pending> pending;
+    double pending_ms[2] = {0.0, 0.0};
+    long long pending_count[2] = {0, 0};
+    long long decisions = 0;
+    bool warmed_up[2] = {false, false};
+    RouteStats stats;
+};
+
+///@brief: The CPU side of the router: the bit-exact CPU engine behind a SoftwareAccelDevice, so the outputs of
+/// both backends are identical for every format and stage, driven by its own BatchPipeline on its own thread.
+/// The pipeline runs one image at a time: a deeper one would keep an image in flight while it waits on the
+/// queue for the next, and that wait would be timed as CPU cost. submit() blocks while `queue_capacity` images
+/// wait, outputs arrive on the backend's thread
+class CpuRouteBackend {
+public:
+    CpuRouteBackend(const PipelineConfig& pipeline_config, const EdgeKernel& edge_kernel, size_t queue_capacity,
+                    const std::function<void(const BatchOutput&)>& on_output)
+        : device(SoftwareAccelDevice::Latency(), "cpu", edge_kernel), pipeline(device, single_image(pipeline_config)), queue(queue_capacity)
+    {
+        worker = std::thread([this, on_output] {
+            trace_thread_name("cpu backend");
+            report = pipeline.run([this](BatchInput& input) { return queue.pop(input); }, on_output);
+        });
+    }
+
+    ~CpuRouteBackend() { finish(); }
+
+    void submit(BatchInput input) { queue.push(std::move(input)); }
+
+    ///@brief: Waits for every submitted image, the report is complete afterwards
+    void finish() {
+        queue.close();
+        if (worker.joinable()) worker.join();
+    }
+
+    const BatchReport& batch_report() const { return report; }
+
+private:
+    static PipelineConfig single_image(PipelineConfig config) {
+        config.queue_depth = 1;
+        config.images_per_run = 1;
+        return config;
+    }
+
+    SoftwareAccelDevice device;
+    BatchPipeline pipeline;
+    BoundedQueue<BatchInput> queue;
+    BatchReport report;
+    std::thread worker;
+};
+
+#endif
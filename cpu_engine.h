@@ -0,0 +1,247 @@
+#ifndef CPU_ENGINE_H
+#define CPU_ENGINE_H
+
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include "image_formats.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPU_ENGINE_X86 1
+#endif
+
+///@brief: CPU implementation of image_process, bit-exact with the kernel on the same device buffers:
+/// 77/150/29 >> 8 grayscale, (|Gx| + |Gy|) >> 1 saturated to 255, (height-2) x (width-2) output and a
+/// zeroed tail up to the last burst. Rows are split in bands across threads, the Sobel rows use AVX2 or
+/// AVX-512BW when the CPU has them.
+
+#define CPU_ISA_AUTO -1
+#define CPU_ISA_SCALAR 0
+#define CPU_ISA_AVX2 1
+#define CPU_ISA_AVX512 2
+
+#define CPU_MIN_BAND_ROWS 16    /// smaller bands cost more in thread start-up than they save
+
+struct CpuEngineOptions {
+    int isa = CPU_ISA_AUTO;     /// anything above what the CPU supports is lowered to the best supported
+    int threads = 0;            /// 0 = std::thread::hardware_concurrency()
+};
+
+inline const char* cpu_isa_name(int isa) {
+    return (isa == CPU_ISA_AVX512) ? "avx512" : (isa == CPU_ISA_AVX2) ? "avx2" : "scalar";
+}
+
+inline int cpu_detect_isa() {
+#ifdef CPU_ENGINE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) return CPU_ISA_AVX512;
+    if (__builtin_cpu_supports("avx2")) return CPU_ISA_AVX2;
+#endif
+    return CPU_ISA_SCALAR;
+}
+
+///@brief: One input row to gray. Kept branch free per format so each ISA wrapper below auto-vectorizes it
+__attribute__((always_inline)) inline void cpu_gray_row_body(const unsigned char* in, unsigned char* gray, int width, int input_format) {
+    if (input_format == INPUT_FORMAT_RGB888) {
+        for (int x = 0; x < width; x++) {
+            const unsigned char* pixel = in + x * 3;
+            gray[x] = (pixel[2] * 77 + pixel[1] * 150 + pixel[0] * 29) >> 8;
+        }
+    } else {
+        for (int x = 0; x < width; x++) {
+            const unsigned char* pixel = in + x * 4;
+            gray[x] = (pixel[2] * 77 + pixel[1] * 150 + pixel[0] * 29) >> 8;
+        }
+    }
+}
+
+///@brief: Output pixels [begin, out_width) of one row, out[ox] is the Sobel at column ox + 1
+inline void cpu_sobel_row_scalar(const unsigned char* up, const unsigned char* mid, const unsigned char* down,
+                                 unsigned char* out, int begin, int out_width) {
+    for (int ox = begin; ox < out_width; ox++) {
+        int gx = (up[ox + 2] - up[ox]) + 2 * (mid[ox + 2] - mid[ox]) + (down[ox + 2] - down[ox]);
+        int gy = (up[ox] + 2 * up[ox + 1] + up[ox + 2]) - (down[ox] + 2 * down[ox + 1] + down[ox + 2]);
+        int magnitude = ((gx < 0 ? -gx : gx) + (gy < 0 ? -gy : gy)) >> 1;
+        out[ox] = magnitude > 255 ? 255 : magnitude;
+    }
+}
+
+inline void cpu_gray_row_scalar(const unsigned char* in, unsigned char* gray, int width, int input_format) {
+    cpu_gray_row_body(in, gray, width, input_format);
+}
+
+#ifdef CPU_ENGINE_X86
+/// All intermediates fit in 16 bits: |Gx|, |Gy| <= 1020, so the lanes are widened bytes
+
+__attribute__((target("avx2"))) inline __m256i cpu_load_u8x16_avx2(const unsigned char* p) {
+    return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+}
+
+__attribute__((target("avx2"))) inline void cpu_sobel_row_avx2(const unsigned char* up, const unsigned char* mid, const unsigned char* down,
+                                                              unsigned char* out, int out_width) {
+    const __m256i max_edge = _mm256_set1_epi16(255);
+    int ox = 0;
+    for (; ox + 16 <= out_width; ox += 16) {
+        __m256i ul = cpu_load_u8x16_avx2(up + ox), uc = cpu_load_u8x16_avx2(up + ox + 1), ur = cpu_load_u8x16_avx2(up + ox + 2);
+        __m256i ml = cpu_load_u8x16_avx2(mid + ox), mr = cpu_load_u8x16_avx2(mid + ox + 2);
+        __m256i dl = cpu_load_u8x16_avx2(down + ox), dc = cpu_load_u8x16_avx2(down + ox + 1), dr = cpu_load_u8x16_avx2(down + ox + 2);
+
+        __m256i gx = _mm256_add_epi16(_mm256_add_epi16(_mm256_sub_epi16(ur, ul), _mm256_sub_epi16(dr, dl)),
+                                      _mm256_slli_epi16(_mm256_sub_epi16(mr, ml), 1));
+        __m256i gy = _mm256_sub_epi16(_mm256_add_epi16(_mm256_add_epi16(ul, ur), _mm256_slli_epi16(uc, 1)),
+                                      _mm256_add_epi16(_mm256_add_epi16(dl, dr), _mm256_slli_epi16(dc, 1)));
+        __m256i magnitude = _mm256_srli_epi16(_mm256_add_epi16(_mm256_abs_epi16(gx), _mm256_abs_epi16(gy)), 1);
+        magnitude = _mm256_min_epu16(magnitude, max_edge);
+
+        __m128i packed = _mm_packus_epi16(_mm256_castsi256_si128(magnitude), _mm256_extracti128_si256(magnitude, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + ox), packed);
+    }
+    cpu_sobel_row_scalar(up, mid, down, out, ox, out_width);
+}
+
+__attribute__((target("avx2"))) inline void cpu_gray_row_avx2(const unsigned char* in, unsigned char* gray, int width, int input_format) {
+    cpu_gray_row_body(in, gray, width, input_format);
+}
+
+__attribute__((target("avx512f,avx512bw"))) inline __m512i cpu_load_u8x32_avx512(const unsigned char* p) {
+    return _mm512_cvtepu8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+}
+
+/// GCC 12's _mm512_cvtepi16_epi8 passes _mm256_undefined_si256() through a masked builtin and trips
+/// -Wmaybe-uninitialized in its own header (fixed in GCC 13)
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+__attribute__((target("avx512f,avx512bw"))) inline void cpu_sobel_row_avx512(const unsigned char* up, const unsigned char* mid, const unsigned char* down,
+                                                                            unsigned char* out, int out_width) {
+    const __m512i max_edge = _mm512_set1_epi16(255);
+    int ox = 0;
+    for (; ox + 32 <= out_width; ox += 32) {
+        __m512i ul = cpu_load_u8x32_avx512(up + ox), uc = cpu_load_u8x32_avx512(up + ox + 1), ur = cpu_load_u8x32_avx512(up + ox + 2);
+        __m512i ml = cpu_load_u8x32_avx512(mid + ox), mr = cpu_load_u8x32_avx512(mid + ox + 2);
+        __m512i dl = cpu_load_u8x32_avx512(down + ox), dc = cpu_load_u8x32_avx512(down + ox + 1), dr = cpu_load_u8x32_avx512(down + ox + 2);
+
+        __m512i gx = _mm512_add_epi16(_mm512_add_epi16(_mm512_sub_epi16(ur, ul), _mm512_sub_epi16(dr, dl)),
+                                      _mm512_slli_epi16(_mm512_sub_epi16(mr, ml), 1));
+        __m512i gy = _mm512_sub_epi16(_mm512_add_epi16(_mm512_add_epi16(ul, ur), _mm512_slli_epi16(uc, 1)),
+                                      _mm512_add_epi16(_mm512_add_epi16(dl, dr), _mm512_slli_epi16(dc, 1)));
+        __m512i magnitude = _mm512_srli_epi16(_mm512_add_epi16(_mm512_abs_epi16(gx), _mm512_abs_epi16(gy)), 1);
+        magnitude = _mm512_min_epu16(magnitude, max_edge);
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + ox), _mm512_cvtepi16_epi8(magnitude));
+    }
+    /// Less than 32 pixels left, finish with the narrower kernel
+    cpu_sobel_row_avx2(up + ox, mid + ox, down + ox, out + ox, out_width - ox);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+__attribute__((target("avx512f,avx512bw"))) inline void cpu_gray_row_avx512(const unsigned char* in, unsigned char* gray, int width, int input_format) {
+    cpu_gray_row_body(in, gray, width, input_format);
+}
+#endif
+
+///@brief: Output rows [row_begin, row_end) of one band. Keeps a ring of three gray rows, LUMA8 rows are read in place
+inline void cpu_process_band(const unsigned char* in_img, unsigned char* out_img, int width, int input_format,
+                             int output_format, int isa, int row_begin, int row_end) {
+    void (*gray_row)(const unsigned char*, unsigned char*, int, int) = cpu_gray_row_scalar;
+    void (*sobel_row)(const unsigned char*, const unsigned char*, const unsigned char*, unsigned char*, int) =
+        [](const unsigned char* up, const unsigned char* mid, const unsigned char* down, unsigned char* out, int out_width) {
+            cpu_sobel_row_scalar(up, mid, down, out, 0, out_width);
+        };
+#ifdef CPU_ENGINE_X86
+    if (isa == CPU_ISA_AVX512) {
+        gray_row = cpu_gray_row_avx512;
+        sobel_row = cpu_sobel_row_avx512;
+    } else if (isa == CPU_ISA_AVX2) {
+        gray_row = cpu_gray_row_avx2;
+        sobel_row = cpu_sobel_row_avx2;
+    }
+#endif
+
+    int out_width = width - 2;
+    size_t in_row_bytes = (size_t)width * input_bytes_per_pixel(input_format);
+    bool luma = (input_format == INPUT_FORMAT_LUMA8);
+    std::vector<unsigned char> gray_ring(luma ? 0 : 3 * width);
+    std::vector<unsigned char> edge_row(output_format == OUTPUT_FORMAT_RGB32 ? out_width : 0);
+
+    auto load_gray = [&](int y) -> const unsigned char* {
+        const unsigned char* in_row = in_img + y * in_row_bytes;
+        if (luma) return in_row;
+        unsigned char* gray = &gray_ring[(y % 3) * width];
+        gray_row(in_row, gray, width, input_format);
+        return gray;
+    };
+
+    const unsigned char* up = load_gray(row_begin);
+    const unsigned char* mid = load_gray(row_begin + 1);
+    for (int oy = row_begin; oy < row_end; oy++) {
+        const unsigned char* down = load_gray(oy + 2);
+        if (output_format == OUTPUT_FORMAT_GRAY8) {
+            sobel_row(up, mid, down, out_img + (size_t)oy * out_width, out_width);
+        } else {
+            sobel_row(up, mid, down, edge_row.data(), out_width);
+            unsigned char* out_row = out_img + (size_t)oy * out_width * 4;
+            for (int ox = 0; ox < out_width; ox++) {
+                out_row[ox * 4] = edge_row[ox];
+                out_row[ox * 4 + 1] = edge_row[ox];
+                out_row[ox * 4 + 2] = edge_row[ox];
+                out_row[ox * 4 + 3] = 0;
+            }
+        }
+        up = mid;
+        mid = down;
+    }
+}
+
+///@brief: The engine writes the edge plane as RGB32 or GRAY8, the masks and MAG_ORIENT come from the reference model
+inline bool cpu_engine_supports(int output_format) {
+    return output_format == OUTPUT_FORMAT_RGB32 || output_format == OUTPUT_FORMAT_GRAY8;
+}
+
+///@brief: Drop-in for image_process_reference, same buffers and same bytes out. Returns false, without touching
+/// out_img, for an output format cpu_engine_supports rejects
+inline bool image_process_cpu(
+    const unsigned char* in_img,
+    unsigned char* out_img,
+    int height,
+    int width,
+    int input_format,
+    int output_format,
+    const CpuEngineOptions& options = CpuEngineOptions())
+{
+    if (!cpu_engine_supports(output_format)) return false;
+    int out_height = height - 2;
+    int out_width = width - 2;
+    size_t out_size = (size_t)out_height * out_width;
+    size_t written = (output_format == OUTPUT_FORMAT_GRAY8) ? out_size : out_size * 4;
+    std::memset(out_img + written, 0, output_buffer_bytes(output_format, out_size) - written);
+    if (out_height <= 0 || out_width <= 0) return true;
+
+    int supported = cpu_detect_isa();
+    int isa = (options.isa == CPU_ISA_AUTO) ? supported : std::min(options.isa, supported);
+
+    int threads = options.threads > 0 ? options.threads : (int)std::thread::hardware_concurrency();
+    int bands = std::max(1, std::min(threads, out_height / CPU_MIN_BAND_ROWS));
+    if (bands == 1) {
+        cpu_process_band(in_img, out_img, width, input_format, output_format, isa, 0, out_height);
+        return true;
+    }
+
+    std::vector<std::thread> workers;
+    for (int band = 0; band < bands; band++) {
+        int row_begin = (int)((long long)out_height * band / bands);
+        int row_end = (int)((long long)out_height * (band + 1) / bands);
+        workers.emplace_back(cpu_process_band, in_img, out_img, width, input_format, output_format, isa, row_begin, row_end);
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef CU_SCHEDULER_H
+#define CU_SCHEDULER_H
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <chrono>
+#include <exception>
+
+#include "accel_device.h"
+#include "batch_pipeline.h"
+#include "trace.h"
+
+struct CuSchedulerConfig {
+    PipelineConfig pipeline;        /// per CU, every CU keeps its own queue_depth runs in flight
+    bool work_stealing = true;      /// false = each CU only works through the images dealt to it
+};
+
+struct CuReport {
+    std::string name;
+    int images = 0;
+    long long pixels = 0;
+    int stolen = 0;                 /// images taken from another CU's queue
+    double busy_time_ms = 0.0;
+    double utilization = 0.0;       /// busy time over the scheduler wall time
+};
+
+struct ScheduleReport {
+    std::vector<PerformanceMetrics> images;
+    std::vector<CuReport> units;
+    long long total_pixels = 0;
+    double wall_time_ms = 0.0;
+    int peak_in_flight = 0;         /// sum of the per CU peaks
+    int setup_allocations = 0;
+
+    double sustained_mpps() const {
+        return wall_time_ms > 0.0 ? (total_pixels / (wall_time_ms / 1000.0)) / 1000000.0 : 0.0;
+    }
+};
+
+///@brief: Spreads a batch over several compute units. Images are dealt round robin into one queue per CU,
+/// each CU has a host thread driving its own BatchPipeline from the front of its queue and, once that is
+/// empty, stealing from the back of the longest other queue. A CU held up by a large image thus only
+/// delays that image, the rest of its share moves to idle CUs. An exception on a worker thread (the device,
+/// `load` or `on_output`) empties the queues and is rethrown from run() once every worker has joined.
+class CuScheduler {
+public:
+    ///@brief: Fills `input` for image `index`, called on the worker thread of `unit` so decode runs in parallel
+    typedef std::function<void(int unit, int index, BatchInput& input)> InputLoader;
+    ///@brief: Called for each finished image, calls are serialized but arrive in completion order
+    typedef std::function<void(int unit, const BatchOutput& output)> OutputSink;
+
+    CuScheduler(const std::vector<AccelDevice*>& compute_units, const CuSchedulerConfig& scheduler_config)
+        : units(compute_units), config(scheduler_config) {}
+
+    ScheduleReport run(int image_count, const InputLoader& load, const OutputSink& on_output) {
+        int unit_count = units.size();
+        queues.assign(unit_count, std::deque<int>());
+        for (int index = 0; index < image_count; index++) {
+            queues[index % unit_count].push_back(index);
+        }
+
+        ScheduleReport report;
+        report.units.resize(unit_count);
+        std::vector<BatchReport> unit_reports(unit_count);
+        auto start = std::chrono::high_resolution_clock::now();
+
+        std::vector<std::exception_ptr> failures(unit_count);
+        std::vector<std::thread> workers;
+        for (int unit = 0; unit < unit_count; unit++) {
+            workers.emplace_back([&, unit]() {
+                trace_thread_name(units[unit]->name());
+                try {
+                    BatchPipeline pipeline(*units[unit], config.pipeline);
+                    unit_reports[unit] = pipeline.run(
+                        [&](BatchInput& input) {
+                            int index = 0;
+                            bool stolen = false;
+                            if (!take(unit, index, stolen)) return false;
+                            if (stolen) report.units[unit].stolen++;
+                            load(unit, index, input);
+                            input.tag = index;
+                            return true;
+                        },
+                        [&](const BatchOutput& output) {
+                            std::lock_guard<std::mutex> lock(output_mutex);
+                            on_output(unit, output);
+                        });
+                } catch (...) {
+                    failures[unit] = std::current_exception();
+                    /// The other CUs finish their runs in flight and take nothing more
+                    std::lock_guard<std::mutex> lock(queue_mutex);
+                    for (std::deque<int>& queue : queues) queue.clear();
+                }
+            });
+        }
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+        for (const std::exception_ptr& failure : failures) {
+            if (failure) std::rethrow_exception(failure);
+        }
+        report.wall_time_ms = elapsed_ms(start, std::chrono::high_resolution_clock::now());
+
+        for (int unit = 0; unit < unit_count; unit++) {
+            CuReport& cu = report.units[unit];
+            const BatchReport& unit_report = unit_reports[unit];
+            cu.name = units[unit]->name();
+            cu.images = unit_report.images.size();
+            cu.pixels = unit_report.total_pixels;
+            cu.busy_time_ms = unit_report.busy_time_ms;
+            cu.utilization = report.wall_time_ms > 0.0 ? unit_report.busy_time_ms / report.wall_time_ms : 0.0;
+            report.images.insert(report.images.end(), unit_report.images.begin(), unit_report.images.end());
+            report.total_pixels += unit_report.total_pixels;
+            report.peak_in_flight += unit_report.peak_in_flight;
+            report.setup_allocations += unit_report.setup_allocations;
+        }
+        return report;
+    }
+
+private:
+    bool take(int unit, int& index, bool& stolen) {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (!queues[unit].empty()) {
+            index = queues[unit].front();
+            queues[unit].pop_front();
+            stolen = false;
+            return true;
+        }
+        if (!config.work_stealing) return false;
+
+        int victim = -1;
+        for (int other = 0; other < (int)queues.size(); other++) {
+            if (!queues[other].empty() && (victim < 0 || queues[other].size() > queues[victim].size())) {
+                victim = other;
+            }
+        }
+        if (victim < 0) return false;
+        index = queues[victim].back();
+        queues[victim].pop_back();
+        stolen = true;
+        return true;
+    }
+
+    std::vector<AccelDevice*> units;
+    CuSchedulerConfig config;
+    std::vector<std::deque<int> > queues;
+    std::mutex queue_mutex;
+    std::mutex output_mutex;
+};
+
+#endif
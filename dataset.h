@@ -0,0 +1,241 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <opencv2/opencv.hpp>
+
+#include "image_formats.h"
+
+///@brief: Single file container of pre-decoded images, written once by make_dataset and memory mapped by
+/// host_app --input-dataset and benchmark so repeated runs pay no codec time. Layout:
+///   page 0                 DatasetHeader
+///   entry payloads         one per image, each starting on a DATASET_ALIGN (4 KiB) boundary
+///   index                  entry_count DatasetEntry records, on a 4 KiB boundary after the last payload
+/// An input container holds the images in the kernel's input layout (pack_input_image, input_buffer_bytes
+/// per image, burst padded), so a payload can be handed to the device as it is: page aligned host memory is
+/// what an XRT user pointer buffer needs. An edge container holds the 8-bit edge maps of a run, dense rows.
+/// Little endian, written and read on the same host.
+
+#define DATASET_ALIGN 4096
+#define DATASET_VERSION 1
+#define DATASET_NAME_BYTES 232
+
+#define DATASET_KIND_INPUT 0        /// payload = kernel input layout of `format` (INPUT_FORMAT_*)
+#define DATASET_KIND_EDGES 1        /// payload = height x width edge values, format = OUTPUT_FORMAT_GRAY8
+
+struct DatasetHeader {
+    char magic[8];                  /// "EDGEDSET"
+    uint32_t version;
+    uint32_t kind;
+    int32_t format;
+    uint32_t entry_count;
+    uint64_t index_offset;
+    uint64_t file_bytes;
+};
+
+struct DatasetEntry {
+    uint64_t offset;                /// from the start of the file, a multiple of DATASET_ALIGN
+    uint64_t bytes;                 /// payload bytes, the space up to the next entry is zero padding
+    int32_t height;
+    int32_t width;
+    char name[DATASET_NAME_BYTES];  /// NUL terminated, longer names are cut
+};
+
+static_assert(sizeof(DatasetHeader) <= DATASET_ALIGN, "dataset header must fit page 0");
+static_assert(sizeof(DatasetEntry) == 256, "dataset index records are 256 bytes");
+
+inline uint64_t dataset_align(uint64_t bytes) {
+    return ((bytes + DATASET_ALIGN - 1) / DATASET_ALIGN) * DATASET_ALIGN;
+}
+
+inline const char* dataset_kind_name(uint32_t kind) {
+    return kind == DATASET_KIND_EDGES ? "edges" : "input";
+}
+
+///@brief: Appends entries to a new container. The index and the final header are written by finish(), which
+/// the destructor calls if needed; a container without them is rejected by DatasetReader
+class DatasetWriter {
+public:
+    DatasetWriter(const std::string& path, uint32_t kind, int format) : file(path, std::ios::binary | std::ios::trunc) {
+        if (!file) {
+            throw std::runtime_error("cannot create dataset " + path);
+        }
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "EDGEDSET", 8);
+        header.version = DATASET_VERSION;
+        header.kind = kind;
+        header.format = format;
+        write_padded(nullptr, 0);
+    }
+
+    ~DatasetWriter() {
+        try {
+            finish();
+        } catch (const std::exception&) {
+        }
+    }
+
+    ///@brief: One image, `bytes` of payload in the container's layout
+    void append(const std::string& name, int height, int width, const unsigned char* payload, size_t bytes) {
+        DatasetEntry entry;
+        std::memset(&entry, 0, sizeof(entry));
+        entry.offset = offset;
+        entry.bytes = bytes;
+        entry.height = height;
+        entry.width = width;
+        std::strncpy(entry.name, name.c_str(), DATASET_NAME_BYTES - 1);
+        write_padded(payload, bytes);
+        entries.push_back(entry);
+    }
+
+    ///@brief: An edge map, CV_8UC1 at any step, stored as dense rows
+    void append_edges(const std::string& name, const cv::Mat& edges) {
+        if (edges.isContinuous()) {
+            append(name, edges.rows, edges.cols, edges.data, edges.total());
+            return;
+        }
+        cv::Mat dense = edges.clone();
+        append(name, dense.rows, dense.cols, dense.data, dense.total());
+    }
+
+    void finish() {
+        if (finished) return;
+        finished = true;
+        header.entry_count = entries.size();
+        header.index_offset = offset;
+        write_padded(reinterpret_cast<const unsigned char*>(entries.data()), entries.size() * sizeof(DatasetEntry));
+        header.file_bytes = offset;
+        file.seekp(0);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.flush();
+        if (!file) {
+            throw std::runtime_error("cannot write dataset index");
+        }
+    }
+
+    size_t size() const { return entries.size(); }
+    uint64_t bytes_written() const { return offset; }
+
+private:
+    ///@brief: Writes bytes at the current offset and zero pads to the next page
+    void write_padded(const unsigned char* data, size_t bytes) {
+        static const char zeros[DATASET_ALIGN] = {};
+        if (bytes > 0) {
+            file.write(reinterpret_cast<const char*>(data), bytes);
+        }
+        uint64_t padded = dataset_align(std::max<uint64_t>(bytes, 1));
+        file.write(zeros, padded - bytes);
+        offset += padded;
+        if (!file) {
+            throw std::runtime_error("cannot write dataset");
+        }
+    }
+
+    std::ofstream file;
+    DatasetHeader header;
+    std::vector<DatasetEntry> entries;
+    uint64_t offset = 0;
+    bool finished = false;
+};
+
+///@brief: Read side, maps the whole container once. The mapping is private and writable: nothing writes to it,
+/// but pinning the pages for a device DMA (an XRT user pointer buffer) wants write access on some drivers
+class DatasetReader {
+public:
+    explicit DatasetReader(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("cannot open dataset " + path);
+        }
+        struct stat info;
+        if (::fstat(fd, &info) != 0 || info.st_size < (off_t)DATASET_ALIGN) {
+            ::close(fd);
+            throw std::runtime_error("dataset too small: " + path);
+        }
+        mapped_bytes = info.st_size;
+        void* mapping = ::mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            throw std::runtime_error("cannot map dataset " + path);
+        }
+        base = static_cast<unsigned char*>(mapping);
+        /// Payloads are read front to back, let the kernel read ahead
+        ::madvise(base, mapped_bytes, MADV_WILLNEED);
+
+        std::memcpy(&header, base, sizeof(header));
+        if (std::memcmp(header.magic, "EDGEDSET", 8) != 0 || header.version != DATASET_VERSION || header.file_bytes != mapped_bytes ||
+            header.index_offset % DATASET_ALIGN != 0 || header.index_offset + (uint64_t)header.entry_count * sizeof(DatasetEntry) > mapped_bytes) {
+            release();
+            throw std::runtime_error("not a dataset or an unfinished one: " + path);
+        }
+        index = reinterpret_cast<const DatasetEntry*>(base + header.index_offset);
+        for (uint32_t i = 0; i < header.entry_count; i++) {
+            const DatasetEntry& entry = index[i];
+            if (entry.offset % DATASET_ALIGN != 0 || entry.offset + entry.bytes > header.index_offset || entry.height < 3 || entry.width < 3 ||
+                entry.bytes < expected_bytes(entry)) {
+                release();
+                throw std::runtime_error("corrupt dataset entry " + std::to_string(i) + " in " + path);
+            }
+        }
+    }
+
+    ~DatasetReader() { release(); }
+
+    DatasetReader(const DatasetReader&) = delete;
+    DatasetReader& operator=(const DatasetReader&) = delete;
+
+    uint32_t kind() const { return header.kind; }
+    int format() const { return header.format; }
+    size_t size() const { return header.entry_count; }
+    uint64_t file_bytes() const { return mapped_bytes; }
+
+    const DatasetEntry& entry(size_t i) const { return index[i]; }
+    std::string name(size_t i) const { return std::string(index[i].name, strnlen(index[i].name, DATASET_NAME_BYTES)); }
+
+    ///@brief: The payload, DATASET_ALIGN aligned, padded with zeros to the next page
+    unsigned char* payload(size_t i) const { return base + index[i].offset; }
+    size_t padded_bytes(size_t i) const { return dataset_align(index[i].bytes); }
+
+    ///@brief: The entry as a BGR / gray cv::Mat. RGB888, LUMA8 and edge payloads are wrapped in place, RGB32 is
+    /// converted into `storage`
+    cv::Mat image(size_t i, cv::Mat& storage) const {
+        const DatasetEntry& e = index[i];
+        if (header.kind == DATASET_KIND_EDGES || header.format == INPUT_FORMAT_LUMA8) {
+            return cv::Mat(e.height, e.width, CV_8UC1, payload(i));
+        }
+        if (header.format == INPUT_FORMAT_RGB888) {
+            return cv::Mat(e.height, e.width, CV_8UC3, payload(i));
+        }
+        cv::cvtColor(cv::Mat(e.height, e.width, CV_8UC4, payload(i)), storage, cv::COLOR_BGRA2BGR);
+        return storage;
+    }
+
+private:
+    size_t expected_bytes(const DatasetEntry& entry) const {
+        size_t pixels = (size_t)entry.height * entry.width;
+        return header.kind == DATASET_KIND_EDGES ? pixels : pixels * input_bytes_per_pixel(header.format);
+    }
+
+    void release() {
+        if (base) ::munmap(base, mapped_bytes);
+        base = nullptr;
+    }
+
+    DatasetHeader header;
+    unsigned char* base = nullptr;
+    size_t mapped_bytes = 0;
+    const DatasetEntry* index = nullptr;
+};
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef EDGE_MASK_H
+#define EDGE_MASK_H
+
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include "image_formats.h"
+
+///@brief: Host side encode and decode of the kernel output layouts. pack_edge_output writes the bytes
+/// write_and_pack writes for an 8-bit edge plane, the decoders turn BIT1 / RLE buffers back into 0 / 255 rows.
+
+inline uint32_t rle_table_entry(const unsigned char* buffer, int row) {
+    uint32_t entry;
+    std::memcpy(&entry, buffer + (size_t)row * 4, 4);
+    return entry;
+}
+
+///@brief: Bytes of the buffer the kernel actually filled. Whole output for the pixel formats and BIT1, the row
+/// table plus the written runs for RLE, so the row table has to be on the host already
+inline size_t edge_output_used_bytes(const unsigned char* buffer, int out_height, int out_width, int output_format) {
+    if (output_format != OUTPUT_FORMAT_RLE) {
+        return output_buffer_bytes(output_format, out_height * out_width);
+    }
+    long long runs = out_height > 0 ? rle_table_entry(buffer, out_height - 1) : 0;
+    return rle_table_bytes(out_height) + rle_run_bytes(runs);
+}
+
+///@brief: Writes an out_height x out_width edge plane in output_format, including the zeroed tail of the last burst.
+/// Mask formats set the pixels >= mask_threshold, MAG_ORIENT takes the orientation bins from the orientation plane
+inline void pack_edge_output(const unsigned char* edges, int out_height, int out_width, int output_format, int mask_threshold,
+                             unsigned char* out_img, const unsigned char* orientation = nullptr) {
+    int out_size = out_height * out_width;
+    if (output_format == OUTPUT_FORMAT_RLE) {
+        std::memset(out_img, 0, rle_table_bytes(out_height));
+        unsigned char* runs = out_img + rle_table_bytes(out_height);
+        uint32_t run_total = 0;
+        auto put_run = [&](int length) {
+            uint16_t value = length;
+            std::memcpy(runs + (size_t)run_total * 2, &value, 2);
+            run_total++;
+        };
+        for (int y = 0; y < out_height; y++) {
+            const unsigned char* row = edges + (size_t)y * out_width;
+            bool run_edge = false;
+            int run_length = 0;
+            for (int x = 0; x < out_width; x++) {
+                bool edge = row[x] >= mask_threshold;
+                if (edge != run_edge) {
+                    put_run(run_length);
+                    run_edge = edge;
+                    run_length = 0;
+                }
+                run_length++;
+            }
+            put_run(run_length);
+            std::memcpy(out_img + (size_t)y * 4, &run_total, 4);
+        }
+        std::memset(runs + (size_t)run_total * 2, 0, rle_run_bytes(run_total) - (size_t)run_total * 2);
+        return;
+    }
+
+    std::memset(out_img, 0, output_buffer_bytes(output_format, out_size));
+    for (int i = 0; i < out_size; i++) {
+        if (output_format == OUTPUT_FORMAT_BIT1) {
+            if (edges[i] >= mask_threshold) out_img[i / 8] |= 1 << (i % 8);
+        } else if (output_format == OUTPUT_FORMAT_GRAY8) {
+            out_img[i] = edges[i];
+        } else if (output_format == OUTPUT_FORMAT_MAG_ORIENT) {
+            out_img[i * 2] = edges[i];
+            out_img[i * 2 + 1] = orientation ? orientation[i] : 0;
+        } else {
+            out_img[i * 4] = edges[i];
+            out_img[i * 4 + 1] = edges[i];
+            out_img[i * 4 + 2] = edges[i];
+        }
+    }
+}
+
+///@brief: pack_edge_output with the rows spaced out_stride bytes apart, each row packed on its own and ending
+/// in its zero padded burst. The bytes between rows are left alone. 0 or RLE packs densely
+inline void pack_edge_rows(const unsigned char* edges, int out_height, int out_width, int output_format, int mask_threshold,
+                           int out_stride, unsigned char* out_img, const unsigned char* orientation = nullptr) {
+    if (out_stride == 0 || output_format == OUTPUT_FORMAT_RLE) {
+        pack_edge_output(edges, out_height, out_width, output_format, mask_threshold, out_img, orientation);
+        return;
+    }
+    for (int r = 0; r < out_height; r++) {
+        size_t first = (size_t)r * out_width;
+        pack_edge_output(edges + first, 1, out_width, output_format, mask_threshold, out_img + (size_t)r * out_stride,
+                         orientation ? orientation + first : nullptr);
+    }
+}
+
+///@brief: Row `row` of a BIT1 or RLE output as 0 / 255 bytes. RLE rows are found through the row table, so any
+/// row decodes on its own
+inline void unpack_mask_row(const unsigned char* buffer, int out_height, int out_width, int output_format, int row, unsigned char* dst) {
+    if (output_format == OUTPUT_FORMAT_BIT1) {
+        size_t first = (size_t)row * out_width;
+        for (int x = 0; x < out_width; x++) {
+            size_t i = first + x;
+            dst[x] = ((buffer[i / 8] >> (i % 8)) & 1) ? 255 : 0;
+        }
+        return;
+    }
+    const unsigned char* runs = buffer + rle_table_bytes(out_height);
+    uint32_t first = row > 0 ? rle_table_entry(buffer, row - 1) : 0;
+    uint32_t end = rle_table_entry(buffer, row);
+    int x = 0;
+    unsigned char value = 0;
+    for (uint32_t k = first; k < end && x < out_width; k++) {
+        uint16_t length;
+        std::memcpy(&length, runs + (size_t)k * 2, 2);
+        int stop = std::min(out_width, x + (int)length);
+        std::memset(dst + x, value, stop - x);
+        x = stop;
+        value ^= 255;
+    }
+    std::memset(dst + x, 0, out_width - x);
+}
+
+#endif
@@ -0,0 +1,158 @@
+#ifndef EDGE_OPERATORS_H
+#define EDGE_OPERATORS_H
+
+#include <string>
+
+///@brief: Gradient operators of the edge kernel. Every operator is separable, Gx(r, c) = smooth(r) * derivative(c)
+/// and Gy(r, c) = -derivative(r) * smooth(c), so Gy is positive when the rows above are brighter. The taps are
+/// constexpr, the fully unrolled convolution multiplies by literals and synthesizes to shift-adds.
+/// MAG_SHIFT scales the magnitude so a step edge gives about the response of the 3x3 sobel, GRAD_SHIFT brings
+/// the signed Gx / Gy of the gradient planes into int16 for a full 0..255 step.
+
+#define EDGE_OPERATOR_SOBEL3 0
+#define EDGE_OPERATOR_SOBEL5 1
+#define EDGE_OPERATOR_SOBEL7 2
+#define EDGE_OPERATOR_SCHARR 3
+#define EDGE_OPERATOR_PREWITT 4
+
+///@brief: Magnitude of (Gx, Gy) before MAG_SHIFT
+#define EDGE_MAGNITUDE_L1 0     /// |Gx| + |Gy|
+#define EDGE_MAGNITUDE_L2 1     /// max + 3/8 min, within 7% of sqrt(Gx^2 + Gy^2)
+
+struct Sobel3Operator {
+    static const int ID = EDGE_OPERATOR_SOBEL3;
+    static const int SIZE = 3;
+    static const int MAG_SHIFT = 1;
+    static const int GRAD_SHIFT = 0;
+    static constexpr int smooth(int i) { return (i == 1) ? 2 : 1; }
+    static constexpr int derivative(int i) { return i - 1; }
+};
+
+struct Sobel5Operator {
+    static const int ID = EDGE_OPERATOR_SOBEL5;
+    static const int SIZE = 5;
+    static const int MAG_SHIFT = 5;
+    static const int GRAD_SHIFT = 0;
+    static constexpr int smooth(int i) { return (i == 2) ? 6 : (i == 1 || i == 3) ? 4 : 1; }
+    static constexpr int derivative(int i) { return (i == 0) ? -1 : (i == 1) ? -2 : (i == 2) ? 0 : (i == 3) ? 2 : 1; }
+};
+
+struct Sobel7Operator {
+    static const int ID = EDGE_OPERATOR_SOBEL7;
+    static const int SIZE = 7;
+    static const int MAG_SHIFT = 8;
+    static const int GRAD_SHIFT = 4;
+    static constexpr int smooth(int i) { return (i == 3) ? 20 : (i == 2 || i == 4) ? 15 : (i == 1 || i == 5) ? 6 : 1; }
+    static constexpr int derivative(int i) {
+        return (i == 0) ? -1 : (i == 1) ? -4 : (i == 2) ? -5 : (i == 3) ? 0 : (i == 4) ? 5 : (i == 5) ? 4 : 1;
+    }
+};
+
+struct ScharrOperator {
+    static const int ID = EDGE_OPERATOR_SCHARR;
+    static const int SIZE = 3;
+    static const int MAG_SHIFT = 3;
+    static const int GRAD_SHIFT = 0;
+    static constexpr int smooth(int i) { return (i == 1) ? 10 : 3; }
+    static constexpr int derivative(int i) { return i - 1; }
+};
+
+struct PrewittOperator {
+    static const int ID = EDGE_OPERATOR_PREWITT;
+    static const int SIZE = 3;
+    static const int MAG_SHIFT = 1;
+    static const int GRAD_SHIFT = 0;
+    static constexpr int smooth(int) { return 1; }
+    static constexpr int derivative(int i) { return i - 1; }
+};
+
+///@brief: Run time view of the same taps for the host side models
+struct EdgeOperatorTaps {
+    int size = 3;
+    int mag_shift = 1;
+    int grad_shift = 0;
+    int smooth[7] = {0};
+    int derivative[7] = {0};
+};
+
+template <class OP>
+EdgeOperatorTaps operator_taps() {
+    EdgeOperatorTaps taps;
+    taps.size = OP::SIZE;
+    taps.mag_shift = OP::MAG_SHIFT;
+    taps.grad_shift = OP::GRAD_SHIFT;
+    for (int i = 0; i < OP::SIZE; i++) {
+        taps.smooth[i] = OP::smooth(i);
+        taps.derivative[i] = OP::derivative(i);
+    }
+    return taps;
+}
+
+inline EdgeOperatorTaps edge_operator_taps(int edge_operator) {
+    switch (edge_operator) {
+        case EDGE_OPERATOR_SOBEL5: return operator_taps<Sobel5Operator>();
+        case EDGE_OPERATOR_SOBEL7: return operator_taps<Sobel7Operator>();
+        case EDGE_OPERATOR_SCHARR: return operator_taps<ScharrOperator>();
+        case EDGE_OPERATOR_PREWITT: return operator_taps<PrewittOperator>();
+        default: return operator_taps<Sobel3Operator>();
+    }
+}
+
+inline int edge_operator_radius(int edge_operator) {
+    return (edge_operator == EDGE_OPERATOR_SOBEL7) ? 3 : (edge_operator == EDGE_OPERATOR_SOBEL5) ? 2 : 1;
+}
+
+///@brief: Unsigned orientation bins of 20 degrees over [0, 180), the HOG layout
+#define ORIENTATION_BINS 9
+
+///@brief: Bin of the gradient angle atan2(gy, gx) folded into [0, 180), bin b covers [20b, 20b + 20) degrees
+/// with 0 along +x and 90 towards the brighter row above. No atan: |gy| << 10 is compared against |gx| times
+/// tan(20), tan(40), tan(60) and tan(80) in Q10, which fits 32 bits for every operator. A gradient with gy = 0,
+/// including a zero gradient, is bin 0. Shared by the kernel and the host models
+inline int orientation_bin(int gx, int gy) {
+    int ax = gx < 0 ? -gx : gx;
+    int ay = gy < 0 ? -gy : gy;
+    if (ay == 0) return 0;
+    int scaled = ay << 10;
+    int steps = (scaled >= ax * 373) + (scaled >= ax * 859) + (scaled >= ax * 1774) + (scaled >= ax * 5807);
+    /// Opposite signs lie in (90, 180) after folding, counted back from 180
+    return ((gx < 0) != (gy < 0)) ? (ORIENTATION_BINS - 1) - steps : steps;
+}
+
+///@brief: Kernel specialization picked by name on the host, the operator and magnitude are compiled in
+struct EdgeKernel {
+    int edge_operator = EDGE_OPERATOR_SOBEL3;
+    int magnitude = EDGE_MAGNITUDE_L1;
+};
+
+///@brief: Command line names, -1 for an unknown name
+inline int parse_edge_operator(const std::string& name) {
+    return (name == "sobel3") ? EDGE_OPERATOR_SOBEL3 : (name == "sobel5") ? EDGE_OPERATOR_SOBEL5 :
+           (name == "sobel7") ? EDGE_OPERATOR_SOBEL7 : (name == "scharr") ? EDGE_OPERATOR_SCHARR :
+           (name == "prewitt") ? EDGE_OPERATOR_PREWITT : -1;
+}
+
+inline int parse_edge_magnitude(const std::string& name) {
+    return (name == "l1") ? EDGE_MAGNITUDE_L1 : (name == "l2") ? EDGE_MAGNITUDE_L2 : -1;
+}
+
+inline const char* edge_operator_name(int edge_operator) {
+    return (edge_operator == EDGE_OPERATOR_SOBEL5) ? "sobel5" : (edge_operator == EDGE_OPERATOR_SOBEL7) ? "sobel7" :
+           (edge_operator == EDGE_OPERATOR_SCHARR) ? "scharr" : (edge_operator == EDGE_OPERATOR_PREWITT) ? "prewitt" : "sobel3";
+}
+
+///@brief: image_process / image_process_batch for the default 3x3 sobel with L1 magnitude,
+/// otherwise <base>_<operator>[_l2], matching the kernels defined in kernel_v3.cpp
+inline std::string edge_kernel_name(const EdgeKernel& edge_kernel, bool batch) {
+    std::string name = batch ? "image_process_batch" : "image_process";
+    if (edge_kernel.edge_operator == EDGE_OPERATOR_SOBEL3 && edge_kernel.magnitude == EDGE_MAGNITUDE_L1) {
+        return name;
+    }
+    name += std::string("_") + edge_operator_name(edge_kernel.edge_operator);
+    if (edge_kernel.magnitude == EDGE_MAGNITUDE_L2) {
+        name += "_l2";
+    }
+    return name;
+}
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef FRAME_REGIONS_H
+#define FRAME_REGIONS_H
+
+#include <vector>
+#include <string>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+
+#include <opencv2/opencv.hpp>
+
+#include "image_formats.h"
+#include "accel_device.h"
+#include "batch_pipeline.h"
+
+struct FrameRegionsConfig {
+    int input_format = INPUT_FORMAT_RGB888;
+    int output_format = OUTPUT_FORMAT_GRAY8;
+    EdgeStages stages;
+    int slot = 0;                   /// device slot holding the frame and the region outputs
+};
+
+struct RegionReport {
+    std::vector<cv::Mat> edges;     /// (h - 2) x (w - 2) per region in region order, valid until the next run() or upload()
+    PerformanceMetrics metrics;     /// the whole call, nothing is uploaded so h2d stays 0
+    int runs = 0;
+};
+
+///@brief: Keeps one frame in device memory and runs the edge kernel over regions of it (detections, tiles).
+/// upload() copies the frame into the device input buffer once, RGB888 / LUMA8 rows at the cv::Mat's own step
+/// so a cropped or padded cv::Mat goes up as one block. run() moves no input: each region is a descriptor with
+/// its origin and the frame stride and the kernel reads the region rows straight out of the frame. With
+/// image_process_batch the regions of a call share one run as far as their outputs fit the output buffer,
+/// otherwise they run one at a time.
+class FrameRegions {
+public:
+    FrameRegions(AccelDevice& accel_device, const FrameRegionsConfig& regions_config)
+        : device(accel_device), config(regions_config) {}
+
+    ///@brief: Places frame in device memory, returns the bytes copied into the mapped input buffer
+    size_t upload(const cv::Mat& frame) {
+        int bytes_per_pixel = input_bytes_per_pixel(config.input_format);
+        frame_height = frame.rows;
+        frame_width = frame.cols;
+        /// RGB32 has no cv::Mat layout to keep and is packed densely
+        in_stride = (config.input_format == INPUT_FORMAT_RGB32) ? frame.cols * 4 : (int)frame.step;
+        size_t frame_bytes = (size_t)(frame.rows - 1) * in_stride + (size_t)frame.cols * bytes_per_pixel;
+        size_t in_bytes = ((frame_bytes + BURST_BYTES - 1) / BURST_BYTES) * BURST_BYTES;
+        size_t out_bytes = output_buffer_bytes(config.output_format, frame.rows - 2, frame.cols - 2);
+        if (in_bytes > in_capacity || out_bytes > out_capacity) {
+            in_capacity = std::max(in_bytes, in_capacity);
+            out_capacity = std::max(out_bytes, out_capacity);
+            device.allocate(config.slot, in_capacity, out_capacity);
+        }
+
+        size_t copied = 0;
+        unsigned char* dst = device.input_map(config.slot);
+        if (config.input_format == INPUT_FORMAT_RGB32) {
+            copied = pack_input_image(frame, INPUT_FORMAT_RGB32, dst);
+        } else {
+            std::memcpy(dst, frame.data, frame_bytes);
+            copied = frame_bytes;
+        }
+        device.sync_input(config.slot, in_bytes);
+        return copied;
+    }
+
+    ///@brief: Edge maps of the regions, each at least 3x3, at most KERNEL_MAX_WIDTH wide and inside the uploaded frame
+    RegionReport run(const std::vector<cv::Rect>& regions) {
+        for (const cv::Rect& region : regions) {
+            if (region.width < 3 || region.height < 3 || region.width > KERNEL_MAX_WIDTH || region.x < 0 || region.y < 0 ||
+                region.x + region.width > frame_width || region.y + region.height > frame_height) {
+                throw std::runtime_error("region outside the uploaded frame");
+            }
+        }
+
+        RegionReport report;
+        storage.resize(regions.size());
+        size_t first = 0;
+        while (first < regions.size()) {
+            /// Regions of one run sit back to back in the output buffer, a region alone always fits
+            size_t end = first;
+            size_t out_bytes = 0;
+            std::vector<ImageDescriptor> descriptors;
+            std::vector<size_t> out_offsets;
+            int max_images = device.supports_batch() ? MAX_BATCH_IMAGES : 1;
+            while (end < regions.size() && (int)descriptors.size() < max_images) {
+                const cv::Rect& region = regions[end];
+                size_t bytes = output_buffer_bytes(config.output_format, region.height - 2, region.width - 2);
+                if (!descriptors.empty() && out_bytes + bytes > out_capacity) break;
+                ImageDescriptor descriptor = ImageDescriptor();
+                descriptor.out_offset = out_bytes / BURST_BYTES;
+                descriptor.height = region.height;
+                descriptor.width = region.width;
+                descriptor.roi_x = region.x;
+                descriptor.roi_y = region.y;
+                descriptor.in_stride = in_stride;
+                descriptors.push_back(descriptor);
+                out_offsets.push_back(out_bytes);
+                out_bytes += bytes;
+                end++;
+            }
+            bool last_run = end == regions.size() && first == 0;
+
+            auto kernel_start = std::chrono::high_resolution_clock::now();
+            if (descriptors.size() == 1) {
+                KernelArgs args;
+                args.height = descriptors[0].height;
+                args.width = descriptors[0].width;
+                args.input_format = config.input_format;
+                args.output_format = config.output_format;
+                args.stages = config.stages;
+                /// The regions' slot has no gradient buffer
+                args.stages.flags &= ~EDGE_STAGE_GRADIENTS;
+                args.roi.x = descriptors[0].roi_x;
+                args.roi.y = descriptors[0].roi_y;
+                args.roi.in_stride = in_stride;
+                device.start(config.slot, args);
+            } else {
+                device.start_batch(config.slot, descriptors, config.input_format, config.output_format, config.stages);
+            }
+            device.wait(config.slot);
+            auto kernel_stop = std::chrono::high_resolution_clock::now();
+            report.metrics.kernel_time_ms += elapsed_ms(kernel_start, kernel_stop);
+            report.runs++;
+
+            for (size_t k = 0; k < descriptors.size(); k++) {
+                const cv::Rect& region = regions[first + k];
+                int out_height = region.height - 2;
+                int out_width = region.width - 2;
+                unsigned char* buffer = device.output_map(config.slot) + out_offsets[k];
+                report.metrics.d2h_bytes += sync_edge_output(device, config.slot, buffer, out_offsets[k], out_height, out_width,
+                                                             config.output_format);
+                cv::Mat& region_storage = storage[first + k];
+                cv::Mat edges = output_image_view(buffer, out_height, out_width, config.output_format, region_storage,
+                                                  report.metrics.bytes_copied);
+                /// GRAY8 views the output buffer, which the next run of this call overwrites
+                if (!last_run && edges.data != region_storage.data) {
+                    edges.copyTo(region_storage);
+                    report.metrics.bytes_copied += (size_t)out_height * out_width;
+                    edges = region_storage;
+                }
+                report.edges.push_back(edges);
+                report.metrics.pixels_processed += region.height * region.width;
+            }
+            report.metrics.d2h_time_ms += elapsed_ms(kernel_stop, std::chrono::high_resolution_clock::now());
+            first = end;
+        }
+        report.metrics.total_time_ms = report.metrics.kernel_time_ms + report.metrics.d2h_time_ms;
+        return report;
+    }
+
+private:
+    AccelDevice& device;
+    FrameRegionsConfig config;
+    int frame_height = 0;
+    int frame_width = 0;
+    int in_stride = 0;
+    size_t in_capacity = 0;
+    size_t out_capacity = 0;
+    std::vector<cv::Mat> storage;
+};
+
+#endif
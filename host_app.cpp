@@ -10,6 +10,10 @@
 #include <filesystem> 
 #include <iomanip>    
 #include <cmath>    
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unistd.h>
 
 ///@brief: XRT ultitiy includes
 #include <xrt/xrt_kernel.h>
@@ -20,6 +24,19 @@
 #include <opencv2/opencv.hpp>
 #include <opencv2/imgcodecs.hpp>
 
+#include "image_formats.h"
+#include "accel_device.h"
+#include "batch_pipeline.h"
+#include "buffer_pool.h"
+#include "tiling.h"
+#include "cu_scheduler.h"
+#include "video_stream.h"
+#include "dataset.h"
+#include "codec_pool.h"
+#include "cost_router.h"
+#include "shard_manifest.h"
+#include "trace.h"
+
 namespace fs = std::filesystem;
 typedef uint32_t Pixel;
 
@@ -28,37 +45,645 @@ typedef uint32_t Pixel;
 #define IMG_WIDTH 1920  
 #define TOTAL_PIXELS (IMG_HEIGHT * IMG_WIDTH)
 
-void save_output_image(const std::vector<unsigned int>& buffer, int out_height, int out_width, const std::string& output_path) {
-    
-    cv::Mat output_image(out_height, out_width, CV_8UC1); 
-    int out_size = out_height * out_width;
+struct HostOptions {
+    int input_format = INPUT_FORMAT_RGB888;
+    int output_format = OUTPUT_FORMAT_GRAY8;
+    int queue_depth = 4;
+    int tile_height = 1024;
+    int images_per_run = 1;
+    int compute_units = 0;          /// 0 = every image_process CU in the xclbin, sw device: 0 = 1
+    EdgeStages stages;
+    EdgeKernel edge_kernel;         /// operator and magnitude, picks the kernel specialization by name
+    std::string device = "xrt";
+    bool stream = false;            /// INPUT_DIR / OUTPUT_DIR are then a frame stream and the edge frame sink
+    int frame_width = 0;            /// raw stream frame size, Y4M streams carry their own
+    int frame_height = 0;
+    double fps = 0.0;               /// stream replay rate and latency budget, 0 = as fast as frames come
+    bool drop_frames = true;
+    bool input_dataset = false;     /// INPUT_DIR is a make_dataset container, mapped and DMAd without decoding
+    bool output_dataset = false;    /// OUTPUT_DIR is an edge container written instead of one image file per input
+    bool band_split = false;        /// oversized images run as row bands on all CUs at once instead of tiled on one
+    int route = ROUTE_MODE_ACCEL;   /// ROUTE_MODE_*, auto sends each image to the CPU engine when the cost model says it is faster there
+    int decode_workers = 0;         /// 0 = the pipeline thread decodes and packs each image before submitting it
+    int encode_workers = 0;         /// 0 = the pipeline thread writes each result as it retires
+    int codec_queue = 0;            /// images waiting in each codec queue, 0 = twice the workers
+    std::string trace_path;         /// non-empty records the stage spans and writes a Chrome trace there
+    ShardSpec shard;                /// --shard i/N, the images of the manifest this run takes
+    std::string manifest_path;      /// sorted image list, read if it exists, written from INPUT_DIR otherwise
+    std::string journal_path;       /// completed images, skipped on a rerun and appended to as images finish
+    std::string summary_path;       /// per shard counts and times for --merge-shards
+    int pyramid_levels = 1;         /// > 1 runs image_process_pyramid, the halved levels are written next to each edge map
+};
 
-    for (int i = 0; i < out_size; i++) {
-        unsigned char edge_pixel = buffer[i] & 0xFF; 
-        int r = i / out_width; 
-        int c = i % out_width;
-        output_image.at<unsigned char>(r, c) = edge_pixel;
+///@brief: Parses the optional flags that follow the positional arguments, returns false on a bad flag
+bool parse_host_options(int argc, char* argv[], int first, HostOptions& options) {
+    for (int i = first; i < argc; i++) {
+        std::string flag = argv[i];
+        if (flag == "--input-format" && i + 1 < argc) {
+            std::string value = argv[++i];
+            options.input_format = parse_input_format(value);
+            if (options.input_format < 0) {
+                std::cerr << "[ERROR] UNKNOWN INPUT FORMAT: " << value << std::endl;
+                return false;
+            }
+        } else if (flag == "--output-format" && i + 1 < argc) {
+            std::string value = argv[++i];
+            options.output_format = parse_output_format(value);
+            if (options.output_format < 0) {
+                std::cerr << "[ERROR] UNKNOWN OUTPUT FORMAT: " << value << std::endl;
+                return false;
+            }
+        } else if (flag == "--queue-depth" && i + 1 < argc) {
+            options.queue_depth = std::atoi(argv[++i]);
+            if (options.queue_depth < 1) {
+                std::cerr << "[ERROR] QUEUE DEPTH MUST BE AT LEAST 1" << std::endl;
+                return false;
+            }
+        } else if (flag == "--images-per-run" && i + 1 < argc) {
+            options.images_per_run = std::atoi(argv[++i]);
+            if (options.images_per_run < 1 || options.images_per_run > MAX_BATCH_IMAGES) {
+                std::cerr << "[ERROR] IMAGES PER RUN MUST BE BETWEEN 1 AND " << MAX_BATCH_IMAGES << std::endl;
+                return false;
+            }
+        } else if (flag == "--tile-height" && i + 1 < argc) {
+            options.tile_height = std::atoi(argv[++i]);
+            if (options.tile_height < 1) {
+                std::cerr << "[ERROR] TILE HEIGHT MUST BE AT LEAST 1" << std::endl;
+                return false;
+            }
+        } else if (flag == "--stages" && i + 1 < argc) {
+            std::string value = argv[++i];
+            options.stages.flags = parse_edge_stages(value);
+            if (options.stages.flags < 0) {
+                std::cerr << "[ERROR] UNKNOWN STAGE IN: " << value << std::endl;
+                return false;
+            }
+        } else if (flag == "--operator" && i + 1 < argc) {
+            std::string value = argv[++i];
+            options.edge_kernel.edge_operator = parse_edge_operator(value);
+            if (options.edge_kernel.edge_operator < 0) {
+                std::cerr << "[ERROR] UNKNOWN OPERATOR: " << value << std::endl;
+                return false;
+            }
+        } else if (flag == "--magnitude" && i + 1 < argc) {
+            std::string value = argv[++i];
+            options.edge_kernel.magnitude = parse_edge_magnitude(value);
+            if (options.edge_kernel.magnitude < 0) {
+                std::cerr << "[ERROR] UNKNOWN MAGNITUDE: " << value << std::endl;
+                return false;
+            }
+        } else if (flag == "--mask-threshold" && i + 1 < argc) {
+            options.stages.mask_threshold = std::atoi(argv[++i]);
+            if (options.stages.mask_threshold < 1 || options.stages.mask_threshold > 255) {
+                std::cerr << "[ERROR] MASK THRESHOLD MUST BE BETWEEN 1 AND 255" << std::endl;
+                return false;
+            }
+        } else if (flag == "--low-threshold" && i + 1 < argc) {
+            options.stages.low_threshold = std::atoi(argv[++i]);
+        } else if (flag == "--high-threshold" && i + 1 < argc) {
+            options.stages.high_threshold = std::atoi(argv[++i]);
+        } else if (flag == "--compute-units" && i + 1 < argc) {
+            options.compute_units = std::atoi(argv[++i]);
+            if (options.compute_units < 0) {
+                std::cerr << "[ERROR] COMPUTE UNITS MUST BE 0 (ALL) OR MORE" << std::endl;
+                return false;
+            }
+        } else if (flag == "--device" && i + 1 < argc) {
+            options.device = argv[++i];
+            if (options.device != "xrt" && options.device != "sw") {
+                std::cerr << "[ERROR] UNKNOWN DEVICE: " << options.device << std::endl;
+                return false;
+            }
+        } else if (flag == "--route" && i + 1 < argc) {
+            std::string value = argv[++i];
+            options.route = parse_route_mode(value);
+            if (options.route < 0) {
+                std::cerr << "[ERROR] UNKNOWN ROUTE: " << value << std::endl;
+                return false;
+            }
+        } else if (flag == "--stream") {
+            options.stream = true;
+        } else if (flag == "--frame-size" && i + 1 < argc) {
+            std::string value = argv[++i];
+            if (std::sscanf(value.c_str(), "%dx%d", &options.frame_width, &options.frame_height) != 2 ||
+                options.frame_width < 3 || options.frame_height < 3 || options.frame_width > KERNEL_MAX_WIDTH) {
+                std::cerr << "[ERROR] FRAME SIZE MUST BE WxH, AT LEAST 3x3 AND AT MOST " << KERNEL_MAX_WIDTH << " WIDE: " << value << std::endl;
+                return false;
+            }
+        } else if (flag == "--fps" && i + 1 < argc) {
+            options.fps = std::atof(argv[++i]);
+            if (options.fps < 0.0) {
+                std::cerr << "[ERROR] FPS MUST BE 0 OR MORE" << std::endl;
+                return false;
+            }
+        } else if (flag == "--no-drop") {
+            options.drop_frames = false;
+        } else if (flag == "--input-dataset") {
+            options.input_dataset = true;
+        } else if (flag == "--output-dataset") {
+            options.output_dataset = true;
+        } else if (flag == "--band-split") {
+            options.band_split = true;
+        } else if ((flag == "--decode-workers" || flag == "--encode-workers" || flag == "--codec-queue") && i + 1 < argc) {
+            int value = std::atoi(argv[++i]);
+            (flag == "--decode-workers" ? options.decode_workers : flag == "--encode-workers" ? options.encode_workers : options.codec_queue) = value;
+            if (value < 0) {
+                std::cerr << "[ERROR] " << flag << " MUST BE 0 OR MORE" << std::endl;
+                return false;
+            }
+        } else if (flag == "--trace" && i + 1 < argc) {
+            options.trace_path = argv[++i];
+        } else if (flag == "--shard" && i + 1 < argc) {
+            std::string value = argv[++i];
+            if (!parse_shard(value, options.shard)) {
+                std::cerr << "[ERROR] SHARD MUST BE i/N WITH 0 <= i < N: " << value << std::endl;
+                return false;
+            }
+        } else if (flag == "--manifest" && i + 1 < argc) {
+            options.manifest_path = argv[++i];
+        } else if (flag == "--journal" && i + 1 < argc) {
+            options.journal_path = argv[++i];
+        } else if (flag == "--shard-summary" && i + 1 < argc) {
+            options.summary_path = argv[++i];
+        } else if (flag == "--pyramid" && i + 1 < argc) {
+            options.pyramid_levels = std::atoi(argv[++i]);
+            if (options.pyramid_levels < 1 || options.pyramid_levels > PYRAMID_MAX_LEVELS) {
+                std::cerr << "[ERROR] PYRAMID LEVELS MUST BE BETWEEN 1 AND " << PYRAMID_MAX_LEVELS << std::endl;
+                return false;
+            }
+        } else {
+            std::cerr << "[ERROR] UNKNOWN OPTION: " << flag << std::endl;
+            return false;
+        }
+    }
+    if (options.stages.low_threshold < 0 || options.stages.low_threshold > options.stages.high_threshold || options.stages.high_threshold > 255) {
+        std::cerr << "[ERROR] THRESHOLDS MUST SATISFY 0 <= LOW <= HIGH <= 255" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+///@brief: LUMA8 lets the decoder produce the gray plane directly
+cv::Mat load_input_image(const std::string& input_path, const HostOptions& options) {
+    TRACE_SPAN("decode");
+    int imread_flags = (options.input_format == INPUT_FORMAT_LUMA8) ? cv::IMREAD_GRAYSCALE : cv::IMREAD_COLOR;
+    cv::Mat image = cv::imread(input_path, imread_flags);
+    if (image.empty()) {
+        std::cerr << "[ERROR] COULD NOT LOAD IMAGE: " << input_path << std::endl; // LOG CAPITALIZED
+    }
+    return image;
+}
+
+///@brief: Writes an edge map, the encode stage of the trace. Returns false if the file was not written
+bool write_output_image(const std::string& output_path, const cv::Mat& edges) {
+    TRACE_SPAN("encode");
+    bool written = cv::imwrite(output_path, edges);
+    if (!written) {
+        std::cerr << "[ERROR] COULD NOT WRITE IMAGE: " << output_path << std::endl;
+    }
+    return written;
+}
+
+///@brief: Writes the edge map and, when the run produced them, the orientation bins as <name>_orient.png and the
+/// signed Gx / Gy planes as 16-bit <name>_gx.tiff / <name>_gy.tiff next to it. Returns false if any was not written
+bool write_output_planes(const std::string& output_path, const cv::Mat& edges, const cv::Mat& orientation,
+                         const cv::Mat& gradient_x, const cv::Mat& gradient_y) {
+    bool written = write_output_image(output_path, edges);
+    fs::path path(output_path);
+    std::string stem = (path.parent_path() / path.stem()).string();
+    if (!orientation.empty()) {
+        written = write_output_image(stem + "_orient.png", orientation) && written;
+    }
+    if (!gradient_x.empty()) {
+        written = write_output_image(stem + "_gx.tiff", gradient_x) && written;
+        written = write_output_image(stem + "_gy.tiff", gradient_y) && written;
     }
-    cv::imwrite(output_path, output_image);
+    return written;
 }
 
-struct PerformanceMetrics {
-    double h2d_time_ms = 0.0;
-    double kernel_time_ms = 0.0;
-    double d2h_time_ms = 0.0;
-    double total_time_ms = 0.0;
-    int pixels_processed = 0; 
+///@brief: Where the edge maps go: out_fpga_<name> image files in OUTPUT_DIR or, with --output-dataset, one edge
+/// container that keeps only the edge plane. Written from the CU threads. With --journal each image is journaled
+/// once its files are written
+struct EdgeOutput {
+    std::string output_dir;
+    std::unique_ptr<DatasetWriter> dataset;
+    std::unique_ptr<BatchJournal> journal;
+    std::mutex mutex;
+
+    void write(const std::string& name, const cv::Mat& edges, const cv::Mat& orientation = cv::Mat(),
+               const cv::Mat& gradient_x = cv::Mat(), const cv::Mat& gradient_y = cv::Mat()) {
+        bool written = true;
+        if (!dataset) {
+            written = write_output_planes(output_dir + "/out_fpga_" + name, edges, orientation, gradient_x, gradient_y);
+        } else {
+            TRACE_SPAN("encode");
+            std::lock_guard<std::mutex> lock(mutex);
+            dataset->append_edges(name, edges);
+        }
+        journal_written(name, written);
+    }
+
+    ///@brief: The edge maps of a pyramid run, level 0 as out_fpga_<name> and level l as out_fpga_<stem>_l<l><ext>
+    void write_levels(const std::string& name, const std::vector<cv::Mat>& levels) {
+        fs::path path(output_dir + "/out_fpga_" + name);
+        std::string stem = (path.parent_path() / path.stem()).string();
+        bool written = true;
+        for (size_t level = 0; level < levels.size(); level++) {
+            std::string level_path = (level == 0) ? path.string() : stem + "_l" + std::to_string(level) + path.extension().string();
+            written = write_output_image(level_path, levels[level]) && written;
+        }
+        journal_written(name, written);
+    }
+
+private:
+    void journal_written(const std::string& name, bool written) {
+        if (journal && written && !journal->record(name)) {
+            std::cerr << "[WARNING] COULD NOT JOURNAL " << name << ", IT IS REDONE ON THE NEXT RUN" << std::endl;
+        }
+    }
+};
+
+///@brief: The images of a batch run, files to decode or the entries of a mapped input dataset. With --shard or
+/// --journal only some of a dataset's entries are run: index i of the run is dataset entry entries[i]
+struct InputSet {
+    std::vector<fs::path> files;
+    std::unique_ptr<DatasetReader> dataset;
+    std::vector<size_t> entries;
+
+    size_t size() const { return dataset ? entries.size() : files.size(); }
+
+    ///@brief: The dataset image of run index `index`, unpacked into `storage` when needed
+    cv::Mat dataset_image(size_t index, cv::Mat& storage) const { return dataset->image(entries[index], storage); }
+};
+
+///@brief: Image `index` of the run: a decoded file, or a dataset payload that the pipeline DMAs in place
+void load_batch_input(const InputSet& inputs, size_t index, const HostOptions& options, BatchInput& input) {
+    if (inputs.dataset) {
+        size_t entry_index = inputs.entries[index];
+        const DatasetEntry& entry = inputs.dataset->entry(entry_index);
+        input.name = inputs.dataset->name(entry_index);
+        input.packed = inputs.dataset->payload(entry_index);
+        input.height = entry.height;
+        input.width = entry.width;
+    } else {
+        input.name = inputs.files[index].filename().string();
+        input.image = load_input_image(inputs.files[index].string(), options);
+    }
+}
+
+///@brief: Tiled path for images wider than the kernel or larger than one tile, its buffers are only allocated on first use
+struct TiledPath {
+    AccelDevice& device;
+    TileConfig config;
+    std::unique_ptr<TiledProcessor> processor;
+
+    TiledPath(AccelDevice& accel_device, const HostOptions& options) : device(accel_device) {
+        config.tile_height = options.tile_height;
+        config.queue_depth = options.queue_depth;
+        config.first_slot = options.queue_depth;    /// after the slots of the untiled path
+        config.input_format = options.input_format;
+        config.output_format = options.output_format;
+        config.stages = options.stages;
+        config.edge_operator = options.edge_kernel.edge_operator;
+    }
+
+    TiledProcessor& get() {
+        if (!processor) processor.reset(new TiledProcessor(device, config));
+        return *processor;
+    }
+};
+
+///@brief: The metrics of one tiled image are the sums over its tiles
+PerformanceMetrics tiled_image_metrics(const BatchReport& report, const cv::Mat& image) {
+    PerformanceMetrics metrics;
+    for (const PerformanceMetrics& tile : report.images) {
+        metrics.h2d_time_ms += tile.h2d_time_ms;
+        metrics.kernel_time_ms += tile.kernel_time_ms;
+        metrics.device_time_ms += tile.device_time_ms;
+        metrics.d2h_time_ms += tile.d2h_time_ms;
+        metrics.d2h_bytes += tile.d2h_bytes;
+        metrics.allocations += tile.allocations;
+        metrics.bytes_copied += tile.bytes_copied;
+    }
+    metrics.total_time_ms = report.wall_time_ms;
+    metrics.pixels_processed = image.rows * image.cols;
+    return metrics;
+}
+
+///@brief: Runs one image through the tiled path
+PerformanceMetrics process_image_tiled(TiledPath& tiled, const cv::Mat& image, EdgeOutput& output, const std::string& name) {
+    BatchReport report;
+    cv::Mat output_image = tiled.get().process(image, report);
+    output.write(name, output_image);
+    std::cout << "[INFO] TILED " << image.cols << "x" << image.rows << " IMAGE IN " << report.images.size() << " TILES" << std::endl;
+    return tiled_image_metrics(report, image);
+}
+
+///@brief: --band-split: one oversized image as row bands over every CU at once, for the latency of a single frame
+PerformanceMetrics process_image_band_split(BandSplitProcessor& splitter, const cv::Mat& image, EdgeOutput& output, const std::string& name) {
+    BatchReport report;
+    cv::Mat output_image = splitter.process(image, report);
+    output.write(name, output_image);
+    std::cout << "[INFO] BAND SPLIT " << image.cols << "x" << image.rows << " IMAGE OVER " << splitter.unit_count() << " CUs IN "
+              << report.images.size() << " TILES, " << report.wall_time_ms << " MS" << std::endl;
+    return tiled_image_metrics(report, image);
+}
+
+///@brief: True when a loaded batch input is too large for the batch slots
+bool input_needs_tiling(const BatchInput& input, const TileConfig& config) {
+    if (!input.packed && input.image.empty()) return false;
+    return input.packed ? needs_tiling(input.height, input.width, config) : needs_tiling(input.image.rows, input.image.cols, config);
+}
+
+///@brief: An input too large for the batch goes through the tiled path as soon as it is loaded and is emptied so the
+/// batch skips it. Returns true if it was tiled
+bool divert_to_tiled(const InputSet& inputs, size_t index, BatchInput& input, TiledPath& tiled, EdgeOutput& output, PerformanceMetrics& metrics) {
+    if (!input_needs_tiling(input, tiled.config)) {
+        return false;
+    }
+    cv::Mat storage;
+    cv::Mat image = input.packed ? inputs.dataset_image(index, storage) : input.image;
+    metrics = process_image_tiled(tiled, image, output, input.name);
+    input.image.release();
+    input.packed = nullptr;
+    return true;
+}
+
+///@brief: --decode-workers / --encode-workers. Decode workers load the images and pack them into page aligned
+/// buffers ahead of the pipelines, which then run on those buffers without a copy; encode workers write the
+/// results behind them. Every queue and the buffer set are bounded, so the images held in memory do not grow with
+/// the input directory. With 0 workers on a side the pipeline thread does that side itself, as before
+class HostCodecs {
+public:
+    HostCodecs(const InputSet& input_set, const HostOptions& host_options, const TileConfig& tile_config, EdgeOutput& edge_output, int pipelines)
+        : inputs(input_set), options(host_options), tiles(tile_config), output(edge_output),
+          queue_capacity(host_options.codec_queue > 0 ? host_options.codec_queue : 2 * std::max(1, std::max(host_options.decode_workers, host_options.encode_workers))),
+          buffers_by_tag(input_set.size(), nullptr)
+    {
+        if (options.decode_workers > 0 && !inputs.dataset) {
+            /// Enough for a full queue, one image per worker, every run the pipelines can hold and the CPU backend's queue
+            size_t buffer_count = queue_capacity + options.decode_workers + pipelines * (options.queue_depth + 1) * options.images_per_run;
+            if (options.route != ROUTE_MODE_ACCEL) buffer_count += options.queue_depth + 2;
+            buffers.reset(new PackedBufferPool(buffer_count, input_buffer_bytes(options.input_format, IMG_HEIGHT * IMG_WIDTH)));
+        }
+        if (options.decode_workers > 0) {
+            decoder.reset(new ProducerPool<DecodedInput>(options.decode_workers, queue_capacity, inputs.size(),
+                                                         [this](size_t index, DecodedInput& item) { return decode(index, item); }));
+        }
+        if (options.encode_workers > 0) {
+            encoder.reset(new ConsumerPool<EncodeJob>(options.encode_workers, queue_capacity, [this](EncodeJob& job) {
+                name_thread("encode", encoders_named);
+                output.write(job.name, job.edges, job.orientation, job.gradient_x, job.gradient_y);
+            }));
+        }
+    }
+
+    ~HostCodecs() {
+        /// Decode workers may be waiting for a buffer that will not come back
+        if (buffers) buffers->shutdown();
+        decoder.reset();
+    }
+
+    ///@brief: The next image for a pipeline, handed back under `tag`. `index` is its place in the InputSet.
+    /// Returns false once every image has been handed out
+    bool next(BatchInput& input, size_t& index, int tag) {
+        if (!decoder) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (next_index >= inputs.size()) return false;
+                index = next_index++;
+            }
+            load_batch_input(inputs, index, options, input);
+            input.tag = tag;
+            return true;
+        }
+        DecodedInput item;
+        if (!decoder->next(item)) return false;
+        input = item.input;
+        input.tag = tag;
+        index = item.index;
+        std::lock_guard<std::mutex> lock(mutex);
+        buffers_by_tag[tag] = item.buffer;
+        return true;
+    }
+
+    ///@brief: A retired image: its packed buffer goes back to the decoders and its result to the encoders
+    void write(const BatchOutput& result) {
+        release(result.tag);
+        if (!encoder) {
+            output.write(result.name, result.edges, result.orientation, result.gradient_x, result.gradient_y);
+            return;
+        }
+        /// The result Mats only live during the callback
+        EncodeJob job;
+        job.name = result.name;
+        job.edges = result.edges.clone();
+        if (!result.orientation.empty()) job.orientation = result.orientation.clone();
+        if (!result.gradient_x.empty()) {
+            job.gradient_x = result.gradient_x.clone();
+            job.gradient_y = result.gradient_y.clone();
+        }
+        encoder->submit(job);
+    }
+
+    ///@brief: For an image that left the batch (tiled), its buffer if it had one
+    void release(int tag) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (buffers && tag >= 0 && tag < (int)buffers_by_tag.size() && buffers_by_tag[tag]) {
+            buffers->release(buffers_by_tag[tag]);
+            buffers_by_tag[tag] = nullptr;
+        }
+    }
+
+    ///@brief: Waits for the queued results to be written
+    void finish() {
+        if (encoder) encoder->finish();
+    }
+
+    void print_report() {
+        if (!decoder && !encoder) return;
+        std::cout << "--- CODEC WORKERS ---" << std::endl;
+        if (decoder) {
+            print_queue("DECODE", decoder->worker_count(), decoder->stats(), "THE PIPELINES WAITED ON DECODE");
+        }
+        if (encoder) {
+            print_queue("ENCODE", encoder->worker_count(), encoder->stats(), "THE PIPELINES WAITED ON ENCODE");
+        }
+        std::cout << "=================================================" << std::endl;
+    }
+
+private:
+    struct DecodedInput {
+        size_t index = 0;
+        BatchInput input;
+        unsigned char* buffer = nullptr;
+    };
+
+    struct EncodeJob {
+        std::string name;
+        cv::Mat edges;
+        cv::Mat orientation;
+        cv::Mat gradient_x;
+        cv::Mat gradient_y;
+    };
+
+    ///@brief: Decode worker: loads image `index` and packs it into a buffer, unless it goes to the tiled path
+    /// or is larger than a buffer, then the pipeline thread handles it as a decoded image
+    bool decode(size_t index, DecodedInput& item) {
+        name_thread("decode", decoders_named);
+        item.index = index;
+        load_batch_input(inputs, index, options, item.input);
+        if (item.input.packed) return true;
+        const cv::Mat& image = item.input.image;
+        if (image.empty()) return false;
+        if (needs_tiling(image.rows, image.cols, tiles) || input_buffer_bytes(options.input_format, image.rows * image.cols) > buffers->bytes()) {
+            return true;
+        }
+        item.buffer = buffers->acquire();
+        if (!item.buffer) return false;
+        {
+            TRACE_SPAN("pack", image.rows * image.cols);
+            pack_input_image(image, options.input_format, item.buffer);
+        }
+        item.input.packed = item.buffer;
+        item.input.height = image.rows;
+        item.input.width = image.cols;
+        item.input.image.release();
+        return true;
+    }
+
+    ///@brief: "decode 0", "decode 1", ... in the trace, once per worker thread
+    static void name_thread(const std::string& side, std::atomic<int>& named) {
+        thread_local bool done = false;
+        if (done) return;
+        done = true;
+        trace_thread_name(side + " " + std::to_string(named++));
+    }
+
+    void print_queue(const std::string& side, int workers, const QueueStats& stats, const std::string& starving) {
+        double run_ms = std::max(stats.lifetime_ms, 1e-3);
+        std::cout << std::left << std::setw(25) << side + " WORKERS:" << workers << ", QUEUE CAPACITY " << stats.capacity << ", " << stats.items << " IMAGES" << std::endl;
+        std::cout << std::left << std::setw(25) << side + " QUEUE MEAN/PEAK:" << stats.mean_occupancy << " / " << stats.peak << std::endl;
+        /// An empty decode queue or a full encode queue for a tenth of the run means that side holds the device back
+        double empty_share = stats.empty_ms / run_ms;
+        double full_share = stats.full_ms / run_ms;
+        std::cout << std::left << std::setw(25) << side + " QUEUE EMPTY:" << stats.empty_ms << " MS (" << 100.0 * empty_share << " %)"
+                  << (side == "DECODE" && empty_share > 0.1 ? ", " + starving : "") << std::endl;
+        std::cout << std::left << std::setw(25) << side + " QUEUE FULL:" << stats.full_ms << " MS (" << 100.0 * full_share << " %)"
+                  << (side == "ENCODE" && full_share > 0.1 ? ", " + starving : "") << std::endl;
+    }
+
+    const InputSet& inputs;
+    const HostOptions& options;
+    TileConfig tiles;
+    EdgeOutput& output;
+    size_t queue_capacity;
+    size_t next_index = 0;
+    std::atomic<int> decoders_named{0};
+    std::atomic<int> encoders_named{0};
+    std::mutex mutex;
+    std::vector<unsigned char*> buffers_by_tag;
+    std::unique_ptr<PackedBufferPool> buffers;
+    std::unique_ptr<ProducerPool<DecodedInput> > decoder;
+    std::unique_ptr<ConsumerPool<EncodeJob> > encoder;
+};
+
+///@brief: --route cpu|auto: the CostRouter in front of the accelerator and the CPU backend it sends images to.
+/// Images for the tiled path always stay on the accelerator. The CPU outputs go through the same HostCodecs
+/// as the accelerator's, from the CPU backend's thread
+class HostRouter {
+public:
+    HostRouter(const HostOptions& host_options, const TileConfig& tile_config, HostCodecs& host_codecs, int accel_lanes)
+        : options(host_options), tiles(tile_config), codecs(host_codecs)
+    {
+        if (options.route == ROUTE_MODE_ACCEL) return;
+        RouterConfig config;
+        config.mode = options.route;
+        config.input_format = options.input_format;
+        config.output_format = options.output_format;
+        config.accel_lanes = accel_lanes;
+        router.reset(new CostRouter(config));
+
+        PipelineConfig pipeline;
+        pipeline.input_format = options.input_format;
+        pipeline.output_format = options.output_format;
+        pipeline.max_height = IMG_HEIGHT;
+        pipeline.max_width = IMG_WIDTH;
+        pipeline.stages = options.stages;
+        cpu.reset(new CpuRouteBackend(pipeline, options.edge_kernel, options.queue_depth, [this](const BatchOutput& result) {
+            codecs.write(result);
+            router->complete(result.tag, result.metrics);
+        }));
+    }
+
+    bool enabled() const { return router != nullptr; }
+
+    ///@brief: Hands a loaded input to the CPU backend if the router picks the CPU for it. The input is emptied
+    /// then, so the batch skips it. Returns true if it went
+    bool divert_to_cpu(BatchInput& input) {
+        if (!router || input_needs_tiling(input, tiles) || (!input.packed && input.image.empty())) return false;
+        int height = input.packed ? input.height : input.image.rows;
+        int width = input.packed ? input.width : input.image.cols;
+        if (router->route(input.tag, height, width) != ROUTE_CPU) return false;
+        cpu->submit(input);
+        input.image.release();
+        input.packed = nullptr;
+        return true;
+    }
+
+    ///@brief: An image the accelerator finished, `tag` as it was routed
+    void accel_done(int tag, const PerformanceMetrics& metrics) {
+        if (router) router->complete(tag, metrics);
+    }
+
+    ///@brief: Waits for the CPU backend, returns the metrics of its images
+    std::vector<PerformanceMetrics> finish() {
+        if (!cpu) return std::vector<PerformanceMetrics>();
+        cpu->finish();
+        return cpu->batch_report().images;
+    }
+
+    void print_report() {
+        if (!router) return;
+        RouteStats stats = router->statistics();
+        CostModel model = router->model();
+        std::cout << "--- COST ROUTER ---" << std::endl;
+        for (int backend : { ROUTE_ACCEL, ROUTE_CPU }) {
+            std::string label = std::string(backend == ROUTE_CPU ? "CPU" : "FPGA") + " IMAGES:";
+            long long modelled = std::max(1LL, stats.modelled[backend]);
+            std::cout << std::left << std::setw(25) << label << stats.images[backend] << " (" << stats.pixels[backend] / 1e6 << " MPIX), MODEL ROUTED "
+                      << stats.modelled[backend] << ", PREDICTED " << stats.predicted_ms[backend] << " MS, OBSERVED " << stats.observed_ms[backend]
+                      << " MS, MEAN ERROR " << stats.abs_error_ms[backend] / modelled << " MS" << std::endl;
+        }
+        std::cout << std::left << std::setw(25) << "WARMUP / EXPLORED:" << stats.warmup << " / " << stats.explored << std::endl;
+        std::cout << std::left << std::setw(25) << "FPGA MODEL:" << "H2D " << model.h2d_ns_per_byte << " NS/B, KERNEL " << model.kernel_ns_per_pixel
+                  << " NS/PX, D2H " << model.d2h_ns_per_byte << " NS/B, FIXED " << model.accel_fixed_ms << " MS (" << model.accel_samples << " SAMPLES)" << std::endl;
+        std::cout << std::left << std::setw(25) << "CPU MODEL:" << model.cpu_mpps << " MPPS, FIXED " << model.cpu_fixed_ms << " MS ("
+                  << model.cpu_samples << " SAMPLES)" << std::endl;
+        int side = router->crossover_side();
+        std::cout << std::left << std::setw(25) << "CPU FASTER UP TO:" << (side > 0 ? std::to_string(side) + "x" + std::to_string(side) : "NONE")
+                  << " (IDLE BACKENDS)" << std::endl;
+        std::cout << "=================================================" << std::endl;
+    }
+
+private:
+    const HostOptions& options;
+    TileConfig tiles;
+    HostCodecs& codecs;
+    std::unique_ptr<CostRouter> router;
+    std::unique_ptr<CpuRouteBackend> cpu;
 };
 
 ///@breif: Function to handle image pixel transfer
-PerformanceMetrics process_image_fpga(xrt::kernel& kernel, xrt::device& device, const std::string& input_path, const std::string& output_path) {
-    
+PerformanceMetrics process_image_fpga(AccelDevice& device, BufferPool& pool, TiledPath& tiled, const cv::Mat& image, const std::string& name, EdgeOutput& output, const HostOptions& options) {
+
     PerformanceMetrics metrics;
-    cv::Mat image = cv::imread(input_path, cv::IMREAD_COLOR);
     if (image.empty()) {
-        std::cerr << "[ERROR] COULD NOT LOAD IMAGE: " << input_path << std::endl; // LOG CAPITALIZED
         return metrics;
     }
+    if (needs_tiling(image.rows, image.cols, tiled.config)) {
+        return process_image_tiled(tiled, image, output, name);
+    }
 
     int height = image.rows;
     int width = image.cols;
@@ -69,142 +694,775 @@ PerformanceMetrics process_image_fpga(xrt::kernel& kernel, xrt::device& device,
 
     int out_height = height - 2;
     int out_width = width - 2;
-    int out_size = out_height * out_width;
 
-    /// Prepare a vector of pixels
-    std::vector<unsigned int> input_vector(size);
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            cv::Vec3b pixel = image.at<cv::Vec3b>(i, j); 
-            input_vector[i * width + j] = (pixel[2] << 16) | (pixel[1] << 8) | pixel[0]; 
-        }
+    /// Device buffers come from the pool, only an image above the pool bounds allocates
+    size_t bo_size_bytes = input_buffer_bytes(options.input_format, size); 
+    size_t bo_out_size_bytes = output_buffer_bytes(options.output_format, out_height, out_width);
+    if (pool.reserve(0, bo_size_bytes, bo_out_size_bytes)) {
+        metrics.allocations++;
+    }
+    bool gradients = (options.stages.flags & EDGE_STAGE_GRADIENTS) != 0;
+    size_t grad_bytes = gradient_buffer_bytes(out_height, out_width);
+    if (gradients && pool.reserve_gradients(0, grad_bytes)) {
+        metrics.allocations++;
     }
     
-    /// XRT initialization
-    size_t bo_size_bytes = size * sizeof(unsigned int); 
-    
-    xrt::bo bo_in  = xrt::bo(device, bo_size_bytes, xrt::bo::flags::cacheable, kernel.group_id(0));
-    xrt::bo bo_out = xrt::bo(device, bo_size_bytes, xrt::bo::flags::cacheable, kernel.group_id(1));
-    
-    unsigned int* bo_in_map  = bo_in.map<unsigned int*>();
-    
-    /// Handle transfering pixel vectors and obtaining processed vectors back
+    /// Pack the image rows straight into the mapped input buffer and transfer
     auto h2d_start = std::chrono::high_resolution_clock::now(); 
-    std::copy(input_vector.begin(), input_vector.end(), bo_in_map);
-    bo_in.sync(XCL_BO_SYNC_BO_TO_DEVICE);
+    {
+        TRACE_SPAN("pack", bo_size_bytes);
+        metrics.bytes_copied += pack_input_image(image, options.input_format, pool.input(0));
+    }
+    {
+        TRACE_SPAN("h2d", bo_size_bytes);
+        device.sync_input(0, bo_size_bytes);
+    }
     auto h2d_stop = std::chrono::high_resolution_clock::now();
-    metrics.h2d_time_ms = std::chrono::duration_cast<std::chrono::microseconds>(h2d_stop - h2d_start).count() / 1000.0;
+    metrics.h2d_time_ms = elapsed_ms(h2d_start, h2d_stop);
+
+    KernelArgs args;
+    args.height = height;
+    args.width = width;
+    args.input_format = options.input_format;
+    args.output_format = options.output_format;
+    args.stages = options.stages;
 
     auto kernel_start = std::chrono::high_resolution_clock::now(); 
-    auto run = kernel(bo_in, bo_out, height, width);
-    run.wait(); 
+    {
+        TRACE_SPAN("kernel", 1);
+        device.start(0, args);
+        device.wait(0);
+    }
     auto kernel_stop = std::chrono::high_resolution_clock::now(); 
-    metrics.kernel_time_ms = std::chrono::duration_cast<std::chrono::microseconds>(kernel_stop - kernel_start).count() / 1000.0;
+    metrics.kernel_time_ms = elapsed_ms(kernel_start, kernel_stop);
+    metrics.device_time_ms = metrics.kernel_time_ms;
     
     auto d2h_start = std::chrono::high_resolution_clock::now(); 
-    bo_out.sync(XCL_BO_SYNC_BO_FROM_DEVICE); 
+    {
+        TRACE_SPAN("d2h");
+        metrics.d2h_bytes = sync_edge_output(device, 0, pool.output(0), 0, out_height, out_width, options.output_format);
+        if (gradients) {
+            device.sync_gradients(0, grad_bytes);
+            metrics.d2h_bytes += grad_bytes;
+        }
+    }
     auto d2h_stop = std::chrono::high_resolution_clock::now(); 
-    metrics.d2h_time_ms = std::chrono::duration_cast<std::chrono::microseconds>(d2h_stop - d2h_start).count() / 1000.0;
+    metrics.d2h_time_ms = elapsed_ms(d2h_start, d2h_stop);
 
     metrics.total_time_ms = metrics.h2d_time_ms + metrics.kernel_time_ms + metrics.d2h_time_ms;
     
-    unsigned int* bo_out_map = bo_out.map<unsigned int*>(); 
-    std::vector<unsigned int> output_vector(out_size); 
+    cv::Mat output_storage;
+    cv::Mat output_image;
+    cv::Mat orientation_storage;
+    cv::Mat orientation;
+    cv::Mat gradient_x;
+    cv::Mat gradient_y;
+    {
+        TRACE_SPAN("unpack");
+        output_image = output_image_view(pool.output(0), out_height, out_width, options.output_format, output_storage, metrics.bytes_copied);
+        if (options.output_format == OUTPUT_FORMAT_MAG_ORIENT) {
+            orientation = orientation_view(pool.output(0), out_height, out_width, orientation_storage, metrics.bytes_copied);
+        }
+        if (gradients) {
+            gradient_views(pool.gradients(0), out_height, out_width, gradient_x, gradient_y);
+        }
+    }
+    output.write(name, output_image, orientation, gradient_x, gradient_y);
+    return metrics;
+}
 
-    std::copy(bo_out_map, bo_out_map + out_size, output_vector.data());
-    
-    save_output_image(output_vector, out_height, out_width, output_path);    
+///@brief: One image_process_pyramid run: the image crosses to the card once and every level comes back as its own
+/// cv::Mat, read from its region of the output buffer. A small image gets the levels that still have a 3x3 window,
+/// images the kernel cannot take whole are skipped
+PerformanceMetrics process_image_pyramid(AccelDevice& device, BufferPool& pool, const cv::Mat& image, const std::string& name, EdgeOutput& output, const HostOptions& options) {
+
+    PerformanceMetrics metrics;
+    if (image.empty()) {
+        return metrics;
+    }
+    int height = image.rows;
+    int width = image.cols;
+    if (!pyramid_fits(height, width, 1) || width > KERNEL_MAX_WIDTH || (options.output_format == OUTPUT_FORMAT_RLE && height - 2 > RLE_MAX_ROWS)) {
+        std::cerr << "[WARNING] " << name << " (" << width << "x" << height << ") DOES NOT FIT A PYRAMID RUN, SKIPPED" << std::endl;
+        return metrics;
+    }
+    int levels = options.pyramid_levels;
+    while (!pyramid_fits(height, width, levels)) {
+        levels--;
+    }
+    if (levels < options.pyramid_levels) {
+        std::cout << "[WARNING] " << name << " (" << width << "x" << height << ") IS TOO SMALL FOR " << options.pyramid_levels
+                  << " PYRAMID LEVELS, WRITING " << levels << std::endl;
+    }
+    int size = height * width;
+    metrics.pixels_processed = size;
+
+    size_t bo_size_bytes = input_buffer_bytes(options.input_format, size);
+    size_t bo_out_size_bytes = pyramid_level_offset(options.output_format, height, width, levels);
+    if (pool.reserve(0, bo_size_bytes, bo_out_size_bytes)) {
+        metrics.allocations++;
+    }
+
+    auto h2d_start = std::chrono::high_resolution_clock::now();
+    {
+        TRACE_SPAN("pack", bo_size_bytes);
+        metrics.bytes_copied += pack_input_image(image, options.input_format, pool.input(0));
+    }
+    {
+        TRACE_SPAN("h2d", bo_size_bytes);
+        device.sync_input(0, bo_size_bytes);
+    }
+    auto h2d_stop = std::chrono::high_resolution_clock::now();
+    metrics.h2d_time_ms = elapsed_ms(h2d_start, h2d_stop);
+
+    KernelArgs args;
+    args.height = height;
+    args.width = width;
+    args.input_format = options.input_format;
+    args.output_format = options.output_format;
+    args.stages = options.stages;
+
+    auto kernel_start = std::chrono::high_resolution_clock::now();
+    {
+        TRACE_SPAN("kernel", 1);
+        device.start_pyramid(0, args, levels);
+        device.wait(0);
+    }
+    auto kernel_stop = std::chrono::high_resolution_clock::now();
+    metrics.kernel_time_ms = elapsed_ms(kernel_start, kernel_stop);
+    metrics.device_time_ms = metrics.kernel_time_ms;
+
+    auto d2h_start = std::chrono::high_resolution_clock::now();
+    {
+        TRACE_SPAN("d2h");
+        for (int level = 0; level < levels; level++) {
+            size_t offset = pyramid_level_offset(options.output_format, height, width, level);
+            metrics.d2h_bytes += sync_edge_output(device, 0, pool.output(0) + offset, offset, pyramid_level_height(height, level) - 2,
+                                                  pyramid_level_width(width, level) - 2, options.output_format);
+        }
+    }
+    auto d2h_stop = std::chrono::high_resolution_clock::now();
+    metrics.d2h_time_ms = elapsed_ms(d2h_start, d2h_stop);
+
+    metrics.total_time_ms = metrics.h2d_time_ms + metrics.kernel_time_ms + metrics.d2h_time_ms;
+
+    std::vector<cv::Mat> storage(levels);
+    std::vector<cv::Mat> edges(levels);
+    {
+        TRACE_SPAN("unpack");
+        for (int level = 0; level < levels; level++) {
+            size_t offset = pyramid_level_offset(options.output_format, height, width, level);
+            edges[level] = output_image_view(pool.output(0) + offset, pyramid_level_height(height, level) - 2, pyramid_level_width(width, level) - 2,
+                                             options.output_format, storage[level], metrics.bytes_copied);
+        }
+    }
+    output.write_levels(name, edges);
     return metrics;
 }
 
+///@brief: Prints the batch summary, batch_wall_time_ms > 0 adds the sustained throughput of a pipelined run
+void print_performance_summary(const std::vector<PerformanceMetrics>& images, double batch_wall_time_ms, int peak_in_flight, int setup_allocations) {
+    double total_h2d_time_ms = 0.0;
+    double total_kernel_time_ms = 0.0;
+    double total_d2h_time_ms = 0.0;
+    long long total_d2h_bytes = 0;
+    double total_end_to_end_time_ms = 0.0;
+    long long total_input_pixels = 0;
+    long long total_bytes_copied = 0;
+    int batch_allocations = 0;
+    int image_count = images.size();
+
+    for (const PerformanceMetrics& metrics : images) {
+        total_h2d_time_ms += metrics.h2d_time_ms;
+        total_kernel_time_ms += metrics.kernel_time_ms;
+        total_d2h_time_ms += metrics.d2h_time_ms;
+        total_d2h_bytes += metrics.d2h_bytes;
+        total_end_to_end_time_ms += metrics.total_time_ms;
+        total_input_pixels += metrics.pixels_processed;
+        total_bytes_copied += metrics.bytes_copied;
+        batch_allocations += metrics.allocations;
+    }
+
+    double avg_kernel_time_s = (total_kernel_time_ms / image_count) / 1000.0;
+    double avg_total_time_s = (total_end_to_end_time_ms / image_count) / 1000.0;
+
+    double avg_pixels_per_image = (double)total_input_pixels / image_count;
+    
+    double kernel_throughput_mpps = (avg_pixels_per_image / avg_kernel_time_s) / 1000000.0;
+    double end_to_end_throughput_mpps = (avg_pixels_per_image / avg_total_time_s) / 1000000.0;
+
+    std::cout << "=================================================" << std::endl;
+    std::cout << "          FPGA BATCH PERFORMANCE SUMMARY" << std::endl;
+    std::cout << "=================================================" << std::endl;
+    std::cout << "IMAGES PROCESSED: " << image_count << std::endl;
+    std::cout << "--- TOTAL TIMES ---" << std::endl;
+    std::cout << std::left << std::setw(25) << "TOTAL H2D DMA TIME:" << total_h2d_time_ms << " MS" << std::endl;
+    std::cout << std::left << std::setw(25) << "TOTAL KERNEL TIME:" << total_kernel_time_ms << " MS" << std::endl;
+    std::cout << std::left << std::setw(25) << "TOTAL D2H DMA TIME:" << total_d2h_time_ms << " MS" << std::endl;
+    std::cout << std::left << std::setw(25) << "TOTAL END-TO-END TIME:" << total_end_to_end_time_ms << " MS" << std::endl;
+    std::cout << "--- AVERAGE TIMES PER IMAGE ---" << std::endl;
+    std::cout << std::left << std::setw(25) << "AVG H2D DMA TIME:" << total_h2d_time_ms / image_count << " MS" << std::endl;
+    std::cout << std::left << std::setw(25) << "AVG KERNEL TIME:" << total_kernel_time_ms / image_count << " MS" << std::endl;
+    std::cout << std::left << std::setw(25) << "AVG D2H DMA TIME:" << total_d2h_time_ms / image_count << " MS" << std::endl;
+    std::cout << std::left << std::setw(25) << "AVG END-TO-END TIME:" << total_end_to_end_time_ms / image_count << " MS" << std::endl;
+    std::cout << "--- THROUGHPUT (MPPS) ---" << std::endl;
+    std::cout << std::left << std::setw(25) << "KERNEL THROUGHPUT:" << kernel_throughput_mpps << " MPPS" << std::endl;
+    std::cout << std::left << std::setw(25) << "END-TO-END THROUGHPUT:" << end_to_end_throughput_mpps << " MPPS" << std::endl;
+    std::cout << "--- HOST BUFFERS ---" << std::endl;
+    std::cout << std::left << std::setw(25) << "SETUP ALLOCATIONS:" << setup_allocations << std::endl;
+    std::cout << std::left << std::setw(25) << "BATCH ALLOCATIONS:" << batch_allocations << std::endl;
+    std::cout << std::left << std::setw(25) << "AVG BYTES COPIED:" << (double)total_bytes_copied / image_count << " B" << std::endl;
+    std::cout << std::left << std::setw(25) << "AVG D2H BYTES:" << (double)total_d2h_bytes / image_count << " B ("
+              << (total_d2h_bytes > 0 ? 8.0 * total_d2h_bytes / total_input_pixels : 0.0) << " BITS PER PIXEL)" << std::endl;
+    if (batch_wall_time_ms > 0.0) {
+        /// In a pipelined run the per-image kernel time includes time queued behind earlier runs
+        std::cout << "--- PIPELINED BATCH ---" << std::endl;
+        std::cout << std::left << std::setw(25) << "BATCH WALL TIME:" << batch_wall_time_ms << " MS" << std::endl;
+        std::cout << std::left << std::setw(25) << "PEAK RUNS IN FLIGHT:" << peak_in_flight << std::endl;
+        std::cout << std::left << std::setw(25) << "SUSTAINED THROUGHPUT:" << (total_input_pixels / (batch_wall_time_ms / 1000.0)) / 1000000.0 << " MPPS" << std::endl;
+    }
+    std::cout << "=================================================" << std::endl;
+}
+
+///@brief: Writes the --trace file and prints the per-span histograms, a no-op without --trace
+void write_trace_report(const HostOptions& options) {
+    if (options.trace_path.empty()) return;
+    std::ofstream trace_file(options.trace_path);
+    write_chrome_trace(trace_file);
+    if (!trace_file) {
+        std::cerr << "[ERROR] CANNOT WRITE TRACE FILE: " << options.trace_path << std::endl;
+        return;
+    }
+    std::cout << "[INFO] TRACE WRITTEN TO " << options.trace_path << " (OPEN IN chrome://tracing OR ui.perfetto.dev)" << std::endl;
+    write_trace_summary(std::cout);
+}
+
+///@brief: Streaming mode, frames from source_path ("-" = stdin) through a ring of device buffers to sink_path
+/// ("-" = stdout, "none" = discarded). Y4M in gives Y4M out, as does a sink named *.y4m. Returns the exit code
+int run_stream(AccelDevice& device, const std::string& source_path, const std::string& sink_path, const HostOptions& options) {
+    std::FILE* input = (source_path == "-") ? stdin : std::fopen(source_path.c_str(), "rb");
+    if (!input) {
+        std::cerr << "[ERROR] COULD NOT OPEN STREAM: " << source_path << std::endl;
+        return 1;
+    }
+    FrameSource source(input, options.frame_width, options.frame_height, options.input_format);
+
+    StreamConfig config;
+    config.input_format = source.input_format();
+    config.output_format = options.output_format;
+    config.stages = options.stages;
+    config.width = source.width();
+    config.height = source.height();
+    config.ring_depth = options.queue_depth;
+    config.pace_fps = options.fps;
+    /// A file read at full speed has no frame interval to fall behind, only a live or paced source drops
+    config.drop_when_full = options.drop_frames && (source_path == "-" || options.fps > 0.0);
+
+    std::FILE* output = (sink_path == "none") ? nullptr : (sink_path == "-") ? stdout : std::fopen(sink_path.c_str(), "wb");
+    if (sink_path != "none" && !output) {
+        std::cerr << "[ERROR] COULD NOT OPEN EDGE FRAME OUTPUT: " << sink_path << std::endl;
+        return 1;
+    }
+    bool y4m_output = source.is_y4m() || (sink_path.size() > 4 && sink_path.compare(sink_path.size() - 4, 4, ".y4m") == 0);
+    int rate_num = (options.fps > 0.0) ? (int)std::lround(options.fps * 1000.0) : source.rate_num();
+    int rate_den = (options.fps > 0.0) ? 1000 : source.rate_den();
+    EdgeFrameWriter writer(output, y4m_output, config.width - 2, config.height - 2, rate_num, rate_den);
+
+    VideoStream stream(device, config);
+    std::cout << "[INFO] STREAMING " << config.width << "x" << config.height << " " << (source.is_y4m() ? "y4m" : input_format_name(config.input_format))
+              << " FRAMES FROM " << source_path << ", RING DEPTH " << config.ring_depth << (config.drop_when_full ? ", DROPPING LATE FRAMES" : "") << std::endl;
+    StreamReport report = stream.run(source, [&](long long, const cv::Mat& edges) { writer.write(edges); });
+    if (input != stdin) std::fclose(input);
+    if (output && output != stdout) std::fclose(output);
+
+    std::cout << "=================================================" << std::endl;
+    std::cout << "          FPGA STREAM PERFORMANCE SUMMARY" << std::endl;
+    std::cout << "=================================================" << std::endl;
+    std::cout << std::left << std::setw(25) << "FRAMES READ:" << report.frames_read << std::endl;
+    std::cout << std::left << std::setw(25) << "FRAMES PROCESSED:" << report.frames_processed << std::endl;
+    std::cout << std::left << std::setw(25) << "FRAMES DROPPED:" << report.frames_dropped << std::endl;
+    std::cout << "--- LATENCY, FRAME READ TO EDGE FRAME WRITTEN ---" << std::endl;
+    std::cout << std::left << std::setw(25) << "P50 / P95 / P99:" << report.latency.percentile(50) << " / " << report.latency.percentile(95)
+              << " / " << report.latency.percentile(99) << " MS" << std::endl;
+    std::cout << std::left << std::setw(25) << "MAX:" << report.latency.percentile(100) << " MS" << std::endl;
+    if (report.frame_interval_ms > 0.0) {
+        std::cout << std::left << std::setw(25) << "FRAME INTERVAL:" << report.frame_interval_ms << " MS" << std::endl;
+        std::cout << std::left << std::setw(25) << "FRAMES OVER INTERVAL:" << report.late_frames << std::endl;
+    }
+    std::cout << "--- DEVICE ---" << std::endl;
+    std::cout << std::left << std::setw(25) << "AVG START TO DONE:" << report.device.mean() << " MS" << std::endl;
+    std::cout << std::left << std::setw(25) << "SETUP ALLOCATIONS:" << report.setup_allocations << std::endl;
+    std::cout << std::left << std::setw(25) << "AVG D2H BYTES:" << (report.frames_processed > 0 ? (double)report.d2h_bytes / report.frames_processed : 0.0)
+              << " B" << std::endl;
+    std::cout << std::left << std::setw(25) << "SUSTAINED RATE:" << report.sustained_fps() << " FPS ("
+              << report.sustained_fps() * config.width * config.height / 1000000.0 << " MPPS)" << std::endl;
+    std::cout << "=================================================" << std::endl;
+    return 0;
+}
+
+///@brief: The counts and times of this run. Without a journal every image of the run that retired counts as processed
+void finish_shard_summary(ShardSummary& summary, const std::vector<PerformanceMetrics>& images, const EdgeOutput& output, double wall_ms) {
+    summary.processed = output.journal ? output.journal->recorded_count() : (long long)images.size();
+    summary.failed = std::max(0LL, summary.assigned - summary.skipped - summary.processed);
+    summary.wall_ms = wall_ms;
+    for (const PerformanceMetrics& metrics : images) {
+        summary.pixels += metrics.pixels_processed;
+        summary.h2d_ms += metrics.h2d_time_ms;
+        summary.kernel_ms += metrics.kernel_time_ms;
+        summary.d2h_ms += metrics.d2h_time_ms;
+    }
+}
+
+void print_shard_summary(const ShardSummary& summary) {
+    std::cout << "--- SHARD " << summary.shard << "/" << summary.shards << " ---" << std::endl;
+    std::cout << std::left << std::setw(25) << "IMAGES IN SHARD:" << summary.assigned << " OF " << summary.manifest << std::endl;
+    std::cout << std::left << std::setw(25) << "SKIPPED (JOURNAL):" << summary.skipped << std::endl;
+    std::cout << std::left << std::setw(25) << "PROCESSED:" << summary.processed << std::endl;
+    std::cout << std::left << std::setw(25) << "FAILED:" << summary.failed << (summary.failed > 0 ? ", RETRIED ON THE NEXT RUN" : "") << std::endl;
+    std::cout << std::left << std::setw(25) << "SHARD WALL TIME:" << summary.wall_ms << " MS" << std::endl;
+    std::cout << std::left << std::setw(25) << "SHARD THROUGHPUT:" << summary.mpps() << " MPPS" << std::endl;
+    std::cout << "=================================================" << std::endl;
+}
+
+///@brief: --merge-shards: adds up the --shard-summary files of one batch and prints the per shard and total
+/// throughput. Returns 1 if a file is not a summary or the summaries are from different splits, 2 if the batch
+/// is not complete yet (a shard is missing or images are left)
+int merge_shards(const std::vector<std::string>& paths) {
+    std::vector<ShardSummary> summaries;
+    for (const std::string& path : paths) {
+        ShardSummary summary;
+        if (!read_shard_summary(path, summary)) {
+            std::cerr << "[ERROR] NOT A SHARD SUMMARY: " << path << std::endl;
+            return 1;
+        }
+        summaries.push_back(summary);
+    }
+    ShardMerge merge = merge_shard_summaries(summaries);
+    if (!merge.consistent) {
+        std::cerr << "[ERROR] THE SUMMARIES ARE FROM DIFFERENT SPLITS (SHARD COUNT OR MANIFEST SIZE DIFFER)" << std::endl;
+        return 1;
+    }
+
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "=================================================" << std::endl;
+    std::cout << "          SHARDED BATCH SUMMARY" << std::endl;
+    std::cout << "=================================================" << std::endl;
+    for (int s = 0; s < merge.shards; s++) {
+        std::string label = "SHARD " + std::to_string(s) + "/" + std::to_string(merge.shards) + ":";
+        if (merge.runs[s] == 0) {
+            std::cout << std::left << std::setw(25) << label << "MISSING" << std::endl;
+            continue;
+        }
+        const ShardSummary& shard = merge.per_shard[s];
+        std::cout << std::left << std::setw(25) << label << shard.host << ", " << merge.done[s] << " OF " << shard.assigned << " DONE, "
+                  << shard.processed << " IN " << merge.runs[s] << " RUN(S), " << shard.failed << " FAILED, " << shard.wall_ms << " MS, "
+                  << shard.mpps() << " MPPS" << std::endl;
+    }
+    std::cout << "--- TOTALS ---" << std::endl;
+    std::cout << std::left << std::setw(25) << "SHARDS REPORTED:" << merge.shards - merge.missing << " OF " << merge.shards << std::endl;
+    std::cout << std::left << std::setw(25) << "IMAGES DONE:" << merge.total_done << " OF " << merge.total.manifest << std::endl;
+    std::cout << std::left << std::setw(25) << "IMAGES MEASURED:" << merge.total.processed << " (" << merge.total.pixels / 1e6 << " MPIX)" << std::endl;
+    std::cout << std::left << std::setw(25) << "IMAGES FAILED:" << merge.total.failed << std::endl;
+    std::cout << std::left << std::setw(25) << "TOTAL KERNEL TIME:" << merge.total.kernel_ms << " MS" << std::endl;
+    std::cout << std::left << std::setw(25) << "SLOWEST SHARD WALL:" << merge.total.wall_ms << " MS" << std::endl;
+    std::cout << std::left << std::setw(25) << "AGGREGATE THROUGHPUT:" << merge.aggregate_mpps << " MPPS" << std::endl;
+    std::cout << std::left << std::setw(25) << "SUM OF SHARD MPPS:" << merge.sum_shard_mpps << " MPPS" << std::endl;
+    /// 1.0 is a perfect split, the aggregate falls short of the sum by this factor
+    std::cout << std::left << std::setw(25) << "LOAD IMBALANCE:" << merge.imbalance << " (SLOWEST / MEAN SHARD WALL)" << std::endl;
+    std::cout << std::left << std::setw(25) << "COMPLETE:" << (merge.complete() ? "YES" : "NO") << std::endl;
+    std::cout << "=================================================" << std::endl;
+    return merge.complete() ? 0 : 2;
+}
+
 int main(int argc, char* argv[]) {
-    if (argc != 4) {
-        std::cout << "USAGE: " << argv[0] << " <XCLBIN_PATH> <INPUT_DIR> <OUTPUT_DIR>" << std::endl;
+    if (argc >= 3 && std::string(argv[1]) == "--merge-shards") {
+        return merge_shards(std::vector<std::string>(argv + 2, argv + argc));
+    }
+    HostOptions options;
+    if (argc < 4 || !parse_host_options(argc, argv, 4, options)) {
+        std::cout << "USAGE: " << argv[0] << " <XCLBIN_PATH> <INPUT_DIR> <OUTPUT_DIR> [OPTIONS]" << std::endl;
+        std::cout << "       " << argv[0] << " --merge-shards SUMMARY...       ADD UP THE --shard-summary FILES OF A SHARDED BATCH" << std::endl;
+        std::cout << "  --input-format rgb32|rgb888|luma8   KERNEL INPUT LAYOUT (DEFAULT rgb888)" << std::endl;
+        std::cout << "  --output-format NAME                KERNEL OUTPUT LAYOUT: rgb32, gray8, magori (EDGE + ORIENTATION BIN) OR THE bit1 / rle EDGE MASKS (DEFAULT gray8)" << std::endl;
+        std::cout << "  --mask-threshold N                  EDGE VALUE SET IN THE bit1 / rle MASKS (DEFAULT 64)" << std::endl;
+        std::cout << "  --queue-depth N                     KERNEL RUNS KEPT IN FLIGHT, 1 = SEQUENTIAL (DEFAULT 4)" << std::endl;
+        std::cout << "  --images-per-run N                  IMAGES PACKED INTO ONE image_process_batch RUN (DEFAULT 1)" << std::endl;
+        std::cout << "  --tile-height N                     OUTPUT ROWS PER TILE FOR IMAGES WIDER THAN 4096 OR LARGER THAN ONE TILE (DEFAULT 1024)" << std::endl;
+        std::cout << "  --stages LIST                       OPTIONAL KERNEL STAGES: gauss3,gauss5,nms,threshold OR canny, gradients ADDS THE Gx / Gy PLANES (DEFAULT none)" << std::endl;
+        std::cout << "  --operator NAME                     GRADIENT OPERATOR: sobel3, sobel5, sobel7, scharr OR prewitt (DEFAULT sobel3)" << std::endl;
+        std::cout << "  --magnitude l1|l2                   |Gx| + |Gy| OR THE APPROXIMATE EUCLIDEAN MAGNITUDE (DEFAULT l1)" << std::endl;
+        std::cout << "  --low-threshold N                   WEAK EDGE BOUND OF THE threshold STAGE ON THE SOBEL MAGNITUDE (DEFAULT 32)" << std::endl;
+        std::cout << "  --high-threshold N                  STRONG EDGE BOUND OF THE threshold STAGE (DEFAULT 64)" << std::endl;
+        std::cout << "  --compute-units N                   CUs TO SPREAD THE BATCH OVER, 0 = ALL IN THE XCLBIN (DEFAULT 0)" << std::endl;
+        std::cout << "  --device xrt|sw                     sw RUNS THE BIT-EXACT CPU ENGINE, NO CARD NEEDED (DEFAULT xrt)" << std::endl;
+        std::cout << "  --stream                            INPUT_DIR IS A RAW OR Y4M FRAME STREAM (- = STDIN), OUTPUT_DIR THE EDGE FRAMES (- = STDOUT, none)" << std::endl;
+        std::cout << "  --frame-size WxH                    SIZE OF RAW STREAM FRAMES IN THE --input-format LAYOUT" << std::endl;
+        std::cout << "  --fps N                             STREAM FRAME RATE, PACES A FILE AND SETS THE LATENCY BUDGET (DEFAULT 0 = UNPACED)" << std::endl;
+        std::cout << "  --no-drop                           BLOCK A LIVE STREAM INSTEAD OF DROPPING FRAMES WHEN THE RING IS FULL" << std::endl;
+        std::cout << "  --input-dataset                     INPUT_DIR IS A make_dataset CONTAINER, MAPPED AND SENT WITHOUT DECODE OR PACK COPY" << std::endl;
+        std::cout << "  --output-dataset                    OUTPUT_DIR IS AN EDGE CONTAINER FILE WRITTEN INSTEAD OF ONE IMAGE PER INPUT" << std::endl;
+        std::cout << "  --route fpga|cpu|auto               auto SENDS EACH IMAGE TO THE CPU ENGINE OR THE FPGA BY AN ONLINE COST MODEL (DEFAULT fpga)" << std::endl;
+        std::cout << "  --band-split                        WITH SEVERAL CUs, RUN EACH OVERSIZED IMAGE AS ROW BANDS ON ALL CUs AT ONCE AFTER THE BATCH" << std::endl;
+        std::cout << "  --decode-workers N                  THREADS DECODING AND PACKING IMAGES AHEAD OF THE DEVICE, 0 = INLINE (DEFAULT 0)" << std::endl;
+        std::cout << "  --encode-workers N                  THREADS WRITING RESULTS BEHIND THE DEVICE, 0 = INLINE (DEFAULT 0)" << std::endl;
+        std::cout << "  --codec-queue N                     IMAGES EACH CODEC QUEUE MAY HOLD, 0 = TWICE THE WORKERS (DEFAULT 0)" << std::endl;
+        std::cout << "  --trace PATH                        RECORD THE STAGE SPANS, WRITE A CHROME TRACE TO PATH AND PRINT THE SPAN HISTOGRAMS" << std::endl;
+        std::cout << "  --shard i/N                         PROCESS ONLY THE IMAGES WHOSE NAME HASHES TO SHARD i OF N (DEFAULT 0/1)" << std::endl;
+        std::cout << "  --manifest PATH                     SORTED IMAGE LIST OF INPUT_DIR, READ IF IT EXISTS, WRITTEN OTHERWISE" << std::endl;
+        std::cout << "  --journal PATH                      APPEND EACH WRITTEN IMAGE TO PATH, A RERUN SKIPS THE IMAGES ALREADY THERE" << std::endl;
+        std::cout << "  --shard-summary PATH                WRITE THE COUNTS AND TIMES OF THIS RUN FOR --merge-shards" << std::endl;
+        std::cout << "  --pyramid N                         ALSO WRITE THE EDGES OF THE IMAGE HALVED N - 1 TIMES (<name>_l1, _l2), ONE image_process_pyramid RUN PER IMAGE (DEFAULT 1)" << std::endl;
         return 1;
     }
     
     const std::string xclbin_path = argv[1];
     const std::string input_dir = argv[2];
     const std::string output_dir = argv[3];
-    fs::create_directories(output_dir);
+    if (options.stream) {
+        if (output_dir == "-") {
+            /// The edge frames own stdout, the log goes to stderr
+            std::cout.rdbuf(std::cerr.rdbuf());
+        }
+        if (options.images_per_run > 1) {
+            std::cerr << "[ERROR] --images-per-run DOES NOT APPLY TO --stream" << std::endl;
+            return 1;
+        }
+        if (options.input_dataset || options.output_dataset) {
+            std::cerr << "[ERROR] --input-dataset / --output-dataset DO NOT APPLY TO --stream" << std::endl;
+            return 1;
+        }
+        if (options.shard.count > 1 || !options.manifest_path.empty() || !options.journal_path.empty() || !options.summary_path.empty()) {
+            std::cerr << "[ERROR] --shard / --manifest / --journal / --shard-summary DO NOT APPLY TO --stream" << std::endl;
+            return 1;
+        }
+        if (options.pyramid_levels > 1) {
+            std::cerr << "[ERROR] --pyramid DOES NOT APPLY TO --stream" << std::endl;
+            return 1;
+        }
+    } else if (options.pyramid_levels > 1 && (options.input_dataset || options.output_dataset || options.images_per_run > 1 || options.band_split ||
+                                              options.route != ROUTE_MODE_ACCEL || options.decode_workers > 0 || options.encode_workers > 0)) {
+        std::cerr << "[ERROR] --pyramid RUNS ONE IMAGE FILE AT A TIME: NO --input-dataset, --output-dataset, --images-per-run, --band-split, --route OR CODEC WORKERS" << std::endl;
+        return 1;
+    } else if (options.pyramid_levels > 1 && (options.stages.flags != 0 || options.output_format == OUTPUT_FORMAT_MAG_ORIENT ||
+                                              options.edge_kernel.edge_operator != EDGE_OPERATOR_SOBEL3 || options.edge_kernel.magnitude != EDGE_MAGNITUDE_L1)) {
+        std::cerr << "[ERROR] --pyramid WRITES THE PLAIN sobel3 l1 EDGE MAPS: NO --stages, --operator, --magnitude OR magori OUTPUT" << std::endl;
+        return 1;
+    } else if (options.output_dataset && !options.journal_path.empty()) {
+        /// A rerun would truncate the container and lose the journaled edge maps
+        std::cerr << "[ERROR] --journal NEEDS IMAGE FILE OUTPUT, --output-dataset REWRITES ITS CONTAINER ON EVERY RUN" << std::endl;
+        return 1;
+    } else if (options.output_dataset) {
+        fs::path parent = fs::path(output_dir).parent_path();
+        if (!parent.empty()) fs::create_directories(parent);
+    } else {
+        fs::create_directories(output_dir);
+    }
     
     std::cout << std::fixed << std::setprecision(3);
+    if (!options.trace_path.empty()) {
+        trace_enable(true);
+        trace_thread_name("host_app");
+    }
 
     std::cout << "[INFO] INITIALIZING XRT DEVICE AND LOADING XCLBIN..." << std::endl; 
     auto setup_start = std::chrono::high_resolution_clock::now();
     try {
-        auto device = xrt::device(0); 
-        auto uuid = device.load_xclbin(xclbin_path);
-        auto kernel = xrt::kernel(device, uuid, "image_process"); 
+        std::vector<std::unique_ptr<AccelDevice> > devices;
+        if (options.device == "sw") {
+            /// Each stand-in has its own worker thread, so several of them behave like several CUs
+            for (int unit = 0; unit < std::max(1, options.compute_units); unit++) {
+                devices.emplace_back(new SoftwareAccelDevice(SoftwareAccelDevice::Latency(), "sw:" + std::to_string(unit), options.edge_kernel));
+            }
+        } else {
+            try {
+                devices = open_xrt_compute_units(xclbin_path, options.compute_units, options.edge_kernel);
+            } catch (const std::exception& e) {
+                /// No card or no usable xclbin, the CPU engine writes the same output
+                std::cerr << "[WARNING] NO ACCELERATOR AVAILABLE (" << e.what() << "), FALLING BACK TO CPU ENGINE (" << cpu_isa_name(cpu_detect_isa()) << ")" << std::endl;
+                devices.clear();
+                devices.emplace_back(new SoftwareAccelDevice(SoftwareAccelDevice::Latency(), "sw", options.edge_kernel));
+            }
+        }
+        AccelDevice* device = devices[0].get();
         auto setup_stop = std::chrono::high_resolution_clock::now();
-        double setup_time_ms = std::chrono::duration_cast<std::chrono::microseconds>(setup_stop - setup_start).count() / 1000.0;
+        double setup_time_ms = elapsed_ms(setup_start, setup_stop);
         
         std::cout << "[INFO] XRT SETUP/LOAD TIME: " << setup_time_ms << " MS" << std::endl; 
+        std::cout << "[INFO] COMPUTE UNITS: " << devices.size() << std::endl;
+        std::cout << "[INFO] KERNEL: " << edge_kernel_name(options.edge_kernel, false) << std::endl;
+        std::cout << "[INFO] KERNEL STAGES: " << edge_stage_names(options.stages.flags) << std::endl;
+        if (options.pyramid_levels > 1) {
+            std::cout << "[INFO] PYRAMID: " << options.pyramid_levels << " LEVELS PER image_process_pyramid RUN" << std::endl;
+        }
         std::cout << "=================================================" << std::endl;
 
-        double total_h2d_time_ms = 0.0;
-        double total_kernel_time_ms = 0.0;
-        double total_d2h_time_ms = 0.0;
-        double total_end_to_end_time_ms = 0.0;
-        long long total_input_pixels = 0; 
-        int image_count = 0;
+        if (options.stream) {
+            /// Frames keep their order through one CU's ring, extra CUs stay idle
+            int status = run_stream(*device, input_dir, output_dir, options);
+            write_trace_report(options);
+            return status;
+        }
 
-        std::cout << "[INFO] STARTING BATCH PROCESSING FROM: " << input_dir << std::endl; 
+        InputSet inputs;
+        std::vector<std::string> manifest;
+        if (options.input_dataset) {
+            inputs.dataset.reset(new DatasetReader(input_dir));
+            if (inputs.dataset->kind() != DATASET_KIND_INPUT) {
+                std::cerr << "[ERROR] NOT AN INPUT DATASET: " << input_dir << std::endl;
+                return 1;
+            }
+            if (inputs.dataset->format() != options.input_format) {
+                std::cout << "[INFO] DATASET IS " << input_format_name(inputs.dataset->format()) << ", OVERRIDING --input-format" << std::endl;
+                options.input_format = inputs.dataset->format();
+            }
+            std::cout << "[INFO] MAPPED DATASET: " << inputs.dataset->size() << " IMAGES, " << inputs.dataset->file_bytes() << " BYTES, NO DECODE" << std::endl;
+            /// The container's index is the manifest
+            for (size_t i = 0; i < inputs.dataset->size(); i++) {
+                manifest.push_back(inputs.dataset->name(i));
+            }
+            if (!options.manifest_path.empty()) {
+                std::cout << "[WARNING] --manifest IS IGNORED FOR A DATASET, ITS INDEX IS THE MANIFEST" << std::endl;
+            }
+        } else {
+            bool created = false;
+            manifest = load_manifest(options.manifest_path, input_dir, created);
+            if (!options.manifest_path.empty()) {
+                std::cout << "[INFO] " << (created ? "WROTE" : "READ") << " MANIFEST OF " << manifest.size() << " IMAGES: " << options.manifest_path << std::endl;
+            }
+        }
 
-        for (const auto& entry : fs::directory_iterator(input_dir)) {
-            if (entry.is_regular_file() && 
-                (entry.path().extension() == ".jpg" || entry.path().extension() == ".jpeg" || entry.path().extension() == ".png")) 
-            {
-                std::string input_file = entry.path().string();
-                std::string output_file = output_dir + "/out_fpga_" + entry.path().filename().string();
-                
-                PerformanceMetrics metrics = process_image_fpga(kernel, device, input_file, output_file);
-                
-                if (metrics.kernel_time_ms > 0.0) { 
-                    total_h2d_time_ms += metrics.h2d_time_ms;
-                    total_kernel_time_ms += metrics.kernel_time_ms;
-                    total_d2h_time_ms += metrics.d2h_time_ms;
-                    total_end_to_end_time_ms += metrics.total_time_ms;
-                    total_input_pixels += metrics.pixels_processed;
-                    image_count++;
+        /// This run's images: the shard's part of the manifest, less the images already journaled
+        EdgeOutput output;
+        output.output_dir = output_dir;
+        if (!options.journal_path.empty()) {
+            output.journal.reset(new BatchJournal(options.journal_path));
+        }
+        ShardSummary shard_summary;
+        shard_summary.shard = options.shard.index;
+        shard_summary.shards = options.shard.count;
+        shard_summary.manifest = manifest.size();
+        char host_name[256] = "-";
+        gethostname(host_name, sizeof(host_name) - 1);
+        shard_summary.host = host_name;
+        for (size_t i = 0; i < manifest.size(); i++) {
+            if (!in_shard(manifest[i], options.shard)) continue;
+            shard_summary.assigned++;
+            if (output.journal && output.journal->done(manifest[i])) {
+                shard_summary.skipped++;
+            } else if (inputs.dataset) {
+                inputs.entries.push_back(i);
+            } else {
+                inputs.files.push_back(fs::path(input_dir) / manifest[i]);
+            }
+        }
+        if (options.shard.count > 1 || output.journal) {
+            std::cout << "[INFO] SHARD " << options.shard.index << "/" << options.shard.count << ": " << shard_summary.assigned << " OF "
+                      << manifest.size() << " IMAGES, " << shard_summary.skipped << " ALREADY IN THE JOURNAL, " << inputs.size() << " TO DO" << std::endl;
+        }
+        if (options.output_dataset) {
+            output.dataset.reset(new DatasetWriter(output_dir, DATASET_KIND_EDGES, OUTPUT_FORMAT_GRAY8));
+            if (options.output_format == OUTPUT_FORMAT_MAG_ORIENT || (options.stages.flags & EDGE_STAGE_GRADIENTS)) {
+                std::cout << "[WARNING] --output-dataset KEEPS THE EDGE PLANE ONLY, THE ORIENTATION AND GRADIENT PLANES ARE DROPPED" << std::endl;
+            }
+        }
+
+        std::cout << "[INFO] STARTING BATCH PROCESSING FROM: " << input_dir << std::endl;
+
+        std::vector<PerformanceMetrics> images;
+        double batch_wall_time_ms = 0.0;
+        int peak_in_flight = 1;
+        int setup_allocations = 0;
+        TiledPath tiled(*device, options);
+        bool codec_workers = options.decode_workers > 0 || options.encode_workers > 0;
+        HostCodecs codecs(inputs, options, tiled.config, output, devices.size());
+        /// A pyramid run is one image at a time on the first CU
+        bool pyramid = options.pyramid_levels > 1;
+        bool sequential = pyramid || (devices.size() == 1 && options.queue_depth == 1 && options.images_per_run == 1 && !inputs.dataset && !codec_workers);
+        HostRouter router(options, tiled.config, codecs, sequential ? 1 : options.queue_depth * devices.size());
+        std::vector<PerformanceMetrics> cpu_images;
+        auto batch_start = std::chrono::high_resolution_clock::now();
+
+        if (options.images_per_run > 1 && (options.stages.flags & EDGE_STAGE_GRADIENTS)) {
+            std::cout << "[WARNING] THE GRADIENT PLANES NEED image_process, --images-per-run IS IGNORED" << std::endl;
+        }
+        if (options.band_split && devices.size() < 2) {
+            std::cout << "[WARNING] --band-split NEEDS SEVERAL CUs, OVERSIZED IMAGES ARE TILED ON ONE" << std::endl;
+        }
+        if (options.images_per_run > 1 && !device->supports_batch()) {
+            std::cerr << "[ERROR] --images-per-run NEEDS THE image_process_batch KERNEL IN THE XCLBIN" << std::endl;
+            return 1;
+        }
+        if (pyramid && !device->supports_pyramid()) {
+            std::cerr << "[ERROR] --pyramid NEEDS THE image_process_pyramid KERNEL IN THE XCLBIN" << std::endl;
+            return 1;
+        }
+        if (pyramid && devices.size() > 1) {
+            std::cout << "[WARNING] --pyramid RUNS ON THE FIRST CU, THE OTHERS STAY IDLE" << std::endl;
+        }
+
+        if (devices.size() > 1 && !pyramid) {
+            /// One pipeline per CU, each with its own tiled path so oversized images stay on the CU that took them
+            std::vector<AccelDevice*> units;
+            std::vector<std::unique_ptr<TiledPath> > unit_tiled;
+            for (const std::unique_ptr<AccelDevice>& unit : devices) {
+                units.push_back(unit.get());
+                unit_tiled.emplace_back(new TiledPath(*unit, options));
+            }
+
+            CuSchedulerConfig config;
+            config.pipeline.queue_depth = options.queue_depth;
+            config.pipeline.input_format = options.input_format;
+            config.pipeline.output_format = options.output_format;
+            config.pipeline.max_height = IMG_HEIGHT;
+            config.pipeline.max_width = IMG_WIDTH;
+            config.pipeline.images_per_run = options.images_per_run;
+            config.pipeline.stages = options.stages;
+            CuScheduler scheduler(units, config);
+
+            std::mutex tiled_mutex;
+            std::vector<PerformanceMetrics> tiled_images;
+            /// The CUs are busy with the batch, band split images wait for it to finish
+            std::vector<size_t> band_split_indices;
+            ScheduleReport report = scheduler.run(inputs.size(),
+                [&](int unit, int index, BatchInput& input) {
+                    /// The scheduler's index becomes the tag, the image may be a different one with decode workers
+                    size_t input_index = index;
+                    if (options.decode_workers > 0 && !codecs.next(input, input_index, index)) return;
+                    if (options.decode_workers == 0) load_batch_input(inputs, index, options, input);
+                    input.tag = index;
+                    if (options.band_split && input_needs_tiling(input, tiled.config)) {
+                        std::lock_guard<std::mutex> lock(tiled_mutex);
+                        band_split_indices.push_back(input_index);
+                        input.image.release();
+                        input.packed = nullptr;
+                        return;
+                    }
+                    PerformanceMetrics metrics;
+                    if (divert_to_tiled(inputs, input_index, input, *unit_tiled[unit], output, metrics)) {
+                        std::lock_guard<std::mutex> lock(tiled_mutex);
+                        tiled_images.push_back(metrics);
+                    }
+                    router.divert_to_cpu(input);
+                },
+                [&](int, const BatchOutput& result) {
+                    codecs.write(result);
+                    router.accel_done(result.tag, result.metrics);
+                });
+            cpu_images = router.finish();
+            codecs.finish();
+
+            if (!band_split_indices.empty()) {
+                /// Decoded again rather than held through the batch, memory stays at one large image
+                std::sort(band_split_indices.begin(), band_split_indices.end());
+                BandSplitProcessor splitter(units, tiled.config);
+                for (size_t index : band_split_indices) {
+                    BatchInput input;
+                    load_batch_input(inputs, index, options, input);
+                    cv::Mat storage;
+                    cv::Mat image = input.packed ? inputs.dataset_image(index, storage) : input.image;
+                    tiled_images.push_back(process_image_band_split(splitter, image, output, input.name));
                 }
             }
+
+            for (const CuReport& cu : report.units) {
+                std::cout << "[INFO] CU " << cu.name << ": " << cu.images << " IMAGES (" << cu.stolen << " STOLEN), BUSY "
+                          << cu.busy_time_ms << " MS, UTILIZATION " << cu.utilization * 100.0 << " %" << std::endl;
+            }
+            images = report.images;
+            images.insert(images.end(), tiled_images.begin(), tiled_images.end());
+            batch_wall_time_ms = report.wall_time_ms;
+            peak_in_flight = report.peak_in_flight;
+            setup_allocations = report.setup_allocations;
+        } else if (sequential) {
+            BufferPool pool(*device, 1, IMG_HEIGHT, IMG_WIDTH, options.input_format, options.output_format);
+            setup_allocations = pool.allocation_count();
+            for (size_t index = 0; index < inputs.files.size(); index++) {
+                BatchInput input;
+                load_batch_input(inputs, index, options, input);
+                input.tag = index;
+                if (router.divert_to_cpu(input)) {
+                    continue;
+                }
+                PerformanceMetrics metrics = pyramid ? process_image_pyramid(*device, pool, input.image, input.name, output, options)
+                                                     : process_image_fpga(*device, pool, tiled, input.image, input.name, output, options);
+                router.accel_done(index, metrics);
+
+                if (metrics.kernel_time_ms > 0.0) {
+                    images.push_back(metrics);
+                }
+            }
+            cpu_images = router.finish();
+        } else {
+            PipelineConfig config;
+            config.queue_depth = options.queue_depth;
+            config.input_format = options.input_format;
+            config.output_format = options.output_format;
+            config.max_height = IMG_HEIGHT;
+            config.max_width = IMG_WIDTH;
+            config.images_per_run = options.images_per_run;
+            config.stages = options.stages;
+            BatchPipeline pipeline(*device, config);
+
+            int next_tag = 0;
+            std::vector<PerformanceMetrics> tiled_images;
+            BatchReport report = pipeline.run(
+                [&](BatchInput& input) {
+                    size_t input_index = 0;
+                    if (!codecs.next(input, input_index, next_tag++)) return false;
+                    /// Oversized images go through the tiled path on their own slots, the batch skips them
+                    PerformanceMetrics metrics;
+                    if (divert_to_tiled(inputs, input_index, input, tiled, output, metrics)) {
+                        tiled_images.push_back(metrics);
+                    }
+                    router.divert_to_cpu(input);
+                    return true;
+                },
+                [&](const BatchOutput& result) {
+                    codecs.write(result);
+                    router.accel_done(result.tag, result.metrics);
+                });
+            cpu_images = router.finish();
+            codecs.finish();
+
+            std::cout << "[INFO] " << report.images.size() << " IMAGES IN " << report.runs << " KERNEL RUNS" << std::endl;
+            images = report.images;
+            images.insert(images.end(), tiled_images.begin(), tiled_images.end());
+            batch_wall_time_ms = report.wall_time_ms;
+            peak_in_flight = report.peak_in_flight;
+            setup_allocations = report.setup_allocations;
+        }
+
+        if (router.enabled()) {
+            /// The CPU backend may finish after the accelerator, the batch lasts until both are done
+            images.insert(images.end(), cpu_images.begin(), cpu_images.end());
+            if (batch_wall_time_ms > 0.0) {
+                batch_wall_time_ms = std::max(batch_wall_time_ms, elapsed_ms(batch_start, std::chrono::high_resolution_clock::now()));
+            }
+        }
+        codecs.print_report();
+        router.print_report();
+        if (output.dataset) {
+            output.dataset->finish();
+            std::cout << "[INFO] WROTE " << output.dataset->size() << " EDGE MAPS TO DATASET " << output_dir << std::endl;
         }
 
         /// Handle metrics determination and print it out on console
-        if (image_count > 0) {
-            
-            double avg_h2d_time_s = (total_h2d_time_ms / image_count) / 1000.0;
-            double avg_kernel_time_s = (total_kernel_time_ms / image_count) / 1000.0;
-            double avg_d2h_time_s = (total_d2h_time_ms / image_count) / 1000.0;
-            double avg_total_time_s = (total_end_to_end_time_ms / image_count) / 1000.0;
-            
-            double avg_pixels_per_image = (double)total_input_pixels / image_count;
-            
-            double kernel_throughput_mpps = (avg_pixels_per_image / avg_kernel_time_s) / 1000000.0;
-            double end_to_end_throughput_mpps = (avg_pixels_per_image / avg_total_time_s) / 1000000.0;
-            
-            std::cout << "=================================================" << std::endl;
-            std::cout << "          FPGA BATCH PERFORMANCE SUMMARY" << std::endl;
-            std::cout << "=================================================" << std::endl;
-            std::cout << "IMAGES PROCESSED: " << image_count << std::endl;
-            std::cout << "--- TOTAL TIMES ---" << std::endl;
-            std::cout << std::left << std::setw(25) << "TOTAL H2D DMA TIME:" << total_h2d_time_ms << " MS" << std::endl;
-            std::cout << std::left << std::setw(25) << "TOTAL KERNEL TIME:" << total_kernel_time_ms << " MS" << std::endl;
-            std::cout << std::left << std::setw(25) << "TOTAL D2H DMA TIME:" << total_d2h_time_ms << " MS" << std::endl;
-            std::cout << std::left << std::setw(25) << "TOTAL END-TO-END TIME:" << total_end_to_end_time_ms << " MS" << std::endl;
-            std::cout << "--- AVERAGE TIMES PER IMAGE ---" << std::endl;
-            std::cout << std::left << std::setw(25) << "AVG H2D DMA TIME:" << total_h2d_time_ms / image_count << " MS" << std::endl;
-            std::cout << std::left << std::setw(25) << "AVG KERNEL TIME:" << total_kernel_time_ms / image_count << " MS" << std::endl;
-            std::cout << std::left << std::setw(25) << "AVG D2H DMA TIME:" << total_d2h_time_ms / image_count << " MS" << std::endl;
-            std::cout << std::left << std::setw(25) << "AVG END-TO-END TIME:" << total_end_to_end_time_ms / image_count << " MS" << std::endl;
-            std::cout << "--- THROUGHPUT (MPPS) ---" << std::endl;
-            std::cout << std::left << std::setw(25) << "KERNEL THROUGHPUT:" << kernel_throughput_mpps << " MPPS" << std::endl;
-            std::cout << std::left << std::setw(25) << "END-TO-END THROUGHPUT:" << end_to_end_throughput_mpps << " MPPS" << std::endl;
-            std::cout << "=================================================" << std::endl;
+        if (!images.empty()) {
+            print_performance_summary(images, batch_wall_time_ms, peak_in_flight, setup_allocations);
+        } else if (shard_summary.skipped > 0 && inputs.size() == 0) {
+            std::cout << "[INFO] EVERY IMAGE OF THE SHARD IS ALREADY IN THE JOURNAL" << std::endl;
         } else {
             std::cout << "[WARNING] NO IMAGES FOUND IN INPUT DIRECTORY: " << input_dir << std::endl; 
         }
+        if (options.shard.count > 1 || output.journal || !options.summary_path.empty()) {
+            finish_shard_summary(shard_summary, images, output, elapsed_ms(batch_start, std::chrono::high_resolution_clock::now()));
+            print_shard_summary(shard_summary);
+            if (!options.summary_path.empty() && !write_shard_summary(options.summary_path, shard_summary)) {
+                std::cerr << "[ERROR] CANNOT WRITE SHARD SUMMARY: " << options.summary_path << std::endl;
+                return 1;
+            }
+        }
+        write_trace_report(options);
 
     } catch (const std::exception& e) {
         std::cerr << "[ERROR] XRT/RUNTIME ERROR: " << e.what() << std::endl; 
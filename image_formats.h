@@ -0,0 +1,240 @@
+#ifndef IMAGE_FORMATS_H
+#define IMAGE_FORMATS_H
+
+#include <cstddef>
+#include <string>
+
+#include "edge_operators.h"
+
+///@brief: Buffer layouts shared by the kernel and the host, selected through the kernel's format arguments
+
+#define BURST_BYTES 64
+
+///@brief: Widest image the kernel line buffers hold, wider images are split in tiles by the host (tiling.h)
+#define KERNEL_MAX_WIDTH 4096
+
+///@brief: Input layouts accepted by read_and_grayscale
+#define INPUT_FORMAT_RGB32 0    /// 0x00RRGGBB per 32-bit word, 16 pixels per burst
+#define INPUT_FORMAT_RGB888 1   /// B, G, R bytes back to back (cv::Mat CV_8UC3 order), 64 pixels per 3 bursts
+#define INPUT_FORMAT_LUMA8 2    /// one gray byte per pixel, 64 pixels per burst, grayscale_weighted is bypassed
+
+inline int input_bytes_per_pixel(int input_format) {
+    return (input_format == INPUT_FORMAT_LUMA8) ? 1 : (input_format == INPUT_FORMAT_RGB888) ? 3 : 4;
+}
+
+///@brief: Bytes the kernel reads for pixels input pixels, always whole bursts
+inline size_t input_buffer_bytes(int input_format, int pixels) {
+    size_t bytes = (size_t)pixels * input_bytes_per_pixel(input_format);
+    return ((bytes + BURST_BYTES - 1) / BURST_BYTES) * BURST_BYTES;
+}
+
+///@brief: Output layouts written by write_and_pack. BIT1 and RLE are edge masks, a pixel is set when its edge
+/// value is at least the kernel's mask_threshold
+#define OUTPUT_FORMAT_RGB32 0   /// edge value copied into the low three bytes of a 32-bit word, 16 pixels per burst
+#define OUTPUT_FORMAT_GRAY8 1   /// one byte per edge pixel, 64 pixels per burst
+#define OUTPUT_FORMAT_BIT1 2    /// one bit per edge pixel, LSB first, 512 pixels per burst
+#define OUTPUT_FORMAT_RLE 3     /// row table then 16-bit runs, see rle_table_bytes
+#define OUTPUT_FORMAT_MAG_ORIENT 4  /// 16 bits per pixel, edge value in the low byte and orientation_bin in the high byte, 32 pixels per burst
+
+///@brief: Rows the kernel's RLE row table holds, taller images are tiled by the host
+#define RLE_MAX_ROWS 4096
+
+inline bool is_mask_output(int output_format) {
+    return output_format == OUTPUT_FORMAT_BIT1 || output_format == OUTPUT_FORMAT_RLE;
+}
+
+inline int output_pixels_per_burst(int output_format) {
+    return (output_format == OUTPUT_FORMAT_BIT1) ? BURST_BYTES * 8 : (output_format == OUTPUT_FORMAT_GRAY8) ? BURST_BYTES :
+           (output_format == OUTPUT_FORMAT_MAG_ORIENT) ? BURST_BYTES / 2 : BURST_BYTES / 4;
+}
+
+///@brief: Bytes the kernel writes for out_pixels edge pixels, always whole bursts. Not for RLE, whose size
+/// depends on the rows, use the (out_height, out_width) form
+inline size_t output_buffer_bytes(int output_format, int out_pixels) {
+    size_t per_burst = output_pixels_per_burst(output_format);
+    return ((out_pixels + per_burst - 1) / per_burst) * BURST_BYTES;
+}
+
+///@brief: RLE layout. The buffer starts with the row table, one 32-bit word per row holding the number of runs
+/// written up to the end of that row, padded to whole bursts. The runs follow: 16-bit lengths, 32 per burst,
+/// alternating background and edge and starting with background (0 when a row starts on an edge), each
+/// row ends with its last run. Row r is runs [table[r - 1], table[r]), decodable without scanning earlier rows
+inline size_t rle_table_bytes(int out_height) {
+    return ((size_t)(out_height + BURST_BYTES / 4 - 1) / (BURST_BYTES / 4)) * BURST_BYTES;
+}
+
+inline size_t rle_run_bytes(long long runs) {
+    return (size_t)((runs + BURST_BYTES / 2 - 1) / (BURST_BYTES / 2)) * BURST_BYTES;
+}
+
+///@brief: Bytes reserved for the output of one image, the worst case for RLE (every pixel its own run).
+/// out_stride spaces the rows as in ImageRoi
+inline size_t output_buffer_bytes(int output_format, int out_height, int out_width, int out_stride = 0) {
+    if (output_format == OUTPUT_FORMAT_RLE) {
+        return rle_table_bytes(out_height) + rle_run_bytes((long long)out_height * (out_width + 1));
+    }
+    if (out_stride != 0 && out_height > 0) {
+        return (size_t)(out_height - 1) * out_stride + output_buffer_bytes(output_format, out_width);
+    }
+    return output_buffer_bytes(output_format, out_height * out_width);
+}
+
+///@brief: Where the kernel finds an image region and puts its output. The region is the kernel's height x width,
+/// row r of it starts at input byte (y + r) * in_stride + x * bytes_per_pixel, anywhere inside a burst, so a frame
+/// kept in device memory can be processed region by region. Output row r starts at byte r * out_stride, which
+/// has to be a multiple of BURST_BYTES: each row ends in a zero padded burst and the bursts between rows are
+/// left alone. RLE ignores out_stride. A zero stride is the dense layout, rows back to back
+struct ImageRoi {
+    int x = 0;
+    int y = 0;
+    int in_stride = 0;
+    int out_stride = 0;
+};
+
+///@brief: Input bytes a region reads, from the start of the frame
+inline size_t roi_input_bytes(const ImageRoi& roi, int input_format, int height, int width) {
+    if (roi.in_stride == 0) {
+        return input_buffer_bytes(input_format, height * width);
+    }
+    size_t end = (size_t)(roi.y + height - 1) * roi.in_stride + (size_t)(roi.x + width) * input_bytes_per_pixel(input_format);
+    return ((end + BURST_BYTES - 1) / BURST_BYTES) * BURST_BYTES;
+}
+
+///@brief: One entry of the image_process_batch descriptor table, stored as eight 32-bit words.
+/// Offsets count 64-byte bursts from the start of the batch input and output buffers, the ROI words are
+/// ImageRoi's (all 0 for a dense image)
+struct ImageDescriptor {
+    unsigned int in_offset;
+    unsigned int out_offset;
+    unsigned int height;
+    unsigned int width;
+    unsigned int roi_x;
+    unsigned int roi_y;
+    unsigned int in_stride;
+    unsigned int out_stride;
+};
+
+#define DESCRIPTOR_WORDS 8
+#define MAX_BATCH_IMAGES 1024   /// descriptor table entries the batch kernel accepts per invocation
+
+///@brief: image_process_pyramid layout. Level l is the image halved l times by 2x2 averaging,
+/// (height >> l) x (width >> l) with the odd last row / column dropped, and its sobel output has the usual
+/// (h - 2) x (w - 2) geometry in the output format. The levels are back to back in one output buffer, each
+/// starting on a PYRAMID_LEVEL_ALIGN boundary so the host can hand each to the kernel as its own sub-buffer
+#define PYRAMID_MAX_LEVELS 3
+#define PYRAMID_LEVEL_ALIGN 4096
+
+inline int pyramid_level_height(int height, int level) { return height >> level; }
+inline int pyramid_level_width(int width, int level) { return width >> level; }
+
+///@brief: Every level down to levels - 1 still has a 3x3 window
+inline bool pyramid_fits(int height, int width, int levels) {
+    return levels >= 1 && levels <= PYRAMID_MAX_LEVELS && pyramid_level_height(height, levels - 1) >= 3 &&
+           pyramid_level_width(width, levels - 1) >= 3;
+}
+
+///@brief: Bytes reserved for the output of one level, rounded up to the level alignment
+inline size_t pyramid_level_bytes(int output_format, int height, int width, int level) {
+    size_t bytes = output_buffer_bytes(output_format, pyramid_level_height(height, level) - 2, pyramid_level_width(width, level) - 2);
+    return ((bytes + PYRAMID_LEVEL_ALIGN - 1) / PYRAMID_LEVEL_ALIGN) * PYRAMID_LEVEL_ALIGN;
+}
+
+///@brief: Byte offset of level `level` in the output buffer, with level = levels the size of the whole buffer
+inline size_t pyramid_level_offset(int output_format, int height, int width, int level) {
+    size_t offset = 0;
+    for (int l = 0; l < level; l++) {
+        offset += pyramid_level_bytes(output_format, height, width, l);
+    }
+    return offset;
+}
+
+///@brief: Optional stages around sobel, OR-ed into the kernel's stages argument. 0 = plain sobel magnitude
+#define EDGE_STAGE_GAUSSIAN3 0x1    /// 3x3 [1 2 1] gaussian on the gray plane before sobel
+#define EDGE_STAGE_GAUSSIAN5 0x2    /// 5x5 [1 4 6 4 1] gaussian, takes precedence over GAUSSIAN3
+#define EDGE_STAGE_NMS 0x4          /// non-maximum suppression along the gradient direction quantized to 45 degrees
+#define EDGE_STAGE_THRESHOLD 0x8    /// dual threshold to 0 / 255, weak pixels survive only next to a strong one
+#define EDGE_STAGE_CANNY (EDGE_STAGE_GAUSSIAN5 | EDGE_STAGE_NMS | EDGE_STAGE_THRESHOLD)
+#define EDGE_STAGE_GRADIENTS 0x10   /// signed Gx / Gy planes to image_process's grad_img port, image_process_batch ignores it
+
+///@brief: grad_img layout: the Gx plane then the Gy plane, each (h - 2) x (w - 2) int16 values back to back and padded
+/// to whole bursts. The values are the operator's raw sums >> GRAD_SHIFT (edge_operators.h), border pixels without a
+/// full window are 0. The planes are always dense, out_stride only spaces the edge output
+inline size_t gradient_plane_bytes(int out_pixels) {
+    size_t bytes = (size_t)out_pixels * 2;
+    return ((bytes + BURST_BYTES - 1) / BURST_BYTES) * BURST_BYTES;
+}
+
+inline size_t gradient_buffer_bytes(int out_height, int out_width) {
+    return 2 * gradient_plane_bytes(out_height * out_width);
+}
+
+///@brief: Host side bundle of the stage arguments, thresholds apply to the 8-bit scaled gradient magnitude
+struct EdgeStages {
+    int flags = 0;
+    int low_threshold = 32;
+    int high_threshold = 64;
+    int mask_threshold = 64;    /// BIT1 / RLE outputs only, any value 1..255 keeps exactly the threshold stage's edges
+};
+
+inline int gaussian_radius(int stages) {
+    return (stages & EDGE_STAGE_GAUSSIAN5) ? 2 : (stages & EDGE_STAGE_GAUSSIAN3) ? 1 : 0;
+}
+
+///@brief: Input pixels on each side an output pixel depends on. 1 for plain 3x3 sobel, tiles need this much overlap
+inline int edge_stage_halo(int stages, int edge_operator = EDGE_OPERATOR_SOBEL3) {
+    return gaussian_radius(stages) + edge_operator_radius(edge_operator) +
+           ((stages & EDGE_STAGE_NMS) ? 1 : 0) + ((stages & EDGE_STAGE_THRESHOLD) ? 1 : 0);
+}
+
+///@brief: Comma separated stage names (gauss3, gauss5, nms, threshold, canny, none), -1 for an unknown name
+inline int parse_edge_stages(const std::string& list) {
+    int stages = 0;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        std::string name = list.substr(start, end - start);
+        if (name == "gauss3") stages |= EDGE_STAGE_GAUSSIAN3;
+        else if (name == "gauss5") stages |= EDGE_STAGE_GAUSSIAN5;
+        else if (name == "nms") stages |= EDGE_STAGE_NMS;
+        else if (name == "threshold") stages |= EDGE_STAGE_THRESHOLD;
+        else if (name == "canny") stages |= EDGE_STAGE_CANNY;
+        else if (name == "gradients") stages |= EDGE_STAGE_GRADIENTS;
+        else if (name != "none") return -1;
+        start = end + 1;
+    }
+    return stages;
+}
+
+inline std::string edge_stage_names(int stages) {
+    std::string names;
+    if (stages & EDGE_STAGE_GAUSSIAN5) names += "gauss5,";
+    else if (stages & EDGE_STAGE_GAUSSIAN3) names += "gauss3,";
+    names += "sobel";
+    if (stages & EDGE_STAGE_NMS) names += ",nms";
+    if (stages & EDGE_STAGE_THRESHOLD) names += ",threshold";
+    if (stages & EDGE_STAGE_GRADIENTS) names += ",gradients";
+    return names;
+}
+
+///@brief: Command line names of the formats, -1 for an unknown name
+inline int parse_input_format(const std::string& name) {
+    return (name == "rgb32") ? INPUT_FORMAT_RGB32 : (name == "rgb888") ? INPUT_FORMAT_RGB888 : (name == "luma8") ? INPUT_FORMAT_LUMA8 : -1;
+}
+
+inline int parse_output_format(const std::string& name) {
+    return (name == "rgb32") ? OUTPUT_FORMAT_RGB32 : (name == "gray8") ? OUTPUT_FORMAT_GRAY8 :
+           (name == "bit1") ? OUTPUT_FORMAT_BIT1 : (name == "rle") ? OUTPUT_FORMAT_RLE :
+           (name == "magori") ? OUTPUT_FORMAT_MAG_ORIENT : -1;
+}
+
+inline const char* input_format_name(int input_format) {
+    return (input_format == INPUT_FORMAT_LUMA8) ? "luma8" : (input_format == INPUT_FORMAT_RGB888) ? "rgb888" : "rgb32";
+}
+
+inline const char* output_format_name(int output_format) {
+    return (output_format == OUTPUT_FORMAT_GRAY8) ? "gray8" : (output_format == OUTPUT_FORMAT_BIT1) ? "bit1" :
+           (output_format == OUTPUT_FORMAT_RLE) ? "rle" : (output_format == OUTPUT_FORMAT_MAG_ORIENT) ? "magori" : "rgb32";
+}
+
+#endif
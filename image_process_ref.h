@@ -0,0 +1,227 @@
+#ifndef IMAGE_PROCESS_REF_H
+#define IMAGE_PROCESS_REF_H
+
+#include <cstdlib>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "image_formats.h"
+#include "edge_mask.h"
+
+///@brief: Copies a height x width region of a frame laid out as roi says into dense rows
+inline void gather_roi_input(const unsigned char* frame, const ImageRoi& roi, int input_format, int height, int width, unsigned char* dst) {
+    int bytes_per_pixel = input_bytes_per_pixel(input_format);
+    size_t row_bytes = (size_t)width * bytes_per_pixel;
+    for (int r = 0; r < height; r++) {
+        std::memcpy(dst + r * row_bytes, frame + (size_t)(roi.y + r) * roi.in_stride + (size_t)roi.x * bytes_per_pixel, row_bytes);
+    }
+}
+
+///@brief: Plain C++ model of the image_process kernel on raw device buffers. Reads the input layout
+/// selected by input_format and writes the same bytes the kernel writes, including the zeroed tail of
+/// the last burst. Used by the software stand-in device and as the golden model in tests.
+/// stages selects the optional gaussian, non-maximum suppression and threshold stages (EDGE_STAGE_*),
+/// edge_operator and magnitude the kernel specialization (EDGE_OPERATOR_*, EDGE_MAGNITUDE_*), mask_threshold
+/// the edge value the BIT1 / RLE outputs count as an edge, roi the region of a larger frame and the output row spacing.
+/// grad_img receives the Gx / Gy planes the kernel writes to its grad_img port when stages has EDGE_STAGE_GRADIENTS.
+inline void image_process_reference(
+    const unsigned char* in_img,
+    unsigned char* out_img,
+    int height,
+    int width,
+    int input_format,
+    int output_format,
+    int stages = 0,
+    int low_threshold = 0,
+    int high_threshold = 0,
+    int edge_operator = EDGE_OPERATOR_SOBEL3,
+    int magnitude_mode = EDGE_MAGNITUDE_L1,
+    int mask_threshold = 0,
+    const ImageRoi& roi = ImageRoi(),
+    unsigned char* grad_img = nullptr)
+{
+    std::vector<unsigned char> region;
+    if (roi.in_stride != 0) {
+        region.resize((size_t)height * width * input_bytes_per_pixel(input_format));
+        gather_roi_input(in_img, roi, input_format, height, width, region.data());
+        in_img = region.data();
+    }
+    int size = height * width;
+    int bytes_per_pixel = input_bytes_per_pixel(input_format);
+    std::vector<unsigned char> gray(size);
+    for (int i = 0; i < size; i++) {
+        const unsigned char* pixel = in_img + (size_t)i * bytes_per_pixel;
+        gray[i] = (input_format == INPUT_FORMAT_LUMA8) ? pixel[0] : (pixel[2] * 77 + pixel[1] * 150 + pixel[0] * 29) >> 8;
+    }
+
+    /// Gaussian with (sum + half) >> shift rounding, pixels closer than the radius to the border are kept
+    int radius = gaussian_radius(stages);
+    if (radius > 0) {
+        const int taps3[3] = { 1, 2, 1 };
+        const int taps5[5] = { 1, 4, 6, 4, 1 };
+        const int* taps = (radius == 2) ? taps5 : taps3;
+        int shift = (radius == 2) ? 8 : 4;
+        std::vector<unsigned char> blurred(gray);
+        for (int y = radius; y < height - radius; y++) {
+            for (int x = radius; x < width - radius; x++) {
+                int sum = 0;
+                for (int dy = -radius; dy <= radius; dy++) {
+                    for (int dx = -radius; dx <= radius; dx++) {
+                        sum += gray[(y + dy) * width + (x + dx)] * taps[dy + radius] * taps[dx + radius];
+                    }
+                }
+                blurred[y * width + x] = (sum + (1 << (shift - 1))) >> shift;
+            }
+        }
+        gray.swap(blurred);
+    }
+
+    int out_width = width - 2;
+    int out_height = height - 2;
+    int out_size = out_height * out_width;
+    std::vector<unsigned char> edges(out_size > 0 ? out_size : 0);
+    std::vector<unsigned char> directions(edges.size());
+    std::vector<unsigned char> orientation(edges.size(), 0);
+    std::vector<short> gradient_x(edges.size(), 0);
+    std::vector<short> gradient_y(edges.size(), 0);
+
+    /// The operators are separable: horizontal derivative and smoothing passes first, then the vertical taps.
+    /// Edge pixels closer than the operator radius to the image border have no full window and stay 0
+    EdgeOperatorTaps taps = edge_operator_taps(edge_operator);
+    int operator_radius = taps.size / 2;
+    std::vector<int> row_derivative(size, 0);
+    std::vector<int> row_smooth(size, 0);
+    for (int y = 0; y < height; y++) {
+        for (int x = operator_radius; x < width - operator_radius; x++) {
+            const unsigned char* window = &gray[y * width + x - operator_radius];
+            int derivative = 0;
+            int smooth = 0;
+            for (int c = 0; c < taps.size; c++) {
+                derivative += window[c] * taps.derivative[c];
+                smooth += window[c] * taps.smooth[c];
+            }
+            row_derivative[y * width + x] = derivative;
+            row_smooth[y * width + x] = smooth;
+        }
+    }
+    for (int y = operator_radius; y < height - operator_radius; y++) {
+        for (int x = operator_radius; x < width - operator_radius; x++) {
+            int gx = 0;
+            int gy = 0;
+            for (int r = 0; r < taps.size; r++) {
+                int i = (y + r - operator_radius) * width + x;
+                gx += taps.smooth[r] * row_derivative[i];
+                gy -= taps.derivative[r] * row_smooth[i];
+            }
+            int ax = std::abs(gx);
+            int ay = std::abs(gy);
+            int magnitude = (magnitude_mode == EDGE_MAGNITUDE_L2) ? std::max(ax, ay) + ((3 * std::min(ax, ay)) >> 3) : ax + ay;
+            magnitude >>= taps.mag_shift;
+            int i = (y - 1) * out_width + (x - 1);
+            edges[i] = magnitude > 255 ? 255 : magnitude;
+            orientation[i] = orientation_bin(gx, gy);
+            gradient_x[i] = gx >> taps.grad_shift;
+            gradient_y[i] = gy >> taps.grad_shift;
+
+            /// 0 horizontal, 1 up-left/down-right, 2 vertical, 3 up-right/down-left, split at 22.5 and 67.5 degrees,
+            /// compared in 64 bits like gradient_direction
+            if (((long long)ay << 15) < (long long)ax * 13573) directions[i] = 0;
+            else if (((long long)ay << 15) > (long long)ax * 79109) directions[i] = 2;
+            else directions[i] = ((gx < 0) == (gy < 0)) ? 3 : 1;
+        }
+    }
+
+    /// Neighbors outside the edge image read as 0 in both stages below
+    auto at = [&](const std::vector<unsigned char>& plane, int y, int x) -> int {
+        return (y < 0 || y >= out_height || x < 0 || x >= out_width) ? 0 : plane[y * out_width + x];
+    };
+
+    if (stages & EDGE_STAGE_NMS) {
+        const int before[4][2] = { {0, -1}, {-1, -1}, {-1, 0}, {-1, 1} };
+        std::vector<unsigned char> thin(edges.size());
+        for (int y = 0; y < out_height; y++) {
+            for (int x = 0; x < out_width; x++) {
+                int i = y * out_width + x;
+                const int* offset = before[directions[i]];
+                int magnitude = edges[i];
+                bool maximum = magnitude > at(edges, y + offset[0], x + offset[1]) &&
+                               magnitude >= at(edges, y - offset[0], x - offset[1]);
+                thin[i] = maximum ? magnitude : 0;
+            }
+        }
+        edges.swap(thin);
+    }
+
+    if (stages & EDGE_STAGE_THRESHOLD) {
+        std::vector<unsigned char> classes(edges.size());
+        for (size_t i = 0; i < edges.size(); i++) {
+            classes[i] = (edges[i] >= high_threshold) ? 2 : (edges[i] >= low_threshold) ? 1 : 0;
+        }
+        for (int y = 0; y < out_height; y++) {
+            for (int x = 0; x < out_width; x++) {
+                int edge_class = classes[y * out_width + x];
+                bool strong_neighbor = false;
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dx = -1; dx <= 1; dx++) {
+                        if ((dy != 0 || dx != 0) && at(classes, y + dy, x + dx) == 2) strong_neighbor = true;
+                    }
+                }
+                edges[y * out_width + x] = (edge_class == 2 || (edge_class == 1 && strong_neighbor)) ? 255 : 0;
+            }
+        }
+    }
+
+    pack_edge_rows(edges.data(), out_height, out_width, output_format, mask_threshold, roi.out_stride, out_img, orientation.data());
+
+    if (grad_img && (stages & EDGE_STAGE_GRADIENTS)) {
+        size_t plane_bytes = gradient_plane_bytes(out_size);
+        std::memset(grad_img, 0, 2 * plane_bytes);
+        std::memcpy(grad_img, gradient_x.data(), gradient_x.size() * sizeof(short));
+        std::memcpy(grad_img + plane_bytes, gradient_y.data(), gradient_y.size() * sizeof(short));
+    }
+}
+
+///@brief: Model of image_process_pyramid. Writes levels levels of out_img at their pyramid_level_offset: level 0
+/// is image_process_reference of the input, each further level that of the gray plane halved by 2x2 averaging
+/// with (sum + 2) >> 2 rounding, the odd last row and column dropped. The bytes between levels are left alone
+inline void image_pyramid_reference(
+    const unsigned char* in_img,
+    unsigned char* out_img,
+    int height,
+    int width,
+    int input_format,
+    int output_format,
+    int levels,
+    int mask_threshold = 0)
+{
+    image_process_reference(in_img, out_img, height, width, input_format, output_format, 0, 0, 0, EDGE_OPERATOR_SOBEL3,
+                            EDGE_MAGNITUDE_L1, mask_threshold);
+
+    int bytes_per_pixel = input_bytes_per_pixel(input_format);
+    std::vector<unsigned char> gray((size_t)height * width);
+    for (size_t i = 0; i < gray.size(); i++) {
+        const unsigned char* pixel = in_img + i * bytes_per_pixel;
+        gray[i] = (input_format == INPUT_FORMAT_LUMA8) ? pixel[0] : (pixel[2] * 77 + pixel[1] * 150 + pixel[0] * 29) >> 8;
+    }
+    int level_height = height;
+    int level_width = width;
+    for (int level = 1; level < levels; level++) {
+        int next_height = level_height / 2;
+        int next_width = level_width / 2;
+        std::vector<unsigned char> next((size_t)next_height * next_width);
+        for (int y = 0; y < next_height; y++) {
+            for (int x = 0; x < next_width; x++) {
+                const unsigned char* top = &gray[(size_t)(2 * y) * level_width + 2 * x];
+                const unsigned char* bottom = top + level_width;
+                next[(size_t)y * next_width + x] = (top[0] + top[1] + bottom[0] + bottom[1] + 2) >> 2;
+            }
+        }
+        gray.swap(next);
+        level_height = next_height;
+        level_width = next_width;
+        image_process_reference(gray.data(), out_img + pyramid_level_offset(output_format, height, width, level), level_height, level_width,
+                                INPUT_FORMAT_LUMA8, output_format, 0, 0, 0, EDGE_OPERATOR_SOBEL3, EDGE_MAGNITUDE_L1, mask_threshold);
+    }
+}
+
+#endif
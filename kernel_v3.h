@@ -0,0 +1,1403 @@
+#ifndef KERNEL_V3_H
+#define KERNEL_V3_H
+
+#include <ap_int.h>
+#include <hls_stream.h>
+#include <cmath>
+#include <algorithm>
+#include "image_formats.h"
+
+/// The loop labels name the loops in the HLS reports, a C-simulation build sees them as unused labels
+#if !defined(__SYNTHESIS__) && defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-label"
+#endif
+
+#define MAX_WIDTH KERNEL_MAX_WIDTH
+#define WIDE_BUS_WIDTH 512
+#define PIXELS_PER_BURST (WIDE_BUS_WIDTH / 32)
+#define GRAY_PIXELS_PER_BURST (WIDE_BUS_WIDTH / 8)
+
+///@brief: Pixels handled per clock by the sobel pipeline (1, 4, 8 or 16)
+#ifndef KERNEL_PPC
+#define KERNEL_PPC PIXELS_PER_BURST
+#endif
+
+typedef ap_uint<8> PIXEL_TYPE;
+typedef ap_uint<32> BUS_TYPE;
+typedef ap_uint<WIDE_BUS_WIDTH> WIDE_BUS_TYPE;
+
+///@brief: Gradient direction quantized to 45 degrees, named by the neighbors non-maximum suppression compares
+#define DIRECTION_HORIZONTAL 0      /// left and right
+#define DIRECTION_DIAGONAL_DOWN 1   /// up-left and down-right
+#define DIRECTION_VERTICAL 2        /// up and down
+#define DIRECTION_DIAGONAL_UP 3     /// up-right and down-left
+
+///@brief: PPC edge pixels plus a lane mask, border positions are sent with valid = 0.
+/// direction carries 2 bits per lane from sobel to non-maximum suppression, orientation the 4-bit
+/// orientation_bin of each lane to the OUTPUT_FORMAT_MAG_ORIENT writer
+template <int PPC>
+struct EdgeVec {
+    ap_uint<8 * PPC> pixels;
+    ap_uint<PPC> valid;
+    ap_uint<2 * PPC> direction;
+    ap_uint<4 * PPC> orientation;
+};
+
+///@brief: Signed Gx (low 16 bits) and Gy (high 16 bits) of PPC lanes, from sobel straight to the gradient writer
+template <int PPC>
+struct GradientVec {
+    ap_uint<32 * PPC> gradients;
+    ap_uint<PPC> valid;
+};
+
+#ifndef __SYNTHESIS__
+///@brief: C-sim only loop trip counters, each pipelined loop runs at II=1 so trips ~ cycles
+struct SimTripCounts {
+    long long read_loop = 0;
+    long long sobel_loop = 0;
+    long long write_loop = 0;
+};
+
+inline SimTripCounts& sim_trip_counts() {
+    static SimTripCounts counts;
+    return counts;
+}
+#endif
+
+inline PIXEL_TYPE grayscale_weighted(PIXEL_TYPE r, PIXEL_TYPE g, PIXEL_TYPE b) {
+    #pragma HLS INLINE
+    return (r * 77 + g * 150 + b * 29) >> 8;
+}
+
+///@brief: Pixels the enabled stages run past the end of the image so their last outputs are flushed, each
+/// window stage emits the pixel radius * (width + 1) positions after it has read it. The 3x3 sobel is
+/// covered by the image it drops, wider operators add their extra radius
+inline int stage_flush_pixels(int width, int stages, int operator_radius = 1) {
+    #pragma HLS INLINE
+    int radius_sum = gaussian_radius(stages) + (operator_radius - 1) +
+                     ((stages & EDGE_STAGE_NMS) ? 1 : 0) + ((stages & EDGE_STAGE_THRESHOLD) ? 1 : 0);
+    return radius_sum * (width + 1);
+}
+
+///@brief: Groups every stage of one image handles, the image groups plus the flush
+template <int PPC>
+int stream_group_count(int height, int width, int stages, int operator_radius = 1) {
+    #pragma HLS INLINE
+    return (height * width + stage_flush_pixels(width, stages, operator_radius) + PPC - 1) / PPC;
+}
+
+///@brief: Bytes of the current bursts are queued so pixels may straddle burst boundaries (RGB888),
+/// a new burst is only read once the queue holds less than one group. Groups past total_groups are zeros
+/// that flush the later stages.
+/// With in_stride = 0 the image is one run of height * width pixels from the start of in_img. Otherwise
+/// row r starts at byte (roi_y + r) * in_stride + roi_x * bytes_per_pixel: each row is queued from its
+/// first byte, which may sit anywhere in a burst, and the bytes past its end are dropped, so the rows
+/// reach the later stages back to back as in the dense layout. Crossing to a row whose bytes are not yet
+/// queued costs a clock or two without a group
+template <int PPC>
+void read_and_grayscale(
+    const WIDE_BUS_TYPE* in_img,
+    hls::stream<ap_uint<8 * PPC> >& stream_grayscale,
+    int total_groups,
+    int stream_groups,
+    int input_format,
+    int height,
+    int width,
+    int roi_x = 0,
+    int roi_y = 0,
+    int in_stride = 0)
+{
+    ap_uint<2 * WIDE_BUS_WIDTH> byte_queue = 0;
+    int queued_bytes = 0;
+    int bytes_per_pixel = input_bytes_per_pixel(input_format);
+    int group_bytes = bytes_per_pixel * PPC;
+
+    /// The dense layout is a single segment, the strided one a segment per row
+    bool strided = in_stride != 0;
+    int segment_bytes = (strided ? 1 : height) * width * bytes_per_pixel;
+    int segments_left = strided ? height : 1;
+    int segment_start = strided ? roi_y * in_stride + roi_x * bytes_per_pixel : 0;
+    int burst_index = segment_start / BURST_BYTES;
+    int burst_skip = segment_start % BURST_BYTES;
+    int segment_left = segment_bytes;
+
+    int i = 0;
+    while (i < stream_groups) {
+        #pragma HLS PIPELINE II=1
+#ifndef __SYNTHESIS__
+        sim_trip_counts().read_loop++;
+#endif
+        if (i >= total_groups) {
+            stream_grayscale.write(0);
+            i++;
+            continue;
+        }
+        if (queued_bytes < group_bytes && segments_left > 0) {
+            WIDE_BUS_TYPE burst = in_img[burst_index++];
+            int taken = std::min(BURST_BYTES - burst_skip, segment_left);
+            byte_queue(queued_bytes * 8 + WIDE_BUS_WIDTH - 1, queued_bytes * 8) = burst >> (burst_skip * 8);
+            queued_bytes += taken;
+            segment_left -= taken;
+            burst_skip = 0;
+            if (segment_left == 0) {
+                segments_left--;
+                segment_start += in_stride;
+                burst_index = segment_start / BURST_BYTES;
+                burst_skip = segment_start % BURST_BYTES;
+                segment_left = segment_bytes;
+            }
+        }
+        /// The last group of the image may be short, its lanes past the image are never used
+        if (queued_bytes < group_bytes && segments_left > 0) {
+            continue;
+        }
+        ap_uint<32 * PPC> group_data = byte_queue(32 * PPC - 1, 0);
+
+        ap_uint<8 * PPC> gray_vec;
+        UNPACK_PIXELS:
+        for (int p = 0; p < PPC; p++) {
+            #pragma HLS UNROLL
+            if (input_format == INPUT_FORMAT_LUMA8) {
+                gray_vec((p + 1) * 8 - 1, p * 8) = group_data((p + 1) * 8 - 1, p * 8);
+            } else {
+                int base = p * bytes_per_pixel * 8;
+                PIXEL_TYPE b = group_data(base + 7, base);
+                PIXEL_TYPE g = group_data(base + 15, base + 8);
+                PIXEL_TYPE r = group_data(base + 23, base + 16);
+
+                gray_vec((p + 1) * 8 - 1, p * 8) = grayscale_weighted(r, g, b);
+            }
+        }
+        stream_grayscale.write(gray_vec);
+        i++;
+
+        byte_queue = byte_queue >> (group_bytes * 8);
+        queued_bytes = std::max(queued_bytes - group_bytes, 0);
+    }
+}
+
+///@brief: Rebuilds the group that starts `width` pixels earlier from the two stored groups around it
+template <int PPC, int BITS = 8>
+ap_uint<BITS * PPC> realign_group(ap_uint<BITS * PPC> older, ap_uint<BITS * PPC> newer, int row_shift) {
+    #pragma HLS INLINE
+    ap_uint<2 * BITS * PPC> joined = 0;
+    joined(BITS * PPC - 1, 0) = older;
+    joined(2 * BITS * PPC - 1, BITS * PPC) = newer;
+    ap_uint<2 * BITS * PPC> aligned = joined >> ((PPC - row_shift) * BITS);
+    return aligned(BITS * PPC - 1, 0);
+}
+
+#define LINE_BUFFER_DEPTH(PPC) (MAX_WIDTH / (PPC) + 1)
+
+///@brief: Read pointer start of the line buffers, row_groups entries behind the write pointer
+inline int line_buffer_read_start(int row_groups, int depth) {
+    #pragma HLS INLINE
+    return (row_groups == 0) ? 0 : depth - row_groups;
+}
+
+///@brief: Moves a K x K window of BITS wide values one group along the stream. Line buffers hold PPC values
+/// per entry and are addressed in the linear pixel order of the stream, so rows do not have to start on a
+/// group boundary. window_rows[K - 1] ends with the incoming group and each row above it is `width` pixels
+/// earlier. Entries that are read before they were written only reach windows that are never used, so the
+/// line buffers need no clear: every emitted pixel comes from its centered window of image pixels.
+template <int PPC, int K, int BITS>
+void slide_window(
+    ap_uint<BITS * PPC> incoming,
+    ap_uint<BITS * PPC> line_buffer[K - 1][LINE_BUFFER_DEPTH(PPC)],
+    ap_uint<BITS * PPC> prev_stored[K - 1],
+    ap_uint<BITS> history[K][K - 1],
+    ap_uint<BITS> window_rows[K][PPC + K - 1],
+    int& wr_ptr,
+    int& rd_ptr,
+    int row_groups,
+    int row_shift)
+{
+    #pragma HLS INLINE
+    const int LB_DEPTH = LINE_BUFFER_DEPTH(PPC);
+
+    /// taps[K - 1] is the incoming group, each tap above it is the one `width` pixels earlier
+    ap_uint<BITS * PPC> taps[K];
+    #pragma HLS ARRAY_PARTITION variable=taps complete
+    taps[K - 1] = incoming;
+
+    LINE_BUFFER_TAPS:
+    for (int k = K - 2; k >= 0; k--) {
+        #pragma HLS UNROLL
+        ap_uint<BITS * PPC> stored = (row_groups == 0) ? taps[k + 1] : line_buffer[k][rd_ptr];
+        taps[k] = realign_group<PPC, BITS>(prev_stored[k], stored, row_shift);
+        prev_stored[k] = stored;
+        line_buffer[k][wr_ptr] = taps[k + 1];
+    }
+    wr_ptr = (wr_ptr == LB_DEPTH - 1) ? 0 : wr_ptr + 1;
+    rd_ptr = (rd_ptr == LB_DEPTH - 1) ? 0 : rd_ptr + 1;
+
+    /// Each window row is the carried history followed by the PPC new values
+    BUILD_WINDOW_ROWS:
+    for (int k = 0; k < K; k++) {
+        #pragma HLS UNROLL
+        for (int l = 0; l < K - 1; l++) {
+            #pragma HLS UNROLL
+            window_rows[k][l] = history[k][l];
+        }
+        for (int p = 0; p < PPC; p++) {
+            #pragma HLS UNROLL
+            window_rows[k][K - 1 + p] = taps[k]((p + 1) * BITS - 1, p * BITS);
+        }
+        for (int l = 0; l < K - 1; l++) {
+            #pragma HLS UNROLL
+            history[k][l] = window_rows[k][PPC + l];
+        }
+    }
+}
+
+///@brief: Row and column of linear pixel index -offset, the position of a stream that starts offset pixels early
+inline void stream_start_position(int offset, int width, int& row, int& col) {
+    #pragma HLS INLINE
+    row = -(offset / width);
+    col = -(offset % width);
+    if (col < 0) {
+        col += width;
+        row--;
+    }
+}
+
+inline void advance_position(int& row, int& col, int width) {
+    #pragma HLS INLINE
+    col++;
+    if (col == width) {
+        col = 0;
+        row++;
+    }
+}
+
+///@brief: 3x3 or 5x5 gaussian on the gray stream. The output for pixel i leaves radius * (width + 1) positions
+/// after pixel i came in, pixels closer than radius to the image border pass through unfiltered. With no
+/// gaussian stage enabled the stream is copied through unchanged.
+template <int PPC>
+void gaussian_process(
+    hls::stream<ap_uint<8 * PPC> >& stream_grayscale,
+    hls::stream<ap_uint<8 * PPC> >& stream_blurred,
+    int height,
+    int width,
+    int stream_groups,
+    int stages)
+{
+    const int K = 5;
+    const int LB_DEPTH = LINE_BUFFER_DEPTH(PPC);
+
+    ap_uint<8 * PPC> line_buffer[K - 1][LB_DEPTH];
+    #pragma HLS ARRAY_PARTITION variable=line_buffer complete dim=1
+    #pragma HLS DEPENDENCE variable=line_buffer array inter false
+
+    ap_uint<8 * PPC> prev_stored[K - 1];
+    #pragma HLS ARRAY_PARTITION variable=prev_stored complete
+
+    PIXEL_TYPE history[K][K - 1];
+    #pragma HLS ARRAY_PARTITION variable=history complete dim=0
+
+    const int G3[3] = { 1, 2, 1 };
+    const int G5[5] = { 1, 4, 6, 4, 1 };
+
+    int radius = gaussian_radius(stages);
+    int row_groups = width / PPC;
+    int row_shift = width % PPC;
+    int wr_ptr = 0;
+    int rd_ptr = line_buffer_read_start(row_groups, LB_DEPTH);
+    int row = 0;
+    int col = 0;
+    stream_start_position(radius * (width + 1), width, row, col);
+
+    GAUSSIAN_LOOP:
+    for (int g = 0; g < stream_groups; g++) {
+        #pragma HLS PIPELINE II=1
+        ap_uint<8 * PPC> incoming = stream_grayscale.read();
+
+        PIXEL_TYPE window_rows[K][PPC + K - 1];
+        #pragma HLS ARRAY_PARTITION variable=window_rows complete dim=0
+        slide_window<PPC, K, 8>(incoming, line_buffer, prev_stored, history, window_rows, wr_ptr, rd_ptr, row_groups, row_shift);
+
+        ap_uint<8 * PPC> blurred;
+        GAUSSIAN_LANES:
+        for (int p = 0; p < PPC; p++) {
+            #pragma HLS UNROLL
+            int sum3 = 0;
+            int sum5 = 0;
+            GAUSSIAN_OUTER:
+            for (int kr = 0; kr < K; kr++) {
+                #pragma HLS UNROLL
+                GAUSSIAN_INNER:
+                for (int kc = 0; kc < K; kc++) {
+                    #pragma HLS UNROLL
+                    sum5 += window_rows[kr][p + kc] * G5[kr] * G5[kc];
+                    if (kr >= 2 && kc >= 2) {
+                        sum3 += window_rows[kr][p + kc] * G3[kr - 2] * G3[kc - 2];
+                    }
+                }
+            }
+
+            /// The centre is radius rows up and radius columns left of the incoming pixel
+            bool interior = row >= radius && row < height - radius && col >= radius && col < width - radius;
+            PIXEL_TYPE pixel;
+            if (radius == 2) {
+                pixel = interior ? (PIXEL_TYPE)((sum5 + 128) >> 8) : window_rows[2][p + 2];
+            } else {
+                pixel = interior ? (PIXEL_TYPE)((sum3 + 8) >> 4) : window_rows[3][p + 3];
+            }
+            blurred((p + 1) * 8 - 1, p * 8) = pixel;
+            advance_position(row, col, width);
+        }
+
+        stream_blurred.write(radius == 0 ? incoming : blurred);
+    }
+}
+
+inline ap_uint<2> gradient_direction(int Gx, int Gy) {
+    #pragma HLS INLINE
+    long long ax = abs(Gx);
+    long long ay = abs(Gy);
+    /// tan(22.5) and tan(67.5) in Q15. Gy is positive for a brighter row above, so equal signs of Gx and Gy
+    /// point up-right / down-left. 64-bit products, the sobel7 gradients reach 2^18 and ax * 79109 needs 35 bits
+    if ((ay << 15) < ax * 13573) return DIRECTION_HORIZONTAL;
+    if ((ay << 15) > ax * 79109) return DIRECTION_VERTICAL;
+    return ((Gx < 0) == (Gy < 0)) ? DIRECTION_DIAGONAL_UP : DIRECTION_DIAGONAL_DOWN;
+}
+
+///@brief: Gradient magnitude and direction of every pixel of the gray stream with the operator OP (edge_operators.h).
+/// The stream starts input_delay positions before the image, the delay added by the stages in front of it.
+/// The output keeps the (height - 2) x (width - 2) geometry of the 3x3 sobel for every operator: centers
+/// closer than the operator radius to the border have no full window and are sent as 0. Stream positions
+/// outside that geometry are sent with valid = 0.
+/// GRADIENTS also sends Gx / Gy >> OP::GRAD_SHIFT of every group to stream_gradients, zero where the magnitude is
+/// zeroed, otherwise stream_gradients is left alone
+template <int PPC, class OP, int MAGNITUDE, bool GRADIENTS = false>
+void sobel_process(
+    hls::stream<ap_uint<8 * PPC> >& stream_grayscale,
+    hls::stream<EdgeVec<PPC> >& stream_edge_output,
+    hls::stream<GradientVec<PPC> >& stream_gradients,
+    int height,
+    int width,
+    int stream_groups,
+    int input_delay)
+{
+    const int K = OP::SIZE;
+    const int R = K / 2;
+    const int LB_DEPTH = LINE_BUFFER_DEPTH(PPC);
+
+    ap_uint<8 * PPC> line_buffer[K - 1][LB_DEPTH];
+    #pragma HLS ARRAY_PARTITION variable=line_buffer complete dim=1
+    #pragma HLS DEPENDENCE variable=line_buffer array inter false
+
+    ap_uint<8 * PPC> prev_stored[K - 1];
+    #pragma HLS ARRAY_PARTITION variable=prev_stored complete
+
+    PIXEL_TYPE history[K][K - 1];
+    #pragma HLS ARRAY_PARTITION variable=history complete dim=0
+
+    int row_groups = width / PPC;
+    int row_shift = width % PPC;
+
+    int wr_ptr = 0;
+    int rd_ptr = line_buffer_read_start(row_groups, LB_DEPTH);
+    /// Position of the window center, R rows up and R columns left of the incoming pixel
+    int row = 0;
+    int col = 0;
+    stream_start_position(input_delay + R * (width + 1), width, row, col);
+
+    SOBEL_PROCESS_LOOP:
+    for (int g = 0; g < stream_groups; g++) {
+        #pragma HLS PIPELINE II=1
+#ifndef __SYNTHESIS__
+        sim_trip_counts().sobel_loop++;
+#endif
+        PIXEL_TYPE window_rows[K][PPC + K - 1];
+        #pragma HLS ARRAY_PARTITION variable=window_rows complete dim=0
+        slide_window<PPC, K, 8>(stream_grayscale.read(), line_buffer, prev_stored, history, window_rows,
+                                wr_ptr, rd_ptr, row_groups, row_shift);
+
+        EdgeVec<PPC> edge_vec;
+        GradientVec<PPC> gradient_vec;
+
+        SOBEL_LANES:
+        for (int p = 0; p < PPC; p++) {
+            #pragma HLS UNROLL
+            int Gx = 0;
+            int Gy = 0;
+
+            CONVOLUTION_OUTER:
+            for (int kr = 0; kr < K; kr++) {
+                #pragma HLS UNROLL
+                CONVOLUTION_INNER:
+                for (int kc = 0; kc < K; kc++) {
+                    #pragma HLS UNROLL
+                    Gx += window_rows[kr][p + kc] * (OP::smooth(kr) * OP::derivative(kc));
+                    Gy += window_rows[kr][p + kc] * (-OP::derivative(kr) * OP::smooth(kc));
+                }
+            }
+
+            int ax = abs(Gx);
+            int ay = abs(Gy);
+            int magnitude;
+            if (MAGNITUDE == EDGE_MAGNITUDE_L2) {
+                magnitude = std::max(ax, ay) + ((3 * std::min(ax, ay)) >> 3);
+            } else {
+                magnitude = ax + ay;
+            }
+            int scaled_magnitude = magnitude >> OP::MAG_SHIFT;
+
+            bool full_window = row >= R && row < height - R && col >= R && col < width - R;
+            PIXEL_TYPE edge_pixel = (scaled_magnitude > 255) ? 255 : (scaled_magnitude < 0) ? 0 : scaled_magnitude;
+            edge_vec.pixels((p + 1) * 8 - 1, p * 8) = full_window ? edge_pixel : (PIXEL_TYPE)0;
+            edge_vec.direction((p + 1) * 2 - 1, p * 2) = gradient_direction(Gx, Gy);
+            edge_vec.orientation((p + 1) * 4 - 1, p * 4) = full_window ? orientation_bin(Gx, Gy) : 0;
+            bool valid = row >= 1 && row < height - 1 && col >= 1 && col < width - 1;
+            edge_vec.valid[p] = valid;
+            ap_int<16> gx_value = full_window ? (Gx >> OP::GRAD_SHIFT) : 0;
+            ap_int<16> gy_value = full_window ? (Gy >> OP::GRAD_SHIFT) : 0;
+            gradient_vec.gradients((p + 1) * 32 - 17, p * 32) = gx_value;
+            gradient_vec.gradients((p + 1) * 32 - 1, p * 32 + 16) = gy_value;
+            gradient_vec.valid[p] = valid;
+
+            advance_position(row, col, width);
+        }
+
+        stream_edge_output.write(edge_vec);
+        if (GRADIENTS) {
+            stream_gradients.write(gradient_vec);
+        }
+    }
+}
+
+///@brief: Keeps a magnitude only if it is a maximum across the edge: greater than the neighbor before it and
+/// not less than the one after it along the gradient direction. Neighbors outside the magnitude image count
+/// as 0. Runs one row and one pixel behind sobel, disabled it copies the stream through.
+template <int PPC>
+void nms_process(
+    hls::stream<EdgeVec<PPC> >& stream_edges,
+    hls::stream<EdgeVec<PPC> >& stream_thin,
+    int width,
+    int stream_groups,
+    int stages)
+{
+    /// Window values: bits 14..11 orientation, bit 10 valid, bits 9..8 direction, bits 7..0 magnitude.
+    /// Invalid lanes are stored as 0
+    const int K = 3;
+    const int BITS = 15;
+    const int LB_DEPTH = LINE_BUFFER_DEPTH(PPC);
+
+    ap_uint<BITS * PPC> line_buffer[K - 1][LB_DEPTH];
+    #pragma HLS ARRAY_PARTITION variable=line_buffer complete dim=1
+    #pragma HLS DEPENDENCE variable=line_buffer array inter false
+
+    ap_uint<BITS * PPC> prev_stored[K - 1];
+    #pragma HLS ARRAY_PARTITION variable=prev_stored complete
+
+    ap_uint<BITS> history[K][K - 1];
+    #pragma HLS ARRAY_PARTITION variable=history complete dim=0
+
+    bool enabled = (stages & EDGE_STAGE_NMS) != 0;
+    int row_groups = width / PPC;
+    int row_shift = width % PPC;
+    int wr_ptr = 0;
+    int rd_ptr = line_buffer_read_start(row_groups, LB_DEPTH);
+
+    NMS_LOOP:
+    for (int g = 0; g < stream_groups; g++) {
+        #pragma HLS PIPELINE II=1
+        EdgeVec<PPC> edge_vec = stream_edges.read();
+
+        ap_uint<BITS * PPC> incoming = 0;
+        NMS_PACK_LANES:
+        for (int p = 0; p < PPC; p++) {
+            #pragma HLS UNROLL
+            if (edge_vec.valid[p]) {
+                ap_uint<BITS> value = 0;
+                value(14, 11) = edge_vec.orientation((p + 1) * 4 - 1, p * 4);
+                value[10] = 1;
+                value(9, 8) = edge_vec.direction((p + 1) * 2 - 1, p * 2);
+                value(7, 0) = edge_vec.pixels((p + 1) * 8 - 1, p * 8);
+                incoming((p + 1) * BITS - 1, p * BITS) = value;
+            }
+        }
+
+        ap_uint<BITS> window_rows[K][PPC + K - 1];
+        #pragma HLS ARRAY_PARTITION variable=window_rows complete dim=0
+        slide_window<PPC, K, BITS>(incoming, line_buffer, prev_stored, history, window_rows, wr_ptr, rd_ptr, row_groups, row_shift);
+
+        EdgeVec<PPC> thin_vec;
+        NMS_LANES:
+        for (int p = 0; p < PPC; p++) {
+            #pragma HLS UNROLL
+            ap_uint<BITS> center = window_rows[1][p + 1];
+            ap_uint<2> direction = center(9, 8);
+            PIXEL_TYPE magnitude = center(7, 0);
+            PIXEL_TYPE before;
+            PIXEL_TYPE after;
+            if (direction == DIRECTION_HORIZONTAL) {
+                before = window_rows[1][p](7, 0);
+                after = window_rows[1][p + 2](7, 0);
+            } else if (direction == DIRECTION_DIAGONAL_DOWN) {
+                before = window_rows[0][p](7, 0);
+                after = window_rows[2][p + 2](7, 0);
+            } else if (direction == DIRECTION_VERTICAL) {
+                before = window_rows[0][p + 1](7, 0);
+                after = window_rows[2][p + 1](7, 0);
+            } else {
+                before = window_rows[0][p + 2](7, 0);
+                after = window_rows[2][p](7, 0);
+            }
+            bool maximum = magnitude > before && magnitude >= after;
+            thin_vec.pixels((p + 1) * 8 - 1, p * 8) = maximum ? magnitude : (PIXEL_TYPE)0;
+            thin_vec.direction((p + 1) * 2 - 1, p * 2) = direction;
+            thin_vec.orientation((p + 1) * 4 - 1, p * 4) = center(14, 11);
+            thin_vec.valid[p] = center[10];
+        }
+
+        stream_thin.write(enabled ? thin_vec : edge_vec);
+    }
+}
+
+///@brief: Dual threshold with one step of hysteresis: magnitudes >= high_threshold are edges, magnitudes
+/// >= low_threshold are edges only when one of their 8 neighbors is >= high_threshold. Edges are 255, the
+/// rest 0. Full hysteresis follows weak chains across the whole image and does not stream, one step covers
+/// the gaps NMS leaves in a strong edge. Runs one row and one pixel behind its input, disabled it copies.
+template <int PPC>
+void threshold_process(
+    hls::stream<EdgeVec<PPC> >& stream_thin,
+    hls::stream<EdgeVec<PPC> >& stream_edge_output,
+    int width,
+    int stream_groups,
+    int stages,
+    int low_threshold,
+    int high_threshold)
+{
+    /// Window values: bits 6..3 orientation, bit 2 valid, bits 1..0 class (0 none, 1 weak, 2 strong).
+    /// Invalid lanes are stored as 0
+    const int K = 3;
+    const int BITS = 7;
+    const int LB_DEPTH = LINE_BUFFER_DEPTH(PPC);
+
+    ap_uint<BITS * PPC> line_buffer[K - 1][LB_DEPTH];
+    #pragma HLS ARRAY_PARTITION variable=line_buffer complete dim=1
+    #pragma HLS DEPENDENCE variable=line_buffer array inter false
+
+    ap_uint<BITS * PPC> prev_stored[K - 1];
+    #pragma HLS ARRAY_PARTITION variable=prev_stored complete
+
+    ap_uint<BITS> history[K][K - 1];
+    #pragma HLS ARRAY_PARTITION variable=history complete dim=0
+
+    bool enabled = (stages & EDGE_STAGE_THRESHOLD) != 0;
+    int row_groups = width / PPC;
+    int row_shift = width % PPC;
+    int wr_ptr = 0;
+    int rd_ptr = line_buffer_read_start(row_groups, LB_DEPTH);
+
+    THRESHOLD_LOOP:
+    for (int g = 0; g < stream_groups; g++) {
+        #pragma HLS PIPELINE II=1
+        EdgeVec<PPC> edge_vec = stream_thin.read();
+
+        ap_uint<BITS * PPC> incoming = 0;
+        CLASSIFY_LANES:
+        for (int p = 0; p < PPC; p++) {
+            #pragma HLS UNROLL
+            int magnitude = edge_vec.pixels((p + 1) * 8 - 1, p * 8);
+            ap_uint<BITS> value = 0;
+            if (edge_vec.valid[p]) {
+                value = 4 | ((magnitude >= high_threshold) ? 2 : (magnitude >= low_threshold) ? 1 : 0);
+                value(6, 3) = edge_vec.orientation((p + 1) * 4 - 1, p * 4);
+            }
+            incoming((p + 1) * BITS - 1, p * BITS) = value;
+        }
+
+        ap_uint<BITS> window_rows[K][PPC + K - 1];
+        #pragma HLS ARRAY_PARTITION variable=window_rows complete dim=0
+        slide_window<PPC, K, BITS>(incoming, line_buffer, prev_stored, history, window_rows, wr_ptr, rd_ptr, row_groups, row_shift);
+
+        EdgeVec<PPC> binary_vec;
+        HYSTERESIS_LANES:
+        for (int p = 0; p < PPC; p++) {
+            #pragma HLS UNROLL
+            ap_uint<BITS> center = window_rows[1][p + 1];
+            bool strong_neighbor = false;
+            NEIGHBOR_ROWS:
+            for (int kr = 0; kr < K; kr++) {
+                #pragma HLS UNROLL
+                NEIGHBOR_COLS:
+                for (int kc = 0; kc < K; kc++) {
+                    #pragma HLS UNROLL
+                    if ((kr != 1 || kc != 1) && window_rows[kr][p + kc](1, 0) == 2) {
+                        strong_neighbor = true;
+                    }
+                }
+            }
+            ap_uint<2> edge_class = center(1, 0);
+            bool edge = edge_class == 2 || (edge_class == 1 && strong_neighbor);
+            binary_vec.pixels((p + 1) * 8 - 1, p * 8) = edge ? 255 : 0;
+            binary_vec.direction((p + 1) * 2 - 1, p * 2) = 0;
+            binary_vec.orientation((p + 1) * 4 - 1, p * 4) = center(6, 3);
+            binary_vec.valid[p] = center[2];
+        }
+
+        stream_edge_output.write(enabled ? binary_vec : edge_vec);
+    }
+}
+
+inline WIDE_BUS_TYPE pack_edge_burst(const PIXEL_TYPE pixels[GRAY_PIXELS_PER_BURST], const ap_uint<4> orientations[GRAY_PIXELS_PER_BURST],
+                                     int count, int output_format) {
+    #pragma HLS INLINE
+    WIDE_BUS_TYPE wide_data = 0;
+    if (output_format == OUTPUT_FORMAT_MAG_ORIENT) {
+        PACK_MAG_ORIENT_PIXELS:
+        for (int p = 0; p < GRAY_PIXELS_PER_BURST / 2; p++) {
+            #pragma HLS UNROLL
+            if (p < count) {
+                wide_data((p + 1) * 16 - 9, p * 16) = pixels[p];
+                wide_data((p + 1) * 16 - 1, p * 16 + 8) = orientations[p];
+            }
+        }
+    } else if (output_format == OUTPUT_FORMAT_GRAY8) {
+        PACK_GRAY_PIXELS:
+        for (int p = 0; p < GRAY_PIXELS_PER_BURST; p++) {
+            #pragma HLS UNROLL
+            if (p < count) {
+                wide_data((p + 1) * 8 - 1, p * 8) = pixels[p];
+            }
+        }
+    } else {
+        PACK_PIXELS:
+        for (int p = 0; p < PIXELS_PER_BURST; p++) {
+            #pragma HLS UNROLL
+            if (p < count) {
+                BUS_TYPE edge_pixel = pixels[p];
+                BUS_TYPE pixel_32 = (edge_pixel << 16) | (edge_pixel << 8) | edge_pixel;
+                wide_data((p + 1) * 32 - 1, p * 32) = pixel_32;
+            }
+        }
+    }
+    return wide_data;
+}
+
+///@brief: Compacts the valid lanes of each group into dense bursts of the selected output format, MAG_ORIENT
+/// pairs each edge value with the lane's orientation bin. The mask formats set a pixel when its edge value is >= mask_threshold: BIT1 packs the bits, RLE turns each row of
+/// out_width pixels into background / edge run lengths. The RLE runs start after the row table, which is kept
+/// on chip while the image streams and written once the last row has ended (layout in image_formats.h).
+/// A non-zero out_stride (bytes, a multiple of BURST_BYTES) starts output row r at burst r * out_stride / 64
+/// for the pixel formats and BIT1: the lanes are taken up to the end of a row, the row's last burst is
+/// padded with zeros and written, and the next row starts on a fresh burst. The bursts between rows are
+/// not touched. Each row end costs up to two clocks without a new group
+template <int PPC>
+void write_and_pack(
+    WIDE_BUS_TYPE* out_img,
+    hls::stream<EdgeVec<PPC> >& stream_edge_output,
+    int total_groups,
+    int output_format,
+    int out_height,
+    int out_width,
+    int mask_threshold,
+    int out_stride = 0)
+{
+    const int RUNS_PER_BURST = WIDE_BUS_WIDTH / 16;
+    const int TABLE_WORDS_PER_BURST = WIDE_BUS_WIDTH / 32;
+    const int PENDING_PIXELS = 2 * GRAY_PIXELS_PER_BURST + PPC;
+
+    /// A padded row end leaves at most two bursts pending
+    PIXEL_TYPE pending[PENDING_PIXELS];
+    #pragma HLS ARRAY_PARTITION variable=pending complete
+    ap_uint<4> pending_orientation[PENDING_PIXELS];
+    #pragma HLS ARRAY_PARTITION variable=pending_orientation complete
+    ap_uint<2 * WIDE_BUS_WIDTH + PPC> pending_bits = 0;
+    /// A lane adds at most two runs: the one its value change closes and the last one of its row
+    ap_uint<16> pending_runs[RUNS_PER_BURST + 2 * PPC];
+    #pragma HLS ARRAY_PARTITION variable=pending_runs complete
+    /// Up to PPC rows end per group, cyclic banks take them in one clock and a whole burst on the way out
+    ap_uint<32> row_table[RLE_MAX_ROWS];
+    #pragma HLS ARRAY_PARTITION variable=row_table cyclic factor=16
+
+    bool rle = output_format == OUTPUT_FORMAT_RLE;
+    bool bit1 = output_format == OUTPUT_FORMAT_BIT1;
+    /// RLE rows are found through the row table, its runs stay dense
+    bool strided = out_stride != 0 && !rle;
+    int stride_bursts = out_stride / BURST_BYTES;
+    int pending_count = 0;
+    int table_bursts = (out_height + TABLE_WORDS_PER_BURST - 1) / TABLE_WORDS_PER_BURST;
+    int out_burst = rle ? table_bursts : 0;
+    int burst_pixels = (output_format == OUTPUT_FORMAT_GRAY8) ? GRAY_PIXELS_PER_BURST :
+                       (output_format == OUTPUT_FORMAT_MAG_ORIENT) ? GRAY_PIXELS_PER_BURST / 2 : PIXELS_PER_BURST;
+    /// pending_count units that fill one burst: pixels, bits or runs
+    int burst_units = rle ? RUNS_PER_BURST : bit1 ? WIDE_BUS_WIDTH : burst_pixels;
+
+    bool run_edge = false;
+    int run_length = 0;
+    int run_total = 0;
+    int row = 0;
+    int col = 0;
+
+    EdgeVec<PPC> edge_vec;
+    int lane = PPC;
+    int groups_read = 0;
+
+    WRITE_GROUP_LOOP:
+    while (groups_read < total_groups || lane < PPC || pending_count >= burst_units) {
+        #pragma HLS PIPELINE II=1
+#ifndef __SYNTHESIS__
+        sim_trip_counts().write_loop++;
+#endif
+        /// Takes lanes only while no full burst is waiting, a strided row end already filled one
+        if (pending_count < burst_units) {
+            if (lane == PPC) {
+                edge_vec = stream_edge_output.read();
+                groups_read++;
+                lane = 0;
+            }
+            int first_lane = lane;
+            bool row_ended = false;
+            int row_end_count = 0;
+
+            COMPACT_LANES:
+            for (int p = 0; p < PPC; p++) {
+                #pragma HLS UNROLL
+                if (p >= first_lane && !row_ended) {
+                    lane = p + 1;
+                    if (edge_vec.valid[p]) {
+                        PIXEL_TYPE pixel = edge_vec.pixels((p + 1) * 8 - 1, p * 8);
+                        bool edge = pixel >= mask_threshold;
+                        if (strided && col == 0) {
+                            out_burst = row * stride_bursts;
+                        }
+                        if (rle) {
+                            if (edge != run_edge) {
+                                pending_runs[pending_count++] = run_length;
+                                run_total++;
+                                run_edge = edge;
+                                run_length = 0;
+                            }
+                            run_length++;
+                        } else if (bit1) {
+                            pending_bits[pending_count++] = edge;
+                        } else {
+                            pending_orientation[pending_count] = edge_vec.orientation((p + 1) * 4 - 1, p * 4);
+                            pending[pending_count++] = pixel;
+                        }
+                        col++;
+                        if (col == out_width) {
+                            if (rle) {
+                                pending_runs[pending_count++] = run_length;
+                                run_total++;
+                                if (row < RLE_MAX_ROWS) {
+                                    row_table[row] = run_total;
+                                }
+                                run_edge = false;
+                                run_length = 0;
+                            }
+                            row++;
+                            col = 0;
+                            if (strided) {
+                                row_ended = true;
+                                row_end_count = pending_count;
+                            }
+                        }
+                    }
+                }
+            }
+
+            if (row_ended) {
+                int padded_count = (row_end_count + burst_units - 1) & ~(burst_units - 1);
+                PAD_ROW:
+                for (int k = 0; k < PENDING_PIXELS; k++) {
+                    #pragma HLS UNROLL
+                    if (k >= row_end_count && k < padded_count) {
+                        pending[k] = 0;
+                        pending_orientation[k] = 0;
+                    }
+                }
+                pending_count = padded_count;
+            }
+        }
+
+        bool full = pending_count >= burst_units;
+        if (full) {
+            WIDE_BUS_TYPE wide_data;
+            if (rle) {
+                PACK_RUNS:
+                for (int k = 0; k < RUNS_PER_BURST; k++) {
+                    #pragma HLS UNROLL
+                    wide_data((k + 1) * 16 - 1, k * 16) = pending_runs[k];
+                }
+                SHIFT_RUNS:
+                for (int k = 0; k < 2 * PPC; k++) {
+                    #pragma HLS UNROLL
+                    pending_runs[k] = pending_runs[k + RUNS_PER_BURST];
+                }
+            } else if (bit1) {
+                wide_data = pending_bits(WIDE_BUS_WIDTH - 1, 0);
+                pending_bits = pending_bits >> WIDE_BUS_WIDTH;
+            } else {
+                wide_data = pack_edge_burst(pending, pending_orientation, burst_pixels, output_format);
+                SHIFT_PENDING:
+                for (int p = 0; p < GRAY_PIXELS_PER_BURST + PPC; p++) {
+                    #pragma HLS UNROLL
+                    pending[p] = pending[p + burst_pixels];
+                    pending_orientation[p] = pending_orientation[p + burst_pixels];
+                }
+            }
+            pending_count -= burst_units;
+            out_img[out_burst++] = wide_data;
+        }
+    }
+
+    if (pending_count > 0) {
+        WIDE_BUS_TYPE wide_data = 0;
+        if (rle) {
+            PACK_LAST_RUNS:
+            for (int k = 0; k < RUNS_PER_BURST; k++) {
+                #pragma HLS UNROLL
+                if (k < pending_count) {
+                    wide_data((k + 1) * 16 - 1, k * 16) = pending_runs[k];
+                }
+            }
+        } else if (bit1) {
+            wide_data = pending_bits(WIDE_BUS_WIDTH - 1, 0);
+        } else {
+            wide_data = pack_edge_burst(pending, pending_orientation, pending_count, output_format);
+        }
+        out_img[out_burst] = wide_data;
+    }
+
+    if (rle) {
+        WRITE_ROW_TABLE:
+        for (int b = 0; b < table_bursts; b++) {
+            #pragma HLS PIPELINE II=1
+            WIDE_BUS_TYPE wide_data = 0;
+            PACK_TABLE:
+            for (int k = 0; k < TABLE_WORDS_PER_BURST; k++) {
+                #pragma HLS UNROLL
+                int r = b * TABLE_WORDS_PER_BURST + k;
+                if (r < out_height && r < RLE_MAX_ROWS) {
+                    wide_data((k + 1) * 32 - 1, k * 32) = row_table[r];
+                }
+            }
+            out_img[b] = wide_data;
+        }
+    }
+}
+
+///@brief: Writes the Gx and Gy planes (gradient_buffer_bytes in image_formats.h) from the valid lanes of each group.
+/// Both planes fill a burst every 32 pixels, a group is read only while neither has a full burst waiting, so
+/// the two writes of a burst pair take two clocks and PPC = 16 still moves one group per clock.
+/// Disabled it only drains the stream
+template <int PPC>
+void write_gradients(
+    WIDE_BUS_TYPE* grad_img,
+    hls::stream<GradientVec<PPC> >& stream_gradients,
+    int stream_groups,
+    int out_pixels,
+    bool enabled)
+{
+    const int VALUES_PER_BURST = WIDE_BUS_WIDTH / 16;
+    const int PENDING_VALUES = VALUES_PER_BURST + PPC;
+
+    if (!enabled) {
+        DRAIN_GRADIENTS_LOOP:
+        for (int g = 0; g < stream_groups; g++) {
+            #pragma HLS PIPELINE II=1
+            stream_gradients.read();
+        }
+        return;
+    }
+
+    ap_int<16> pending_gx[PENDING_VALUES];
+    #pragma HLS ARRAY_PARTITION variable=pending_gx complete
+    ap_int<16> pending_gy[PENDING_VALUES];
+    #pragma HLS ARRAY_PARTITION variable=pending_gy complete
+    int gx_count = 0;
+    int gy_count = 0;
+    int gx_burst = 0;
+    int gy_burst = (out_pixels + VALUES_PER_BURST - 1) / VALUES_PER_BURST;
+    int groups_read = 0;
+
+    WRITE_GRADIENTS_LOOP:
+    while (groups_read < stream_groups || gx_count >= VALUES_PER_BURST || gy_count >= VALUES_PER_BURST) {
+        #pragma HLS PIPELINE II=1
+        if (gx_count < VALUES_PER_BURST && gy_count < VALUES_PER_BURST) {
+            GradientVec<PPC> gradient_vec = stream_gradients.read();
+            groups_read++;
+            COMPACT_GRADIENT_LANES:
+            for (int p = 0; p < PPC; p++) {
+                #pragma HLS UNROLL
+                if (gradient_vec.valid[p]) {
+                    pending_gx[gx_count++] = gradient_vec.gradients((p + 1) * 32 - 17, p * 32);
+                    pending_gy[gy_count++] = gradient_vec.gradients((p + 1) * 32 - 1, p * 32 + 16);
+                }
+            }
+        }
+
+        if (gx_count >= VALUES_PER_BURST || gy_count >= VALUES_PER_BURST) {
+            bool gx_full = gx_count >= VALUES_PER_BURST;
+            WIDE_BUS_TYPE wide_data;
+            PACK_GRADIENTS:
+            for (int k = 0; k < VALUES_PER_BURST; k++) {
+                #pragma HLS UNROLL
+                wide_data((k + 1) * 16 - 1, k * 16) = gx_full ? pending_gx[k] : pending_gy[k];
+            }
+            SHIFT_GRADIENTS:
+            for (int k = 0; k < PPC; k++) {
+                #pragma HLS UNROLL
+                if (gx_full) {
+                    pending_gx[k] = pending_gx[k + VALUES_PER_BURST];
+                } else {
+                    pending_gy[k] = pending_gy[k + VALUES_PER_BURST];
+                }
+            }
+            if (gx_full) {
+                gx_count -= VALUES_PER_BURST;
+                grad_img[gx_burst++] = wide_data;
+            } else {
+                gy_count -= VALUES_PER_BURST;
+                grad_img[gy_burst++] = wide_data;
+            }
+        }
+    }
+
+    if (gx_count > 0) {
+        WIDE_BUS_TYPE gx_data = 0;
+        WIDE_BUS_TYPE gy_data = 0;
+        PACK_LAST_GRADIENTS:
+        for (int k = 0; k < VALUES_PER_BURST; k++) {
+            #pragma HLS UNROLL
+            if (k < gx_count) {
+                gx_data((k + 1) * 16 - 1, k * 16) = pending_gx[k];
+                gy_data((k + 1) * 16 - 1, k * 16) = pending_gy[k];
+            }
+        }
+        grad_img[gx_burst] = gx_data;
+        grad_img[gy_burst] = gy_data;
+    }
+}
+
+///@brief: grayscale -> gaussian -> sobel -> nms -> threshold -> pack, PPC pixels per iteration. The optional
+/// stages are selected at run time by the stages register and copy their input through when disabled, the
+/// gradient operator and magnitude are compiled in, one kernel per combination.
+/// height x width is the region processed, roi_x / roi_y / in_stride place it in a larger frame in in_img and
+/// out_stride spaces the output rows (ImageRoi in image_formats.h), all 0 for a dense image.
+/// EDGE_STAGE_GRADIENTS writes the Gx / Gy planes to grad_img next to the edge output
+template <int PPC, class OP = Sobel3Operator, int MAGNITUDE = EDGE_MAGNITUDE_L1>
+void sobel_dataflow(
+    const WIDE_BUS_TYPE* in_img,
+    WIDE_BUS_TYPE* out_img,
+    int height,
+    int width,
+    int input_format,
+    int output_format,
+    int stages = 0,
+    int low_threshold = 0,
+    int high_threshold = 0,
+    int mask_threshold = 0,
+    int roi_x = 0,
+    int roi_y = 0,
+    int in_stride = 0,
+    int out_stride = 0,
+    WIDE_BUS_TYPE* grad_img = 0)
+{
+    #pragma HLS DATAFLOW
+
+    hls::stream<ap_uint<8 * PPC> > stream_grayscale("grayscale_stream");
+    hls::stream<ap_uint<8 * PPC> > stream_blurred("blurred_stream");
+    hls::stream<EdgeVec<PPC> > stream_edges("edge_stream");
+    hls::stream<EdgeVec<PPC> > stream_thin("thin_edge_stream");
+    hls::stream<EdgeVec<PPC> > stream_edge_output("edge_output_stream");
+    /// The gradient writer runs beside nms and threshold, the gradients reach it rows before their edge values
+    hls::stream<GradientVec<PPC> > stream_gradients("gradient_stream");
+
+    int total_pixels = height * width;
+    int total_groups = (total_pixels + PPC - 1) / PPC;
+    int stream_groups = stream_group_count<PPC>(height, width, stages, OP::SIZE / 2);
+    int sobel_delay = gaussian_radius(stages) * (width + 1);
+
+    read_and_grayscale<PPC>(in_img, stream_grayscale, total_groups, stream_groups, input_format, height, width, roi_x, roi_y, in_stride);
+    gaussian_process<PPC>(stream_grayscale, stream_blurred, height, width, stream_groups, stages);
+    sobel_process<PPC, OP, MAGNITUDE, true>(stream_blurred, stream_edges, stream_gradients, height, width, stream_groups, sobel_delay);
+    nms_process<PPC>(stream_edges, stream_thin, width, stream_groups, stages);
+    threshold_process<PPC>(stream_thin, stream_edge_output, width, stream_groups, stages, low_threshold, high_threshold);
+    write_and_pack<PPC>(out_img, stream_edge_output, stream_groups, output_format, height - 2, width - 2, mask_threshold, out_stride);
+    write_gradients<PPC>(grad_img, stream_gradients, stream_groups, (height - 2) * (width - 2), (stages & EDGE_STAGE_GRADIENTS) != 0);
+}
+
+struct BatchDescriptor {
+    int in_offset;
+    int out_offset;
+    int height;
+    int width;
+    int roi_x;
+    int roi_y;
+    int in_stride;
+    int out_stride;
+};
+
+///@brief: Fans every descriptor out to the six stages so each stage can move on to the next image on its own
+inline void read_descriptors(
+    const BUS_TYPE* descriptors,
+    int image_count,
+    hls::stream<BatchDescriptor>& to_read,
+    hls::stream<BatchDescriptor>& to_gaussian,
+    hls::stream<BatchDescriptor>& to_sobel,
+    hls::stream<BatchDescriptor>& to_nms,
+    hls::stream<BatchDescriptor>& to_threshold,
+    hls::stream<BatchDescriptor>& to_write)
+{
+    for (int i = 0; i < image_count; i++) {
+        #pragma HLS PIPELINE II=DESCRIPTOR_WORDS
+        BatchDescriptor descriptor;
+        descriptor.in_offset = descriptors[i * DESCRIPTOR_WORDS];
+        descriptor.out_offset = descriptors[i * DESCRIPTOR_WORDS + 1];
+        descriptor.height = descriptors[i * DESCRIPTOR_WORDS + 2];
+        descriptor.width = descriptors[i * DESCRIPTOR_WORDS + 3];
+        descriptor.roi_x = descriptors[i * DESCRIPTOR_WORDS + 4];
+        descriptor.roi_y = descriptors[i * DESCRIPTOR_WORDS + 5];
+        descriptor.in_stride = descriptors[i * DESCRIPTOR_WORDS + 6];
+        descriptor.out_stride = descriptors[i * DESCRIPTOR_WORDS + 7];
+        to_read.write(descriptor);
+        to_gaussian.write(descriptor);
+        to_sobel.write(descriptor);
+        to_nms.write(descriptor);
+        to_threshold.write(descriptor);
+        to_write.write(descriptor);
+    }
+}
+
+template <int PPC>
+void read_batch(
+    const WIDE_BUS_TYPE* in_img,
+    hls::stream<BatchDescriptor>& descriptors,
+    hls::stream<ap_uint<8 * PPC> >& stream_grayscale,
+    int image_count,
+    int input_format,
+    int stages,
+    int operator_radius)
+{
+    for (int i = 0; i < image_count; i++) {
+        BatchDescriptor descriptor = descriptors.read();
+        int total_groups = (descriptor.height * descriptor.width + PPC - 1) / PPC;
+        int stream_groups = stream_group_count<PPC>(descriptor.height, descriptor.width, stages, operator_radius);
+        read_and_grayscale<PPC>(in_img + descriptor.in_offset, stream_grayscale, total_groups, stream_groups, input_format,
+                                descriptor.height, descriptor.width, descriptor.roi_x, descriptor.roi_y, descriptor.in_stride);
+    }
+}
+
+template <int PPC>
+void gaussian_batch(
+    hls::stream<ap_uint<8 * PPC> >& stream_grayscale,
+    hls::stream<BatchDescriptor>& descriptors,
+    hls::stream<ap_uint<8 * PPC> >& stream_blurred,
+    int image_count,
+    int stages,
+    int operator_radius)
+{
+    for (int i = 0; i < image_count; i++) {
+        BatchDescriptor descriptor = descriptors.read();
+        int stream_groups = stream_group_count<PPC>(descriptor.height, descriptor.width, stages, operator_radius);
+        gaussian_process<PPC>(stream_grayscale, stream_blurred, descriptor.height, descriptor.width, stream_groups, stages);
+    }
+}
+
+template <int PPC, class OP, int MAGNITUDE>
+void sobel_batch(
+    hls::stream<ap_uint<8 * PPC> >& stream_grayscale,
+    hls::stream<BatchDescriptor>& descriptors,
+    hls::stream<EdgeVec<PPC> >& stream_edge_output,
+    int image_count,
+    int stages)
+{
+    /// The batch kernel has no gradient port, sobel_process never writes this stream
+    hls::stream<GradientVec<PPC> > unused_gradients("unused_gradient_stream");
+
+    for (int i = 0; i < image_count; i++) {
+        BatchDescriptor descriptor = descriptors.read();
+        int stream_groups = stream_group_count<PPC>(descriptor.height, descriptor.width, stages, OP::SIZE / 2);
+        sobel_process<PPC, OP, MAGNITUDE>(stream_grayscale, stream_edge_output, unused_gradients, descriptor.height, descriptor.width,
+                                          stream_groups, gaussian_radius(stages) * (descriptor.width + 1));
+    }
+}
+
+template <int PPC>
+void nms_batch(
+    hls::stream<EdgeVec<PPC> >& stream_edges,
+    hls::stream<BatchDescriptor>& descriptors,
+    hls::stream<EdgeVec<PPC> >& stream_thin,
+    int image_count,
+    int stages,
+    int operator_radius)
+{
+    for (int i = 0; i < image_count; i++) {
+        BatchDescriptor descriptor = descriptors.read();
+        int stream_groups = stream_group_count<PPC>(descriptor.height, descriptor.width, stages, operator_radius);
+        nms_process<PPC>(stream_edges, stream_thin, descriptor.width, stream_groups, stages);
+    }
+}
+
+template <int PPC>
+void threshold_batch(
+    hls::stream<EdgeVec<PPC> >& stream_thin,
+    hls::stream<BatchDescriptor>& descriptors,
+    hls::stream<EdgeVec<PPC> >& stream_edge_output,
+    int image_count,
+    int stages,
+    int low_threshold,
+    int high_threshold,
+    int operator_radius)
+{
+    for (int i = 0; i < image_count; i++) {
+        BatchDescriptor descriptor = descriptors.read();
+        int stream_groups = stream_group_count<PPC>(descriptor.height, descriptor.width, stages, operator_radius);
+        threshold_process<PPC>(stream_thin, stream_edge_output, descriptor.width, stream_groups, stages, low_threshold, high_threshold);
+    }
+}
+
+template <int PPC>
+void write_batch(
+    WIDE_BUS_TYPE* out_img,
+    hls::stream<BatchDescriptor>& descriptors,
+    hls::stream<EdgeVec<PPC> >& stream_edge_output,
+    int image_count,
+    int output_format,
+    int stages,
+    int mask_threshold,
+    int operator_radius)
+{
+    for (int i = 0; i < image_count; i++) {
+        BatchDescriptor descriptor = descriptors.read();
+        int stream_groups = stream_group_count<PPC>(descriptor.height, descriptor.width, stages, operator_radius);
+        write_and_pack<PPC>(out_img + descriptor.out_offset, stream_edge_output, stream_groups, output_format,
+                            descriptor.height - 2, descriptor.width - 2, mask_threshold, descriptor.out_stride);
+    }
+}
+
+///@brief: sobel_dataflow over a descriptor table. The stages stay live across images, so the read of image
+/// i + 1 overlaps the sobel and write of image i and the launch cost is paid once per table. The stage
+/// selection and thresholds apply to every image of the table. Descriptors may point at regions of one
+/// frame, several of them sharing in_offset
+template <int PPC, class OP = Sobel3Operator, int MAGNITUDE = EDGE_MAGNITUDE_L1>
+void sobel_batch_dataflow(
+    const WIDE_BUS_TYPE* in_img,
+    WIDE_BUS_TYPE* out_img,
+    const BUS_TYPE* descriptors,
+    int image_count,
+    int input_format,
+    int output_format,
+    int stages = 0,
+    int low_threshold = 0,
+    int high_threshold = 0,
+    int mask_threshold = 0)
+{
+    #pragma HLS DATAFLOW
+
+    hls::stream<BatchDescriptor> read_descriptor_stream("read_descriptor_stream");
+    hls::stream<BatchDescriptor> gaussian_descriptor_stream("gaussian_descriptor_stream");
+    hls::stream<BatchDescriptor> sobel_descriptor_stream("sobel_descriptor_stream");
+    hls::stream<BatchDescriptor> nms_descriptor_stream("nms_descriptor_stream");
+    hls::stream<BatchDescriptor> threshold_descriptor_stream("threshold_descriptor_stream");
+    hls::stream<BatchDescriptor> write_descriptor_stream("write_descriptor_stream");
+    #pragma HLS STREAM variable=read_descriptor_stream depth=4
+    #pragma HLS STREAM variable=gaussian_descriptor_stream depth=4
+    #pragma HLS STREAM variable=sobel_descriptor_stream depth=4
+    #pragma HLS STREAM variable=nms_descriptor_stream depth=4
+    #pragma HLS STREAM variable=threshold_descriptor_stream depth=4
+    #pragma HLS STREAM variable=write_descriptor_stream depth=4
+    hls::stream<ap_uint<8 * PPC> > stream_grayscale("grayscale_stream");
+    hls::stream<ap_uint<8 * PPC> > stream_blurred("blurred_stream");
+    hls::stream<EdgeVec<PPC> > stream_edges("edge_stream");
+    hls::stream<EdgeVec<PPC> > stream_thin("thin_edge_stream");
+    hls::stream<EdgeVec<PPC> > stream_edge_output("edge_output_stream");
+
+    read_descriptors(descriptors, image_count, read_descriptor_stream, gaussian_descriptor_stream, sobel_descriptor_stream,
+                     nms_descriptor_stream, threshold_descriptor_stream, write_descriptor_stream);
+    const int operator_radius = OP::SIZE / 2;
+    read_batch<PPC>(in_img, read_descriptor_stream, stream_grayscale, image_count, input_format, stages, operator_radius);
+    gaussian_batch<PPC>(stream_grayscale, gaussian_descriptor_stream, stream_blurred, image_count, stages, operator_radius);
+    sobel_batch<PPC, OP, MAGNITUDE>(stream_blurred, sobel_descriptor_stream, stream_edges, image_count, stages);
+    nms_batch<PPC>(stream_edges, nms_descriptor_stream, stream_thin, image_count, stages, operator_radius);
+    threshold_batch<PPC>(stream_thin, threshold_descriptor_stream, stream_edge_output, image_count, stages, low_threshold,
+                         high_threshold, operator_radius);
+    write_batch<PPC>(out_img, write_descriptor_stream, stream_edge_output, image_count, output_format, stages, mask_threshold,
+                     operator_radius);
+}
+
+///@brief: Copies the gray stream of one pyramid level to its sobel and, when the next level is on, to the
+/// decimator that builds it
+template <int PPC>
+void pyramid_split(
+    hls::stream<ap_uint<8 * PPC> >& stream_grayscale,
+    hls::stream<ap_uint<8 * PPC> >& stream_to_sobel,
+    hls::stream<ap_uint<8 * PPC> >& stream_to_next,
+    int stream_groups,
+    bool next_level)
+{
+    for (int g = 0; g < stream_groups; g++) {
+        #pragma HLS PIPELINE II=1
+        ap_uint<8 * PPC> group = stream_grayscale.read();
+        stream_to_sobel.write(group);
+        if (next_level) {
+            stream_to_next.write(group);
+        }
+    }
+}
+
+///@brief: The next pyramid level of a height x width gray stream: each output pixel is the rounded mean of a
+/// 2x2 block, (a + b + c + d + 2) >> 2, an odd last row or column is dropped. Even rows leave their pair sums
+/// in a half row buffer, odd rows complete them, so the output comes in bursts on every other row and a quarter
+/// of the input rate overall. It is packed PPC pixels per group back into linear order and followed by zero
+/// groups up to out_groups, the stream length of the next level. The input is read at one group per clock
+template <int PPC>
+void pyramid_decimate(
+    hls::stream<ap_uint<8 * PPC> >& stream_grayscale,
+    hls::stream<ap_uint<8 * PPC> >& stream_decimated,
+    int height,
+    int width,
+    int in_groups,
+    int out_groups)
+{
+    ap_uint<9> pair_sums[MAX_WIDTH / 2];
+    #pragma HLS ARRAY_PARTITION variable=pair_sums cyclic factor=PPC
+    #pragma HLS DEPENDENCE variable=pair_sums inter false
+
+    /// Up to PPC / 2 + 1 pixels join per group and PPC leave whenever that many are there
+    PIXEL_TYPE pending[2 * PPC];
+    #pragma HLS ARRAY_PARTITION variable=pending complete
+    int pending_count = 0;
+
+    int used_rows = (height / 2) * 2;
+    int used_cols = (width / 2) * 2;
+    int row = 0;
+    int col = 0;
+    ap_uint<8> held = 0;
+    int groups_read = 0;
+    int groups_written = 0;
+
+    while (groups_read < in_groups || groups_written < out_groups) {
+        #pragma HLS PIPELINE II=1
+        if (pending_count < PPC && groups_read < in_groups) {
+            ap_uint<8 * PPC> group = stream_grayscale.read();
+            groups_read++;
+            DECIMATE_LANES:
+            for (int p = 0; p < PPC; p++) {
+                #pragma HLS UNROLL
+                ap_uint<8> pixel = group((p + 1) * 8 - 1, p * 8);
+                if (row < used_rows && col < used_cols) {
+                    if ((col & 1) == 0) {
+                        held = pixel;
+                    } else if ((row & 1) == 0) {
+                        pair_sums[col >> 1] = held + pixel;
+                    } else {
+                        int sum = pair_sums[col >> 1] + held + pixel;
+                        pending[pending_count++] = (sum + 2) >> 2;
+                    }
+                }
+                advance_position(row, col, width);
+            }
+        }
+
+        /// After the last input group whatever is pending goes out, then the zero groups
+        if (groups_written < out_groups && (pending_count >= PPC || groups_read == in_groups)) {
+            ap_uint<8 * PPC> decimated = 0;
+            PACK_DECIMATED:
+            for (int p = 0; p < PPC; p++) {
+                #pragma HLS UNROLL
+                if (p < pending_count) {
+                    decimated((p + 1) * 8 - 1, p * 8) = pending[p];
+                }
+            }
+            SHIFT_DECIMATED:
+            for (int p = 0; p < PPC; p++) {
+                #pragma HLS UNROLL
+                pending[p] = pending[p + PPC];
+            }
+            pending_count = std::max(pending_count - PPC, 0);
+            stream_decimated.write(decimated);
+            groups_written++;
+        }
+    }
+}
+
+///@brief: sobel_process for one pyramid level, a level that is off (no groups) is skipped
+template <int PPC>
+void pyramid_sobel(
+    hls::stream<ap_uint<8 * PPC> >& stream_grayscale,
+    hls::stream<EdgeVec<PPC> >& stream_edge_output,
+    int height,
+    int width,
+    int stream_groups)
+{
+    /// The pyramid kernel has no gradient port, sobel_process never writes this stream
+    hls::stream<GradientVec<PPC> > unused_gradients("unused_gradient_stream");
+    if (stream_groups == 0) {
+        return;
+    }
+    sobel_process<PPC, Sobel3Operator, EDGE_MAGNITUDE_L1>(stream_grayscale, stream_edge_output, unused_gradients, height, width, stream_groups, 0);
+}
+
+///@brief: The plain sobel of an image and of its 2x2 averaged halvings (image_formats.h) in one pass over the
+/// input. The gray stream of each level feeds that level's sobel and the decimator building the next level, and
+/// every level has its own sobel and writer, so all levels run at once while the input streams in once. Each
+/// level down has a quarter of the pixels of the one above, its stages idle most clocks and only cost area.
+/// levels (1 .. PYRAMID_MAX_LEVELS) turns the coarser levels on, level l goes to out_levels[l]. Each level is
+/// a full image_process output in output_format, mask_threshold applies to the mask formats. No optional stages
+/// and no ROI: a pyramid is over a dense image
+template <int PPC>
+void sobel_pyramid_dataflow(
+    const WIDE_BUS_TYPE* in_img,
+    WIDE_BUS_TYPE* out_full,
+    WIDE_BUS_TYPE* out_half,
+    WIDE_BUS_TYPE* out_quarter,
+    int height,
+    int width,
+    int input_format,
+    int output_format,
+    int levels,
+    int mask_threshold = 0)
+{
+    #pragma HLS DATAFLOW
+
+    hls::stream<ap_uint<8 * PPC> > stream_gray_full("gray_full_stream");
+    hls::stream<ap_uint<8 * PPC> > stream_sobel_full("sobel_full_stream");
+    hls::stream<ap_uint<8 * PPC> > stream_decimate_half("decimate_half_stream");
+    hls::stream<ap_uint<8 * PPC> > stream_gray_half("gray_half_stream");
+    hls::stream<ap_uint<8 * PPC> > stream_sobel_half("sobel_half_stream");
+    hls::stream<ap_uint<8 * PPC> > stream_decimate_quarter("decimate_quarter_stream");
+    hls::stream<ap_uint<8 * PPC> > stream_gray_quarter("gray_quarter_stream");
+    hls::stream<EdgeVec<PPC> > stream_edges_full("edge_full_stream");
+    hls::stream<EdgeVec<PPC> > stream_edges_half("edge_half_stream");
+    hls::stream<EdgeVec<PPC> > stream_edges_quarter("edge_quarter_stream");
+
+    /// A level that is off gets no groups, every stage of it then does nothing
+    int half_height = (levels > 1) ? pyramid_level_height(height, 1) : 0;
+    int half_width = (levels > 1) ? pyramid_level_width(width, 1) : 0;
+    int quarter_height = (levels > 2) ? pyramid_level_height(height, 2) : 0;
+    int quarter_width = (levels > 2) ? pyramid_level_width(width, 2) : 0;
+    int full_groups = (height * width + PPC - 1) / PPC;
+    int half_groups = (half_height * half_width + PPC - 1) / PPC;
+    int quarter_groups = (quarter_height * quarter_width + PPC - 1) / PPC;
+
+    read_and_grayscale<PPC>(in_img, stream_gray_full, full_groups, full_groups, input_format, height, width);
+    pyramid_split<PPC>(stream_gray_full, stream_sobel_full, stream_decimate_half, full_groups, levels > 1);
+    pyramid_sobel<PPC>(stream_sobel_full, stream_edges_full, height, width, full_groups);
+    write_and_pack<PPC>(out_full, stream_edges_full, full_groups, output_format, height - 2, width - 2, mask_threshold);
+
+    pyramid_decimate<PPC>(stream_decimate_half, stream_gray_half, height, width, half_groups > 0 ? full_groups : 0, half_groups);
+    pyramid_split<PPC>(stream_gray_half, stream_sobel_half, stream_decimate_quarter, half_groups, levels > 2);
+    pyramid_sobel<PPC>(stream_sobel_half, stream_edges_half, half_height, half_width, half_groups);
+    write_and_pack<PPC>(out_half, stream_edges_half, half_groups, output_format, std::max(half_height - 2, 0),
+                        std::max(half_width - 2, 0), mask_threshold);
+
+    pyramid_decimate<PPC>(stream_decimate_quarter, stream_gray_quarter, half_height, half_width, quarter_groups > 0 ? half_groups : 0,
+                          quarter_groups);
+    pyramid_sobel<PPC>(stream_gray_quarter, stream_edges_quarter, quarter_height, quarter_width, quarter_groups);
+    write_and_pack<PPC>(out_quarter, stream_edges_quarter, quarter_groups, output_format, std::max(quarter_height - 2, 0),
+                        std::max(quarter_width - 2, 0), mask_threshold);
+}
+
+#if !defined(__SYNTHESIS__) && defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif
@@ -0,0 +1,122 @@
+///@brief: Converts a directory of images into a dataset container (dataset.h) in the kernel's input layout, lists
+/// a container, or extracts one (an input set or the edge maps host_app --output-dataset wrote) back to PNG files
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <filesystem>
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#include "image_formats.h"
+#include "batch_pipeline.h"
+#include "dataset.h"
+
+namespace fs = std::filesystem;
+
+int list_dataset(const std::string& dataset_path) {
+    DatasetReader reader(dataset_path);
+    std::cout << "[INFO] " << dataset_path << ": " << reader.size() << " " << dataset_kind_name(reader.kind()) << " ENTRIES, "
+              << (reader.kind() == DATASET_KIND_EDGES ? "gray8" : input_format_name(reader.format())) << ", "
+              << reader.file_bytes() << " BYTES" << std::endl;
+    for (size_t i = 0; i < reader.size(); i++) {
+        const DatasetEntry& entry = reader.entry(i);
+        std::cout << std::left << std::setw(40) << reader.name(i) << entry.width << "x" << entry.height
+                  << " AT " << entry.offset << ", " << entry.bytes << " B" << std::endl;
+    }
+    return 0;
+}
+
+int extract_dataset(const std::string& dataset_path, const std::string& output_dir) {
+    DatasetReader reader(dataset_path);
+    fs::create_directories(output_dir);
+    cv::Mat storage;
+    for (size_t i = 0; i < reader.size(); i++) {
+        std::string name = fs::path(reader.name(i)).replace_extension(".png").filename().string();
+        if (!cv::imwrite(output_dir + "/" + name, reader.image(i, storage))) {
+            std::cerr << "[ERROR] COULD NOT WRITE: " << output_dir << "/" << name << std::endl;
+            return 1;
+        }
+    }
+    std::cout << "[INFO] EXTRACTED " << reader.size() << " IMAGES TO " << output_dir << std::endl;
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    try {
+        if (argc == 3 && std::string(argv[1]) == "--list") {
+            return list_dataset(argv[2]);
+        }
+        if (argc == 4 && std::string(argv[1]) == "--extract") {
+            return extract_dataset(argv[2], argv[3]);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "[ERROR] " << e.what() << std::endl;
+        return 1;
+    }
+
+    int input_format = INPUT_FORMAT_RGB888;
+    bool options_ok = argc >= 3 && std::string(argv[1]).compare(0, 2, "--") != 0;
+    for (int i = 3; options_ok && i < argc; i++) {
+        std::string flag = argv[i];
+        if (flag == "--input-format" && i + 1 < argc) {
+            input_format = parse_input_format(argv[++i]);
+            options_ok = input_format >= 0;
+        } else {
+            options_ok = false;
+        }
+        if (!options_ok) {
+            std::cerr << "[ERROR] BAD OPTION: " << flag << std::endl;
+        }
+    }
+    if (!options_ok) {
+        std::cout << "USAGE: " << argv[0] << " <IMAGE_DIR> <DATASET> [--input-format rgb32|rgb888|luma8]" << std::endl;
+        std::cout << "       " << argv[0] << " --list <DATASET>" << std::endl;
+        std::cout << "       " << argv[0] << " --extract <DATASET> <OUTPUT_DIR>" << std::endl;
+        std::cout << "  THE IMAGES ARE DECODED ONCE AND STORED IN THE KERNEL INPUT LAYOUT (DEFAULT rgb888), 4 KiB ALIGNED," << std::endl;
+        std::cout << "  FOR host_app --input-dataset AND benchmark" << std::endl;
+        return 1;
+    }
+    const std::string input_dir = argv[1];
+    const std::string dataset_path = argv[2];
+    std::cout << std::fixed << std::setprecision(3);
+
+    std::vector<fs::path> files;
+    for (const auto& entry : fs::directory_iterator(input_dir)) {
+        std::string extension = entry.path().extension().string();
+        if (entry.is_regular_file() && (extension == ".jpg" || extension == ".jpeg" || extension == ".png")) {
+            files.push_back(entry.path());
+        }
+    }
+    std::sort(files.begin(), files.end());
+
+    try {
+        DatasetWriter writer(dataset_path, DATASET_KIND_INPUT, input_format);
+        std::vector<unsigned char> packed;
+        double decode_time_ms = 0.0;
+        int imread_flags = (input_format == INPUT_FORMAT_LUMA8) ? cv::IMREAD_GRAYSCALE : cv::IMREAD_COLOR;
+        for (const fs::path& path : files) {
+            auto decode_start = std::chrono::high_resolution_clock::now();
+            cv::Mat image = cv::imread(path.string(), imread_flags);
+            decode_time_ms += elapsed_ms(decode_start, std::chrono::high_resolution_clock::now());
+            if (image.empty() || image.rows < 3 || image.cols < 3) {
+                std::cerr << "[WARNING] SKIPPING UNREADABLE IMAGE: " << path.string() << std::endl;
+                continue;
+            }
+            packed.assign(input_buffer_bytes(input_format, image.rows * image.cols), 0);
+            pack_input_image(image, input_format, packed.data());
+            writer.append(path.filename().string(), image.rows, image.cols, packed.data(), packed.size());
+        }
+        writer.finish();
+        std::cout << "[INFO] WROTE " << writer.size() << " " << input_format_name(input_format) << " IMAGES TO " << dataset_path
+                  << " (" << writer.bytes_written() << " BYTES)" << std::endl;
+        std::cout << "[INFO] DECODE TIME SAVED PER PASS: " << decode_time_ms << " MS" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "[ERROR] " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,219 @@
+#ifndef OPENCV_ENGINE_H
+#define OPENCV_ENGINE_H
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "cpu_engine.h"
+
+///@brief: Function that performs edge detection on input image
+inline void process_image_opencv(const cv::Mat& input_img, cv::Mat& output_img) {
+
+    cv::Mat gray_img;
+    cv::Mat grad_x, grad_y;
+    cv::Mat abs_grad_x, abs_grad_y;
+
+    cv::cvtColor(input_img, gray_img, cv::COLOR_BGR2GRAY);
+
+    cv::Sobel(gray_img, grad_x, CV_8U, 1, 0, 3);
+    cv::Sobel(gray_img, grad_y, CV_8U, 0, 1, 3);
+
+    cv::convertScaleAbs(grad_x, abs_grad_x);
+    cv::convertScaleAbs(grad_y, abs_grad_y);
+
+    const double alpha_scale = 1.0;
+    const double beta_scale = 1.0;
+    const double gamma_value = 0.0;
+
+    cv::addWeighted(abs_grad_x, alpha_scale, abs_grad_y, beta_scale, gamma_value, output_img);
+}
+
+///@brief: The same edge map as process_image_opencv in one pass over the image. Each input row is converted to
+/// gray once into a ring of three padded gray rows, and the output row it completes is written straight away, so
+/// the working set is four rows and no full-image temporary is made. The operator is the one the OpenCV calls
+/// above compute:
+///   gray     (B * 3735 + G * 19235 + R * 9798 + 16384) >> 15, cvtColor's fixed point BGR2GRAY
+///   Gx, Gy   3x3 Sobel with BORDER_REFLECT_101, each saturated to 0..255 (the CV_8U Sobel, so negative
+///            gradients are 0 and convertScaleAbs leaves them as they are)
+///   edge     min(255, Gx + Gy), addWeighted with unit weights
+/// The output has the input's size, unlike the kernel's (height-2) x (width-2). cvtColor has used these 15-bit
+/// weights since OpenCV 4, with and without IPP
+
+///@brief: Per thread buffers, grown to the widest image seen and reused for the next ones
+struct FusedScratch {
+    std::vector<unsigned char> ring;    /// three gray rows of width + 2, the outer columns reflected
+};
+
+inline int fused_reflect_101(int i, int n) {
+    if (n == 1) return 0;
+    return i < 0 ? -i : (i >= n ? 2 * n - 2 - i : i);
+}
+
+///@brief: One BGR (3 channel) or BGRA (4 channel) row to gray at gray[1 .. width], then the reflected borders.
+/// Kept branch free per layout so each ISA wrapper below auto-vectorizes it
+__attribute__((always_inline)) inline void fused_gray_row_body(const unsigned char* in, unsigned char* gray, int width, int channels) {
+    if (channels == 3) {
+        for (int x = 0; x < width; x++) {
+            const unsigned char* pixel = in + x * 3;
+            gray[x + 1] = (pixel[0] * 3735 + pixel[1] * 19235 + pixel[2] * 9798 + 16384) >> 15;
+        }
+    } else if (channels == 4) {
+        for (int x = 0; x < width; x++) {
+            const unsigned char* pixel = in + x * 4;
+            gray[x + 1] = (pixel[0] * 3735 + pixel[1] * 19235 + pixel[2] * 9798 + 16384) >> 15;
+        }
+    } else {
+        std::copy(in, in + width, gray + 1);
+    }
+    gray[0] = gray[1 + fused_reflect_101(-1, width)];
+    gray[width + 1] = gray[1 + fused_reflect_101(width, width)];
+}
+
+///@brief: One output row from three padded gray rows, out[x] from gray columns x .. x + 2
+__attribute__((always_inline)) inline void fused_edge_row_body(const unsigned char* up, const unsigned char* mid, const unsigned char* down,
+                                                                unsigned char* out, int width) {
+    for (int x = 0; x < width; x++) {
+        int gx = (up[x + 2] - up[x]) + 2 * (mid[x + 2] - mid[x]) + (down[x + 2] - down[x]);
+        int gy = (down[x] + 2 * down[x + 1] + down[x + 2]) - (up[x] + 2 * up[x + 1] + up[x + 2]);
+        int edge = std::min(255, std::max(0, gx)) + std::min(255, std::max(0, gy));
+        out[x] = std::min(255, edge);
+    }
+}
+
+inline void fused_gray_row_scalar(const unsigned char* in, unsigned char* gray, int width, int channels) {
+    fused_gray_row_body(in, gray, width, channels);
+}
+
+inline void fused_edge_row_scalar(const unsigned char* up, const unsigned char* mid, const unsigned char* down, unsigned char* out, int width) {
+    fused_edge_row_body(up, mid, down, out, width);
+}
+
+#ifdef CPU_ENGINE_X86
+/// The edge rows in 16-bit lanes: Gx, Gy are within +-1020, so max(Gx, 0) + max(Gy, 0) fits and the saturating
+/// pack to bytes does both clamps to 255 (either term at 255 or more already puts the sum there)
+
+__attribute__((target("avx2"))) inline void fused_gray_row_avx2(const unsigned char* in, unsigned char* gray, int width, int channels) {
+    fused_gray_row_body(in, gray, width, channels);
+}
+
+__attribute__((target("avx2"))) inline void fused_edge_row_avx2(const unsigned char* up, const unsigned char* mid, const unsigned char* down,
+                                                               unsigned char* out, int width) {
+    const __m256i zero = _mm256_setzero_si256();
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m256i ul = cpu_load_u8x16_avx2(up + x), uc = cpu_load_u8x16_avx2(up + x + 1), ur = cpu_load_u8x16_avx2(up + x + 2);
+        __m256i ml = cpu_load_u8x16_avx2(mid + x), mr = cpu_load_u8x16_avx2(mid + x + 2);
+        __m256i dl = cpu_load_u8x16_avx2(down + x), dc = cpu_load_u8x16_avx2(down + x + 1), dr = cpu_load_u8x16_avx2(down + x + 2);
+
+        __m256i gx = _mm256_add_epi16(_mm256_add_epi16(_mm256_sub_epi16(ur, ul), _mm256_sub_epi16(dr, dl)),
+                                      _mm256_slli_epi16(_mm256_sub_epi16(mr, ml), 1));
+        __m256i gy = _mm256_sub_epi16(_mm256_add_epi16(_mm256_add_epi16(dl, dr), _mm256_slli_epi16(dc, 1)),
+                                      _mm256_add_epi16(_mm256_add_epi16(ul, ur), _mm256_slli_epi16(uc, 1)));
+        __m256i edge = _mm256_add_epi16(_mm256_max_epi16(gx, zero), _mm256_max_epi16(gy, zero));
+
+        __m128i packed = _mm_packus_epi16(_mm256_castsi256_si128(edge), _mm256_extracti128_si256(edge, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), packed);
+    }
+    fused_edge_row_body(up + x, mid + x, down + x, out + x, width - x);
+}
+
+__attribute__((target("avx512f,avx512bw"))) inline void fused_gray_row_avx512(const unsigned char* in, unsigned char* gray, int width, int channels) {
+    fused_gray_row_body(in, gray, width, channels);
+}
+
+__attribute__((target("avx512f,avx512bw"))) inline void fused_edge_row_avx512(const unsigned char* up, const unsigned char* mid, const unsigned char* down,
+                                                                             unsigned char* out, int width) {
+    const __m512i zero = _mm512_setzero_si512();
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m512i ul = cpu_load_u8x32_avx512(up + x), uc = cpu_load_u8x32_avx512(up + x + 1), ur = cpu_load_u8x32_avx512(up + x + 2);
+        __m512i ml = cpu_load_u8x32_avx512(mid + x), mr = cpu_load_u8x32_avx512(mid + x + 2);
+        __m512i dl = cpu_load_u8x32_avx512(down + x), dc = cpu_load_u8x32_avx512(down + x + 1), dr = cpu_load_u8x32_avx512(down + x + 2);
+
+        __m512i gx = _mm512_add_epi16(_mm512_add_epi16(_mm512_sub_epi16(ur, ul), _mm512_sub_epi16(dr, dl)),
+                                      _mm512_slli_epi16(_mm512_sub_epi16(mr, ml), 1));
+        __m512i gy = _mm512_sub_epi16(_mm512_add_epi16(_mm512_add_epi16(dl, dr), _mm512_slli_epi16(dc, 1)),
+                                      _mm512_add_epi16(_mm512_add_epi16(ul, ur), _mm512_slli_epi16(uc, 1)));
+        __m512i edge = _mm512_add_epi16(_mm512_max_epi16(gx, zero), _mm512_max_epi16(gy, zero));
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x), _mm512_maskz_cvtusepi16_epi8(0xFFFFFFFF, edge));
+    }
+    /// Less than 32 pixels left, finish with the narrower kernel
+    fused_edge_row_avx2(up + x, mid + x, down + x, out + x, width - x);
+}
+#endif
+
+///@brief: Drop-in for process_image_opencv on one thread. `output` is reused when it already has the size
+inline void process_image_fused(const cv::Mat& input, cv::Mat& output, FusedScratch& scratch, int isa = CPU_ISA_AUTO) {
+    int height = input.rows;
+    int width = input.cols;
+    output.create(height, width, CV_8UC1);
+    if (height == 0 || width == 0) return;
+
+    void (*gray_row)(const unsigned char*, unsigned char*, int, int) = fused_gray_row_scalar;
+    void (*edge_row)(const unsigned char*, const unsigned char*, const unsigned char*, unsigned char*, int) = fused_edge_row_scalar;
+#ifdef CPU_ENGINE_X86
+    int supported = cpu_detect_isa();
+    isa = (isa == CPU_ISA_AUTO) ? supported : std::min(isa, supported);
+    if (isa == CPU_ISA_AVX512) {
+        gray_row = fused_gray_row_avx512;
+        edge_row = fused_edge_row_avx512;
+    } else if (isa == CPU_ISA_AVX2) {
+        gray_row = fused_gray_row_avx2;
+        edge_row = fused_edge_row_avx2;
+    }
+#endif
+
+    size_t padded = (size_t)width + 2;
+    if (scratch.ring.size() < 3 * padded) {
+        scratch.ring.resize(3 * padded);
+    }
+    int channels = input.channels();
+    auto gray = [&](int y) { return &scratch.ring[(y % 3) * padded]; };
+
+    /// Rows 0 and 1 first, then each step converts the row below the output row and writes that output row.
+    /// A reflected neighbour row is always one of the three in the ring
+    gray_row(input.ptr<unsigned char>(0), gray(0), width, channels);
+    if (height > 1) {
+        gray_row(input.ptr<unsigned char>(1), gray(1), width, channels);
+    }
+    for (int y = 0; y < height; y++) {
+        if (y + 1 < height && y > 0) {
+            gray_row(input.ptr<unsigned char>(y + 1), gray(y + 1), width, channels);
+        }
+        edge_row(gray(fused_reflect_101(y - 1, height)), gray(y), gray(fused_reflect_101(y + 1, height)), output.ptr<unsigned char>(y), width);
+    }
+}
+
+///@brief: Runs work(index, scratch) for index 0 .. count - 1 over `threads` threads (0 = one per core), each image
+/// on one thread, the next image to whichever thread is free. Each thread keeps its own FusedScratch across images
+inline void fused_for_each_image(size_t count, int threads, const std::function<void(size_t index, FusedScratch& scratch)>& work) {
+    int workers = threads > 0 ? threads : std::max(1, (int)std::thread::hardware_concurrency());
+    workers = (int)std::max<size_t>(1, std::min<size_t>(workers, count));
+    std::atomic<size_t> next{0};
+    auto run = [&] {
+        FusedScratch scratch;
+        for (size_t index = next++; index < count; index = next++) {
+            work(index, scratch);
+        }
+    };
+    if (workers == 1) {
+        run();
+        return;
+    }
+    std::vector<std::thread> pool;
+    for (int w = 0; w < workers; w++) {
+        pool.emplace_back(run);
+    }
+    for (std::thread& thread : pool) {
+        thread.join();
+    }
+}
+
+#endif
@@ -0,0 +1,343 @@
+#ifndef SHARD_MANIFEST_H
+#define SHARD_MANIFEST_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_set>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <mutex>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+
+///@brief: Splitting one batch over several processes, cards or hosts, and resuming it after a crash:
+///   manifest   the sorted image names of INPUT_DIR, optionally frozen in a file so every shard sees the same list
+///   shard i/N  the names whose FNV-1a hash is i mod N. The hash depends on the name only, so the split is the
+///              same on every host and does not move when images are added to the directory
+///   journal    an append-only file with one line per image whose result is written. A rerun skips them
+///   summary    the counts and times of one shard run, which host_app --merge-shards adds up over the shards
+/// A journal line is appended with one write() after the output file is written, so a crash loses at most the
+/// images in flight and they are redone on the rerun. Names holding a newline are never journaled
+
+#define SHARD_SUMMARY_MAGIC "EDGE_SHARD_SUMMARY 1"
+
+struct ShardSpec {
+    int index = 0;
+    int count = 1;                  /// 1 = the whole manifest
+};
+
+///@brief: "i/N" with 0 <= i < N, false on anything else
+inline bool parse_shard(const std::string& text, ShardSpec& shard) {
+    int index = 0;
+    int count = 0;
+    char tail = 0;
+    if (std::sscanf(text.c_str(), "%d/%d%c", &index, &count, &tail) != 2 || count < 1 || index < 0 || index >= count) {
+        return false;
+    }
+    shard.index = index;
+    shard.count = count;
+    return true;
+}
+
+///@brief: 64-bit FNV-1a, fixed by its definition rather than by the standard library like std::hash
+inline uint64_t shard_hash(const std::string& name) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : name) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+inline int shard_of(const std::string& name, int count) {
+    return (int)(shard_hash(name) % (uint64_t)std::max(1, count));
+}
+
+inline bool in_shard(const std::string& name, const ShardSpec& shard) {
+    return shard.count <= 1 || shard_of(name, shard.count) == shard.index;
+}
+
+///@brief: The files host_app decodes: .jpg, .jpeg and .png
+inline bool is_manifest_image(const std::filesystem::path& path) {
+    std::string extension = path.extension().string();
+    return extension == ".jpg" || extension == ".jpeg" || extension == ".png";
+}
+
+///@brief: The image file names in input_dir, sorted bytewise so the order does not depend on the file system
+inline std::vector<std::string> build_manifest(const std::string& input_dir) {
+    std::vector<std::string> names;
+    for (const auto& entry : std::filesystem::directory_iterator(input_dir)) {
+        if (entry.is_regular_file() && is_manifest_image(entry.path())) {
+            names.push_back(entry.path().filename().string());
+        }
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+///@brief: One name per line. Written to a temporary file and renamed, so a shard starting at the same moment
+/// reads either no manifest or a whole one
+inline void write_manifest(const std::string& path, const std::vector<std::string>& names) {
+    std::string temporary = path + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream file(temporary, std::ios::trunc);
+        for (const std::string& name : names) {
+            file << name << '\n';
+        }
+        if (!file.flush()) {
+            throw std::runtime_error("cannot write manifest " + temporary);
+        }
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("cannot write manifest " + path);
+    }
+}
+
+inline std::vector<std::string> read_manifest(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("cannot read manifest " + path);
+    }
+    std::vector<std::string> names;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (!line.empty()) names.push_back(line);
+    }
+    return names;
+}
+
+///@brief: The manifest at manifest_path if there is one, otherwise the sorted listing of input_dir, saved there
+/// when manifest_path is set. `created` tells which
+inline std::vector<std::string> load_manifest(const std::string& manifest_path, const std::string& input_dir, bool& created) {
+    created = false;
+    if (!manifest_path.empty() && std::filesystem::exists(manifest_path)) {
+        return read_manifest(manifest_path);
+    }
+    std::vector<std::string> names = build_manifest(input_dir);
+    if (!manifest_path.empty()) {
+        write_manifest(manifest_path, names);
+        created = true;
+    }
+    return names;
+}
+
+///@brief: The completed image names of a batch, loaded from `path` and appended to as images finish. A line
+/// without its newline (the process died while writing it) is ignored and terminated before the next append.
+/// record() is safe from several threads, and from several processes sharing one journal
+class BatchJournal {
+public:
+    explicit BatchJournal(const std::string& journal_path) : path(journal_path) {
+        bool torn = false;
+        {
+            std::ifstream file(path, std::ios::binary);
+            std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            size_t start = 0;
+            for (size_t end = contents.find('\n'); end != std::string::npos; end = contents.find('\n', start)) {
+                if (end > start) completed.insert(contents.substr(start, end - start));
+                start = end + 1;
+            }
+            torn = start < contents.size();
+        }
+        loaded = completed.size();
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("cannot open journal " + path);
+        }
+        if (torn && ::write(fd, "\n", 1) != 1) {
+            ::close(fd);
+            throw std::runtime_error("cannot write journal " + path);
+        }
+    }
+
+    ~BatchJournal() {
+        if (fd >= 0) ::close(fd);
+    }
+
+    BatchJournal(const BatchJournal&) = delete;
+    BatchJournal& operator=(const BatchJournal&) = delete;
+
+    bool done(const std::string& name) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return completed.count(name) != 0;
+    }
+
+    ///@brief: Appends `name` as completed, returns false if the write failed (the image is redone next run)
+    bool record(const std::string& name) {
+        if (name.empty() || name.find('\n') != std::string::npos) return false;
+        std::string line = name + '\n';
+        std::lock_guard<std::mutex> lock(mutex);
+        ssize_t written = ::write(fd, line.data(), line.size());
+        if (written != (ssize_t)line.size()) {
+            return false;
+        }
+        completed.insert(name);
+        recorded++;
+        return true;
+    }
+
+    ///@brief: Images completed before this run
+    size_t loaded_count() const { return loaded; }
+
+    ///@brief: Images completed in this run
+    long long recorded_count() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return recorded;
+    }
+    const std::string& file_path() const { return path; }
+
+private:
+    std::string path;
+    int fd = -1;
+    mutable std::mutex mutex;
+    std::unordered_set<std::string> completed;
+    size_t loaded = 0;
+    long long recorded = 0;
+};
+
+///@brief: One run of one shard. A resumed shard has a summary per run, merge_shards adds them up
+struct ShardSummary {
+    int shard = 0;
+    int shards = 1;
+    std::string host;
+    long long manifest = 0;         /// images in the whole manifest
+    long long assigned = 0;         /// of those in this shard
+    long long skipped = 0;          /// already in the journal when the run started
+    long long processed = 0;        /// written in this run
+    long long failed = 0;           /// neither, they are tried again on a rerun
+    long long pixels = 0;
+    double wall_ms = 0.0;
+    double h2d_ms = 0.0;
+    double kernel_ms = 0.0;
+    double d2h_ms = 0.0;
+
+    double mpps() const { return wall_ms > 0.0 ? pixels / (wall_ms * 1000.0) : 0.0; }
+};
+
+inline bool write_shard_summary(const std::string& path, const ShardSummary& summary) {
+    std::ofstream file(path, std::ios::trunc);
+    file << SHARD_SUMMARY_MAGIC << '\n'
+         << "shard " << summary.shard << '\n' << "shards " << summary.shards << '\n'
+         << "host " << (summary.host.empty() ? "-" : summary.host) << '\n'
+         << "manifest " << summary.manifest << '\n' << "assigned " << summary.assigned << '\n'
+         << "skipped " << summary.skipped << '\n' << "processed " << summary.processed << '\n'
+         << "failed " << summary.failed << '\n' << "pixels " << summary.pixels << '\n';
+    file.precision(17);
+    file << "wall_ms " << summary.wall_ms << '\n' << "h2d_ms " << summary.h2d_ms << '\n'
+         << "kernel_ms " << summary.kernel_ms << '\n' << "d2h_ms " << summary.d2h_ms << '\n';
+    return (bool)file.flush();
+}
+
+///@brief: False if the file is missing or not a shard summary. Unknown keys are skipped
+inline bool read_shard_summary(const std::string& path, ShardSummary& summary) {
+    std::ifstream file(path);
+    std::string line;
+    if (!std::getline(file, line) || line != SHARD_SUMMARY_MAGIC) {
+        return false;
+    }
+    summary = ShardSummary();
+    std::map<std::string, long long*> counts = {
+        {"manifest", &summary.manifest}, {"assigned", &summary.assigned},
+        {"skipped", &summary.skipped}, {"processed", &summary.processed}, {"failed", &summary.failed}, {"pixels", &summary.pixels} };
+    std::map<std::string, double*> times = {
+        {"wall_ms", &summary.wall_ms}, {"h2d_ms", &summary.h2d_ms}, {"kernel_ms", &summary.kernel_ms}, {"d2h_ms", &summary.d2h_ms} };
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string key;
+        fields >> key;
+        if (key == "shard") fields >> summary.shard;
+        else if (key == "shards") fields >> summary.shards;
+        else if (key == "host") fields >> summary.host;
+        else if (counts.count(key)) fields >> *counts[key];
+        else if (times.count(key)) fields >> *times[key];
+    }
+    return summary.shards >= 1 && summary.shard >= 0 && summary.shard < summary.shards;
+}
+
+///@brief: The shard summaries of one batch added up. Runs of the same shard ran one after the other, so their
+/// times add; the shards ran side by side, so the batch took as long as the slowest one. A run that crashed left
+/// no summary, so what a shard has done comes from its latest run (the one that skipped the most): the images it
+/// found in the journal plus the ones it processed
+struct ShardMerge {
+    int shards = 0;
+    std::vector<ShardSummary> per_shard;    /// indexed by shard, the measured runs of each added up
+    std::vector<int> runs;                  /// summaries found per shard, 0 = missing
+    std::vector<long long> done;            /// images of the shard written by now
+    bool consistent = true;                 /// same shard count and manifest size in every summary
+    int missing = 0;                        /// shards without a summary
+    ShardSummary total;                     /// wall_ms is the slowest shard's
+    long long total_done = 0;
+    double aggregate_mpps = 0.0;            /// all pixels over the slowest shard's wall time
+    double sum_shard_mpps = 0.0;            /// what the shards would give with no imbalance
+    double imbalance = 0.0;                 /// slowest shard wall time over the mean
+
+    bool complete() const { return consistent && missing == 0 && total_done == total.manifest; }
+};
+
+inline ShardMerge merge_shard_summaries(const std::vector<ShardSummary>& summaries) {
+    ShardMerge merge;
+    if (summaries.empty()) return merge;
+    merge.shards = summaries[0].shards;
+    merge.per_shard.resize(merge.shards);
+    merge.runs.assign(merge.shards, 0);
+    merge.done.assign(merge.shards, 0);
+    std::vector<const ShardSummary*> latest(merge.shards, nullptr);
+    for (const ShardSummary& summary : summaries) {
+        if (summary.shards != merge.shards || summary.manifest != summaries[0].manifest) {
+            merge.consistent = false;
+            continue;
+        }
+        ShardSummary& shard = merge.per_shard[summary.shard];
+        if (merge.runs[summary.shard]++ == 0) {
+            shard = summary;
+        } else {
+            shard.processed += summary.processed;
+            shard.pixels += summary.pixels;
+            shard.wall_ms += summary.wall_ms;
+            shard.h2d_ms += summary.h2d_ms;
+            shard.kernel_ms += summary.kernel_ms;
+            shard.d2h_ms += summary.d2h_ms;
+            if (shard.host != summary.host) shard.host += "," + summary.host;
+        }
+        if (!latest[summary.shard] || summary.skipped >= latest[summary.shard]->skipped) {
+            latest[summary.shard] = &summary;
+        }
+    }
+    double wall_sum = 0.0;
+    int present = 0;
+    merge.total.shards = merge.shards;
+    merge.total.manifest = summaries[0].manifest;
+    for (int s = 0; s < merge.shards; s++) {
+        if (merge.runs[s] == 0) {
+            merge.missing++;
+            continue;
+        }
+        ShardSummary& shard = merge.per_shard[s];
+        shard.skipped = latest[s]->skipped;
+        shard.failed = latest[s]->failed;
+        merge.done[s] = latest[s]->skipped + latest[s]->processed;
+        merge.total_done += merge.done[s];
+        merge.total.assigned += shard.assigned;
+        merge.total.processed += shard.processed;
+        merge.total.failed += shard.failed;
+        merge.total.pixels += shard.pixels;
+        merge.total.h2d_ms += shard.h2d_ms;
+        merge.total.kernel_ms += shard.kernel_ms;
+        merge.total.d2h_ms += shard.d2h_ms;
+        merge.total.wall_ms = std::max(merge.total.wall_ms, shard.wall_ms);
+        merge.sum_shard_mpps += shard.mpps();
+        wall_sum += shard.wall_ms;
+        present++;
+    }
+    merge.aggregate_mpps = merge.total.mpps();
+    merge.imbalance = wall_sum > 0.0 ? merge.total.wall_ms / (wall_sum / present) : 0.0;
+    return merge;
+}
+
+#endif
@@ -0,0 +1,263 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <opencv2/opencv.hpp>
+
+#include "accel_device.h"
+#include "accel_server.h"
+#include "accel_client.h"
+#include "image_process_ref.h"
+#include "test_images.h"
+
+///@brief: Runs accel_daemon's server on the software stand-in device and drives it from several client
+/// connections at once over a real UNIX socket. Checks every reply against the plain C model, that jobs arriving
+/// together share dispatches, that mixed formats are kept apart and that a bad request is answered, not dropped.
+/// Also checks that per job thresholds reuse a bounded set of device slots and that the replies of one connection
+/// come back in send order when its queued jobs alternate between groups
+
+///@brief: The software device, noting the highest slot the server allocates (dispatcher thread only)
+class SlotCountingDevice : public SoftwareAccelDevice {
+public:
+    explicit SlotCountingDevice(const Latency& latency) : SoftwareAccelDevice(latency) {}
+
+    void allocate(int slot, size_t in_bytes, size_t out_bytes) override {
+        highest_slot = std::max(highest_slot, slot);
+        SoftwareAccelDevice::allocate(slot, in_bytes, out_bytes);
+    }
+
+    int highest_slot = -1;
+};
+
+bool matches_reference(const cv::Mat& image, const JobParams& params, const cv::Mat& edges) {
+    int out_height = image.rows - 2;
+    int out_width = image.cols - 2;
+    std::vector<unsigned char> packed(input_buffer_bytes(params.input_format, image.rows * image.cols));
+    std::vector<unsigned char> expected(output_buffer_bytes(OUTPUT_FORMAT_GRAY8, out_height * out_width));
+    pack_input_image(image, params.input_format, packed.data());
+    image_process_reference(packed.data(), expected.data(), image.rows, image.cols, params.input_format, OUTPUT_FORMAT_GRAY8,
+                            params.stages.flags, params.stages.low_threshold, params.stages.high_threshold);
+    if (edges.rows != out_height || edges.cols != out_width) return false;
+    for (int r = 0; r < out_height; r++) {
+        for (int c = 0; c < out_width; c++) {
+            unsigned char value = expected[r * out_width + c];
+            if (is_mask_output(params.output_format)) value = value >= params.stages.mask_threshold ? 255 : 0;
+            if (edges.ptr<unsigned char>(r)[c] != value) return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    std::cout << "--- Starting accelerator server test on the software stand-in device ---" << std::endl;
+    int errors = 0;
+
+    /// A launch cost well above the per-image time, jobs sent while a run is on the device pile up for the next one
+    SoftwareAccelDevice::Latency latency;
+    latency.launch_us = 3000.0;
+    latency.kernel_mpps = 200.0;
+    SlotCountingDevice device(latency);
+    ServerConfig config;
+    config.socket_path = "/tmp/test_accel_server_" + std::to_string(getpid()) + ".sock";
+    config.queue_depth = 2;
+    config.max_batch = 8;
+    config.max_height = 240;
+    config.max_width = 320;
+    config.max_pipelines = 2;
+    AccelServer server(device, config);
+    server.start();
+
+    const int shapes[][2] = { {240, 320}, {61, 93}, {120, 160}, {33, 257} };
+    std::mutex error_mutex;
+    int batched_replies = 0;
+    std::vector<std::thread> clients;
+    for (int t = 0; t < 4; t++) {
+        clients.emplace_back([&, t] {
+            AccelClient client(config.socket_path);
+            JobParams params;
+            for (int k = 0; k < 8; k++) {
+                cv::Mat image = pattern_image(shapes[(t + k) % 4][0], shapes[(t + k) % 4][1], CV_8UC3, t * 8 + k);
+                JobResult result = client.run(image, params);
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (result.status != ACCEL_JOB_OK || !matches_reference(image, params, result.edges)) {
+                    std::cerr << "Client " << t << " job " << k << " came back with status " << result.status << " or wrong pixels" << std::endl;
+                    errors++;
+                }
+                if (result.batch_jobs > 1) batched_replies++;
+            }
+        });
+    }
+    /// A fifth client on luma8 / canny / bit1, decoding into the shared buffer so run() copies nothing
+    clients.emplace_back([&] {
+        AccelClient client(config.socket_path);
+        JobParams params;
+        params.input_format = INPUT_FORMAT_LUMA8;
+        params.output_format = OUTPUT_FORMAT_BIT1;
+        params.stages.flags = EDGE_STAGE_CANNY;
+        for (int k = 0; k < 6; k++) {
+            cv::Mat source = pattern_image(77 + k, 131, CV_8UC1, 100 + k);
+            cv::Mat image = client.input_image(source.rows, source.cols, CV_8UC1);
+            source.copyTo(image);
+            JobResult result = client.run(image, params);
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (result.status != ACCEL_JOB_OK || !matches_reference(source, params, result.edges) ||
+                result.output_bytes != output_buffer_bytes(OUTPUT_FORMAT_BIT1, (source.rows - 2) * (source.cols - 2))) {
+                std::cerr << "Mask job " << k << " came back with status " << result.status << " or wrong pixels" << std::endl;
+                errors++;
+            }
+        }
+    });
+    for (std::thread& client : clients) client.join();
+
+    /// An unknown output format is answered with an error and the connection stays usable
+    {
+        AccelClient client(config.socket_path);
+        JobParams params;
+        params.output_format = 9;
+        cv::Mat image = pattern_image(16, 16, CV_8UC3, 7);
+        JobResult rejected = client.run(image, params);
+        params.output_format = OUTPUT_FORMAT_GRAY8;
+        JobResult accepted = client.run(image, params);
+        if (rejected.status != ACCEL_JOB_BAD_REQUEST || accepted.status != ACCEL_JOB_OK || !matches_reference(image, params, accepted.edges)) {
+            std::cerr << "Bad request answered with status " << rejected.status << ", next job with " << accepted.status << std::endl;
+            errors++;
+        }
+    }
+
+    ServerStats concurrent = server.stats();
+
+    /// A new threshold pair per job shares the canny pipeline, the three format combinations of this test take
+    /// turns on the two slot ranges max_pipelines allows
+    {
+        AccelClient client(config.socket_path);
+        JobParams params;
+        params.stages.flags = EDGE_STAGE_CANNY;
+        for (int k = 0; k < 12; k++) {
+            params.stages.low_threshold = 10 + 7 * k;
+            params.stages.high_threshold = 30 + 9 * k;
+            cv::Mat image = pattern_image(45, 67, CV_8UC3, 200 + k);
+            JobResult result = client.run(image, params);
+            if (result.status != ACCEL_JOB_OK || !matches_reference(image, params, result.edges)) {
+                std::cerr << "Threshold job " << k << " came back with status " << result.status << " or wrong pixels" << std::endl;
+                errors++;
+            }
+        }
+        if (device.highest_slot >= config.max_pipelines * config.queue_depth) {
+            std::cerr << "Thresholds took device slot " << device.highest_slot << std::endl;
+            errors++;
+        }
+    }
+
+    /// Jobs sent back to back on one connection, alternating between two thresholds, still complete in send order.
+    /// The last one comes with buffers that can shrink and is answered with ACCEL_JOB_BAD_BUFFER in its place
+    {
+        int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        struct sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        std::strcpy(address.sun_path, config.socket_path.c_str());
+        if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+            std::cerr << "Cannot connect for the ordering check" << std::endl;
+            errors++;
+        }
+        const int jobs = 8;
+        std::vector<cv::Mat> images;
+        std::vector<JobParams> job_params(jobs);
+        std::vector<int> out_fds;
+        for (int k = 0; k < jobs; k++) {
+            images.push_back(pattern_image(52, 75, CV_8UC3, 300 + k));
+            job_params[k].stages.flags = EDGE_STAGE_CANNY;
+            job_params[k].stages.low_threshold = (k % 2) ? 20 : 40;
+            job_params[k].stages.high_threshold = (k % 2) ? 50 : 90;
+            /// The last job's buffers are not sealed against shrinking, the server has to refuse to map them
+            bool sealed = k != jobs - 1;
+            unsigned int flags = MFD_CLOEXEC | MFD_ALLOW_SEALING;
+            int fds[2] = { memfd_create("job_in", flags), memfd_create("job_out", flags) };
+            size_t in_bytes = job_input_bytes(52, 75, INPUT_FORMAT_RGB888);
+            if (ftruncate(fds[0], in_bytes) != 0 || ftruncate(fds[1], job_output_bytes(52, 75, OUTPUT_FORMAT_GRAY8)) != 0 ||
+                pwrite(fds[0], images[k].data, in_bytes, 0) != (ssize_t)in_bytes ||
+                (sealed && (fcntl(fds[0], F_ADD_SEALS, F_SEAL_SHRINK) != 0 || fcntl(fds[1], F_ADD_SEALS, F_SEAL_SHRINK) != 0))) {
+                std::cerr << "Cannot fill the buffers of ordered job " << k << std::endl;
+                errors++;
+            }
+            JobRequest request;
+            std::memset(&request, 0, sizeof(request));
+            request.magic = ACCEL_JOB_MAGIC;
+            request.job_id = k;
+            request.height = 52;
+            request.width = 75;
+            request.input_format = INPUT_FORMAT_RGB888;
+            request.output_format = OUTPUT_FORMAT_GRAY8;
+            request.stages = job_params[k].stages.flags;
+            request.low_threshold = job_params[k].stages.low_threshold;
+            request.high_threshold = job_params[k].stages.high_threshold;
+            request.mask_threshold = job_params[k].stages.mask_threshold;
+            send_job_message(fd, &request, sizeof(request), fds, 2);
+            close(fds[0]);
+            out_fds.push_back(fds[1]);
+        }
+        for (int k = 0; k < jobs; k++) {
+            JobReply reply;
+            int reply_fds[2];
+            int reply_fd_count = 0;
+            int expected_status = (k == jobs - 1) ? ACCEL_JOB_BAD_BUFFER : ACCEL_JOB_OK;
+            if (receive_job_message(fd, &reply, sizeof(reply), reply_fds, reply_fd_count) != (ssize_t)sizeof(reply) ||
+                reply.job_id != (uint32_t)k || reply.status != expected_status) {
+                std::cerr << "Reply " << k << " out of send order or with status " << reply.status << ", expected " << expected_status << std::endl;
+                errors++;
+                continue;
+            }
+            if (expected_status != ACCEL_JOB_OK) continue;
+            std::vector<unsigned char> edges(50 * 73);
+            if (pread(out_fds[k], edges.data(), edges.size(), 0) != (ssize_t)edges.size() ||
+                !matches_reference(images[k], job_params[k], cv::Mat(50, 73, CV_8UC1, edges.data()))) {
+                std::cerr << "Ordered job " << k << " has wrong pixels" << std::endl;
+                errors++;
+            }
+        }
+        for (int out_fd : out_fds) close(out_fd);
+        close(fd);
+    }
+
+    ServerStats stats = server.stats();
+    std::cout << "SERVED " << stats.jobs << " JOBS IN " << stats.dispatches << " DISPATCHES AND " << stats.runs << " RUNS, "
+              << batched_replies << " OF 32 RGB888 REPLIES SHARED A DISPATCH" << std::endl;
+    if (stats.jobs != 58 || stats.rejected != 2) {
+        std::cerr << "Expected 58 jobs run and 2 rejected, saw " << stats.jobs << " and " << stats.rejected << std::endl;
+        errors++;
+    }
+    if (concurrent.dispatches >= 30 || batched_replies == 0) {
+        std::cerr << "Concurrent jobs were not batched" << std::endl;
+        errors++;
+    }
+
+    server.stop();
+    bool refused = false;
+    try {
+        AccelClient late(config.socket_path);
+    } catch (const std::runtime_error&) {
+        refused = true;
+    }
+    if (!refused) {
+        std::cerr << "Connected to a stopped server" << std::endl;
+        errors++;
+    }
+
+    if (errors == 0) {
+        std::cout << "--- Accelerator server test PASSED ---" << std::endl;
+        return 0;
+    } else {
+        std::cout << "--- Accelerator server test FAILED ---" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,269 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <vector>
+#include <string>
+
+#include <opencv2/opencv.hpp>
+
+#include "accel_device.h"
+#include "batch_pipeline.h"
+#include "image_process_ref.h"
+#include "edge_mask.h"
+#include "test_images.h"
+
+///@brief: Runs the batch engine against the software stand-in device, no card needed
+
+///@brief: Processes the batch at the given depth and checks every output against the reference model
+BatchReport run_batch(const std::vector<cv::Mat>& images, int queue_depth, int output_format, int& errors,
+                      int images_per_run = 1, double launch_us = 50.0) {
+    SoftwareAccelDevice::Latency latency;
+    latency.dma_gbps = 0.5;
+    latency.kernel_mpps = 50.0;
+    latency.launch_us = launch_us;
+    SoftwareAccelDevice device(latency);
+
+    PipelineConfig config;
+    config.queue_depth = queue_depth;
+    config.input_format = INPUT_FORMAT_RGB888;
+    config.output_format = output_format;
+    config.images_per_run = images_per_run;
+    BatchPipeline pipeline(device, config);
+
+    size_t next_image = 0;
+    size_t next_output = 0;
+    return pipeline.run(
+        [&](BatchInput& input) {
+            if (next_image == images.size()) return false;
+            input.name = std::to_string(next_image);
+            input.image = images[next_image++];
+            return true;
+        },
+        [&](const BatchOutput& output) {
+            if (output.name != std::to_string(next_output)) {
+                std::cerr << "Output " << output.name << " delivered out of order, expected " << next_output << std::endl;
+                errors++;
+            }
+            const cv::Mat& image = images[next_output++];
+            int size = image.rows * image.cols;
+            int out_size = (image.rows - 2) * (image.cols - 2);
+            std::vector<unsigned char> packed(input_buffer_bytes(INPUT_FORMAT_RGB888, size));
+            std::vector<unsigned char> expected(output_buffer_bytes(OUTPUT_FORMAT_GRAY8, out_size));
+            pack_input_image(image, INPUT_FORMAT_RGB888, packed.data());
+            image_process_reference(packed.data(), expected.data(), image.rows, image.cols, INPUT_FORMAT_RGB888, OUTPUT_FORMAT_GRAY8);
+            if (is_mask_output(output_format)) {
+                for (int i = 0; i < out_size; i++) {
+                    expected[i] = expected[i] >= config.stages.mask_threshold ? 255 : 0;
+                }
+            }
+
+            for (int r = 0; r < output.edges.rows; r++) {
+                if (std::memcmp(output.edges.ptr<unsigned char>(r), &expected[r * output.edges.cols], output.edges.cols) != 0) {
+                    std::cerr << "Output " << output.name << " differs from the reference at row " << r << std::endl;
+                    errors++;
+                    break;
+                }
+            }
+        });
+}
+
+///@brief: Mostly flat images with a few thin lines. Checks the compressed outputs handed over with decode_masks off
+/// against the decoded run and returns the D2H bytes of the batch
+size_t run_sparse(int output_format, bool decode_masks, std::vector<std::vector<unsigned char> >& masks, int& errors) {
+    SoftwareAccelDevice device;
+    PipelineConfig config;
+    config.queue_depth = 2;
+    config.output_format = output_format;
+    config.decode_masks = decode_masks;
+    BatchPipeline pipeline(device, config);
+
+    int next_image = 0;
+    size_t d2h_bytes = 0;
+    pipeline.run(
+        [&](BatchInput& input) {
+            if (next_image == 4) return false;
+            input.name = std::to_string(next_image);
+            input.image = cv::Mat(480, 640, CV_8UC3, cv::Scalar(40, 40, 40));
+            for (int r = 100; r < 260; r++) {
+                for (int c = 100 + 20 * next_image; c < 300; c++) {
+                    input.image.at<cv::Vec3b>(r, c) = cv::Vec3b(200, 200, 200);
+                }
+            }
+            for (int c = 0; c < 640; c++) {
+                int r = 60 * next_image + c * (479 - 120 * next_image) / 639;
+                input.image.at<cv::Vec3b>(r, c) = cv::Vec3b(220, 220, 220);
+            }
+            next_image++;
+            return true;
+        },
+        [&](const BatchOutput& output) {
+            d2h_bytes += output.metrics.d2h_bytes;
+            int index = std::stoi(output.name);
+            std::vector<unsigned char> mask(478 * 638);
+            if (decode_masks) {
+                for (int r = 0; r < 478; r++) {
+                    std::memcpy(&mask[r * 638], output.edges.ptr<unsigned char>(r), 638);
+                }
+                masks.push_back(mask);
+                return;
+            }
+            if (output.compressed == nullptr || !output.edges.empty() ||
+                output.compressed_bytes != edge_output_used_bytes(output.compressed, 478, 638, output_format)) {
+                std::cerr << "Output " << index << " was not handed over compressed" << std::endl;
+                errors++;
+                return;
+            }
+            for (int r = 0; r < 478; r++) {
+                unpack_mask_row(output.compressed, 478, 638, output_format, r, &mask[r * 638]);
+            }
+            if (mask != masks[index]) {
+                std::cerr << "Compressed output " << index << " decodes differently from the decoded run" << std::endl;
+                errors++;
+            }
+        });
+    return d2h_bytes;
+}
+
+///@brief: MAG_ORIENT with the gradient planes, edges / orientation / Gx / Gy of every image against the reference
+void run_gradient_planes(const std::vector<cv::Mat>& images, int& errors) {
+    SoftwareAccelDevice device;
+    PipelineConfig config;
+    config.queue_depth = 2;
+    config.input_format = INPUT_FORMAT_RGB888;
+    config.output_format = OUTPUT_FORMAT_MAG_ORIENT;
+    config.stages.flags = EDGE_STAGE_NMS | EDGE_STAGE_GRADIENTS;
+    config.images_per_run = 4;
+    BatchPipeline pipeline(device, config);
+
+    size_t next_image = 0;
+    BatchReport report = pipeline.run(
+        [&](BatchInput& input) {
+            if (next_image == images.size()) return false;
+            input.name = std::to_string(next_image);
+            input.tag = next_image;
+            input.image = images[next_image++];
+            return true;
+        },
+        [&](const BatchOutput& output) {
+            const cv::Mat& image = images[output.tag];
+            int out_height = image.rows - 2;
+            int out_width = image.cols - 2;
+            std::vector<unsigned char> packed(input_buffer_bytes(INPUT_FORMAT_RGB888, image.rows * image.cols));
+            std::vector<unsigned char> expected(output_buffer_bytes(OUTPUT_FORMAT_MAG_ORIENT, out_height * out_width));
+            std::vector<unsigned char> expected_grad(gradient_buffer_bytes(out_height, out_width));
+            pack_input_image(image, INPUT_FORMAT_RGB888, packed.data());
+            image_process_reference(packed.data(), expected.data(), image.rows, image.cols, INPUT_FORMAT_RGB888, OUTPUT_FORMAT_MAG_ORIENT,
+                                    config.stages.flags, config.stages.low_threshold, config.stages.high_threshold, EDGE_OPERATOR_SOBEL3,
+                                    EDGE_MAGNITUDE_L1, 0, ImageRoi(), expected_grad.data());
+            const short* gx = reinterpret_cast<const short*>(expected_grad.data());
+            const short* gy = reinterpret_cast<const short*>(expected_grad.data() + gradient_plane_bytes(out_height * out_width));
+            if (output.orientation.rows != out_height || output.gradient_x.cols != out_width || output.gradient_y.type() != CV_16SC1) {
+                std::cerr << "Output " << output.name << " is missing its orientation or gradient planes" << std::endl;
+                errors++;
+                return;
+            }
+            for (int r = 0; r < out_height; r++) {
+                for (int c = 0; c < out_width; c++) {
+                    int i = r * out_width + c;
+                    if (output.edges.ptr<unsigned char>(r)[c] != expected[i * 2] || output.orientation.ptr<unsigned char>(r)[c] != expected[i * 2 + 1] ||
+                        output.gradient_x.ptr<short>(r)[c] != gx[i] || output.gradient_y.ptr<short>(r)[c] != gy[i]) {
+                        std::cerr << "Output " << output.name << " differs from the reference planes at (" << c << ", " << r << ")" << std::endl;
+                        errors++;
+                        return;
+                    }
+                }
+            }
+        });
+    if (report.images.size() != images.size() || report.runs != (int)images.size()) {
+        std::cerr << "Gradient planes need one image per run, saw " << report.runs << " runs for " << report.images.size() << " images" << std::endl;
+        errors++;
+    }
+}
+
+int main() {
+    std::cout << "--- Starting batch pipeline test on the software stand-in device ---" << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+
+    const int shapes[][2] = { {321, 481}, {481, 321}, {13, 97}, {240, 320} };
+    std::vector<cv::Mat> images = random_images(12, shapes, 11);
+    int errors = 0;
+
+    BatchReport sequential = run_batch(images, 1, OUTPUT_FORMAT_GRAY8, errors);
+    BatchReport pipelined = run_batch(images, 3, OUTPUT_FORMAT_GRAY8, errors);
+    run_batch(images, 2, OUTPUT_FORMAT_RGB32, errors);
+
+    std::cout << "DEPTH 1: " << sequential.wall_time_ms << " MS, " << sequential.sustained_mpps() << " MPPS" << std::endl;
+    std::cout << "DEPTH 3: " << pipelined.wall_time_ms << " MS, " << pipelined.sustained_mpps() << " MPPS, PEAK IN FLIGHT "
+              << pipelined.peak_in_flight << std::endl;
+
+    if (pipelined.images.size() != images.size() || sequential.images.size() != images.size()) {
+        std::cerr << "Not every image was retired" << std::endl;
+        errors++;
+    }
+    if (pipelined.peak_in_flight != 3) {
+        std::cerr << "Expected 3 runs in flight, saw " << pipelined.peak_in_flight << std::endl;
+        errors++;
+    }
+    int batch_allocations = 0;
+    for (const PerformanceMetrics& metrics : pipelined.images) {
+        batch_allocations += metrics.allocations;
+        if (metrics.bytes_copied != (size_t)metrics.pixels_processed * 3) {
+            std::cerr << "Expected only the RGB888 pack copy, saw " << metrics.bytes_copied << " bytes copied" << std::endl;
+            errors++;
+            break;
+        }
+    }
+    if (pipelined.setup_allocations != 3 || batch_allocations != 0) {
+        std::cerr << "Buffer pool allocated " << pipelined.setup_allocations << " slots up front and "
+                  << batch_allocations << " times during the batch, expected 3 and 0" << std::endl;
+        errors++;
+    }
+    /// Transfers are about a third of the simulated kernel time, overlapping them must show up in wall time
+    if (pipelined.wall_time_ms > 0.9 * sequential.wall_time_ms) {
+        std::cerr << "Pipelined batch did not overlap transfers with kernel runs" << std::endl;
+        errors++;
+    }
+
+    /// A launch cost well above the per-image kernel time, packing 6 images per run must pay it twice instead of 12 times
+    BatchReport single_runs = run_batch(images, 2, OUTPUT_FORMAT_GRAY8, errors, 1, 10000.0);
+    BatchReport packed_runs = run_batch(images, 2, OUTPUT_FORMAT_GRAY8, errors, 6, 10000.0);
+    run_batch(images, 2, OUTPUT_FORMAT_RGB32, errors, 5, 50.0);
+    std::cout << "1 IMAGE PER RUN: " << single_runs.wall_time_ms << " MS IN " << single_runs.runs << " RUNS, 6 IMAGES PER RUN: "
+              << packed_runs.wall_time_ms << " MS IN " << packed_runs.runs << " RUNS" << std::endl;
+    if (packed_runs.runs != 2 || packed_runs.images.size() != images.size() || packed_runs.wall_time_ms > 0.7 * single_runs.wall_time_ms) {
+        std::cerr << "Multi-image runs did not amortize the launch cost" << std::endl;
+        errors++;
+    }
+
+    /// Edge masks: decoded outputs against the thresholded reference, compressed outputs against the decoded ones
+    run_batch(images, 2, OUTPUT_FORMAT_BIT1, errors);
+    run_batch(images, 3, OUTPUT_FORMAT_RLE, errors, 4, 50.0);
+    std::vector<std::vector<unsigned char> > bit1_masks, rle_masks;
+    size_t rgb32_bytes = run_sparse(OUTPUT_FORMAT_RGB32, true, bit1_masks, errors);
+    bit1_masks.clear();
+    size_t bit1_bytes = run_sparse(OUTPUT_FORMAT_BIT1, true, bit1_masks, errors);
+    run_sparse(OUTPUT_FORMAT_BIT1, false, bit1_masks, errors);
+    size_t rle_bytes = run_sparse(OUTPUT_FORMAT_RLE, true, rle_masks, errors);
+    run_sparse(OUTPUT_FORMAT_RLE, false, rle_masks, errors);
+    std::cout << "SPARSE D2H BYTES  RGB32: " << rgb32_bytes << "  BIT1: " << bit1_bytes << " (x" << (double)rgb32_bytes / bit1_bytes
+              << ")  RLE: " << rle_bytes << " (x" << (double)rgb32_bytes / rle_bytes << ")" << std::endl;
+    if (bit1_masks != rle_masks) {
+        std::cerr << "BIT1 and RLE masks differ" << std::endl;
+        errors++;
+    }
+    if (rle_bytes * 30 > rgb32_bytes || bit1_bytes * 30 > rgb32_bytes) {
+        std::cerr << "Mask outputs did not cut the sparse D2H bytes 30 times" << std::endl;
+        errors++;
+    }
+
+    /// Orientation bins and Gx / Gy planes next to the magnitude, images_per_run falls back to 1
+    run_gradient_planes(images, errors);
+
+    if (errors == 0) {
+        std::cout << "--- Batch pipeline test PASSED ---" << std::endl;
+        return 0;
+    } else {
+        std::cout << "--- Batch pipeline test FAILED ---" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,229 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <cstring>
+
+#include <opencv2/opencv.hpp>
+
+#include "accel_device.h"
+#include "batch_pipeline.h"
+#include "image_process_ref.h"
+#include "codec_pool.h"
+#include "test_images.h"
+
+///@brief: Checks the codec pools: a bounded queue never holds more than its capacity and reports when it sat full
+/// or empty, a producer pool hands out every index exactly once, the packed buffer set is page aligned and blocks
+/// when drained, and a BatchPipeline fed from decode workers matches the plain C model without a pack copy
+
+struct Decoded {
+    size_t index = 0;
+    unsigned char* buffer = nullptr;
+};
+
+int main() {
+    std::cout << "--- Starting codec pool test ---" << std::endl;
+    int errors = 0;
+
+    /// A slow consumer: the queue fills up to its capacity and no further
+    {
+        BoundedQueue<int> queue(3);
+        std::thread producer([&] {
+            for (int i = 0; i < 20; i++) queue.push(i);
+            queue.close();
+        });
+        int expected = 0;
+        int value = 0;
+        bool in_order = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        while (queue.pop(value)) {
+            in_order = in_order && value == expected++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        producer.join();
+        QueueStats stats = queue.stats();
+        if (!in_order || expected != 20 || stats.items != 20 || stats.peak != 3 || stats.full_ms < 10.0 || stats.mean_occupancy > 3.0) {
+            std::cerr << "Slow consumer: " << expected << " items, peak " << stats.peak << ", full " << stats.full_ms << " ms" << std::endl;
+            errors++;
+        }
+        if (queue.push(99)) {
+            std::cerr << "A closed queue accepted an item" << std::endl;
+            errors++;
+        }
+    }
+
+    /// A slow producer: the queue sits empty
+    {
+        BoundedQueue<int> queue(4);
+        std::thread producer([&] {
+            for (int i = 0; i < 5; i++) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                queue.push(i);
+            }
+            queue.close();
+        });
+        int value = 0;
+        while (queue.pop(value)) {
+        }
+        producer.join();
+        QueueStats stats = queue.stats();
+        if (stats.empty_ms < 0.5 * stats.lifetime_ms || stats.full_ms > 0.0) {
+            std::cerr << "Slow producer: empty " << stats.empty_ms << " of " << stats.lifetime_ms << " ms, full " << stats.full_ms << " ms" << std::endl;
+            errors++;
+        }
+    }
+
+    /// Every index produced once, the rejected ones never handed out
+    {
+        const size_t count = 500;
+        std::vector<std::atomic<int> > produced(count);
+        ProducerPool<size_t> pool(4, 8, count, [&](size_t index, size_t& item) {
+            produced[index]++;
+            item = index;
+            return index % 7 != 3;
+        });
+        std::vector<int> seen(count, 0);
+        size_t item = 0;
+        while (pool.next(item)) seen[item]++;
+        for (size_t i = 0; i < count; i++) {
+            if (produced[i] != 1 || seen[i] != (i % 7 != 3 ? 1 : 0)) {
+                std::cerr << "Index " << i << " produced " << produced[i] << " times, handed out " << seen[i] << " times" << std::endl;
+                errors++;
+                break;
+            }
+        }
+        if (pool.worker_count() != 4 || pool.stats().peak > 8) {
+            std::cerr << "Producer pool ran " << pool.worker_count() << " workers, queue peak " << pool.stats().peak << std::endl;
+            errors++;
+        }
+    }
+
+    /// A pool dropped early does not hang on a full queue
+    {
+        ProducerPool<int> pool(2, 1, 1000, [](size_t index, int& item) { item = index; return true; });
+        int item = 0;
+        pool.next(item);
+    }
+
+    /// Every submitted item consumed once, finish() waits for them
+    {
+        std::atomic<long long> sum{0};
+        ConsumerPool<int> pool(3, 2, [&](int& item) { sum += item; });
+        for (int i = 1; i <= 100; i++) pool.submit(i);
+        pool.finish();
+        if (sum != 5050 || pool.stats().items != 100 || pool.stats().peak > 2) {
+            std::cerr << "Consumer pool summed " << sum << " over " << pool.stats().items << " items" << std::endl;
+            errors++;
+        }
+    }
+
+    /// Buffers are page aligned and whole pages, acquire blocks until one comes back and fails after shutdown
+    {
+        PackedBufferPool buffers(2, 1000);
+        unsigned char* a = buffers.acquire();
+        unsigned char* b = buffers.acquire();
+        bool aligned = reinterpret_cast<uintptr_t>(a) % DATASET_ALIGN == 0 && reinterpret_cast<uintptr_t>(b) % DATASET_ALIGN == 0;
+        std::atomic<bool> got{false};
+        std::thread waiter([&] {
+            unsigned char* c = buffers.acquire();
+            got = c == a;
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        bool blocked = !got;
+        buffers.release(a);
+        waiter.join();
+        std::thread late([&] {
+            if (buffers.acquire() != nullptr) errors++;
+        });
+        buffers.shutdown();
+        late.join();
+        if (!aligned || buffers.bytes() != DATASET_ALIGN || buffers.count() != 2 || !blocked || !got) {
+            std::cerr << "Packed buffers: aligned " << aligned << ", " << buffers.bytes() << " bytes, blocked " << blocked << std::endl;
+            errors++;
+        }
+    }
+
+    /// Decode workers pack ahead of a pipeline that runs on their buffers in place
+    {
+        const int image_count = 12;
+        std::vector<cv::Mat> images;
+        for (int i = 0; i < image_count; i++) {
+            images.push_back(pattern_image(16 + i * 3, 40 - i, CV_8UC3, i));
+        }
+        SoftwareAccelDevice device;
+        PipelineConfig config;
+        config.queue_depth = 2;
+        config.max_height = 64;
+        config.max_width = 64;
+        BatchPipeline pipeline(device, config);
+
+        const int decode_workers = 3;
+        const size_t queue_capacity = 4;
+        PackedBufferPool buffers(queue_capacity + decode_workers + config.queue_depth + 1, input_buffer_bytes(config.input_format, 64 * 64));
+        std::vector<unsigned char*> buffer_of(image_count, nullptr);
+        std::mutex buffer_mutex;
+        {
+            ProducerPool<Decoded> decoder(decode_workers, queue_capacity, image_count, [&](size_t index, Decoded& item) {
+                item.index = index;
+                item.buffer = buffers.acquire();
+                if (!item.buffer) return false;
+                pack_input_image(images[index], config.input_format, item.buffer);
+                return true;
+            });
+
+            BatchReport report = pipeline.run(
+                [&](BatchInput& input) {
+                    Decoded item;
+                    if (!decoder.next(item)) return false;
+                    const cv::Mat& image = images[item.index];
+                    input.name = std::to_string(item.index);
+                    input.packed = item.buffer;
+                    input.height = image.rows;
+                    input.width = image.cols;
+                    input.tag = item.index;
+                    std::lock_guard<std::mutex> lock(buffer_mutex);
+                    buffer_of[item.index] = item.buffer;
+                    return true;
+                },
+                [&](const BatchOutput& output) {
+                    const cv::Mat& image = images[output.tag];
+                    std::vector<unsigned char> packed(input_buffer_bytes(config.input_format, image.rows * image.cols));
+                    pack_input_image(image, config.input_format, packed.data());
+                    std::vector<unsigned char> expected(output_buffer_bytes(OUTPUT_FORMAT_GRAY8, (image.rows - 2) * (image.cols - 2)));
+                    image_process_reference(packed.data(), expected.data(), image.rows, image.cols, config.input_format, OUTPUT_FORMAT_GRAY8);
+                    cv::Mat reference(image.rows - 2, image.cols - 2, CV_8UC1, expected.data());
+                    bool same = output.edges.rows == reference.rows && output.edges.cols == reference.cols;
+                    for (int r = 0; same && r < reference.rows; r++) {
+                        same = std::memcmp(output.edges.ptr<unsigned char>(r), reference.ptr<unsigned char>(r), reference.cols) == 0;
+                    }
+                    if (!same) {
+                        std::cerr << "Image " << output.name << " from the decode pool differs from the reference" << std::endl;
+                        errors++;
+                    }
+                    std::lock_guard<std::mutex> lock(buffer_mutex);
+                    buffers.release(buffer_of[output.tag]);
+                });
+
+            size_t copied = 0;
+            for (const PerformanceMetrics& metrics : report.images) {
+                copied += metrics.bytes_copied;
+            }
+            if (report.images.size() != (size_t)image_count || copied != 0) {
+                std::cerr << "Decode pool run retired " << report.images.size() << " images and copied " << copied << " bytes" << std::endl;
+                errors++;
+            }
+            buffers.shutdown();
+        }
+    }
+
+    if (errors == 0) {
+        std::cout << "--- Codec pool test PASSED ---" << std::endl;
+        return 0;
+    } else {
+        std::cout << "--- Codec pool test FAILED ---" << std::endl;
+        return 1;
+    }
+}
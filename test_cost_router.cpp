@@ -0,0 +1,214 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstring>
+
+#include <opencv2/opencv.hpp>
+
+#include "accel_device.h"
+#include "batch_pipeline.h"
+#include "image_process_ref.h"
+#include "cost_router.h"
+#include "test_images.h"
+
+///@brief: Checks the CPU / accelerator router: the online fit recovers a known line, a router fed synthetic
+/// timings sends small images to the CPU and large ones to the accelerator and recovers the cost terms without the
+/// accelerator's queueing, a burst of images is split over both backends, and a mixed batch run on a slow-to-launch
+/// stand-in accelerator with the CPU backend beside it matches the plain C model for every image
+
+bool near(double value, double expected, double tolerance) {
+    return std::fabs(value - expected) <= tolerance * std::fabs(expected);
+}
+
+///@brief: Timings of a made up accelerator (0.5 ms launch, 1 ns per pixel, 0.1 ns per byte each way) and CPU (100 MPPS).
+/// Every accelerator image also waits 2 ms behind earlier runs, the router books that through its backlog, so
+/// it must not end up in the fitted launch cost
+PerformanceMetrics synthetic_metrics(int backend, int height, int width) {
+    long long pixels = (long long)height * width;
+    PerformanceMetrics metrics;
+    if (backend == ROUTE_CPU) {
+        metrics.kernel_time_ms = pixels / 100e3;
+        metrics.device_time_ms = metrics.kernel_time_ms;
+        return metrics;
+    }
+    metrics.d2h_bytes = output_buffer_bytes(OUTPUT_FORMAT_GRAY8, (long long)(height - 2) * (width - 2));
+    metrics.h2d_time_ms = input_buffer_bytes(INPUT_FORMAT_RGB888, pixels) * 1e-7;
+    metrics.device_time_ms = 0.5 + pixels * 1e-6;
+    metrics.kernel_time_ms = metrics.device_time_ms + 2.0;
+    metrics.d2h_time_ms = metrics.d2h_bytes * 1e-7;
+    return metrics;
+}
+
+int main() {
+    std::cout << "--- Starting cost router test ---" << std::endl;
+    int errors = 0;
+
+    /// The fit recovers a line, and a single size gives a flat line at the mean
+    {
+        OnlineLinearFit fit;
+        for (int x = 1; x <= 50; x++) fit.add(x * 100.0, 2.0 + 0.5 * x * 100.0);
+        OnlineLinearFit one_size;
+        one_size.add(10.0, 4.0);
+        one_size.add(10.0, 6.0);
+        if (!near(fit.slope(), 0.5, 1e-6) || !near(fit.intercept(), 2.0, 1e-6) || !near(one_size.predict(20.0), 5.0, 1e-2)) {
+            std::cerr << "Fit gave slope " << fit.slope() << " intercept " << fit.intercept() << std::endl;
+            errors++;
+        }
+    }
+
+    /// Synthetic timings: after warm up small images go to the CPU and large ones to the accelerator
+    {
+        RouterConfig config;
+        config.explore_every = 0;
+        CostRouter router(config);
+        const int sizes[][2] = { {8, 8}, {1080, 1920}, {40, 30}, {600, 800}, {16, 200}, {2000, 2000}, {100, 100}, {300, 50} };
+        int id = 0;
+        for (int round = 0; round < 20; round++) {
+            for (const auto& size : sizes) {
+                int backend = router.route(id, size[0], size[1]);
+                router.complete(id++, synthetic_metrics(backend, size[0], size[1]));
+            }
+        }
+        CostModel model = router.model();
+        int tiny = router.route(id++, 10, 10);
+        int large = router.route(id++, 2160, 3840);
+        int side = router.crossover_side();
+        std::cout << "Synthetic model: kernel " << model.kernel_ns_per_pixel << " ns/px, fixed " << model.accel_fixed_ms << " ms, CPU "
+                  << model.cpu_mpps << " MPPS, CPU faster up to " << side << "x" << side << std::endl;
+        /// 10 ns per pixel on the CPU against 0.5 ms + ~1.4 ns per pixel crosses near 240x240 pixels
+        if (tiny != ROUTE_CPU || large != ROUTE_ACCEL || !near(model.kernel_ns_per_pixel, 1.0, 0.05) || !near(model.accel_fixed_ms, 0.5, 0.05) ||
+            !near(model.cpu_mpps, 100.0, 0.05) || !near(model.h2d_ns_per_byte, 0.1, 0.05) || side != 192) {
+            std::cerr << "Synthetic routing: tiny on " << route_backend_name(tiny) << ", large on " << route_backend_name(large) << std::endl;
+            errors++;
+        }
+        RouteStats stats = router.statistics();
+        if (stats.warmup != 6 || stats.images[ROUTE_CPU] == 0 || stats.images[ROUTE_ACCEL] == 0) {
+            std::cerr << "Synthetic routing: " << stats.warmup << " warm up images" << std::endl;
+            errors++;
+        }
+    }
+
+    /// A burst of equal images with nothing completing: the backlog spreads it over both backends
+    {
+        RouterConfig config;
+        config.explore_every = 0;
+        config.accel_lanes = 4;
+        CostRouter router(config);
+        int id = 0;
+        for (int i = 0; i < 12; i++) {
+            int height = (i % 2) ? 200 : 100;
+            int backend = router.route(id, height, 100);
+            router.complete(id++, synthetic_metrics(backend, height, 100));
+        }
+        int on_cpu = 0;
+        for (int i = 0; i < 40; i++) {
+            on_cpu += router.route(id++, 150, 100) == ROUTE_CPU;
+        }
+        if (on_cpu == 0 || on_cpu == 40) {
+            std::cerr << "A burst of 40 images put " << on_cpu << " on the CPU" << std::endl;
+            errors++;
+        }
+    }
+
+    /// Forced CPU mode never uses the accelerator
+    {
+        RouterConfig config;
+        config.mode = ROUTE_MODE_CPU;
+        CostRouter router(config);
+        bool all_cpu = true;
+        for (int i = 0; i < 10; i++) all_cpu = all_cpu && router.route(i, 2000, 2000) == ROUTE_CPU;
+        if (!all_cpu) {
+            std::cerr << "Forced CPU mode routed to the accelerator" << std::endl;
+            errors++;
+        }
+    }
+
+    /// Mixed batch: a 2 ms launch makes the accelerator lose on tiny images, the outputs of both backends match
+    {
+        SoftwareAccelDevice::Latency latency;
+        latency.launch_us = 2000.0;
+        latency.kernel_mpps = 2000.0;
+        SoftwareAccelDevice device(latency);
+        PipelineConfig config;
+        config.queue_depth = 2;
+        config.max_height = 256;
+        config.max_width = 256;
+        BatchPipeline pipeline(device, config);
+
+        std::vector<cv::Mat> images;
+        for (int i = 0; i < 60; i++) {
+            images.push_back(i % 10 == 9 ? pattern_image(250, 240, CV_8UC3, i) : pattern_image(5 + i % 7, 9 + i % 5, CV_8UC3, i));
+        }
+        RouterConfig router_config;
+        router_config.accel_lanes = config.queue_depth;
+        CostRouter router(router_config);
+        std::vector<int> outputs(images.size(), 0);
+        std::mutex output_mutex;
+        auto check = [&](const BatchOutput& output) {
+            const cv::Mat& image = images[output.tag];
+            std::vector<unsigned char> packed(input_buffer_bytes(config.input_format, image.rows * image.cols));
+            pack_input_image(image, config.input_format, packed.data());
+            std::vector<unsigned char> expected(output_buffer_bytes(OUTPUT_FORMAT_GRAY8, (image.rows - 2) * (image.cols - 2)));
+            image_process_reference(packed.data(), expected.data(), image.rows, image.cols, config.input_format, OUTPUT_FORMAT_GRAY8);
+            bool same = output.edges.rows == image.rows - 2 && output.edges.cols == image.cols - 2;
+            for (int r = 0; same && r < output.edges.rows; r++) {
+                same = std::memcmp(output.edges.ptr<unsigned char>(r), &expected[r * output.edges.cols], output.edges.cols) == 0;
+            }
+            std::lock_guard<std::mutex> lock(output_mutex);
+            outputs[output.tag]++;
+            if (!same) {
+                std::cerr << "Routed image " << output.tag << " differs from the reference" << std::endl;
+                errors++;
+            }
+            router.complete(output.tag, output.metrics);
+        };
+
+        CpuRouteBackend cpu(config, EdgeKernel(), 4, check);
+        size_t next = 0;
+        int small_on_cpu = 0;
+        int small_routed = 0;
+        pipeline.run(
+            [&](BatchInput& input) {
+                if (next == images.size()) return false;
+                input.image = images[next];
+                input.name = std::to_string(next);
+                input.tag = next++;
+                int backend = router.route(input.tag, input.image.rows, input.image.cols);
+                if (input.tag >= 20 && input.image.rows < 20) {
+                    small_routed++;
+                    small_on_cpu += backend == ROUTE_CPU;
+                }
+                if (backend == ROUTE_CPU) {
+                    cpu.submit(input);
+                    input.image.release();
+                }
+                return true;
+            },
+            check);
+        cpu.finish();
+
+        for (size_t i = 0; i < outputs.size(); i++) {
+            if (outputs[i] != 1) {
+                std::cerr << "Routed image " << i << " came out " << outputs[i] << " times" << std::endl;
+                errors++;
+                break;
+            }
+        }
+        RouteStats stats = router.statistics();
+        std::cout << "Mixed batch: " << stats.images[ROUTE_ACCEL] << " on the accelerator, " << stats.images[ROUTE_CPU] << " on the CPU, "
+                  << small_on_cpu << " of " << small_routed << " small images after warm up on the CPU" << std::endl;
+        if (small_on_cpu < small_routed * 3 / 4) {
+            std::cerr << "The router kept small images on the slow-to-launch accelerator" << std::endl;
+            errors++;
+        }
+    }
+
+    if (errors == 0) {
+        std::cout << "--- Cost router test PASSED ---" << std::endl;
+        return 0;
+    } else {
+        std::cout << "--- Cost router test FAILED ---" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,120 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <chrono>
+
+#include "image_formats.h"
+#include "image_process_ref.h"
+#include "cpu_engine.h"
+
+///@brief: Checks every CPU engine variant the host supports byte for byte against image_process_reference,
+/// including the zeroed tail of the last output burst, then times a 1920x1080 frame per variant
+
+struct Shape {
+    int height;
+    int width;
+};
+
+double time_engine_ms(const std::vector<unsigned char>& input, std::vector<unsigned char>& output, int height, int width,
+                      int input_format, int output_format, int isa, int threads, bool reference) {
+    const int runs = 5;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int run = 0; run < runs; run++) {
+        if (reference) {
+            image_process_reference(input.data(), output.data(), height, width, input_format, output_format);
+        } else {
+            CpuEngineOptions options;
+            options.isa = isa;
+            options.threads = threads;
+            image_process_cpu(input.data(), output.data(), height, width, input_format, output_format, options);
+        }
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count() / 1000.0 / runs;
+}
+
+int main() {
+    std::cout << "--- Starting CPU engine test ---" << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+
+    const Shape shapes[] = { {3, 3}, {5, 4}, {4, 7}, {9, 17}, {7, 33}, {6, 34}, {35, 35}, {16, 64}, {13, 97}, {11, 481}, {321, 481} };
+    const int input_formats[] = { INPUT_FORMAT_RGB32, INPUT_FORMAT_RGB888, INPUT_FORMAT_LUMA8 };
+    const int output_formats[] = { OUTPUT_FORMAT_RGB32, OUTPUT_FORMAT_GRAY8 };
+    const int thread_counts[] = { 1, 4 };
+    int supported = cpu_detect_isa();
+    std::cout << "HOST ISA: " << cpu_isa_name(supported) << std::endl;
+
+    srand(5);
+    int errors = 0;
+    for (const Shape& shape : shapes) {
+        int size = shape.height * shape.width;
+        int out_size = (shape.height - 2) * (shape.width - 2);
+        for (int input_format : input_formats) {
+            std::vector<unsigned char> input(input_buffer_bytes(input_format, size));
+            for (unsigned char& byte : input) {
+                byte = rand() & 0xFF;
+            }
+            for (int output_format : output_formats) {
+                size_t out_bytes = output_buffer_bytes(output_format, out_size);
+                std::vector<unsigned char> expected(out_bytes);
+                image_process_reference(input.data(), expected.data(), shape.height, shape.width, input_format, output_format);
+
+                for (int isa = CPU_ISA_SCALAR; isa <= supported; isa++) {
+                    for (int threads : thread_counts) {
+                        /// Poison the buffer so bytes the engine fails to write show up
+                        std::vector<unsigned char> output(out_bytes, 0xA5);
+                        CpuEngineOptions options;
+                        options.isa = isa;
+                        options.threads = threads;
+                        image_process_cpu(input.data(), output.data(), shape.height, shape.width, input_format, output_format, options);
+                        if (output != expected) {
+                            std::cerr << "Mismatch " << shape.height << "x" << shape.width << " input " << input_format
+                                      << " output " << output_format << " isa " << cpu_isa_name(isa) << " threads " << threads << std::endl;
+                            errors++;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    /// The mask and MAG_ORIENT buffers are smaller than an RGB32 plane, the engine must refuse them untouched
+    const int unsupported_formats[] = { OUTPUT_FORMAT_BIT1, OUTPUT_FORMAT_RLE, OUTPUT_FORMAT_MAG_ORIENT };
+    for (int output_format : unsupported_formats) {
+        std::vector<unsigned char> input(input_buffer_bytes(INPUT_FORMAT_RGB32, 66 * 66), 0x40);
+        std::vector<unsigned char> output(output_buffer_bytes(output_format, 64, 64), 0xA5);
+        if (cpu_engine_supports(output_format) ||
+            image_process_cpu(input.data(), output.data(), 66, 66, INPUT_FORMAT_RGB32, output_format) ||
+            output != std::vector<unsigned char>(output.size(), 0xA5)) {
+            std::cerr << "Output format " << output_format << " not rejected" << std::endl;
+            errors++;
+        }
+    }
+
+    int height = 1080;
+    int width = 1920;
+    std::vector<unsigned char> frame(input_buffer_bytes(INPUT_FORMAT_RGB888, height * width));
+    for (unsigned char& byte : frame) {
+        byte = rand() & 0xFF;
+    }
+    std::vector<unsigned char> edges(output_buffer_bytes(OUTPUT_FORMAT_GRAY8, (height - 2) * (width - 2)));
+    double reference_ms = time_engine_ms(frame, edges, height, width, INPUT_FORMAT_RGB888, OUTPUT_FORMAT_GRAY8, 0, 1, true);
+    std::cout << "1920x1080 RGB888 -> GRAY8" << std::endl;
+    std::cout << "  reference: " << reference_ms << " ms" << std::endl;
+    for (int isa = CPU_ISA_SCALAR; isa <= supported; isa++) {
+        double single_ms = time_engine_ms(frame, edges, height, width, INPUT_FORMAT_RGB888, OUTPUT_FORMAT_GRAY8, isa, 1, false);
+        double threaded_ms = time_engine_ms(frame, edges, height, width, INPUT_FORMAT_RGB888, OUTPUT_FORMAT_GRAY8, isa, 0, false);
+        std::cout << "  " << std::left << std::setw(8) << cpu_isa_name(isa) << " 1 thread: " << single_ms << " ms ("
+                  << reference_ms / single_ms << "x), all threads: " << threaded_ms << " ms (" << reference_ms / threaded_ms << "x)" << std::endl;
+    }
+
+    if (errors == 0) {
+        std::cout << "--- CPU engine test PASSED ---" << std::endl;
+        return 0;
+    } else {
+        std::cout << "--- CPU engine test FAILED ---" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,157 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <memory>
+#include <stdexcept>
+
+#include <opencv2/opencv.hpp>
+
+#include "accel_device.h"
+#include "batch_pipeline.h"
+#include "cu_scheduler.h"
+#include "image_process_ref.h"
+#include "test_images.h"
+
+///@brief: Spreads a batch over three software stand-in CUs, one of them much slower than the others, and
+/// checks that every image comes out once and bit-exact and that stealing keeps the slow CU off the critical path.
+/// A CU that fails its third run has to surface as an exception from run(), not take the process down
+
+///@brief: Stand-in CU whose runs throw once `good_runs` have been started
+class FailingAccelDevice : public SoftwareAccelDevice {
+public:
+    explicit FailingAccelDevice(int good_runs) : SoftwareAccelDevice(Latency(), "sw:failing"), runs_left(good_runs) {}
+
+    void start_batch(int slot, const std::vector<ImageDescriptor>& descriptors, int input_format, int output_format, const EdgeStages& stages) override {
+        if (runs_left-- == 0) throw std::runtime_error("compute unit lost");
+        SoftwareAccelDevice::start_batch(slot, descriptors, input_format, output_format, stages);
+    }
+
+private:
+    int runs_left;
+};
+
+ScheduleReport run_scheduled(const std::vector<cv::Mat>& images, bool work_stealing, int& errors) {
+    std::vector<std::unique_ptr<SoftwareAccelDevice> > devices;
+    std::vector<AccelDevice*> units;
+    for (int unit = 0; unit < 3; unit++) {
+        SoftwareAccelDevice::Latency latency;
+        latency.kernel_mpps = unit == 0 ? 2.0 : 40.0;
+        latency.launch_us = 100.0;
+        devices.emplace_back(new SoftwareAccelDevice(latency, "sw:" + std::to_string(unit)));
+        units.push_back(devices.back().get());
+    }
+
+    CuSchedulerConfig config;
+    config.pipeline.queue_depth = 2;
+    config.pipeline.max_height = 480;
+    config.pipeline.max_width = 640;
+    config.work_stealing = work_stealing;
+    CuScheduler scheduler(units, config);
+
+    std::vector<int> seen(images.size(), 0);
+    ScheduleReport report = scheduler.run(images.size(),
+        [&](int, int index, BatchInput& input) {
+            input.name = std::to_string(index);
+            input.image = images[index];
+        },
+        [&](int, const BatchOutput& output) {
+            int index = std::stoi(output.name);
+            seen[index]++;
+            const cv::Mat& image = images[index];
+            int out_size = (image.rows - 2) * (image.cols - 2);
+            std::vector<unsigned char> packed(input_buffer_bytes(INPUT_FORMAT_RGB888, image.rows * image.cols));
+            std::vector<unsigned char> expected(output_buffer_bytes(OUTPUT_FORMAT_GRAY8, out_size));
+            pack_input_image(image, INPUT_FORMAT_RGB888, packed.data());
+            image_process_reference(packed.data(), expected.data(), image.rows, image.cols, INPUT_FORMAT_RGB888, OUTPUT_FORMAT_GRAY8);
+            for (int r = 0; r < output.edges.rows; r++) {
+                if (std::memcmp(output.edges.ptr<unsigned char>(r), &expected[r * output.edges.cols], output.edges.cols) != 0) {
+                    std::cerr << "Image " << index << " differs from the reference at row " << r << std::endl;
+                    errors++;
+                    break;
+                }
+            }
+        });
+
+    for (size_t i = 0; i < seen.size(); i++) {
+        if (seen[i] != 1) {
+            std::cerr << "Image " << i << " was delivered " << seen[i] << " times" << std::endl;
+            errors++;
+        }
+    }
+    return report;
+}
+
+int main() {
+    std::cout << "--- Starting multi-CU scheduler test ---" << std::endl;
+    int errors = 0;
+    const int shapes[][2] = { {480, 640}, {64, 96}, {241, 319}, {120, 160} };
+    std::vector<cv::Mat> images = random_images(24, shapes, 17);
+
+    ScheduleReport static_report = run_scheduled(images, false, errors);
+    ScheduleReport stealing_report = run_scheduled(images, true, errors);
+
+    int stolen = 0;
+    for (const CuReport& cu : stealing_report.units) {
+        std::cout << cu.name << ": " << cu.images << " images, " << cu.stolen << " stolen, utilization "
+                  << cu.utilization * 100.0 << " %" << std::endl;
+        stolen += cu.stolen;
+        if (cu.utilization < 0.0 || cu.utilization > 1.0) {
+            std::cerr << "Utilization of " << cu.name << " out of range" << std::endl;
+            errors++;
+        }
+    }
+    std::cout << "Static: " << static_report.wall_time_ms << " ms, stealing: " << stealing_report.wall_time_ms << " ms" << std::endl;
+
+    if (stolen == 0 || stealing_report.units[0].images >= static_report.units[0].images) {
+        std::cerr << "The slow CU kept its whole share, nothing was stolen from it" << std::endl;
+        errors++;
+    }
+    if (stealing_report.wall_time_ms > static_report.wall_time_ms * 0.8) {
+        std::cerr << "Work stealing did not shorten the batch" << std::endl;
+        errors++;
+    }
+    if (stealing_report.total_pixels != static_report.total_pixels) {
+        std::cerr << "Pixel totals differ between the two runs" << std::endl;
+        errors++;
+    }
+
+    /// One of three CUs fails, a loader throws: both end run() with their exception after every worker joined
+    for (bool failing_loader : { false, true }) {
+        std::vector<std::unique_ptr<SoftwareAccelDevice> > devices;
+        devices.emplace_back(new SoftwareAccelDevice());
+        devices.emplace_back(new FailingAccelDevice(failing_loader ? 1000 : 2));
+        devices.emplace_back(new SoftwareAccelDevice());
+        std::vector<AccelDevice*> units = { devices[0].get(), devices[1].get(), devices[2].get() };
+        CuSchedulerConfig config;
+        config.pipeline.max_height = 480;
+        config.pipeline.max_width = 640;
+        CuScheduler scheduler(units, config);
+        std::string message;
+        try {
+            scheduler.run(images.size(),
+                [&](int, int index, BatchInput& input) {
+                    if (failing_loader && index == 7) throw std::runtime_error("cannot decode image 7");
+                    input.name = std::to_string(index);
+                    input.image = images[index];
+                },
+                [](int, const BatchOutput&) {});
+        } catch (const std::runtime_error& error) {
+            message = error.what();
+        }
+        std::string expected = failing_loader ? "cannot decode image 7" : "compute unit lost";
+        if (message != expected) {
+            std::cerr << "Expected run() to throw \"" << expected << "\", got \"" << message << "\"" << std::endl;
+            errors++;
+        }
+    }
+
+    if (errors == 0) {
+        std::cout << "--- Multi-CU scheduler test PASSED ---" << std::endl;
+        return 0;
+    } else {
+        std::cout << "--- Multi-CU scheduler test FAILED ---" << std::endl;
+        return 1;
+    }
+}
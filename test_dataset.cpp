@@ -0,0 +1,162 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+#include <opencv2/opencv.hpp>
+
+#include "accel_device.h"
+#include "batch_pipeline.h"
+#include "image_process_ref.h"
+#include "dataset.h"
+#include "test_images.h"
+
+///@brief: Writes input and edge containers and maps them back: payloads are page aligned and hold the packed
+/// images, a BatchPipeline fed from the mapping runs on the payloads without a pack copy and matches the plain C
+/// model, and truncated or foreign files are refused
+
+bool same_pixels(const cv::Mat& a, const cv::Mat& b) {
+    if (a.rows != b.rows || a.cols != b.cols || a.type() != b.type()) return false;
+    for (int r = 0; r < a.rows; r++) {
+        if (std::memcmp(a.ptr<unsigned char>(r), b.ptr<unsigned char>(r), a.cols * a.elemSize()) != 0) return false;
+    }
+    return true;
+}
+
+///@brief: Runs the mapped dataset through the pipeline and checks each output against the reference
+void run_mapped(const DatasetReader& reader, const std::vector<cv::Mat>& images, int images_per_run, bool expect_copies, int& errors) {
+    SoftwareAccelDevice device;
+    PipelineConfig config;
+    config.queue_depth = 2;
+    config.input_format = reader.format();
+    config.max_height = 64;
+    config.max_width = 64;
+    config.images_per_run = images_per_run;
+    BatchPipeline pipeline(device, config);
+
+    size_t next = 0;
+    BatchReport report = pipeline.run(
+        [&](BatchInput& input) {
+            if (next == reader.size()) return false;
+            input.name = reader.name(next);
+            input.packed = reader.payload(next);
+            input.height = reader.entry(next).height;
+            input.width = reader.entry(next).width;
+            input.tag = next++;
+            return true;
+        },
+        [&](const BatchOutput& output) {
+            const cv::Mat& image = images[output.tag];
+            std::vector<unsigned char> expected(output_buffer_bytes(OUTPUT_FORMAT_GRAY8, (image.rows - 2) * (image.cols - 2)));
+            image_process_reference(reader.payload(output.tag), expected.data(), image.rows, image.cols, config.input_format, OUTPUT_FORMAT_GRAY8);
+            if (!same_pixels(output.edges, cv::Mat(image.rows - 2, image.cols - 2, CV_8UC1, expected.data()))) {
+                std::cerr << "Mapped " << input_format_name(config.input_format) << " image " << output.name << " differs from the reference" << std::endl;
+                errors++;
+            }
+        });
+
+    size_t copied = 0;
+    for (const PerformanceMetrics& metrics : report.images) {
+        copied += metrics.bytes_copied;
+    }
+    if (report.images.size() != images.size() || (copied > 0) != expect_copies) {
+        std::cerr << "Mapped run of " << images_per_run << " per run retired " << report.images.size() << " images and copied "
+                  << copied << " bytes" << std::endl;
+        errors++;
+    }
+}
+
+int main() {
+    std::cout << "--- Starting dataset container test ---" << std::endl;
+    int errors = 0;
+    const std::string path = "/tmp/test_dataset_" + std::to_string(getpid()) + ".edgeds";
+    /// Larger than the pipeline slots on purpose: 80x70 grows a slot when copied, runs in place when attached
+    const int shapes[][2] = { {3, 3}, {13, 97}, {48, 64}, {80, 70}, {5, 4} };
+    const int image_count = sizeof(shapes) / sizeof(shapes[0]);
+
+    for (int input_format : { INPUT_FORMAT_RGB888, INPUT_FORMAT_LUMA8, INPUT_FORMAT_RGB32 }) {
+        std::vector<cv::Mat> images;
+        {
+            DatasetWriter writer(path, DATASET_KIND_INPUT, input_format);
+            for (int i = 0; i < image_count; i++) {
+                images.push_back(pattern_image(shapes[i][0], shapes[i][1], input_format == INPUT_FORMAT_LUMA8 ? CV_8UC1 : CV_8UC3, i));
+                std::vector<unsigned char> packed(input_buffer_bytes(input_format, shapes[i][0] * shapes[i][1]));
+                pack_input_image(images.back(), input_format, packed.data());
+                writer.append(i == 1 ? std::string(300, 'n') : "image_" + std::to_string(i), shapes[i][0], shapes[i][1], packed.data(), packed.size());
+            }
+        }
+
+        DatasetReader reader(path);
+        if (reader.kind() != DATASET_KIND_INPUT || reader.format() != input_format || reader.size() != (size_t)image_count) {
+            std::cerr << "Header of the " << input_format_name(input_format) << " container read back wrong" << std::endl;
+            errors++;
+            continue;
+        }
+        cv::Mat storage;
+        for (int i = 0; i < image_count; i++) {
+            std::vector<unsigned char> packed(input_buffer_bytes(input_format, shapes[i][0] * shapes[i][1]));
+            pack_input_image(images[i], input_format, packed.data());
+            const DatasetEntry& entry = reader.entry(i);
+            if (reinterpret_cast<uintptr_t>(reader.payload(i)) % DATASET_ALIGN != 0 || entry.bytes != packed.size() ||
+                std::memcmp(reader.payload(i), packed.data(), packed.size()) != 0 || !same_pixels(reader.image(i, storage), images[i]) ||
+                reader.name(i) != (i == 1 ? std::string(DATASET_NAME_BYTES - 1, 'n') : "image_" + std::to_string(i))) {
+                std::cerr << input_format_name(input_format) << " entry " << i << " read back wrong" << std::endl;
+                errors++;
+            }
+        }
+
+        run_mapped(reader, images, 1, false, errors);
+        run_mapped(reader, images, 3, true, errors);
+    }
+
+    /// Edge container: a strided ROI goes in, dense rows come back
+    {
+        cv::Mat frame = pattern_image(40, 50, CV_8UC1, 7);
+        cv::Mat roi = frame(cv::Rect(3, 5, 31, 17));
+        {
+            DatasetWriter writer(path, DATASET_KIND_EDGES, OUTPUT_FORMAT_GRAY8);
+            writer.append_edges("roi", roi);
+            writer.append_edges("frame", frame);
+        }
+        DatasetReader reader(path);
+        cv::Mat storage;
+        if (reader.kind() != DATASET_KIND_EDGES || reader.size() != 2 || !same_pixels(reader.image(0, storage), roi) ||
+            !same_pixels(reader.image(1, storage), frame) || reader.entry(0).bytes != 31 * 17) {
+            std::cerr << "Edge container read back wrong" << std::endl;
+            errors++;
+        }
+    }
+
+    /// A container cut short or a file that is not one is refused
+    {
+        std::ifstream in(path, std::ios::binary);
+        std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::ofstream(path, std::ios::binary | std::ios::trunc).write(bytes.data(), bytes.size() - DATASET_ALIGN);
+        std::ofstream(path + ".bad", std::ios::binary).write(std::string(2 * DATASET_ALIGN, 'x').data(), 2 * DATASET_ALIGN);
+        for (const std::string& bad : { path, path + ".bad", path + ".missing" }) {
+            bool refused = false;
+            try {
+                DatasetReader reader(bad);
+            } catch (const std::runtime_error&) {
+                refused = true;
+            }
+            if (!refused) {
+                std::cerr << "Opened a broken dataset: " << bad << std::endl;
+                errors++;
+            }
+        }
+    }
+    std::remove(path.c_str());
+    std::remove((path + ".bad").c_str());
+
+    if (errors == 0) {
+        std::cout << "--- Dataset container test PASSED ---" << std::endl;
+        return 0;
+    } else {
+        std::cout << "--- Dataset container test FAILED ---" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,160 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+
+#include <opencv2/opencv.hpp>
+
+#include "accel_device.h"
+#include "batch_pipeline.h"
+#include "frame_regions.h"
+#include "image_process_ref.h"
+
+///@brief: Uploads a cropped (non-continuous) frame once and runs many regions of it on the software stand-in
+/// device, with and without the batch kernel. Every region output is checked against the reference run on
+/// a dense copy of the region
+
+///@brief: The stand-in device without image_process_batch, regions then run one by one
+class SingleKernelDevice : public SoftwareAccelDevice {
+public:
+    bool supports_batch() const override { return false; }
+};
+
+std::vector<cv::Rect> make_regions(int frame_height, int frame_width, int count) {
+    std::vector<cv::Rect> regions;
+    regions.push_back(cv::Rect(0, 0, frame_width, frame_height));
+    regions.push_back(cv::Rect(frame_width - 3, frame_height - 3, 3, 3));
+    regions.push_back(cv::Rect(1, 2, frame_width - 1, 5));
+    for (int i = 0; i < count; i++) {
+        int width = 3 + rand() % 120;
+        int height = 3 + rand() % 90;
+        regions.push_back(cv::Rect(rand() % (frame_width - width + 1), rand() % (frame_height - height + 1), width, height));
+    }
+    return regions;
+}
+
+void check_regions(const cv::Mat& frame, const std::vector<cv::Rect>& regions, const RegionReport& report, const FrameRegionsConfig& config,
+                   const std::string& label, int& errors) {
+    if (report.edges.size() != regions.size()) {
+        std::cerr << label << ": " << report.edges.size() << " outputs for " << regions.size() << " regions" << std::endl;
+        errors++;
+        return;
+    }
+    for (size_t n = 0; n < regions.size(); n++) {
+        const cv::Rect& region = regions[n];
+        cv::Mat image = frame(region);
+        int out_height = region.height - 2;
+        int out_width = region.width - 2;
+        std::vector<unsigned char> packed(input_buffer_bytes(config.input_format, region.height * region.width));
+        std::vector<unsigned char> expected(output_buffer_bytes(OUTPUT_FORMAT_GRAY8, out_height * out_width));
+        pack_input_image(image, config.input_format, packed.data());
+        image_process_reference(packed.data(), expected.data(), region.height, region.width, config.input_format, OUTPUT_FORMAT_GRAY8,
+                                config.stages.flags, config.stages.low_threshold, config.stages.high_threshold);
+        if (is_mask_output(config.output_format)) {
+            for (int i = 0; i < out_height * out_width; i++) {
+                expected[i] = expected[i] >= config.stages.mask_threshold ? 255 : 0;
+            }
+        }
+        const cv::Mat& edges = report.edges[n];
+        if (edges.rows != out_height || edges.cols != out_width) {
+            std::cerr << label << ": region " << n << " came back " << edges.cols << "x" << edges.rows << std::endl;
+            errors++;
+            continue;
+        }
+        for (int r = 0; r < out_height; r++) {
+            if (std::memcmp(edges.ptr<unsigned char>(r), &expected[r * out_width], out_width) != 0) {
+                std::cerr << label << ": region " << n << " (" << region.x << ", " << region.y << ") " << region.width << "x"
+                          << region.height << " differs from the reference at row " << r << std::endl;
+                errors++;
+                break;
+            }
+        }
+    }
+}
+
+int main() {
+    std::cout << "--- Starting frame regions test on the software stand-in device ---" << std::endl;
+    int errors = 0;
+    srand(23);
+
+    /// The frame is a crop of a larger image, its rows are the parent's step apart
+    cv::Mat parent(300, 500, CV_8UC3);
+    for (int r = 0; r < parent.rows; r++) {
+        unsigned char* row = parent.ptr<unsigned char>(r);
+        for (int c = 0; c < parent.cols * 3; c++) {
+            row[c] = ((c / 21 + r / 13) % 2) * 150 + (rand() & 0x3F);
+        }
+    }
+    cv::Mat frame = parent(cv::Rect(7, 5, 401, 257));
+    std::vector<cv::Rect> regions = make_regions(frame.rows, frame.cols, 40);
+
+    SoftwareAccelDevice device;
+    FrameRegionsConfig config;
+    FrameRegions frame_regions(device, config);
+    size_t uploaded = frame_regions.upload(frame);
+    if (uploaded != (size_t)(frame.rows - 1) * frame.step + frame.cols * 3) {
+        std::cerr << "Upload copied " << uploaded << " bytes, expected the frame block at its own step" << std::endl;
+        errors++;
+    }
+    RegionReport batched = frame_regions.run(regions);
+    check_regions(frame, regions, batched, config, "BATCH GRAY8", errors);
+    std::cout << "BATCH GRAY8: " << regions.size() << " REGIONS IN " << batched.runs << " RUNS, " << batched.metrics.bytes_copied
+              << " BYTES COPIED ON THE HOST" << std::endl;
+    if (batched.runs < 2 || batched.runs >= (int)regions.size()) {
+        std::cerr << "Expected the regions to be packed into a few runs bounded by the output buffer" << std::endl;
+        errors++;
+    }
+
+    /// A second set on the resident frame, small enough for one run: the GRAY8 outputs are views, nothing is copied
+    std::vector<cv::Rect> small_regions(regions.begin() + 3, regions.begin() + 9);
+    RegionReport single_run = frame_regions.run(small_regions);
+    check_regions(frame, small_regions, single_run, config, "RESIDENT FRAME", errors);
+    if (single_run.runs != 1 || single_run.metrics.bytes_copied != 0) {
+        std::cerr << "Regions of one run should come back in place, saw " << single_run.runs << " runs and "
+                  << single_run.metrics.bytes_copied << " bytes copied" << std::endl;
+        errors++;
+    }
+
+    /// LUMA8 frame, canny, bit1 masks and no batch kernel
+    cv::Mat gray_parent(300, 500, CV_8UC1);
+    for (int r = 0; r < gray_parent.rows; r++) {
+        for (int c = 0; c < gray_parent.cols; c++) {
+            gray_parent.ptr<unsigned char>(r)[c] = ((c / 17 + r / 11) % 2) * 140 + (rand() & 0x1F);
+        }
+    }
+    cv::Mat gray_frame = gray_parent(cv::Rect(3, 1, 333, 201));
+    std::vector<cv::Rect> gray_regions = make_regions(gray_frame.rows, gray_frame.cols, 12);
+    SingleKernelDevice single_device;
+    FrameRegionsConfig mask_config;
+    mask_config.input_format = INPUT_FORMAT_LUMA8;
+    mask_config.output_format = OUTPUT_FORMAT_BIT1;
+    mask_config.stages.flags = EDGE_STAGE_CANNY;
+    FrameRegions mask_regions(single_device, mask_config);
+    mask_regions.upload(gray_frame);
+    RegionReport masks = mask_regions.run(gray_regions);
+    check_regions(gray_frame, gray_regions, masks, mask_config, "SINGLE KERNEL BIT1", errors);
+    if (masks.runs != (int)gray_regions.size()) {
+        std::cerr << "Without the batch kernel every region is its own run, saw " << masks.runs << std::endl;
+        errors++;
+    }
+
+    bool rejected = false;
+    try {
+        mask_regions.run(std::vector<cv::Rect>(1, cv::Rect(gray_frame.cols - 2, 0, 3, 3)));
+    } catch (const std::runtime_error&) {
+        rejected = true;
+    }
+    if (!rejected) {
+        std::cerr << "A region outside the frame was accepted" << std::endl;
+        errors++;
+    }
+
+    if (errors == 0) {
+        std::cout << "--- Frame regions test PASSED ---" << std::endl;
+        return 0;
+    } else {
+        std::cout << "--- Frame regions test FAILED ---" << std::endl;
+        return 1;
+    }
+}
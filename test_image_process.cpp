@@ -3,6 +3,7 @@
 #include <cmath>
 #include <algorithm>
 #include <ap_int.h>
+#include "image_formats.h"
 
 #define MAX_WIDTH 4096 
 #define WIDE_BUS_WIDTH 512
@@ -16,8 +17,19 @@ extern "C" {
 void image_process(
     const WIDE_BUS_TYPE* in_img, 
     WIDE_BUS_TYPE* out_img,      
+    WIDE_BUS_TYPE* grad_img,
     int height,
-    int width);
+    int width,
+    int input_format,
+    int output_format,
+    int stages,
+    int low_threshold,
+    int high_threshold,
+    int mask_threshold,
+    int roi_x,
+    int roi_y,
+    int in_stride,
+    int out_stride);
 }
 
 void pack_image_data(const BUS_TYPE* unpacked, WIDE_BUS_TYPE* packed, int size) {
@@ -78,7 +90,7 @@ int main() {
     pack_image_data(input_32bit, input_wide, INPUT_SIZE);
 
     std::cout << "Calling image_process kernel..." << std::endl;
-    image_process(input_wide, output_wide, HEIGHT, WIDTH);
+    image_process(input_wide, output_wide, nullptr, HEIGHT, WIDTH, INPUT_FORMAT_RGB32, OUTPUT_FORMAT_RGB32, 0, 0, 0, 0, 0, 0, 0, 0);
     std::cout << "Kernel execution complete." << std::endl;
 
     unpack_image_data(output_wide, output_32bit, OUTPUT_SIZE);
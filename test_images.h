@@ -0,0 +1,52 @@
+#ifndef TEST_IMAGES_H
+#define TEST_IMAGES_H
+
+#include <vector>
+#include <cstdlib>
+#include <cstddef>
+
+#include <opencv2/opencv.hpp>
+
+///@brief: Input images shared by the test programs
+
+///@brief: Blocky bands with a little texture, the same image for the same seed on every run. type is CV_8UC1 / CV_8UC3
+inline cv::Mat pattern_image(int height, int width, int type, int seed) {
+    cv::Mat image(height, width, type);
+    for (int r = 0; r < height; r++) {
+        unsigned char* row = image.ptr<unsigned char>(r);
+        for (int c = 0; c < width * image.channels(); c++) {
+            row[c] = ((c / 13 + r / 7 + seed) % 3) * 100 + ((c * 31 + r * 17 + seed) & 0x1F);
+        }
+    }
+    return image;
+}
+
+///@brief: Bytes from rand(), seeded by the caller. With noise_every > 1 only one byte in noise_every on average
+/// is random and the others form flat 0 / 200 patches, so an edge map has both saturated and zero gradients
+inline cv::Mat random_image(int height, int width, int type, int noise_every = 1) {
+    cv::Mat image(height, width, type);
+    for (int r = 0; r < height; r++) {
+        unsigned char* row = image.ptr<unsigned char>(r);
+        for (size_t c = 0; c < width * image.elemSize(); c++) {
+            if (noise_every <= 1 || rand() % noise_every == 0) {
+                row[c] = rand() & 0xFF;
+            } else {
+                row[c] = ((c / 9 + r / 5) % 2) * 200;
+            }
+        }
+    }
+    return image;
+}
+
+///@brief: count random BGR images cycling through shapes ({height, width} pairs), after srand(seed)
+template <size_t N>
+std::vector<cv::Mat> random_images(int count, const int (&shapes)[N][2], unsigned seed) {
+    std::vector<cv::Mat> images;
+    srand(seed);
+    for (int i = 0; i < count; i++) {
+        images.push_back(random_image(shapes[i % N][0], shapes[i % N][1], CV_8UC3));
+    }
+    return images;
+}
+
+#endif
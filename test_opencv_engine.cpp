@@ -0,0 +1,158 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <atomic>
+#include <chrono>
+
+#include <opencv2/opencv.hpp>
+
+#include "opencv_engine.h"
+#include "test_images.h"
+
+///@brief: Checks the fused engine of openCV_app byte for byte against a plain C model of the OpenCV pipeline for
+/// every ISA the host supports, on odd and degenerate shapes, 1 / 3 / 4 channel and strided ROI inputs and with
+/// scratch reused across sizes. Also checks that the image pool runs every image once and that process_image_opencv
+/// gives the same maps, then times a 1920x1080 frame on both engines. Only that process_image_opencv check runs
+/// OpenCV's own code, so the equivalence is only tested in a build against a real OpenCV (pkg-config opencv4)
+
+///@brief: The OpenCV pipeline written out per pixel: BGR2GRAY, CV_8U Sobel both ways with reflected borders, sum
+cv::Mat reference_edges(const cv::Mat& input) {
+    int height = input.rows;
+    int width = input.cols;
+    std::vector<int> gray(height * width);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const unsigned char* pixel = input.ptr<unsigned char>(y) + x * input.channels();
+            gray[y * width + x] = input.channels() == 1 ? pixel[0] : (pixel[0] * 3735 + pixel[1] * 19235 + pixel[2] * 9798 + 16384) >> 15;
+        }
+    }
+    auto at = [&](int y, int x) { return gray[fused_reflect_101(y, height) * width + fused_reflect_101(x, width)]; };
+    cv::Mat edges(height, width, CV_8UC1);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int gx = at(y - 1, x + 1) - at(y - 1, x - 1) + 2 * (at(y, x + 1) - at(y, x - 1)) + at(y + 1, x + 1) - at(y + 1, x - 1);
+            int gy = at(y + 1, x - 1) + 2 * at(y + 1, x) + at(y + 1, x + 1) - at(y - 1, x - 1) - 2 * at(y - 1, x) - at(y - 1, x + 1);
+            int edge = std::min(255, std::max(0, gx)) + std::min(255, std::max(0, gy));
+            edges.ptr<unsigned char>(y)[x] = std::min(255, edge);
+        }
+    }
+    return edges;
+}
+
+int count_differences(const cv::Mat& a, const cv::Mat& b) {
+    if (a.rows != b.rows || a.cols != b.cols || a.type() != b.type()) return a.rows * a.cols + 1;
+    int differences = 0;
+    for (int y = 0; y < a.rows; y++) {
+        for (int x = 0; x < a.cols; x++) {
+            differences += a.ptr<unsigned char>(y)[x] != b.ptr<unsigned char>(y)[x];
+        }
+    }
+    return differences;
+}
+
+int main() {
+    std::cout << "--- Starting fused OpenCV engine test ---" << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+    srand(11);
+    int errors = 0;
+    int supported = cpu_detect_isa();
+    std::cout << "HOST ISA: " << cpu_isa_name(supported) << std::endl;
+
+    const int shapes[][2] = { {1, 1}, {1, 7}, {6, 1}, {2, 2}, {3, 3}, {2, 65}, {17, 33}, {31, 64}, {64, 97}, {5, 300}, {121, 161} };
+    for (int isa = CPU_ISA_SCALAR; isa <= supported; isa++) {
+        /// One scratch for every shape: it grows and is reused, stale rows must not leak into a smaller image
+        FusedScratch scratch;
+        cv::Mat output;
+        for (const auto& shape : shapes) {
+            for (int type : { CV_8UC3, CV_8UC4, CV_8UC1 }) {
+                cv::Mat image = random_image(shape[0], shape[1], type, 4);
+                process_image_fused(image, output, scratch, isa);
+                if (count_differences(output, reference_edges(image)) != 0) {
+                    std::cerr << cpu_isa_name(isa) << ": " << shape[0] << "x" << shape[1] << " with " << image.channels()
+                              << " channels differs from the model" << std::endl;
+                    errors++;
+                }
+            }
+        }
+        /// A strided window of a larger frame
+        cv::Mat frame = random_image(90, 120, CV_8UC3, 4);
+        cv::Mat roi = frame(cv::Rect(7, 11, 53, 41));
+        process_image_fused(roi, output, scratch, isa);
+        if (count_differences(output, reference_edges(roi)) != 0) {
+            std::cerr << cpu_isa_name(isa) << ": ROI input differs from the model" << std::endl;
+            errors++;
+        }
+    }
+
+    /// The OpenCV calls themselves give the same maps, pixel for pixel, for BGR and BGRA, noisy and plain random
+    {
+        FusedScratch scratch;
+        long long differing = 0;
+        long long pixels = 0;
+        for (const auto& shape : shapes) {
+            for (int type : { CV_8UC3, CV_8UC4 }) {
+                for (int noise_every : { 1, 4 }) {
+                    cv::Mat image = random_image(shape[0] + 2, shape[1] + 2, type, noise_every);
+                    cv::Mat fused_output;
+                    cv::Mat opencv_output;
+                    process_image_fused(image, fused_output, scratch);
+                    process_image_opencv(image, opencv_output);
+                    differing += count_differences(fused_output, opencv_output);
+                    pixels += image.rows * image.cols;
+                }
+            }
+        }
+        if (differing != 0) {
+            std::cerr << differing << " of " << pixels << " pixels differ from process_image_opencv" << std::endl;
+            errors++;
+        }
+    }
+
+    /// Every image once, over more threads than there are cores
+    {
+        const size_t count = 200;
+        std::vector<std::atomic<int> > seen(count);
+        std::vector<cv::Mat> images;
+        for (size_t i = 0; i < count; i++) {
+            images.push_back(random_image(8 + i % 13, 9 + i % 29, CV_8UC3, 4));
+        }
+        std::vector<cv::Mat> outputs(count);
+        fused_for_each_image(count, 6, [&](size_t index, FusedScratch& scratch) {
+            seen[index]++;
+            process_image_fused(images[index], outputs[index], scratch);
+        });
+        for (size_t i = 0; i < count; i++) {
+            if (seen[i] != 1 || count_differences(outputs[i], reference_edges(images[i])) != 0) {
+                std::cerr << "Pooled image " << i << " ran " << seen[i] << " times or differs from the model" << std::endl;
+                errors++;
+                break;
+            }
+        }
+    }
+
+    /// 1920x1080: the fused pass against the five OpenCV passes, one image on one thread each
+    {
+        cv::Mat frame = random_image(1080, 1920, CV_8UC3, 4);
+        FusedScratch scratch;
+        cv::Mat output;
+        const int runs = 5;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int run = 0; run < runs; run++) process_image_fused(frame, output, scratch);
+        double fused_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / runs;
+        start = std::chrono::high_resolution_clock::now();
+        for (int run = 0; run < runs; run++) process_image_opencv(frame, output);
+        double opencv_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / runs;
+        std::cout << "1920x1080: fused " << fused_ms << " ms (" << 1920 * 1080 / (fused_ms * 1000.0) << " MPPS), opencv "
+                  << opencv_ms << " ms (" << 1920 * 1080 / (opencv_ms * 1000.0) << " MPPS)" << std::endl;
+    }
+
+    if (errors == 0) {
+        std::cout << "--- Fused OpenCV engine test PASSED ---" << std::endl;
+        return 0;
+    } else {
+        std::cout << "--- Fused OpenCV engine test FAILED ---" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,197 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <filesystem>
+#include <cmath>
+#include <unistd.h>
+
+#include "shard_manifest.h"
+
+///@brief: Checks the sharded batch pieces: the shard hash is FNV-1a and splits names evenly with each name in
+/// exactly one shard, a manifest lists the images of a directory sorted whatever order they were created in and
+/// reads back the same, a journal reloads its names, ignores a torn last line and takes appends from several
+/// threads, and shard summaries read back and merge into complete or incomplete totals
+
+namespace fs = std::filesystem;
+
+int main() {
+    std::cout << "--- Starting shard manifest test ---" << std::endl;
+    int errors = 0;
+    const std::string root = "/tmp/test_shard_manifest_" + std::to_string(getpid());
+    fs::create_directories(root + "/images/sub.png");
+
+    /// Shard specs and the hash
+    {
+        ShardSpec shard;
+        bool good = parse_shard("3/8", shard) && shard.index == 3 && shard.count == 8;
+        for (const char* bad : { "8/8", "-1/4", "1/0", "1", "1/4x", "a/b" }) {
+            ShardSpec rejected;
+            good = good && !parse_shard(bad, rejected);
+        }
+        if (!good || shard_hash("") != 0xcbf29ce484222325ULL || shard_hash("a") != 0xaf63dc4c8601ec8cULL) {
+            std::cerr << "Shard spec or FNV-1a hash wrong" << std::endl;
+            errors++;
+        }
+    }
+
+    /// Every name in exactly one shard, shards within 10 % of an even split
+    {
+        const int names = 20000;
+        for (int count : { 2, 3, 7, 16 }) {
+            std::vector<int> per_shard(count, 0);
+            for (int i = 0; i < names; i++) {
+                std::string name = "IMG_" + std::to_string(100000 + i) + ".jpg";
+                int owners = 0;
+                for (int s = 0; s < count; s++) {
+                    ShardSpec shard;
+                    shard.index = s;
+                    shard.count = count;
+                    owners += in_shard(name, shard);
+                }
+                per_shard[shard_of(name, count)]++;
+                if (owners != 1) {
+                    std::cerr << name << " is in " << owners << " of " << count << " shards" << std::endl;
+                    errors++;
+                    break;
+                }
+            }
+            for (int s = 0; s < count; s++) {
+                if (std::fabs(per_shard[s] - (double)names / count) > 0.1 * names / count) {
+                    std::cerr << "Shard " << s << "/" << count << " got " << per_shard[s] << " of " << names << " names" << std::endl;
+                    errors++;
+                }
+            }
+        }
+    }
+
+    /// Sorted manifest of the image files only, saved and read back
+    {
+        for (const char* name : { "c.png", "a.jpg", "B.jpeg", "notes.txt", "b.png", "z.PNG" }) {
+            std::ofstream(root + "/images/" + name) << "x";
+        }
+        std::vector<std::string> expected = { "B.jpeg", "a.jpg", "b.png", "c.png" };
+        bool created = false;
+        std::vector<std::string> listed = load_manifest(root + "/manifest", root + "/images", created);
+        std::ofstream(root + "/images/d.png") << "x";
+        bool reread = false;
+        std::vector<std::string> frozen = load_manifest(root + "/manifest", root + "/images", reread);
+        if (listed != expected || !created || frozen != expected || reread || build_manifest(root + "/images").size() != 5) {
+            std::cerr << "Manifest listed " << listed.size() << " names, read back " << frozen.size() << std::endl;
+            errors++;
+        }
+    }
+
+    /// Journal: reload, a torn last line, appends from several threads
+    {
+        const std::string path = root + "/journal";
+        {
+            BatchJournal journal(path);
+            journal.record("one.png");
+            journal.record("two.png");
+            if (journal.record("bad\nname.png") || journal.loaded_count() != 0 || journal.recorded_count() != 2) {
+                std::cerr << "A fresh journal recorded " << journal.recorded_count() << " names" << std::endl;
+                errors++;
+            }
+        }
+        std::ofstream(path, std::ios::app) << "thr";
+        {
+            BatchJournal journal(path);
+            if (journal.loaded_count() != 2 || !journal.done("one.png") || !journal.done("two.png") || journal.done("thr")) {
+                std::cerr << "Reloaded journal has " << journal.loaded_count() << " names" << std::endl;
+                errors++;
+            }
+            std::vector<std::thread> threads;
+            for (int t = 0; t < 4; t++) {
+                threads.emplace_back([&journal, t] {
+                    for (int i = 0; i < 250; i++) journal.record("t" + std::to_string(t) + "_" + std::to_string(i) + ".png");
+                });
+            }
+            for (std::thread& thread : threads) thread.join();
+        }
+        BatchJournal journal(path);
+        bool all = journal.loaded_count() == 2 + 1 + 1000 && journal.done("thr");
+        for (int t = 0; all && t < 4; t++) {
+            for (int i = 0; all && i < 250; i++) all = journal.done("t" + std::to_string(t) + "_" + std::to_string(i) + ".png");
+        }
+        if (!all) {
+            std::cerr << "Journal after threaded appends has " << journal.loaded_count() << " names" << std::endl;
+            errors++;
+        }
+    }
+
+    /// Summaries read back, a resumed shard adds up, a missing shard leaves the batch incomplete
+    {
+        std::vector<ShardSummary> summaries;
+        for (int s = 0; s < 3; s++) {
+            ShardSummary summary;
+            summary.shard = s;
+            summary.shards = 3;
+            summary.host = "node" + std::to_string(s);
+            summary.manifest = 30;
+            summary.assigned = 10;
+            summary.processed = 10;
+            summary.pixels = 1000000 * (s + 1);
+            summary.wall_ms = 100.0 * (s + 1);
+            summary.kernel_ms = 10.0;
+            std::string path = root + "/summary" + std::to_string(s);
+            ShardSummary read;
+            if (!write_shard_summary(path, summary) || !read_shard_summary(path, read) || read.host != summary.host ||
+                read.pixels != summary.pixels || read.wall_ms != summary.wall_ms || read.shard != s) {
+                std::cerr << "Summary of shard " << s << " read back wrong" << std::endl;
+                errors++;
+            }
+            summaries.push_back(read);
+        }
+        /// Shard 2 crashed after 4 images (no summary) and its rerun did the other 6
+        summaries[2].skipped = 4;
+        summaries[2].processed = 6;
+        summaries[2].pixels = 600000;
+        ShardMerge merge = merge_shard_summaries(summaries);
+        double expected_mpps = (1e6 + 2e6 + 0.6e6) / (300.0 * 1000.0);
+        if (!merge.complete() || merge.total_done != 30 || merge.total.processed != 26 || merge.total.wall_ms != 300.0 ||
+            std::fabs(merge.aggregate_mpps - expected_mpps) > 1e-9 || std::fabs(merge.imbalance - 1.5) > 1e-9) {
+            std::cerr << "Merge: " << merge.total_done << " done, " << merge.aggregate_mpps << " MPPS, imbalance " << merge.imbalance << std::endl;
+            errors++;
+        }
+        ShardSummary second_run = summaries[1];
+        second_run.skipped = 10;
+        second_run.processed = 0;
+        second_run.pixels = 0;
+        second_run.wall_ms = 5.0;
+        summaries.push_back(second_run);
+        merge = merge_shard_summaries(summaries);
+        if (merge.runs[1] != 2 || merge.done[1] != 10 || merge.per_shard[1].wall_ms != 205.0 || !merge.complete()) {
+            std::cerr << "A second run of shard 1 merged to " << merge.done[1] << " done in " << merge.per_shard[1].wall_ms << " ms" << std::endl;
+            errors++;
+        }
+        summaries.erase(summaries.begin());
+        merge = merge_shard_summaries(summaries);
+        if (merge.complete() || merge.missing != 1 || merge.total_done != 20) {
+            std::cerr << "Merge without shard 0 counted as complete" << std::endl;
+            errors++;
+        }
+        summaries[0].shards = 4;
+        summaries[0].shard = 1;
+        if (merge_shard_summaries(summaries).consistent) {
+            std::cerr << "Summaries of a 3 and a 4 way split merged" << std::endl;
+            errors++;
+        }
+        std::ofstream(root + "/not_a_summary") << "shard 0\n";
+        ShardSummary ignored;
+        if (read_shard_summary(root + "/not_a_summary", ignored) || read_shard_summary(root + "/missing", ignored)) {
+            std::cerr << "Read a file that is not a shard summary" << std::endl;
+            errors++;
+        }
+    }
+    fs::remove_all(root);
+
+    if (errors == 0) {
+        std::cout << "--- Shard manifest test PASSED ---" << std::endl;
+        return 0;
+    } else {
+        std::cout << "--- Shard manifest test FAILED ---" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,689 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include "kernel_v3.h"
+#include "image_process_ref.h"
+
+struct ImageShape {
+    int height;
+    int width;
+};
+
+///@brief: Plain C model of the kernel: 77/150/29 grayscale, 3x3 sobel, (|Gx| + |Gy|) >> 1 saturated
+void grayscale_reference(const std::vector<unsigned int>& rgb, std::vector<int>& gray) {
+    gray.resize(rgb.size());
+    for (size_t i = 0; i < rgb.size(); i++) {
+        int r = (rgb[i] >> 16) & 0xFF;
+        int g = (rgb[i] >> 8) & 0xFF;
+        int b = rgb[i] & 0xFF;
+        gray[i] = (r * 77 + g * 150 + b * 29) >> 8;
+    }
+}
+
+void sobel_reference(const std::vector<int>& gray, std::vector<unsigned char>& edges, int height, int width) {
+    edges.assign((height - 2) * (width - 2), 0);
+    for (int y = 1; y < height - 1; y++) {
+        for (int x = 1; x < width - 1; x++) {
+            const int* up = &gray[(y - 1) * width + x];
+            const int* mid = &gray[y * width + x];
+            const int* down = &gray[(y + 1) * width + x];
+            int gx = (up[1] - up[-1]) + 2 * (mid[1] - mid[-1]) + (down[1] - down[-1]);
+            int gy = (up[-1] + 2 * up[0] + up[1]) - (down[-1] + 2 * down[0] + down[1]);
+            int magnitude = (std::abs(gx) + std::abs(gy)) >> 1;
+            edges[(y - 1) * (width - 2) + (x - 1)] = magnitude > 255 ? 255 : magnitude;
+        }
+    }
+}
+
+///@brief: Lays out RGB32, RGB888 (B, G, R bytes) or LUMA8 pixels as the host does
+void pack_image_data(const std::vector<unsigned int>& rgb, const std::vector<int>& gray,
+                     std::vector<WIDE_BUS_TYPE>& packed, int input_format) {
+    int size = rgb.size();
+    std::vector<unsigned char> bytes(input_buffer_bytes(input_format, size), 0);
+    for (int i = 0; i < size; i++) {
+        if (input_format == INPUT_FORMAT_LUMA8) {
+            bytes[i] = gray[i];
+        } else {
+            int base = i * input_bytes_per_pixel(input_format);
+            bytes[base] = rgb[i] & 0xFF;
+            bytes[base + 1] = (rgb[i] >> 8) & 0xFF;
+            bytes[base + 2] = (rgb[i] >> 16) & 0xFF;
+        }
+    }
+    packed.assign(bytes.size() / BURST_BYTES, 0);
+    for (size_t i = 0; i < bytes.size(); i++) {
+        packed[i / BURST_BYTES]((i % BURST_BYTES + 1) * 8 - 1, (i % BURST_BYTES) * 8) = bytes[i];
+    }
+}
+
+int unpack_edge_pixel(const std::vector<WIDE_BUS_TYPE>& output_wide, int i, int output_format) {
+    if (output_format == OUTPUT_FORMAT_GRAY8) {
+        return (unsigned)output_wide[i / GRAY_PIXELS_PER_BURST]((i % GRAY_PIXELS_PER_BURST + 1) * 8 - 1, (i % GRAY_PIXELS_PER_BURST) * 8);
+    }
+    BUS_TYPE pixel_32 = output_wide[i / PIXELS_PER_BURST]((i % PIXELS_PER_BURST + 1) * 32 - 1, (i % PIXELS_PER_BURST) * 32);
+    return pixel_32 & 0xFF;
+}
+
+///@brief: Runs one PPC variant, checks it pixel by pixel and returns the modeled cycle count
+template <int PPC>
+long long run_ppc(const std::vector<WIDE_BUS_TYPE>& input_wide, const std::vector<unsigned char>& expected,
+                  std::vector<WIDE_BUS_TYPE>& output_wide, ImageShape shape, int input_format, int output_format, int& errors) {
+    int out_size = (shape.height - 2) * (shape.width - 2);
+    output_wide.assign(output_buffer_bytes(output_format, out_size) / BURST_BYTES, 0);
+
+    sim_trip_counts() = SimTripCounts();
+    sobel_dataflow<PPC>(input_wide.data(), output_wide.data(), shape.height, shape.width, input_format, output_format);
+    SimTripCounts counts = sim_trip_counts();
+
+    for (int i = 0; i < out_size; i++) {
+        int edge_pixel = unpack_edge_pixel(output_wide, i, output_format);
+        if (edge_pixel != expected[i]) {
+            if (errors < 10) {
+                std::cerr << "Mismatch PPC=" << PPC << " FORMATS=" << input_format << "/" << output_format << " " << shape.width << "x" << shape.height
+                          << " at output " << i << ": got " << edge_pixel << " expected " << (int)expected[i] << std::endl;
+            }
+            errors++;
+        }
+    }
+    return std::max(counts.read_loop, std::max(counts.sobel_loop, counts.write_loop));
+}
+
+bool same_bursts(const std::vector<WIDE_BUS_TYPE>& a, const std::vector<WIDE_BUS_TYPE>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        for (int p = 0; p < PIXELS_PER_BURST; p++) {
+            if ((unsigned)a[i]((p + 1) * 32 - 1, p * 32) != (unsigned)b[i]((p + 1) * 32 - 1, p * 32)) return false;
+        }
+    }
+    return true;
+}
+
+///@brief: All shapes back to back through sobel_batch_dataflow, each output is checked at its descriptor offset
+template <int PPC>
+void run_batch(const ImageShape* shapes, int image_count, int input_format, int output_format, int& errors) {
+    std::vector<BUS_TYPE> descriptors(image_count * DESCRIPTOR_WORDS, 0);
+    std::vector<std::vector<unsigned char> > expected(image_count);
+    std::vector<WIDE_BUS_TYPE> input_batch;
+    int out_bursts = 0;
+
+    for (int n = 0; n < image_count; n++) {
+        int size = shapes[n].height * shapes[n].width;
+        std::vector<unsigned int> input_32bit(size);
+        for (int i = 0; i < size; i++) {
+            input_32bit[i] = rand() & 0xFFFFFF;
+        }
+        std::vector<int> gray;
+        grayscale_reference(input_32bit, gray);
+        sobel_reference(gray, expected[n], shapes[n].height, shapes[n].width);
+
+        std::vector<WIDE_BUS_TYPE> packed;
+        pack_image_data(input_32bit, gray, packed, input_format);
+        descriptors[n * DESCRIPTOR_WORDS] = input_batch.size();
+        descriptors[n * DESCRIPTOR_WORDS + 1] = out_bursts;
+        descriptors[n * DESCRIPTOR_WORDS + 2] = shapes[n].height;
+        descriptors[n * DESCRIPTOR_WORDS + 3] = shapes[n].width;
+        input_batch.insert(input_batch.end(), packed.begin(), packed.end());
+        out_bursts += output_buffer_bytes(output_format, expected[n].size()) / BURST_BYTES;
+    }
+
+    std::vector<WIDE_BUS_TYPE> output_batch(out_bursts, 0);
+    sobel_batch_dataflow<PPC>(input_batch.data(), output_batch.data(), descriptors.data(), image_count, input_format, output_format);
+
+    for (int n = 0; n < image_count; n++) {
+        int out_offset = descriptors[n * DESCRIPTOR_WORDS + 1];
+        int image_bursts = output_buffer_bytes(output_format, expected[n].size()) / BURST_BYTES;
+        std::vector<WIDE_BUS_TYPE> output_wide(output_batch.begin() + out_offset, output_batch.begin() + out_offset + image_bursts);
+        for (size_t i = 0; i < expected[n].size(); i++) {
+            if (unpack_edge_pixel(output_wide, i, output_format) != expected[n][i]) {
+                std::cerr << "Batch mismatch PPC=" << PPC << " image " << n << " at output " << i << std::endl;
+                errors++;
+                break;
+            }
+        }
+    }
+}
+
+std::vector<WIDE_BUS_TYPE> bytes_to_bursts(const std::vector<unsigned char>& bytes) {
+    std::vector<WIDE_BUS_TYPE> bursts(bytes.size() / BURST_BYTES, 0);
+    for (size_t i = 0; i < bytes.size(); i++) {
+        bursts[i / BURST_BYTES]((i % BURST_BYTES + 1) * 8 - 1, (i % BURST_BYTES) * 8) = bytes[i];
+    }
+    return bursts;
+}
+
+///@brief: Gaussian / NMS / threshold stages against image_process_reference, single image and batch.
+/// The input is smooth blobs plus noise so the thresholds see both weak and strong edges
+template <int PPC, class OP = Sobel3Operator, int MAGNITUDE = EDGE_MAGNITUDE_L1>
+void run_stages(const ImageShape* shapes, int image_count, int stages, int& errors) {
+    const int LOW = 20;
+    const int HIGH = 60;
+    std::vector<BUS_TYPE> descriptors(image_count * DESCRIPTOR_WORDS, 0);
+    std::vector<std::vector<unsigned char> > expected(image_count);
+    std::vector<WIDE_BUS_TYPE> input_batch;
+    int out_bursts = 0;
+
+    for (int n = 0; n < image_count; n++) {
+        ImageShape shape = shapes[n];
+        std::vector<unsigned char> bytes(input_buffer_bytes(INPUT_FORMAT_RGB888, shape.height * shape.width), 0);
+        for (int i = 0; i < shape.height * shape.width; i++) {
+            int y = i / shape.width;
+            int x = i % shape.width;
+            int base = ((x / 5 + y / 4) % 3) * 90 + (rand() % 24);
+            bytes[i * 3] = base;
+            bytes[i * 3 + 1] = base + (rand() % 8);
+            bytes[i * 3 + 2] = base;
+        }
+        int out_size = (shape.height - 2) * (shape.width - 2);
+        expected[n].assign(output_buffer_bytes(OUTPUT_FORMAT_GRAY8, out_size), 0);
+        image_process_reference(bytes.data(), expected[n].data(), shape.height, shape.width, INPUT_FORMAT_RGB888, OUTPUT_FORMAT_GRAY8, stages, LOW, HIGH,
+                                OP::ID, MAGNITUDE);
+
+        std::vector<WIDE_BUS_TYPE> packed = bytes_to_bursts(bytes);
+        /// Stale bytes in the output buffer, every output pixel has to be written
+        std::vector<WIDE_BUS_TYPE> output_wide(expected[n].size() / BURST_BYTES, ~WIDE_BUS_TYPE(0));
+        sobel_dataflow<PPC, OP, MAGNITUDE>(packed.data(), output_wide.data(), shape.height, shape.width, INPUT_FORMAT_RGB888, OUTPUT_FORMAT_GRAY8,
+                                           stages, LOW, HIGH);
+        for (int i = 0; i < out_size; i++) {
+            if (unpack_edge_pixel(output_wide, i, OUTPUT_FORMAT_GRAY8) != expected[n][i]) {
+                std::cerr << "Stage mismatch PPC=" << PPC << " OPERATOR=" << edge_operator_name(OP::ID) << " L" << MAGNITUDE + 1
+                          << " STAGES=" << edge_stage_names(stages) << " " << shape.width << "x" << shape.height
+                          << " at output " << i << ": got " << unpack_edge_pixel(output_wide, i, OUTPUT_FORMAT_GRAY8)
+                          << " expected " << (int)expected[n][i] << std::endl;
+                errors++;
+                break;
+            }
+        }
+
+        descriptors[n * DESCRIPTOR_WORDS] = input_batch.size();
+        descriptors[n * DESCRIPTOR_WORDS + 1] = out_bursts;
+        descriptors[n * DESCRIPTOR_WORDS + 2] = shape.height;
+        descriptors[n * DESCRIPTOR_WORDS + 3] = shape.width;
+        input_batch.insert(input_batch.end(), packed.begin(), packed.end());
+        out_bursts += expected[n].size() / BURST_BYTES;
+    }
+
+    std::vector<WIDE_BUS_TYPE> output_batch(out_bursts, ~WIDE_BUS_TYPE(0));
+    sobel_batch_dataflow<PPC, OP, MAGNITUDE>(input_batch.data(), output_batch.data(), descriptors.data(), image_count,
+                                             INPUT_FORMAT_RGB888, OUTPUT_FORMAT_GRAY8, stages, LOW, HIGH);
+    for (int n = 0; n < image_count; n++) {
+        int out_offset = descriptors[n * DESCRIPTOR_WORDS + 1];
+        std::vector<WIDE_BUS_TYPE> output_wide(output_batch.begin() + out_offset, output_batch.begin() + out_offset + expected[n].size() / BURST_BYTES);
+        for (int i = 0; i < (shapes[n].height - 2) * (shapes[n].width - 2); i++) {
+            if (unpack_edge_pixel(output_wide, i, OUTPUT_FORMAT_GRAY8) != expected[n][i]) {
+                std::cerr << "Batch stage mismatch PPC=" << PPC << " OPERATOR=" << edge_operator_name(OP::ID) << " STAGES=" << edge_stage_names(stages) << " image " << n << " at output " << i << std::endl;
+                errors++;
+                break;
+            }
+        }
+    }
+}
+
+std::vector<unsigned char> bursts_to_bytes(const std::vector<WIDE_BUS_TYPE>& bursts) {
+    std::vector<unsigned char> bytes(bursts.size() * BURST_BYTES);
+    for (size_t i = 0; i < bytes.size(); i++) {
+        bytes[i] = (unsigned)bursts[i / BURST_BYTES]((i % BURST_BYTES + 1) * 8 - 1, (i % BURST_BYTES) * 8);
+    }
+    return bytes;
+}
+
+///@brief: BIT1 / RLE outputs against the reference packed by pack_edge_output, single image and batch. Every
+/// byte the host reads back (edge_output_used_bytes) has to match, the buffers start out stale
+template <int PPC>
+void run_masks(const ImageShape* shapes, int image_count, int output_format, int stages, int mask_threshold, int& errors) {
+    const int LOW = 20;
+    const int HIGH = 60;
+    std::vector<BUS_TYPE> descriptors(image_count * DESCRIPTOR_WORDS, 0);
+    std::vector<std::vector<unsigned char> > expected(image_count);
+    std::vector<WIDE_BUS_TYPE> input_batch;
+    int out_bursts = 0;
+
+    for (int n = 0; n < image_count; n++) {
+        ImageShape shape = shapes[n];
+        std::vector<unsigned char> bytes(input_buffer_bytes(INPUT_FORMAT_RGB888, shape.height * shape.width), 0);
+        for (int i = 0; i < shape.height * shape.width; i++) {
+            int base = (((i % shape.width) / 6 + (i / shape.width) / 5) % 2) * 120 + (rand() % 16);
+            bytes[i * 3] = base;
+            bytes[i * 3 + 1] = base;
+            bytes[i * 3 + 2] = base + (rand() % 8);
+        }
+        int out_height = shape.height - 2;
+        int out_width = shape.width - 2;
+        expected[n].assign(output_buffer_bytes(output_format, out_height, out_width), 0);
+        image_process_reference(bytes.data(), expected[n].data(), shape.height, shape.width, INPUT_FORMAT_RGB888, output_format, stages, LOW, HIGH,
+                                EDGE_OPERATOR_SOBEL3, EDGE_MAGNITUDE_L1, mask_threshold);
+        size_t used = edge_output_used_bytes(expected[n].data(), out_height, out_width, output_format);
+
+        std::vector<WIDE_BUS_TYPE> packed = bytes_to_bursts(bytes);
+        std::vector<WIDE_BUS_TYPE> output_wide(expected[n].size() / BURST_BYTES, ~WIDE_BUS_TYPE(0));
+        sobel_dataflow<PPC>(packed.data(), output_wide.data(), shape.height, shape.width, INPUT_FORMAT_RGB888, output_format,
+                            stages, LOW, HIGH, mask_threshold);
+        std::vector<unsigned char> got = bursts_to_bytes(output_wide);
+        for (size_t i = 0; i < used; i++) {
+            if (got[i] != expected[n][i]) {
+                std::cerr << "Mask mismatch PPC=" << PPC << " FORMAT=" << output_format_name(output_format) << " "
+                          << shape.width << "x" << shape.height << " at byte " << i << " of " << used << std::endl;
+                errors++;
+                break;
+            }
+        }
+
+        descriptors[n * DESCRIPTOR_WORDS] = input_batch.size();
+        descriptors[n * DESCRIPTOR_WORDS + 1] = out_bursts;
+        descriptors[n * DESCRIPTOR_WORDS + 2] = shape.height;
+        descriptors[n * DESCRIPTOR_WORDS + 3] = shape.width;
+        input_batch.insert(input_batch.end(), packed.begin(), packed.end());
+        out_bursts += expected[n].size() / BURST_BYTES;
+    }
+
+    std::vector<WIDE_BUS_TYPE> output_batch(out_bursts, ~WIDE_BUS_TYPE(0));
+    sobel_batch_dataflow<PPC>(input_batch.data(), output_batch.data(), descriptors.data(), image_count,
+                              INPUT_FORMAT_RGB888, output_format, stages, LOW, HIGH, mask_threshold);
+    std::vector<unsigned char> got = bursts_to_bytes(output_batch);
+    for (int n = 0; n < image_count; n++) {
+        size_t offset = (size_t)descriptors[n * DESCRIPTOR_WORDS + 1] * BURST_BYTES;
+        size_t used = edge_output_used_bytes(expected[n].data(), shapes[n].height - 2, shapes[n].width - 2, output_format);
+        for (size_t i = 0; i < used; i++) {
+            if (got[offset + i] != expected[n][i]) {
+                std::cerr << "Batch mask mismatch PPC=" << PPC << " FORMAT=" << output_format_name(output_format)
+                          << " image " << n << " at byte " << i << std::endl;
+                errors++;
+                break;
+            }
+        }
+    }
+}
+
+///@brief: MAG_ORIENT output and the Gx / Gy planes of EDGE_STAGE_GRADIENTS against the reference, byte for byte.
+/// Both buffers start out stale, the padding bytes after the last pixel of each plane are not compared
+template <int PPC, class OP, int MAGNITUDE>
+void run_gradients(const ImageShape* shapes, int image_count, int stages, int& errors) {
+    const int LOW = 20;
+    const int HIGH = 60;
+    stages |= EDGE_STAGE_GRADIENTS;
+    for (int n = 0; n < image_count; n++) {
+        ImageShape shape = shapes[n];
+        std::vector<unsigned char> bytes(input_buffer_bytes(INPUT_FORMAT_RGB888, shape.height * shape.width), 0);
+        for (int i = 0; i < shape.height * shape.width; i++) {
+            int y = i / shape.width;
+            int x = i % shape.width;
+            int base = (((x + y) / 7 + (x - y + 512) / 5) % 3) * 80 + (rand() % 24);
+            bytes[i * 3] = base;
+            bytes[i * 3 + 1] = base + (rand() % 8);
+            bytes[i * 3 + 2] = base;
+        }
+        int out_size = (shape.height - 2) * (shape.width - 2);
+        std::vector<unsigned char> expected(output_buffer_bytes(OUTPUT_FORMAT_MAG_ORIENT, out_size), 0);
+        std::vector<unsigned char> expected_grad(gradient_buffer_bytes(shape.height - 2, shape.width - 2), 0);
+        image_process_reference(bytes.data(), expected.data(), shape.height, shape.width, INPUT_FORMAT_RGB888, OUTPUT_FORMAT_MAG_ORIENT,
+                                stages, LOW, HIGH, OP::ID, MAGNITUDE, 0, ImageRoi(), expected_grad.data());
+
+        std::vector<WIDE_BUS_TYPE> packed = bytes_to_bursts(bytes);
+        std::vector<WIDE_BUS_TYPE> output_wide(expected.size() / BURST_BYTES, ~WIDE_BUS_TYPE(0));
+        std::vector<WIDE_BUS_TYPE> grad_wide(expected_grad.size() / BURST_BYTES, ~WIDE_BUS_TYPE(0));
+        sobel_dataflow<PPC, OP, MAGNITUDE>(packed.data(), output_wide.data(), shape.height, shape.width, INPUT_FORMAT_RGB888,
+                                           OUTPUT_FORMAT_MAG_ORIENT, stages, LOW, HIGH, 0, 0, 0, 0, 0, grad_wide.data());
+        std::vector<unsigned char> got = bursts_to_bytes(output_wide);
+        std::vector<unsigned char> got_grad = bursts_to_bytes(grad_wide);
+        size_t plane = gradient_plane_bytes(out_size);
+        for (size_t i = 0; i < (size_t)out_size * 2; i++) {
+            const char* what = got[i] != expected[i] ? "edge/orientation" : got_grad[i] != expected_grad[i] ? "Gx" :
+                               got_grad[plane + i] != expected_grad[plane + i] ? "Gy" : nullptr;
+            if (what) {
+                std::cerr << "Gradient mismatch PPC=" << PPC << " OPERATOR=" << edge_operator_name(OP::ID) << " STAGES="
+                          << edge_stage_names(stages) << " " << shape.width << "x" << shape.height << " in " << what
+                          << " at byte " << i << std::endl;
+                errors++;
+                break;
+            }
+        }
+    }
+}
+
+struct RegionCase {
+    int x;
+    int y;
+    int height;
+    int width;
+    int out_stride;     /// -1 = the smallest burst multiple that holds a row plus one burst of gap
+};
+
+///@brief: Regions of one frame whose rows are in_stride bytes apart, so row starts fall anywhere in a burst.
+/// Each region runs on its own and then all of them in one batch sharing the frame. Outputs start stale and
+/// are compared whole, including the gap bytes between spaced out rows that must stay untouched
+template <int PPC>
+void run_regions(int input_format, int output_format, int stages, int& errors) {
+    const int FRAME_HEIGHT = 41;
+    const int FRAME_WIDTH = 203;
+    const RegionCase cases[] = {
+        {0, 0, FRAME_HEIGHT, FRAME_WIDTH, 0}, {1, 0, 3, 3, 0}, {5, 3, 17, 29, -1}, {13, 7, 9, 190, 0}, {77, 11, 30, 126, -1},
+        {200, 2, 12, 3, -1}, {3, 38, 3, 200, 0}, {31, 1, 40, 64, -1}
+    };
+    const int case_count = sizeof(cases) / sizeof(cases[0]);
+    const int LOW = 20;
+    const int HIGH = 60;
+    const int MASK_THRESHOLD = 48;
+
+    int bytes_per_pixel = input_bytes_per_pixel(input_format);
+    int in_stride = FRAME_WIDTH * bytes_per_pixel + 5;
+    std::vector<unsigned char> frame(((FRAME_HEIGHT * in_stride + BURST_BYTES - 1) / BURST_BYTES) * BURST_BYTES, 0);
+    for (size_t i = 0; i < frame.size(); i++) {
+        frame[i] = rand() & 0xFF;
+    }
+    std::vector<WIDE_BUS_TYPE> frame_bursts = bytes_to_bursts(frame);
+
+    std::vector<BUS_TYPE> descriptors(case_count * DESCRIPTOR_WORDS, 0);
+    std::vector<std::vector<unsigned char> > expected(case_count);
+    std::vector<size_t> compared(case_count);
+    int out_bursts = 0;
+    for (int n = 0; n < case_count; n++) {
+        const RegionCase& region = cases[n];
+        ImageRoi roi;
+        roi.x = region.x;
+        roi.y = region.y;
+        roi.in_stride = in_stride;
+        roi.out_stride = region.out_stride >= 0 ? region.out_stride :
+                         (int)output_buffer_bytes(output_format, region.width - 2) + BURST_BYTES;
+        int out_height = region.height - 2;
+        int out_width = region.width - 2;
+        expected[n].assign(output_buffer_bytes(output_format, out_height, out_width, roi.out_stride), 0xFF);
+        image_process_reference(frame.data(), expected[n].data(), region.height, region.width, input_format, output_format, stages,
+                                LOW, HIGH, EDGE_OPERATOR_SOBEL3, EDGE_MAGNITUDE_L1, MASK_THRESHOLD, roi);
+        compared[n] = output_format == OUTPUT_FORMAT_RLE ? edge_output_used_bytes(expected[n].data(), out_height, out_width, output_format)
+                                                         : expected[n].size();
+
+        std::vector<WIDE_BUS_TYPE> output_wide = bytes_to_bursts(std::vector<unsigned char>(expected[n].size(), 0xFF));
+        sobel_dataflow<PPC>(frame_bursts.data(), output_wide.data(), region.height, region.width, input_format, output_format,
+                            stages, LOW, HIGH, MASK_THRESHOLD, roi.x, roi.y, roi.in_stride, roi.out_stride);
+        std::vector<unsigned char> got = bursts_to_bytes(output_wide);
+        for (size_t i = 0; i < compared[n]; i++) {
+            if (got[i] != expected[n][i]) {
+                std::cerr << "Region mismatch PPC=" << PPC << " " << input_format_name(input_format) << " -> " << output_format_name(output_format)
+                          << " region " << region.width << "x" << region.height << " at (" << region.x << ", " << region.y << ") OUT STRIDE "
+                          << roi.out_stride << " at byte " << i << std::endl;
+                errors++;
+                break;
+            }
+        }
+
+        descriptors[n * DESCRIPTOR_WORDS] = 0;
+        descriptors[n * DESCRIPTOR_WORDS + 1] = out_bursts;
+        descriptors[n * DESCRIPTOR_WORDS + 2] = region.height;
+        descriptors[n * DESCRIPTOR_WORDS + 3] = region.width;
+        descriptors[n * DESCRIPTOR_WORDS + 4] = roi.x;
+        descriptors[n * DESCRIPTOR_WORDS + 5] = roi.y;
+        descriptors[n * DESCRIPTOR_WORDS + 6] = roi.in_stride;
+        descriptors[n * DESCRIPTOR_WORDS + 7] = roi.out_stride;
+        out_bursts += expected[n].size() / BURST_BYTES;
+    }
+
+    std::vector<WIDE_BUS_TYPE> output_batch = bytes_to_bursts(std::vector<unsigned char>((size_t)out_bursts * BURST_BYTES, 0xFF));
+    sobel_batch_dataflow<PPC>(frame_bursts.data(), output_batch.data(), descriptors.data(), case_count, input_format, output_format,
+                              stages, LOW, HIGH, MASK_THRESHOLD);
+    std::vector<unsigned char> got = bursts_to_bytes(output_batch);
+    for (int n = 0; n < case_count; n++) {
+        size_t offset = (size_t)descriptors[n * DESCRIPTOR_WORDS + 1] * BURST_BYTES;
+        for (size_t i = 0; i < compared[n]; i++) {
+            if (got[offset + i] != expected[n][i]) {
+                std::cerr << "Batch region mismatch PPC=" << PPC << " " << output_format_name(output_format) << " region " << n
+                          << " at byte " << i << std::endl;
+                errors++;
+                break;
+            }
+        }
+    }
+}
+
+///@brief: All pyramid levels of one image_process_pyramid pass against image_pyramid_reference, byte for byte over
+/// what the host reads back of each level. Shapes too small for the levels are skipped, odd sizes drop a row or column
+template <int PPC>
+void run_pyramid(const ImageShape* shapes, int image_count, int input_format, int output_format, int levels, int mask_threshold, int& errors) {
+    for (int n = 0; n < image_count; n++) {
+        ImageShape shape = shapes[n];
+        if (!pyramid_fits(shape.height, shape.width, levels)) continue;
+        int size = shape.height * shape.width;
+        std::vector<unsigned char> bytes(input_buffer_bytes(input_format, size), 0);
+        for (int i = 0; i < size * input_bytes_per_pixel(input_format); i++) {
+            int pixel = i / input_bytes_per_pixel(input_format);
+            bytes[i] = (((pixel % shape.width) / 7 + (pixel / shape.width) / 6) % 2) * 150 + (rand() % 40);
+        }
+        size_t total_bytes = pyramid_level_offset(output_format, shape.height, shape.width, levels);
+        std::vector<unsigned char> expected(total_bytes, 0);
+        image_pyramid_reference(bytes.data(), expected.data(), shape.height, shape.width, input_format, output_format, levels, mask_threshold);
+
+        std::vector<WIDE_BUS_TYPE> packed = bytes_to_bursts(bytes);
+        std::vector<WIDE_BUS_TYPE> output_wide(total_bytes / BURST_BYTES, ~WIDE_BUS_TYPE(0));
+        WIDE_BUS_TYPE* level_out[PYRAMID_MAX_LEVELS];
+        for (int level = 0; level < PYRAMID_MAX_LEVELS; level++) {
+            level_out[level] = output_wide.data() + (level < levels ? pyramid_level_offset(output_format, shape.height, shape.width, level) / BURST_BYTES : 0);
+        }
+        sobel_pyramid_dataflow<PPC>(packed.data(), level_out[0], level_out[1], level_out[2], shape.height, shape.width, input_format,
+                                    output_format, levels, mask_threshold);
+        std::vector<unsigned char> got = bursts_to_bytes(output_wide);
+
+        for (int level = 0; level < levels; level++) {
+            size_t offset = pyramid_level_offset(output_format, shape.height, shape.width, level);
+            int out_height = pyramid_level_height(shape.height, level) - 2;
+            int out_width = pyramid_level_width(shape.width, level) - 2;
+            size_t used = edge_output_used_bytes(expected.data() + offset, out_height, out_width, output_format);
+            for (size_t i = 0; i < used; i++) {
+                if (got[offset + i] != expected[offset + i]) {
+                    std::cerr << "Pyramid mismatch PPC=" << PPC << " FORMATS=" << input_format_name(input_format) << "/"
+                              << output_format_name(output_format) << " " << shape.width << "x" << shape.height << " level " << level
+                              << " at byte " << i << " of " << used << std::endl;
+                    errors++;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+///@brief: Full 0..255 stripes at eight angles through the sobel7 operator with NMS, whose |Gx| and |Gy| reach
+/// 163200. Checked against a model written here, gradients in 64 bits and the NMS direction from atan2, not
+/// against image_process_reference, so a direction both implementations get wrong still shows up
+template <int PPC>
+void run_strong_nms(int& errors) {
+    const int height = 72;
+    const int width = 96;
+    const int radius = Sobel7Operator::SIZE / 2;
+    const double angles[8] = { 0.0, 90.0, 45.0, 135.0, 30.0, 60.0, 120.0, 150.0 };
+    std::vector<unsigned char> bytes(input_buffer_bytes(INPUT_FORMAT_LUMA8, height * width), 0);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            double angle = angles[(y / 36) * 4 + x / 24] * M_PI / 180.0;
+            bytes[y * width + x] = ((int)std::floor((x * std::cos(angle) + y * std::sin(angle)) / 9.0) & 1) ? 255 : 0;
+        }
+    }
+
+    int out_height = height - 2;
+    int out_width = width - 2;
+    std::vector<int> magnitude(out_height * out_width, 0);
+    std::vector<int> direction(out_height * out_width, 0);
+    long long strongest = 0;
+    for (int y = radius; y < height - radius; y++) {
+        for (int x = radius; x < width - radius; x++) {
+            long long gx = 0;
+            long long gy = 0;
+            for (int r = 0; r < Sobel7Operator::SIZE; r++) {
+                for (int c = 0; c < Sobel7Operator::SIZE; c++) {
+                    long long pixel = bytes[(y + r - radius) * width + x + c - radius];
+                    gx += pixel * Sobel7Operator::smooth(r) * Sobel7Operator::derivative(c);
+                    gy -= pixel * Sobel7Operator::derivative(r) * Sobel7Operator::smooth(c);
+                }
+            }
+            strongest = std::max(strongest, std::max(std::llabs(gx), std::llabs(gy)));
+            int i = (y - 1) * out_width + (x - 1);
+            magnitude[i] = (int)std::min<long long>(255, (std::llabs(gx) + std::llabs(gy)) >> Sobel7Operator::MAG_SHIFT);
+            /// Folded into [0, 180): 0 horizontal, 1 up-left/down-right, 2 vertical, 3 up-right/down-left
+            double degrees = std::atan2((double)gy, (double)gx) * 180.0 / M_PI;
+            if (degrees < 0.0) degrees += 180.0;
+            direction[i] = (degrees < 22.5 || degrees >= 157.5) ? 0 : (degrees < 67.5) ? 3 : (degrees < 112.5) ? 2 : 1;
+        }
+    }
+    const int before[4][2] = { {0, -1}, {-1, -1}, {-1, 0}, {-1, 1} };
+    auto at = [&](int y, int x) { return (y < 0 || y >= out_height || x < 0 || x >= out_width) ? 0 : magnitude[y * out_width + x]; };
+    std::vector<int> expected(out_height * out_width);
+    for (int y = 0; y < out_height; y++) {
+        for (int x = 0; x < out_width; x++) {
+            const int* offset = before[direction[y * out_width + x]];
+            int m = magnitude[y * out_width + x];
+            expected[y * out_width + x] = (m > at(y + offset[0], x + offset[1]) && m >= at(y - offset[0], x - offset[1])) ? m : 0;
+        }
+    }
+
+    std::vector<WIDE_BUS_TYPE> packed = bytes_to_bursts(bytes);
+    std::vector<WIDE_BUS_TYPE> output_wide(output_buffer_bytes(OUTPUT_FORMAT_GRAY8, out_height * out_width) / BURST_BYTES, ~WIDE_BUS_TYPE(0));
+    sobel_dataflow<PPC, Sobel7Operator, EDGE_MAGNITUDE_L1>(packed.data(), output_wide.data(), height, width, INPUT_FORMAT_LUMA8,
+                                                           OUTPUT_FORMAT_GRAY8, EDGE_STAGE_NMS, 0, 0);
+    int differing = 0;
+    for (int i = 0; i < out_height * out_width; i++) {
+        if (unpack_edge_pixel(output_wide, i, OUTPUT_FORMAT_GRAY8) != expected[i]) differing++;
+    }
+    if (strongest < 150000 || differing != 0) {
+        std::cerr << "Sobel7 NMS on full steps PPC=" << PPC << ": " << differing << " pixels differ from the 64-bit model, strongest gradient "
+                  << strongest << std::endl;
+        errors++;
+    }
+}
+
+int main() {
+    const ImageShape shapes[] = {
+        {3, 3}, {5, 4}, {4, 7}, {9, 17}, {7, 31}, {16, 64}, {13, 97}, {11, 481}, {6, 483}, {321, 481}
+    };
+
+    std::cout << "--- Starting HLS Test Bench for multi-pixel sobel engine ---" << std::endl;
+    std::cout << std::fixed << std::setprecision(3);
+
+    srand(7);
+    int errors = 0;
+
+    for (const ImageShape& shape : shapes) {
+        int size = shape.height * shape.width;
+        std::vector<unsigned int> input_32bit(size);
+        for (int i = 0; i < size; i++) {
+            input_32bit[i] = rand() & 0xFFFFFF;
+        }
+
+        std::vector<int> gray;
+        grayscale_reference(input_32bit, gray);
+
+        std::vector<WIDE_BUS_TYPE> input_wide, input_rgb888, input_luma8;
+        pack_image_data(input_32bit, gray, input_wide, INPUT_FORMAT_RGB32);
+        pack_image_data(input_32bit, gray, input_rgb888, INPUT_FORMAT_RGB888);
+        pack_image_data(input_32bit, gray, input_luma8, INPUT_FORMAT_LUMA8);
+
+        std::vector<unsigned char> expected;
+        sobel_reference(gray, expected, shape.height, shape.width);
+
+        std::vector<WIDE_BUS_TYPE> out_ppc1, out_ppc4, out_ppc8, out_ppc16;
+        long long cycles_1 = run_ppc<1>(input_wide, expected, out_ppc1, shape, INPUT_FORMAT_RGB32, OUTPUT_FORMAT_RGB32, errors);
+        long long cycles_4 = run_ppc<4>(input_wide, expected, out_ppc4, shape, INPUT_FORMAT_RGB32, OUTPUT_FORMAT_RGB32, errors);
+        long long cycles_8 = run_ppc<8>(input_wide, expected, out_ppc8, shape, INPUT_FORMAT_RGB32, OUTPUT_FORMAT_RGB32, errors);
+        long long cycles_16 = run_ppc<16>(input_wide, expected, out_ppc16, shape, INPUT_FORMAT_RGB32, OUTPUT_FORMAT_RGB32, errors);
+
+        if (!same_bursts(out_ppc1, out_ppc4) || !same_bursts(out_ppc1, out_ppc8) || !same_bursts(out_ppc1, out_ppc16)) {
+            std::cerr << "Output bursts differ between PPC variants for " << shape.width << "x" << shape.height << std::endl;
+            errors++;
+        }
+
+        std::vector<WIDE_BUS_TYPE> out_gray1, out_gray16;
+        run_ppc<1>(input_wide, expected, out_gray1, shape, INPUT_FORMAT_RGB32, OUTPUT_FORMAT_GRAY8, errors);
+        run_ppc<16>(input_wide, expected, out_gray16, shape, INPUT_FORMAT_RGB32, OUTPUT_FORMAT_GRAY8, errors);
+        if (!same_bursts(out_gray1, out_gray16)) {
+            std::cerr << "GRAY8 output bursts differ between PPC variants for " << shape.width << "x" << shape.height << std::endl;
+            errors++;
+        }
+
+        std::vector<WIDE_BUS_TYPE> out_compact;
+        run_ppc<1>(input_rgb888, expected, out_compact, shape, INPUT_FORMAT_RGB888, OUTPUT_FORMAT_GRAY8, errors);
+        run_ppc<4>(input_rgb888, expected, out_compact, shape, INPUT_FORMAT_RGB888, OUTPUT_FORMAT_GRAY8, errors);
+        run_ppc<16>(input_rgb888, expected, out_compact, shape, INPUT_FORMAT_RGB888, OUTPUT_FORMAT_RGB32, errors);
+        run_ppc<1>(input_luma8, expected, out_compact, shape, INPUT_FORMAT_LUMA8, OUTPUT_FORMAT_GRAY8, errors);
+        run_ppc<8>(input_luma8, expected, out_compact, shape, INPUT_FORMAT_LUMA8, OUTPUT_FORMAT_RGB32, errors);
+        run_ppc<16>(input_luma8, expected, out_compact, shape, INPUT_FORMAT_LUMA8, OUTPUT_FORMAT_GRAY8, errors);
+
+        std::cout << std::setw(4) << shape.width << "x" << std::left << std::setw(4) << shape.height << std::right
+                  << " CYCLES/PIXEL  PPC1: " << (double)cycles_1 / size
+                  << "  PPC4: " << (double)cycles_4 / size
+                  << "  PPC8: " << (double)cycles_8 / size
+                  << "  PPC16: " << (double)cycles_16 / size
+                  << "  (SPEEDUP x" << (double)cycles_1 / cycles_16 << ")" << std::endl;
+    }
+
+    int image_count = sizeof(shapes) / sizeof(shapes[0]);
+    run_batch<1>(shapes, image_count, INPUT_FORMAT_RGB32, OUTPUT_FORMAT_RGB32, errors);
+    run_batch<16>(shapes, image_count, INPUT_FORMAT_RGB888, OUTPUT_FORMAT_GRAY8, errors);
+    run_batch<4>(shapes, image_count, INPUT_FORMAT_LUMA8, OUTPUT_FORMAT_GRAY8, errors);
+    std::cout << "BATCH OF " << image_count << " IMAGES CHECKED AT PPC 1, 4 AND 16" << std::endl;
+
+    const int stage_sets[] = {
+        EDGE_STAGE_GAUSSIAN3, EDGE_STAGE_GAUSSIAN5, EDGE_STAGE_NMS, EDGE_STAGE_THRESHOLD,
+        EDGE_STAGE_GAUSSIAN3 | EDGE_STAGE_NMS, EDGE_STAGE_NMS | EDGE_STAGE_THRESHOLD, EDGE_STAGE_CANNY
+    };
+    for (int stages : stage_sets) {
+        run_stages<1>(shapes, image_count, stages, errors);
+        run_stages<4>(shapes, image_count, stages, errors);
+        run_stages<16>(shapes, image_count, stages, errors);
+        std::cout << "STAGES " << edge_stage_names(stages) << " CHECKED AT PPC 1, 4 AND 16" << std::endl;
+    }
+
+    run_stages<1, Sobel5Operator, EDGE_MAGNITUDE_L1>(shapes, image_count, 0, errors);
+    run_stages<16, Sobel5Operator, EDGE_MAGNITUDE_L2>(shapes, image_count, EDGE_STAGE_CANNY, errors);
+    run_stages<1, Sobel7Operator, EDGE_MAGNITUDE_L2>(shapes, image_count, 0, errors);
+    run_stages<4, Sobel7Operator, EDGE_MAGNITUDE_L1>(shapes, image_count, EDGE_STAGE_GAUSSIAN3 | EDGE_STAGE_NMS, errors);
+    run_stages<16, Sobel7Operator, EDGE_MAGNITUDE_L1>(shapes, image_count, EDGE_STAGE_THRESHOLD, errors);
+    run_stages<4, ScharrOperator, EDGE_MAGNITUDE_L1>(shapes, image_count, 0, errors);
+    run_stages<16, ScharrOperator, EDGE_MAGNITUDE_L2>(shapes, image_count, EDGE_STAGE_NMS, errors);
+    run_stages<1, PrewittOperator, EDGE_MAGNITUDE_L1>(shapes, image_count, EDGE_STAGE_GAUSSIAN5, errors);
+    run_stages<16, PrewittOperator, EDGE_MAGNITUDE_L2>(shapes, image_count, 0, errors);
+    run_stages<4, Sobel3Operator, EDGE_MAGNITUDE_L2>(shapes, image_count, 0, errors);
+    std::cout << "OPERATORS sobel5, sobel7, scharr, prewitt AND L2 MAGNITUDE CHECKED AT PPC 1, 4 AND 16" << std::endl;
+
+    run_masks<1>(shapes, image_count, OUTPUT_FORMAT_BIT1, 0, 64, errors);
+    run_masks<4>(shapes, image_count, OUTPUT_FORMAT_BIT1, EDGE_STAGE_CANNY, 1, errors);
+    run_masks<16>(shapes, image_count, OUTPUT_FORMAT_BIT1, 0, 40, errors);
+    run_masks<1>(shapes, image_count, OUTPUT_FORMAT_RLE, 0, 64, errors);
+    run_masks<4>(shapes, image_count, OUTPUT_FORMAT_RLE, 0, 1, errors);
+    run_masks<16>(shapes, image_count, OUTPUT_FORMAT_RLE, EDGE_STAGE_CANNY, 128, errors);
+    run_masks<16>(shapes, image_count, OUTPUT_FORMAT_RLE, 0, 255, errors);
+    std::cout << "BIT1 AND RLE MASKS CHECKED AT PPC 1, 4 AND 16" << std::endl;
+
+    run_regions<1>(INPUT_FORMAT_RGB888, OUTPUT_FORMAT_GRAY8, 0, errors);
+    run_regions<4>(INPUT_FORMAT_RGB32, OUTPUT_FORMAT_RGB32, 0, errors);
+    run_regions<16>(INPUT_FORMAT_RGB888, OUTPUT_FORMAT_GRAY8, EDGE_STAGE_CANNY, errors);
+    run_regions<16>(INPUT_FORMAT_LUMA8, OUTPUT_FORMAT_RGB32, 0, errors);
+    run_regions<8>(INPUT_FORMAT_LUMA8, OUTPUT_FORMAT_BIT1, EDGE_STAGE_NMS, errors);
+    run_regions<16>(INPUT_FORMAT_RGB888, OUTPUT_FORMAT_RLE, 0, errors);
+    run_regions<4>(INPUT_FORMAT_RGB32, OUTPUT_FORMAT_MAG_ORIENT, EDGE_STAGE_NMS, errors);
+    std::cout << "REGIONS OF A STRIDED FRAME CHECKED AT PPC 1, 4, 8 AND 16" << std::endl;
+
+    run_gradients<1, Sobel3Operator, EDGE_MAGNITUDE_L1>(shapes, image_count, 0, errors);
+    run_gradients<4, Sobel3Operator, EDGE_MAGNITUDE_L2>(shapes, image_count, EDGE_STAGE_CANNY, errors);
+    run_gradients<16, Sobel7Operator, EDGE_MAGNITUDE_L1>(shapes, image_count, EDGE_STAGE_NMS, errors);
+    run_gradients<8, ScharrOperator, EDGE_MAGNITUDE_L1>(shapes, image_count, EDGE_STAGE_THRESHOLD, errors);
+    run_gradients<16, PrewittOperator, EDGE_MAGNITUDE_L2>(shapes, image_count, 0, errors);
+    std::cout << "ORIENTATION AND GRADIENT PLANES CHECKED AT PPC 1, 4, 8 AND 16" << std::endl;
+
+    run_strong_nms<1>(errors);
+    run_strong_nms<16>(errors);
+    std::cout << "SOBEL7 NMS DIRECTIONS ON FULL STEPS CHECKED AT PPC 1 AND 16" << std::endl;
+
+    run_pyramid<1>(shapes, image_count, INPUT_FORMAT_RGB888, OUTPUT_FORMAT_GRAY8, 3, 0, errors);
+    run_pyramid<4>(shapes, image_count, INPUT_FORMAT_RGB32, OUTPUT_FORMAT_RGB32, 3, 0, errors);
+    run_pyramid<8>(shapes, image_count, INPUT_FORMAT_LUMA8, OUTPUT_FORMAT_GRAY8, 2, 0, errors);
+    run_pyramid<16>(shapes, image_count, INPUT_FORMAT_RGB888, OUTPUT_FORMAT_GRAY8, 3, 0, errors);
+    run_pyramid<16>(shapes, image_count, INPUT_FORMAT_RGB888, OUTPUT_FORMAT_BIT1, 3, 64, errors);
+    run_pyramid<4>(shapes, image_count, INPUT_FORMAT_LUMA8, OUTPUT_FORMAT_RLE, 3, 40, errors);
+    run_pyramid<16>(shapes, image_count, INPUT_FORMAT_RGB888, OUTPUT_FORMAT_MAG_ORIENT, 1, 0, errors);
+    std::cout << "PYRAMID LEVELS CHECKED AT PPC 1, 4, 8 AND 16" << std::endl;
+
+    if (errors == 0) {
+        std::cout << "--- HLS C Simulation PASSED (multi-pixel sobel engine) ---" << std::endl;
+        return 0;
+    } else {
+        std::cout << "--- HLS C Simulation FAILED (" << errors << " errors) ---" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,150 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <memory>
+
+#include <opencv2/opencv.hpp>
+
+#include "image_formats.h"
+#include "image_process_ref.h"
+#include "accel_device.h"
+#include "batch_pipeline.h"
+#include "tiling.h"
+#include "test_images.h"
+
+///@brief: Checks that tiled processing on the software stand-in device stitches to exactly the
+/// whole-image output, for images wider than KERNEL_MAX_WIDTH, for small odd tile sizes and with the
+/// optional stages that widen the tile halo, and that a row band split over several devices does too
+
+int check_tiled(AccelDevice& device, int height, int width, int tile_height, int tile_width, int input_format, int output_format, int stages = 0,
+                const EdgeKernel& edge_kernel = EdgeKernel()) {
+    cv::Mat image = random_image(height, width, input_format == INPUT_FORMAT_LUMA8 ? CV_8UC1 : CV_8UC3);
+
+    int out_size = (height - 2) * (width - 2);
+    std::vector<unsigned char> packed(input_buffer_bytes(input_format, height * width));
+    std::vector<unsigned char> expected(output_buffer_bytes(OUTPUT_FORMAT_GRAY8, out_size));
+    pack_input_image(image, input_format, packed.data());
+    TileConfig config;
+    config.stages.flags = stages;
+    config.edge_operator = edge_kernel.edge_operator;
+    image_process_reference(packed.data(), expected.data(), height, width, input_format, OUTPUT_FORMAT_GRAY8,
+                            stages, config.stages.low_threshold, config.stages.high_threshold,
+                            edge_kernel.edge_operator, edge_kernel.magnitude);
+
+    config.tile_height = tile_height;
+    config.tile_width = tile_width;
+    config.queue_depth = 3;
+    config.input_format = input_format;
+    config.output_format = output_format;
+    TiledProcessor tiler(device, config);
+
+    BatchReport report;
+    cv::Mat output = tiler.process(image, report);
+
+    int used_width = effective_tile_width(config);
+    int expected_tiles = ((height - 2 + tile_height - 1) / tile_height) * ((width - 2 + used_width - 1) / used_width);
+    if ((int)report.images.size() != expected_tiles) {
+        std::cerr << "Expected " << expected_tiles << " tiles, ran " << report.images.size() << std::endl;
+        return 1;
+    }
+    for (int r = 0; r < output.rows; r++) {
+        if (std::memcmp(output.ptr<unsigned char>(r), &expected[r * output.cols], output.cols) != 0) {
+            std::cerr << "Tiled output differs at row " << r << " for " << height << "x" << width << " tiles "
+                      << tile_height << "x" << tile_width << " stages " << edge_stage_names(stages)
+                      << " operator " << edge_operator_name(edge_kernel.edge_operator) << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+///@brief: One image over `unit_count` stand-in CUs, checked against the plain C model. Returns the latency in ms,
+/// or -1 if the output differs
+double check_band_split(int unit_count, int height, int width, int tile_height, int stages, const SoftwareAccelDevice::Latency& latency) {
+    cv::Mat image = random_image(height, width, CV_8UC3);
+    std::vector<unsigned char> packed(input_buffer_bytes(INPUT_FORMAT_RGB888, height * width));
+    std::vector<unsigned char> expected(output_buffer_bytes(OUTPUT_FORMAT_GRAY8, (height - 2) * (width - 2)));
+    pack_input_image(image, INPUT_FORMAT_RGB888, packed.data());
+    TileConfig config;
+    config.stages.flags = stages;
+    config.tile_height = tile_height;
+    image_process_reference(packed.data(), expected.data(), height, width, INPUT_FORMAT_RGB888, OUTPUT_FORMAT_GRAY8,
+                            stages, config.stages.low_threshold, config.stages.high_threshold);
+
+    std::vector<std::unique_ptr<SoftwareAccelDevice> > devices;
+    std::vector<AccelDevice*> units;
+    for (int unit = 0; unit < unit_count; unit++) {
+        devices.emplace_back(new SoftwareAccelDevice(latency, "sw:" + std::to_string(unit)));
+        units.push_back(devices.back().get());
+    }
+    BandSplitProcessor splitter(units, config);
+    BatchReport report;
+    cv::Mat output = splitter.process(image, report);
+    for (int r = 0; r < output.rows; r++) {
+        if (std::memcmp(output.ptr<unsigned char>(r), &expected[r * output.cols], output.cols) != 0) {
+            std::cerr << "Band split over " << unit_count << " CUs differs at row " << r << " for " << height << "x" << width
+                      << " stages " << edge_stage_names(stages) << std::endl;
+            return -1.0;
+        }
+    }
+    return report.wall_time_ms;
+}
+
+int main() {
+    std::cout << "--- Starting tiled processing test ---" << std::endl;
+    srand(3);
+    SoftwareAccelDevice device;
+    int errors = 0;
+
+    /// Wider than the kernel line buffers with the default tile width
+    errors += check_tiled(device, 40, 9000, 16, KERNEL_MAX_WIDTH - 2, INPUT_FORMAT_RGB888, OUTPUT_FORMAT_GRAY8);
+    /// Small and uneven tiles so every band and column edge is exercised
+    errors += check_tiled(device, 37, 101, 5, 13, INPUT_FORMAT_RGB888, OUTPUT_FORMAT_GRAY8);
+    errors += check_tiled(device, 23, 64, 7, 1, INPUT_FORMAT_RGB32, OUTPUT_FORMAT_RGB32);
+    errors += check_tiled(device, 19, 77, 17, 75, INPUT_FORMAT_LUMA8, OUTPUT_FORMAT_GRAY8);
+    errors += check_tiled(device, 3, 3, 4, 4, INPUT_FORMAT_RGB888, OUTPUT_FORMAT_GRAY8);
+    /// Gaussian, NMS and threshold need a four pixel halo, tile edges must not show in the output
+    errors += check_tiled(device, 41, 67, 6, 9, INPUT_FORMAT_RGB888, OUTPUT_FORMAT_GRAY8, EDGE_STAGE_CANNY);
+    errors += check_tiled(device, 29, 53, 1, 2, INPUT_FORMAT_LUMA8, OUTPUT_FORMAT_RGB32, EDGE_STAGE_GAUSSIAN3 | EDGE_STAGE_NMS);
+    errors += check_tiled(device, 30, 9000, 16, KERNEL_MAX_WIDTH - 2, INPUT_FORMAT_RGB888, OUTPUT_FORMAT_GRAY8, EDGE_STAGE_CANNY);
+    /// A 7x7 operator widens the halo by two more pixels
+    EdgeKernel sobel7;
+    sobel7.edge_operator = EDGE_OPERATOR_SOBEL7;
+    sobel7.magnitude = EDGE_MAGNITUDE_L2;
+    SoftwareAccelDevice sobel7_device(SoftwareAccelDevice::Latency(), "sw", sobel7);
+    errors += check_tiled(sobel7_device, 43, 71, 5, 8, INPUT_FORMAT_RGB888, OUTPUT_FORMAT_GRAY8, 0, sobel7);
+    errors += check_tiled(sobel7_device, 33, 59, 4, 3, INPUT_FORMAT_LUMA8, OUTPUT_FORMAT_GRAY8, EDGE_STAGE_CANNY, sobel7);
+
+    /// Row bands: more CUs than rows, uneven bands, bands that are themselves tiled, and the four pixel halo
+    SoftwareAccelDevice::Latency no_latency;
+    for (int units : { 1, 2, 3, 8 }) {
+        errors += check_band_split(units, 5, 40, 1024, 0, no_latency) < 0.0;
+        errors += check_band_split(units, 61, 90, 7, 0, no_latency) < 0.0;
+        errors += check_band_split(units, 47, 55, 5, EDGE_STAGE_CANNY, no_latency) < 0.0;
+    }
+    errors += check_band_split(3, 20, 9000, 6, 0, no_latency) < 0.0;
+    /// At 20 MPPS per CU, four CUs should take well under half the latency of one
+    SoftwareAccelDevice::Latency slow;
+    slow.kernel_mpps = 20.0;
+    double one_cu_ms = check_band_split(1, 802, 1002, 200, 0, slow);
+    double four_cu_ms = check_band_split(4, 802, 1002, 200, 0, slow);
+    std::cout << "Band split latency: 1 CU " << one_cu_ms << " ms, 4 CUs " << four_cu_ms << " ms" << std::endl;
+    if (one_cu_ms < 0.0 || four_cu_ms < 0.0 || four_cu_ms > 0.5 * one_cu_ms) {
+        std::cerr << "Band split over 4 CUs did not cut the latency" << std::endl;
+        errors++;
+    }
+
+    if (!needs_tiling(100, KERNEL_MAX_WIDTH + 1, TileConfig()) || needs_tiling(1080, 1920, TileConfig())) {
+        std::cerr << "needs_tiling gave the wrong answer" << std::endl;
+        errors++;
+    }
+
+    if (errors == 0) {
+        std::cout << "--- Tiled processing test PASSED ---" << std::endl;
+        return 0;
+    } else {
+        std::cout << "--- Tiled processing test FAILED ---" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,166 @@
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <set>
+#include <thread>
+
+#include <opencv2/opencv.hpp>
+
+#include "accel_device.h"
+#include "batch_pipeline.h"
+#include "trace.h"
+
+///@brief: Checks the trace spans: nothing is recorded while tracing is off, spans from several threads land in
+/// their own rings, a full ring keeps the newest events, the Chrome export is well formed and a BatchPipeline run
+/// on the software stand-in device records every host stage
+
+int count_spans(const char* name) {
+    int count = 0;
+    for (const auto& thread : tracer().snapshot()) {
+        for (const TraceEvent& event : thread.second) {
+            if (std::string(event.name) == name) count++;
+        }
+    }
+    return count;
+}
+
+///@brief: Bracket and quote balance plus the expected top level keys, enough to catch a broken writer
+bool json_well_formed(const std::string& json) {
+    int depth = 0;
+    bool in_string = false;
+    for (size_t i = 0; i < json.size(); i++) {
+        char c = json[i];
+        if (in_string) {
+            if (c == '\\') i++;
+            else if (c == '"') in_string = false;
+        } else if (c == '"') {
+            in_string = true;
+        } else if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']') {
+            if (--depth < 0) return false;
+        }
+    }
+    return depth == 0 && !in_string && json.find("\"traceEvents\"") != std::string::npos;
+}
+
+int main() {
+    std::cout << "--- Starting trace test ---" << std::endl;
+    int errors = 0;
+
+    /// Off: spans record nothing
+    for (int i = 0; i < 1000; i++) {
+        TRACE_SPAN("off");
+    }
+    if (count_spans("off") != 0) {
+        std::cerr << "Spans were recorded with tracing off" << std::endl;
+        errors++;
+    }
+
+    /// On: nested spans from four threads, each thread named
+    trace_enable(true, 64);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([t] {
+            trace_thread_name("worker \"" + std::to_string(t) + "\"");
+            for (int i = 0; i < 10; i++) {
+                TRACE_SPAN("outer", i);
+                TRACE_SPAN("inner");
+            }
+        });
+    }
+    for (std::thread& thread : threads) thread.join();
+    if (count_spans("outer") != 40 || count_spans("inner") != 40) {
+        std::cerr << "Expected 40 outer and 40 inner spans, saw " << count_spans("outer") << " and " << count_spans("inner") << std::endl;
+        errors++;
+    }
+    for (const auto& thread : tracer().snapshot()) {
+        for (size_t i = 0; i + 1 < thread.second.size(); i += 2) {
+            const TraceEvent& inner = thread.second[i];
+            const TraceEvent& outer = thread.second[i + 1];
+            if (std::string(inner.name) == "inner" &&
+                (std::string(outer.name) != "outer" || inner.start_ns < outer.start_ns || inner.end_ns > outer.end_ns)) {
+                std::cerr << "Inner span not nested in its outer span" << std::endl;
+                errors++;
+                break;
+            }
+        }
+    }
+
+    /// A full ring keeps the newest events of its thread
+    std::thread wrap([] {
+        for (int i = 0; i < 200; i++) {
+            TRACE_SPAN("wrap", i);
+        }
+    });
+    wrap.join();
+    int64_t oldest_kept = -1;
+    for (const auto& thread : tracer().snapshot()) {
+        if (!thread.second.empty() && std::string(thread.second[0].name) == "wrap") oldest_kept = thread.second[0].arg;
+    }
+    if (count_spans("wrap") != 64 || oldest_kept != 200 - 64) {
+        std::cerr << "A wrapped ring kept " << count_spans("wrap") << " spans from " << oldest_kept << std::endl;
+        errors++;
+    }
+
+    std::ostringstream json;
+    write_chrome_trace(json);
+    if (!json_well_formed(json.str()) || json.str().find("worker \\\"2\\\"") == std::string::npos) {
+        std::cerr << "Chrome trace is not well formed or lost a thread name" << std::endl;
+        errors++;
+    }
+
+    /// A pipeline run records every host stage, one kernel and one d2h span per run
+    tracer().clear();
+    trace_enable(true);
+    SoftwareAccelDevice device;
+    PipelineConfig config;
+    config.queue_depth = 2;
+    config.max_height = 64;
+    config.max_width = 96;
+    BatchPipeline pipeline(device, config);
+    int next = 0;
+    BatchReport report = pipeline.run(
+        [&](BatchInput& input) {
+            if (next == 6) return false;
+            input.image = cv::Mat(64, 96, CV_8UC3, cv::Scalar(next * 40, 20, 200 - next * 30));
+            input.name = std::to_string(next++);
+            return true;
+        },
+        [](const BatchOutput&) {});
+    trace_enable(false);
+    for (const char* stage : { "pack", "h2d", "kernel", "d2h", "unpack" }) {
+        if (count_spans(stage) != 6) {
+            std::cerr << "Expected 6 " << stage << " spans, saw " << count_spans(stage) << std::endl;
+            errors++;
+        }
+    }
+    std::ostringstream summary;
+    write_trace_summary(summary);
+    std::cout << summary.str();
+    if (report.images.size() != 6 || summary.str().find("kernel") == std::string::npos) {
+        std::cerr << "Pipeline run or span summary incomplete" << std::endl;
+        errors++;
+    }
+
+    /// Both writers leave the caller's stream formatting as they found it
+    summary.str("");
+    write_chrome_trace(summary);
+    write_trace_summary(summary);
+    summary.str("");
+    summary << 0.5 << " " << std::setw(4) << 7;
+    if (summary.str() != "0.5    7") {
+        std::cerr << "Trace writers changed the stream format: \"" << summary.str() << "\"" << std::endl;
+        errors++;
+    }
+
+    if (errors == 0) {
+        std::cout << "--- Trace test PASSED ---" << std::endl;
+        return 0;
+    } else {
+        std::cout << "--- Trace test FAILED ---" << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,261 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+
+#include <opencv2/opencv.hpp>
+
+#include "accel_device.h"
+#include "video_stream.h"
+#include "image_process_ref.h"
+
+///@brief: Streams raw and Y4M frames through the ring on the software stand-in device. Checks that every frame
+/// comes out bit-exact and in order, that a blocking source loses nothing, and that a paced source in front of a
+/// device too slow for its rate drops frames instead of queueing them
+
+std::vector<std::vector<unsigned char> > make_frames(int count, size_t frame_bytes) {
+    std::vector<std::vector<unsigned char> > frames(count, std::vector<unsigned char>(frame_bytes));
+    for (int f = 0; f < count; f++) {
+        for (size_t i = 0; i < frame_bytes; i++) {
+            frames[f][i] = ((i / 29 + f) % 3) * 90 + (rand() & 0x1F);
+        }
+    }
+    return frames;
+}
+
+///@brief: Checks the edge frames a stream delivered against the reference on the frames it was fed
+void check_frames(const std::vector<std::vector<unsigned char> >& frames, const std::vector<long long>& indices,
+                  const std::vector<std::vector<unsigned char> >& outputs, const StreamConfig& config, const std::string& label, int& errors) {
+    int out_height = config.height - 2;
+    int out_width = config.width - 2;
+    std::vector<unsigned char> expected(output_buffer_bytes(OUTPUT_FORMAT_GRAY8, out_height * out_width));
+    std::vector<unsigned char> input;
+    for (size_t k = 0; k < indices.size(); k++) {
+        if (k > 0 && indices[k] <= indices[k - 1]) {
+            std::cerr << label << ": frame " << indices[k] << " delivered after frame " << indices[k - 1] << std::endl;
+            errors++;
+            return;
+        }
+        input = frames[indices[k]];
+        input.resize(input_buffer_bytes(config.input_format, config.height * config.width), 0);
+        image_process_reference(input.data(), expected.data(), config.height, config.width, config.input_format, OUTPUT_FORMAT_GRAY8,
+                                config.stages.flags, config.stages.low_threshold, config.stages.high_threshold);
+        if (is_mask_output(config.output_format)) {
+            for (int i = 0; i < out_height * out_width; i++) {
+                expected[i] = expected[i] >= config.stages.mask_threshold ? 255 : 0;
+            }
+        }
+        if (std::memcmp(outputs[k].data(), expected.data(), (size_t)out_height * out_width) != 0) {
+            std::cerr << label << ": frame " << indices[k] << " differs from the reference" << std::endl;
+            errors++;
+            return;
+        }
+    }
+}
+
+StreamReport run_stream(std::FILE* file, StreamConfig& config, const SoftwareAccelDevice::Latency& latency,
+                        std::vector<long long>& indices, std::vector<std::vector<unsigned char> >& outputs, int raw_format) {
+    std::rewind(file);
+    FrameSource source(file, config.width, config.height, raw_format);
+    config.width = source.width();
+    config.height = source.height();
+    config.input_format = source.input_format();
+    SoftwareAccelDevice device(latency);
+    VideoStream stream(device, config);
+    return stream.run(source, [&](long long frame, const cv::Mat& edges) {
+        indices.push_back(frame);
+        std::vector<unsigned char> plane;
+        for (int r = 0; r < edges.rows; r++) {
+            plane.insert(plane.end(), edges.ptr<unsigned char>(r), edges.ptr<unsigned char>(r) + edges.cols);
+        }
+        outputs.push_back(plane);
+    });
+}
+
+int main() {
+    std::cout << "--- Starting video stream test on the software stand-in device ---" << std::endl;
+    int errors = 0;
+    srand(41);
+
+    /// Raw RGB888 frames from a file, blocking source: every frame comes out
+    {
+        StreamConfig config;
+        config.width = 101;
+        config.height = 67;
+        config.ring_depth = 3;
+        config.drop_when_full = false;
+        std::vector<std::vector<unsigned char> > frames = make_frames(24, (size_t)101 * 67 * 3);
+        std::FILE* file = std::tmpfile();
+        for (const std::vector<unsigned char>& frame : frames) std::fwrite(frame.data(), 1, frame.size(), file);
+        SoftwareAccelDevice::Latency latency;
+        latency.kernel_mpps = 20.0;
+        std::vector<long long> indices;
+        std::vector<std::vector<unsigned char> > outputs;
+        StreamReport report = run_stream(file, config, latency, indices, outputs, INPUT_FORMAT_RGB888);
+        std::fclose(file);
+        check_frames(frames, indices, outputs, config, "RAW RGB888", errors);
+        if (report.frames_read != 24 || report.frames_processed != 24 || report.frames_dropped != 0 || report.setup_allocations != 3) {
+            std::cerr << "RAW RGB888: read " << report.frames_read << ", processed " << report.frames_processed << ", dropped "
+                      << report.frames_dropped << " with " << report.setup_allocations << " allocations" << std::endl;
+            errors++;
+        }
+        std::cout << "RAW RGB888: " << report.frames_processed << " FRAMES, LATENCY P50 " << report.latency.percentile(50) << " MS, MAX "
+                  << report.latency.percentile(100) << " MS" << std::endl;
+    }
+
+    /// Y4M 4:2:0, the Y plane is the LUMA8 input, with canny and a bit1 mask output written back as Y4M
+    {
+        int width = 77;
+        int height = 45;
+        std::vector<std::vector<unsigned char> > frames = make_frames(10, (size_t)width * height);
+        size_t chroma = 2 * (size_t)((width + 1) / 2) * ((height + 1) / 2);
+        std::FILE* file = std::tmpfile();
+        std::fprintf(file, "YUV4MPEG2 W%d H%d F30000:1001 Ip A1:1 C420jpeg\n", width, height);
+        for (const std::vector<unsigned char>& frame : frames) {
+            std::fputs("FRAME\n", file);
+            std::fwrite(frame.data(), 1, frame.size(), file);
+            std::vector<unsigned char> planes(chroma, 128);
+            std::fwrite(planes.data(), 1, planes.size(), file);
+        }
+        StreamConfig config;
+        config.output_format = OUTPUT_FORMAT_BIT1;
+        config.stages.flags = EDGE_STAGE_CANNY;
+        config.drop_when_full = false;
+        std::vector<long long> indices;
+        std::vector<std::vector<unsigned char> > outputs;
+        StreamReport report = run_stream(file, config, SoftwareAccelDevice::Latency(), indices, outputs, INPUT_FORMAT_RGB888);
+        std::fclose(file);
+        if (config.width != width || config.height != height || config.input_format != INPUT_FORMAT_LUMA8 ||
+            report.frames_processed != 10 || report.frame_interval_ms < 33.3 || report.frame_interval_ms > 33.4) {
+            std::cerr << "Y4M: header read as " << config.width << "x" << config.height << " format " << config.input_format << ", "
+                      << report.frames_processed << " frames at " << report.frame_interval_ms << " ms" << std::endl;
+            errors++;
+        } else {
+            check_frames(frames, indices, outputs, config, "Y4M BIT1", errors);
+        }
+
+        /// The edge frames written back as mono Y4M read in again as the same planes
+        std::FILE* sink = std::tmpfile();
+        EdgeFrameWriter writer(sink, true, width - 2, height - 2, 30000, 1001);
+        for (const std::vector<unsigned char>& plane : outputs) {
+            writer.write(cv::Mat(height - 2, width - 2, CV_8UC1, const_cast<unsigned char*>(plane.data())));
+        }
+        std::rewind(sink);
+        FrameSource written(sink, 0, 0, INPUT_FORMAT_RGB888);
+        std::vector<unsigned char> plane(written.frame_bytes());
+        size_t frames_back = 0;
+        while (written.read(plane.data())) {
+            if (frames_back < outputs.size() && plane != outputs[frames_back]) break;
+            frames_back++;
+        }
+        std::fclose(sink);
+        if (!written.is_y4m() || written.width() != width - 2 || frames_back != outputs.size()) {
+            std::cerr << "Y4M OUTPUT: read back " << frames_back << " of " << outputs.size() << " edge frames" << std::endl;
+            errors++;
+        }
+    }
+
+    /// A paced source at twice the rate the device sustains, a two slot ring drops instead of falling behind
+    {
+        StreamConfig config;
+        config.input_format = INPUT_FORMAT_LUMA8;
+        config.width = 64;
+        config.height = 64;
+        config.ring_depth = 2;
+        config.pace_fps = 200.0;
+        config.drop_when_full = true;
+        std::vector<std::vector<unsigned char> > frames = make_frames(40, 64 * 64);
+        std::FILE* file = std::tmpfile();
+        for (const std::vector<unsigned char>& frame : frames) std::fwrite(frame.data(), 1, frame.size(), file);
+        SoftwareAccelDevice::Latency latency;
+        latency.kernel_mpps = 64 * 64 / 10000.0;    /// 10 ms per frame against a 5 ms interval
+        std::vector<long long> indices;
+        std::vector<std::vector<unsigned char> > outputs;
+        StreamReport report = run_stream(file, config, latency, indices, outputs, INPUT_FORMAT_LUMA8);
+        std::fclose(file);
+        check_frames(frames, indices, outputs, config, "PACED", errors);
+        std::cout << "PACED 200 FPS ON A 100 FPS DEVICE: " << report.frames_processed << " PROCESSED, " << report.frames_dropped
+                  << " DROPPED, LATENCY MAX " << report.latency.percentile(100) << " MS" << std::endl;
+        if (report.frames_read != 40 || report.frames_processed + report.frames_dropped != 40 || report.frames_dropped < 10) {
+            std::cerr << "Expected a full read of 40 frames with about half of them dropped" << std::endl;
+            errors++;
+        }
+        /// A kept frame waits for at most the one run ahead of it in the two slot ring
+        if (report.latency.percentile(100) > 60.0) {
+            std::cerr << "Latency grew to " << report.latency.percentile(100) << " ms with frames being dropped" << std::endl;
+            errors++;
+        }
+    }
+
+    /// A sink that throws ends the run with its exception, the stream is then usable for the next run
+    {
+        StreamConfig config;
+        config.input_format = INPUT_FORMAT_LUMA8;
+        config.width = 48;
+        config.height = 32;
+        config.ring_depth = 3;
+        config.drop_when_full = false;
+        std::vector<std::vector<unsigned char> > frames = make_frames(12, 48 * 32);
+        std::FILE* file = std::tmpfile();
+        for (const std::vector<unsigned char>& frame : frames) std::fwrite(frame.data(), 1, frame.size(), file);
+        SoftwareAccelDevice device;
+        VideoStream stream(device, config);
+        std::rewind(file);
+        FrameSource failing(file, config.width, config.height, INPUT_FORMAT_LUMA8);
+        bool thrown = false;
+        try {
+            stream.run(failing, [](long long frame, const cv::Mat&) {
+                if (frame == 4) throw std::runtime_error("sink failed");
+            });
+        } catch (const std::runtime_error& error) {
+            thrown = std::string(error.what()) == "sink failed";
+        }
+        std::rewind(file);
+        FrameSource source(file, config.width, config.height, INPUT_FORMAT_LUMA8);
+        std::vector<long long> indices;
+        std::vector<std::vector<unsigned char> > outputs;
+        StreamReport report = stream.run(source, [&](long long frame, const cv::Mat& edges) {
+            indices.push_back(frame);
+            std::vector<unsigned char> plane;
+            for (int r = 0; r < edges.rows; r++) {
+                plane.insert(plane.end(), edges.ptr<unsigned char>(r), edges.ptr<unsigned char>(r) + edges.cols);
+            }
+            outputs.push_back(plane);
+        });
+        std::fclose(file);
+        if (!thrown || report.frames_processed != 12) {
+            std::cerr << "THROWING SINK: exception " << (thrown ? "" : "not ") << "passed on, next run processed "
+                      << report.frames_processed << " of 12 frames" << std::endl;
+            errors++;
+        }
+        check_frames(frames, indices, outputs, config, "AFTER THROWING SINK", errors);
+    }
+
+    /// Bad frame sizes are rejected before any ring buffer is allocated
+    for (int width : { 2, KERNEL_MAX_WIDTH + 1 }) {
+        StreamConfig config;
+        config.width = width;
+        config.height = 8;
+        SoftwareAccelDevice device;
+        bool rejected = false;
+        try {
+            VideoStream stream(device, config);
+        } catch (const std::runtime_error&) {
+            rejected = true;
+        }
+        if (!rejected) {
+            std::cerr << "A " << width << " pixel wide stream was accepted" << std::endl;
+            errors++;
+        }
+    }
+
+    if (errors == 0) {
+        std::cout << "--- Video stream test PASSED ---" << std::endl;
+        return 0;
+    } else {
+        std::cout << "--- Video stream test FAILED ---" << std::endl;
+        return 1;
+    }
+}
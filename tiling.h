@@ -0,0 +1,241 @@
+#ifndef TILING_H
+#define TILING_H
+
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <exception>
+#include <chrono>
+
+#include <opencv2/opencv.hpp>
+
+#include "image_formats.h"
+#include "accel_device.h"
+#include "batch_pipeline.h"
+#include "trace.h"
+
+///@brief: One tile in output coordinates. The kernel is given the input rectangle grown by the halo on
+/// every side, for plain sobel one pixel: (out_height + 2) x (out_width + 2) starting at input (out_row, out_col),
+/// and its (h-2) x (w-2) output is exactly this rectangle of the full image output. The optional stages need a
+/// wider halo (edge_stage_halo), the input rectangle is then clipped to the image and the extra border of the
+/// tile output is cropped. Tiles stitch with no seams and the result is identical to processing the whole
+/// image at once.
+struct TileRect {
+    int out_row = 0;
+    int out_col = 0;
+    int out_height = 0;
+    int out_width = 0;
+};
+
+struct TileConfig {
+    int tile_height = 1024;                     /// output rows per tile, bounds device and host memory
+    int tile_width = KERNEL_MAX_WIDTH - 2;      /// output columns per tile, the input tile is 2 wider
+    int queue_depth = 4;
+    int first_slot = 0;                         /// device slots used are first_slot .. first_slot + queue_depth - 1
+    int input_format = INPUT_FORMAT_RGB888;
+    int output_format = OUTPUT_FORMAT_GRAY8;
+    EdgeStages stages;
+    int edge_operator = EDGE_OPERATOR_SOBEL3;   /// operator of the device's kernel, wider ones widen the halo
+};
+
+///@brief: Tile width actually used, the input tile including the halo has to fit the kernel line buffers
+inline int effective_tile_width(const TileConfig& config) {
+    return std::min(config.tile_width, KERNEL_MAX_WIDTH - 2 * edge_stage_halo(config.stages.flags, config.edge_operator));
+}
+
+///@brief: Tile height actually used, RLE output rows have to fit the kernel's row table
+inline int effective_tile_height(const TileConfig& config) {
+    return config.output_format == OUTPUT_FORMAT_RLE ? std::min(config.tile_height, RLE_MAX_ROWS) : config.tile_height;
+}
+
+///@brief: Tiles in row band order, left to right inside a band
+inline std::vector<TileRect> plan_tiles(int out_height, int out_width, int tile_height, int tile_width) {
+    std::vector<TileRect> tiles;
+    for (int row = 0; row < out_height; row += tile_height) {
+        for (int col = 0; col < out_width; col += tile_width) {
+            TileRect tile;
+            tile.out_row = row;
+            tile.out_col = col;
+            tile.out_height = std::min(tile_height, out_height - row);
+            tile.out_width = std::min(tile_width, out_width - col);
+            tiles.push_back(tile);
+        }
+    }
+    return tiles;
+}
+
+///@brief: Splits the output rows into up to band_count bands of near equal height, one per compute unit
+inline std::vector<TileRect> plan_row_bands(int out_height, int out_width, int band_count) {
+    std::vector<TileRect> bands;
+    int count = std::max(1, std::min(band_count, out_height));
+    for (int b = 0; b < count; b++) {
+        TileRect band;
+        band.out_row = (int)((long long)out_height * b / count);
+        band.out_height = (int)((long long)out_height * (b + 1) / count) - band.out_row;
+        band.out_width = out_width;
+        bands.push_back(band);
+    }
+    return bands;
+}
+
+///@brief: True when the image is wider than the kernel line buffers, taller than the RLE row table or larger than one tile
+inline bool needs_tiling(int height, int width, const TileConfig& config) {
+    return width > KERNEL_MAX_WIDTH || (config.output_format == OUTPUT_FORMAT_RLE && height - 2 > RLE_MAX_ROWS) ||
+           (long long)height * width > (long long)(config.tile_height + 2) * (config.tile_width + 2);
+}
+
+///@brief: Streams an image of any size through the kernel tile by tile. Device buffers are sized for one tile,
+/// the host holds one band of input rows and one band of output rows at a time. Tiles of a band are kept in
+/// flight together, and the next band's tiles are uploaded while the last ones of the current band run.
+class TiledProcessor {
+public:
+    ///@brief: Returns input rows [first_row, first_row + row_count) at full width in the configured color layout
+    typedef std::function<cv::Mat(int first_row, int row_count)> RowSource;
+    ///@brief: Receives output rows [out_row, out_row + strip.rows), strip is only valid during the call
+    typedef std::function<void(int out_row, const cv::Mat& strip)> StripSink;
+
+    TiledProcessor(AccelDevice& device, const TileConfig& tile_config)
+        : config(tile_config), pipeline(device, make_pipeline_config(tile_config)) {}
+
+    ///@brief: Output rows [out_first, out_first + out_count) of a height x width image, all of them by default.
+    /// The tiles of a part still read their halo rows from the rest of the image, so parts stitch like tiles
+    BatchReport process_strips(int height, int width, const RowSource& source, const StripSink& sink, int out_first = 0, int out_count = -1) {
+        int out_width = width - 2;
+        int halo = edge_stage_halo(config.stages.flags, config.edge_operator);
+        std::vector<TileRect> tiles = plan_tiles(out_count < 0 ? height - 2 - out_first : out_count, out_width,
+                                                 effective_tile_height(config), effective_tile_width(config));
+        for (TileRect& tile : tiles) {
+            tile.out_row += out_first;
+        }
+
+        /// Output (r, c) is centred on input (r + 1, c + 1), the tile input reaches halo pixels beyond that
+        auto first_input = [&](int out_first) { return std::max(0, out_first + 1 - halo); };
+        auto end_input = [&](int out_first, int out_count, int limit) { return std::min(limit, out_first + out_count + 1 + halo); };
+
+        cv::Mat band_input;
+        int band_row = -1;
+        cv::Mat strip;
+        size_t next_tile = 0;
+        return pipeline.run(
+            [&](BatchInput& input) {
+                if (next_tile == tiles.size()) return false;
+                const TileRect& tile = tiles[next_tile];
+                int row_first = first_input(tile.out_row);
+                /// Earlier tiles were packed into device buffers at submit, the previous band can be dropped
+                if (tile.out_row != band_row) {
+                    band_input = source(row_first, end_input(tile.out_row, tile.out_height, height) - row_first);
+                    band_row = tile.out_row;
+                }
+                int col_first = first_input(tile.out_col);
+                input.image = band_input(cv::Rect(col_first, 0, end_input(tile.out_col, tile.out_width, width) - col_first, band_input.rows));
+                input.tag = next_tile++;
+                return true;
+            },
+            [&](const BatchOutput& output) {
+                const TileRect& tile = tiles[output.tag];
+                TRACE_SPAN("stitch", output.tag);
+                if (tile.out_col == 0) {
+                    strip.create(tile.out_height, out_width, CV_8UC1);
+                }
+                cv::Rect crop(tile.out_col - first_input(tile.out_col), tile.out_row - first_input(tile.out_row), tile.out_width, tile.out_height);
+                output.edges(crop).copyTo(strip(cv::Rect(tile.out_col, 0, tile.out_width, tile.out_height)));
+                if (tile.out_col + tile.out_width == out_width) {
+                    sink(tile.out_row, strip);
+                }
+            });
+    }
+
+    ///@brief: Whole image in host memory, the output is assembled in one Mat
+    cv::Mat process(const cv::Mat& image, BatchReport& report) {
+        cv::Mat output(image.rows - 2, image.cols - 2, CV_8UC1);
+        report = process_strips(image.rows, image.cols,
+            [&](int first_row, int row_count) { return image.rowRange(first_row, first_row + row_count); },
+            [&](int out_row, const cv::Mat& strip) { strip.copyTo(output.rowRange(out_row, out_row + strip.rows)); });
+        return output;
+    }
+
+private:
+    static PipelineConfig make_pipeline_config(const TileConfig& tile_config) {
+        PipelineConfig pipeline_config;
+        pipeline_config.queue_depth = tile_config.queue_depth;
+        pipeline_config.input_format = tile_config.input_format;
+        pipeline_config.output_format = tile_config.output_format;
+        int halo = edge_stage_halo(tile_config.stages.flags, tile_config.edge_operator);
+        pipeline_config.max_height = effective_tile_height(tile_config) + 2 * halo;
+        pipeline_config.max_width = effective_tile_width(tile_config) + 2 * halo;
+        pipeline_config.first_slot = tile_config.first_slot;
+        pipeline_config.stages = tile_config.stages;
+        /// Only the edge output is stitched, the tiles skip the Gx / Gy planes
+        pipeline_config.stages.flags &= ~EDGE_STAGE_GRADIENTS;
+        return pipeline_config;
+    }
+
+    TileConfig config;
+    BatchPipeline pipeline;
+};
+
+///@brief: Cuts the latency of one large image by the CU count: the output rows are split into one band per
+/// device and the bands run on all CUs at once, each band tiled on its own CU (TiledProcessor) from its own
+/// host thread. A band reads its halo rows from the neighbouring bands, two input rows of overlap for plain
+/// sobel, so the result is identical to processing the whole image at once. Each XrtAccelDevice allocates in
+/// its own CU's HBM bank, so the bands do not share a memory channel. The devices must not be in use elsewhere
+/// while process() runs
+class BandSplitProcessor {
+public:
+    BandSplitProcessor(const std::vector<AccelDevice*>& devices, const TileConfig& tile_config) {
+        for (AccelDevice* device : devices) {
+            processors.emplace_back(new TiledProcessor(*device, tile_config));
+        }
+    }
+
+    ///@brief: The whole (rows - 2) x (cols - 2) output. report.images holds the tiles of every band,
+    /// wall_time_ms is the latency of the image
+    cv::Mat process(const cv::Mat& image, BatchReport& report) {
+        cv::Mat output(image.rows - 2, image.cols - 2, CV_8UC1);
+        std::vector<TileRect> bands = plan_row_bands(output.rows, output.cols, processors.size());
+        std::vector<BatchReport> band_reports(bands.size());
+        std::vector<std::exception_ptr> failures(bands.size());
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (size_t b = 0; b < bands.size(); b++) {
+            threads.emplace_back([&, b] {
+                trace_thread_name("band " + std::to_string(b));
+                try {
+                    /// Bands write disjoint output rows, no lock needed
+                    band_reports[b] = processors[b]->process_strips(image.rows, image.cols,
+                        [&](int first_row, int row_count) { return image.rowRange(first_row, first_row + row_count); },
+                        [&](int out_row, const cv::Mat& strip) { strip.copyTo(output.rowRange(out_row, out_row + strip.rows)); },
+                        bands[b].out_row, bands[b].out_height);
+                } catch (...) {
+                    failures[b] = std::current_exception();
+                }
+            });
+        }
+        for (std::thread& thread : threads) thread.join();
+        for (const std::exception_ptr& failure : failures) {
+            if (failure) std::rethrow_exception(failure);
+        }
+
+        report = BatchReport();
+        for (const BatchReport& band : band_reports) {
+            report.images.insert(report.images.end(), band.images.begin(), band.images.end());
+            report.total_pixels += band.total_pixels;
+            report.peak_in_flight += band.peak_in_flight;
+            report.runs += band.runs;
+            report.busy_time_ms = std::max(report.busy_time_ms, band.busy_time_ms);
+            report.setup_allocations += band.setup_allocations;
+        }
+        report.wall_time_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return output;
+    }
+
+    int unit_count() const { return processors.size(); }
+
+private:
+    std::vector<std::unique_ptr<TiledProcessor> > processors;
+};
+
+#endif
@@ -0,0 +1,225 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cmath>
+#include <map>
+#include <ostream>
+#include <iomanip>
+
+#include "bench_stats.h"
+
+///@brief: Scoped spans over the host stages (decode, pack, h2d, kernel, d2h, unpack, encode, ...), switched on
+/// and off at run time with trace_enable(). Off, a span is one relaxed atomic load and a branch, so the spans stay
+/// compiled into production builds; -DTRACE_COMPILED_OUT removes them entirely. On, every thread records into
+/// its own ring of trace_enable's capacity, single writer and no lock, the oldest events are overwritten when a
+/// ring wraps. Buffers are registered once per thread and kept until exit, so the spans of finished threads are
+/// still dumped. Dump with write_chrome_trace (chrome://tracing, ui.perfetto.dev) or write_trace_summary once
+/// the traced work is done, a ring written during the dump may show a partly overwritten event.
+
+struct TraceEvent {
+    const char* name;               /// string literal, only the pointer is stored
+    uint64_t start_ns;
+    uint64_t end_ns;
+    int64_t arg;                    /// span specific: bytes moved, images in a run, frame number, -1 = none
+};
+
+struct TraceBuffer {
+    std::vector<TraceEvent> events;
+    std::atomic<uint64_t> written{0};
+    int tid = 0;
+    std::string name;
+
+    void push(const TraceEvent& event) {
+        uint64_t index = written.load(std::memory_order_relaxed);
+        events[index & (events.size() - 1)] = event;
+        written.store(index + 1, std::memory_order_release);
+    }
+};
+
+class Tracer {
+public:
+    std::atomic<bool> enabled{false};
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    uint64_t now_ns() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    ///@brief: This thread's ring, registered on first use
+    TraceBuffer& thread_buffer() {
+        thread_local TraceBuffer* buffer = nullptr;
+        if (!buffer) {
+            std::lock_guard<std::mutex> lock(mutex);
+            buffers.emplace_back(new TraceBuffer());
+            buffer = buffers.back().get();
+            buffer->events.resize(capacity);
+            buffer->tid = buffers.size();
+        }
+        return *buffer;
+    }
+
+    ///@brief: Snapshot of every thread's events, oldest first per thread
+    std::vector<std::pair<const TraceBuffer*, std::vector<TraceEvent> > > snapshot() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<std::pair<const TraceBuffer*, std::vector<TraceEvent> > > threads;
+        for (const std::unique_ptr<TraceBuffer>& buffer : buffers) {
+            uint64_t written = buffer->written.load(std::memory_order_acquire);
+            uint64_t size = buffer->events.size();
+            uint64_t first = written > size ? written - size : 0;
+            std::vector<TraceEvent> events;
+            for (uint64_t i = first; i < written; i++) {
+                events.push_back(buffer->events[i & (size - 1)]);
+            }
+            threads.push_back(std::make_pair(buffer.get(), events));
+        }
+        return threads;
+    }
+
+    void set_capacity(size_t events_per_thread) {
+        size_t rounded = 1;
+        while (rounded < events_per_thread) rounded <<= 1;
+        std::lock_guard<std::mutex> lock(mutex);
+        capacity = rounded;
+    }
+
+    ///@brief: Forgets the recorded events, only while no thread is tracing
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const std::unique_ptr<TraceBuffer>& buffer : buffers) {
+            buffer->written.store(0, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<std::unique_ptr<TraceBuffer> > buffers;
+    size_t capacity = 1 << 16;
+};
+
+inline Tracer& tracer() {
+    static Tracer instance;
+    return instance;
+}
+
+inline bool trace_enabled() {
+#ifdef TRACE_COMPILED_OUT
+    return false;
+#else
+    return tracer().enabled.load(std::memory_order_relaxed);
+#endif
+}
+
+///@brief: Turns recording on or off. events_per_thread sizes the rings of threads that record for the first time
+inline void trace_enable(bool on, size_t events_per_thread = 1 << 16) {
+    tracer().set_capacity(events_per_thread);
+    tracer().enabled.store(on, std::memory_order_relaxed);
+}
+
+inline uint64_t trace_now_ns() {
+    return trace_enabled() ? tracer().now_ns() : 0;
+}
+
+///@brief: Records an interval measured by the caller, for stages that do not fit a scope (a run started in
+/// one place and waited for in another). start_ns from trace_now_ns(), 0 when tracing was off at the start
+inline void trace_record(const char* name, uint64_t start_ns, int64_t arg = -1) {
+    if (!trace_enabled() || start_ns == 0) return;
+    TraceEvent event = { name, start_ns, tracer().now_ns(), arg };
+    tracer().thread_buffer().push(event);
+}
+
+///@brief: Names the calling thread in the trace (a CU, the stream ingest thread)
+inline void trace_thread_name(const std::string& name) {
+    if (trace_enabled()) tracer().thread_buffer().name = name;
+}
+
+///@brief: One span from construction to destruction, recorded only if tracing was on at construction
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* span_name, int64_t span_arg = -1) : name(span_name), arg(span_arg), start_ns(trace_now_ns()) {}
+    ~TraceSpan() { trace_record(name, start_ns, arg); }
+
+    void set_arg(int64_t span_arg) { arg = span_arg; }
+
+private:
+    const char* name;
+    int64_t arg;
+    uint64_t start_ns;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SPAN(...) TraceSpan TRACE_CONCAT(trace_span_, __LINE__)(__VA_ARGS__)
+
+///@brief: Chrome trace-event JSON, one complete ("X") event per span and a thread_name entry per named thread
+inline void write_chrome_trace(std::ostream& out) {
+    std::ios_base::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    bool first = true;
+    for (const auto& thread : tracer().snapshot()) {
+        const TraceBuffer* buffer = thread.first;
+        if (!buffer->name.empty()) {
+            out << (first ? "\n" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->tid
+                << ", \"args\": {\"name\": \"" << json_escape(buffer->name) << "\"}}";
+            first = false;
+        }
+        for (const TraceEvent& event : thread.second) {
+            out << (first ? "\n" : ",\n") << "{\"name\": \"" << json_escape(event.name) << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->tid
+                << ", \"ts\": " << std::fixed << std::setprecision(3) << event.start_ns / 1000.0
+                << ", \"dur\": " << (event.end_ns - event.start_ns) / 1000.0;
+            if (event.arg >= 0) out << ", \"args\": {\"arg\": " << event.arg << "}";
+            out << "}";
+            first = false;
+        }
+    }
+    out << "\n]}\n";
+    out.flags(flags);
+    out.precision(precision);
+}
+
+///@brief: Per span name: count, total, percentiles and a log2 histogram of the durations in microseconds
+inline void write_trace_summary(std::ostream& out) {
+    std::vector<std::string> order;
+    std::map<std::string, StageStats> spans;
+    std::map<std::string, std::vector<long long> > histograms;
+    for (const auto& thread : tracer().snapshot()) {
+        for (const TraceEvent& event : thread.second) {
+            double us = (event.end_ns - event.start_ns) / 1000.0;
+            if (spans.find(event.name) == spans.end()) order.push_back(event.name);
+            spans[event.name].add(us / 1000.0);
+            std::vector<long long>& buckets = histograms[event.name];
+            int bucket = us < 1.0 ? 0 : 1 + (int)std::log2(us);
+            if ((int)buckets.size() <= bucket) buckets.resize(bucket + 1, 0);
+            buckets[bucket]++;
+        }
+    }
+    std::ios_base::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+    out << std::left << std::setw(12) << "SPAN" << std::setw(10) << "COUNT" << std::setw(14) << "TOTAL MS" << std::setw(12) << "MEAN MS"
+        << std::setw(12) << "P50 MS" << std::setw(12) << "P95 MS" << std::setw(12) << "P99 MS" << "MAX MS" << std::endl;
+    for (const std::string& name : order) {
+        const StageStats& stats = spans[name];
+        out << std::left << std::setw(12) << name << std::setw(10) << stats.samples_ms.size() << std::setw(14)
+            << stats.mean() * stats.samples_ms.size() << std::setw(12) << stats.mean() << std::setw(12) << stats.percentile(50)
+            << std::setw(12) << stats.percentile(95) << std::setw(12) << stats.percentile(99) << stats.percentile(100) << std::endl;
+        const std::vector<long long>& buckets = histograms[name];
+        out << "    US:";
+        for (size_t b = 0; b < buckets.size(); b++) {
+            if (buckets[b] == 0) continue;
+            out << " [" << (b == 0 ? 0 : 1LL << (b - 1)) << "," << (1LL << b) << ")=" << buckets[b];
+        }
+        out << std::endl;
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+#endif
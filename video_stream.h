@@ -0,0 +1,425 @@
+#ifndef VIDEO_STREAM_H
+#define VIDEO_STREAM_H
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <stdexcept>
+
+#include <opencv2/opencv.hpp>
+
+#include "image_formats.h"
+#include "accel_device.h"
+#include "batch_pipeline.h"
+#include "buffer_pool.h"
+#include "bench_stats.h"
+#include "trace.h"
+
+///@brief: Fixed size frames from a pipe or a file. Raw frames are width x height pixels already in the kernel's
+/// input layout (input_format), back to back. A stream starting with the YUV4MPEG2 signature is read as Y4M:
+/// size and rate come from the header and the Y plane of each frame is the LUMA8 input, the chroma planes are skipped
+class FrameSource {
+public:
+    FrameSource(std::FILE* stream, int raw_width, int raw_height, int raw_input_format)
+        : file(stream), frame_width(raw_width), frame_height(raw_height), format(raw_input_format)
+    {
+        const char signature[] = "YUV4MPEG2";
+        prefix.resize(sizeof(signature) - 1);
+        prefix.resize(std::fread(prefix.data(), 1, prefix.size(), file));
+        if (prefix.size() == sizeof(signature) - 1 && std::memcmp(prefix.data(), signature, prefix.size()) == 0) {
+            prefix.clear();
+            parse_y4m_header();
+        } else if (frame_width < 3 || frame_height < 3) {
+            throw std::runtime_error("raw frames need a frame size of at least 3x3");
+        }
+    }
+
+    int width() const { return frame_width; }
+    int height() const { return frame_height; }
+    int input_format() const { return format; }
+    bool is_y4m() const { return y4m; }
+    ///@brief: Frame rate of a Y4M header as num / den, 0 / 1 for raw frames
+    int rate_num() const { return frame_rate_num; }
+    int rate_den() const { return frame_rate_den; }
+    double fps() const { return frame_rate_den > 0 ? (double)frame_rate_num / frame_rate_den : 0.0; }
+    size_t frame_bytes() const { return (size_t)frame_width * frame_height * input_bytes_per_pixel(format); }
+
+    ///@brief: Reads the next frame's pixels (frame_bytes) into dst. false at the end of the stream, a frame cut
+    /// short by the end of the stream throws
+    bool read(unsigned char* dst) {
+        if (y4m) {
+            std::string header;
+            int c = std::fgetc(file);
+            if (c == EOF) return false;
+            while (c != EOF && c != '\n') {
+                header += (char)c;
+                c = std::fgetc(file);
+            }
+            if (header.compare(0, 5, "FRAME") != 0) {
+                throw std::runtime_error("bad Y4M frame header: " + header.substr(0, 16));
+            }
+            read_exact(dst, frame_bytes(), false);
+            chroma.resize(chroma_bytes);
+            read_exact(chroma.data(), chroma_bytes, false);
+            return true;
+        }
+        return read_exact(dst, frame_bytes(), true);
+    }
+
+private:
+    void parse_y4m_header() {
+        y4m = true;
+        format = INPUT_FORMAT_LUMA8;
+        std::string line;
+        int c = std::fgetc(file);
+        while (c != EOF && c != '\n') {
+            line += (char)c;
+            c = std::fgetc(file);
+        }
+        std::string colorspace = "420";
+        size_t start = 0;
+        while (start < line.size()) {
+            size_t end = line.find(' ', start);
+            if (end == std::string::npos) end = line.size();
+            std::string token = line.substr(start, end - start);
+            if (!token.empty()) {
+                if (token[0] == 'W') frame_width = std::atoi(token.c_str() + 1);
+                else if (token[0] == 'H') frame_height = std::atoi(token.c_str() + 1);
+                else if (token[0] == 'C') colorspace = token.substr(1);
+                else if (token[0] == 'F' && std::sscanf(token.c_str() + 1, "%d:%d", &frame_rate_num, &frame_rate_den) != 2) {
+                    frame_rate_num = 0;
+                    frame_rate_den = 1;
+                }
+            }
+            start = end + 1;
+        }
+        if (frame_width < 3 || frame_height < 3) {
+            throw std::runtime_error("Y4M header without a frame size of at least 3x3");
+        }
+        size_t half_width = (frame_width + 1) / 2;
+        size_t half_height = (frame_height + 1) / 2;
+        if (colorspace == "mono") chroma_bytes = 0;
+        else if (colorspace == "420" || colorspace == "420jpeg" || colorspace == "420paldv" || colorspace == "420mpeg2") chroma_bytes = 2 * half_width * half_height;
+        else if (colorspace == "422") chroma_bytes = 2 * half_width * frame_height;
+        else if (colorspace == "444") chroma_bytes = 2 * (size_t)frame_width * frame_height;
+        else throw std::runtime_error("unsupported Y4M colorspace: C" + colorspace);
+    }
+
+    bool read_exact(unsigned char* dst, size_t bytes, bool end_allowed) {
+        size_t done = std::min(bytes, prefix.size());
+        std::memcpy(dst, prefix.data(), done);
+        prefix.erase(prefix.begin(), prefix.begin() + done);
+        while (done < bytes) {
+            size_t got = std::fread(dst + done, 1, bytes - done, file);
+            if (got == 0) break;
+            done += got;
+        }
+        if (done == bytes || (done == 0 && end_allowed)) {
+            return done == bytes;
+        }
+        throw std::runtime_error("stream ended inside a frame");
+    }
+
+    std::FILE* file;
+    int frame_width = 0;
+    int frame_height = 0;
+    int format = INPUT_FORMAT_RGB888;
+    bool y4m = false;
+    int frame_rate_num = 0;
+    int frame_rate_den = 1;
+    size_t chroma_bytes = 0;
+    std::vector<unsigned char> prefix;      /// bytes read while looking for the Y4M signature
+    std::vector<unsigned char> chroma;
+};
+
+///@brief: Writes the edge frames of a stream in order, as raw GRAY8 planes or as a mono Y4M stream. Every frame
+/// is flushed so a reader on the other end of a pipe sees it at once
+class EdgeFrameWriter {
+public:
+    EdgeFrameWriter(std::FILE* stream, bool y4m_output, int out_width, int out_height, int rate_num, int rate_den)
+        : file(stream), y4m(y4m_output)
+    {
+        if (y4m && file) {
+            std::fprintf(file, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 Cmono\n", out_width, out_height,
+                         rate_num > 0 ? rate_num : 30, rate_num > 0 ? rate_den : 1);
+        }
+    }
+
+    void write(const cv::Mat& edges) {
+        if (!file) return;
+        if (y4m) std::fputs("FRAME\n", file);
+        for (int r = 0; r < edges.rows; r++) {
+            std::fwrite(edges.ptr<unsigned char>(r), 1, edges.cols, file);
+        }
+        std::fflush(file);
+    }
+
+private:
+    std::FILE* file;
+    bool y4m;
+};
+
+struct StreamConfig {
+    int input_format = INPUT_FORMAT_RGB888;
+    int output_format = OUTPUT_FORMAT_GRAY8;
+    EdgeStages stages;
+    int width = 0;                  /// every frame of the stream has this size
+    int height = 0;
+    int ring_depth = 3;             /// device buffer pairs, frames in flight between arrival and output
+    int first_slot = 0;
+    double pace_fps = 0.0;          /// > 0 reads one frame per interval, replaying a file at camera rate
+    bool drop_when_full = true;     /// a frame arriving with the ring full is read and dropped, false blocks the source
+};
+
+struct StreamReport {
+    long long frames_read = 0;
+    long long frames_processed = 0;
+    long long frames_dropped = 0;
+    long long late_frames = 0;      /// latency above one frame interval
+    StageStats latency;             /// frame read complete to its edge frame handed to the sink
+    StageStats device;              /// start() to the return of wait(), includes time queued behind earlier frames
+    double frame_interval_ms = 0.0; /// from pace_fps or the Y4M header, 0 = unknown
+    double wall_time_ms = 0.0;
+    size_t d2h_bytes = 0;
+    int setup_allocations = 0;
+
+    double sustained_fps() const {
+        return wall_time_ms > 0.0 ? frames_processed / (wall_time_ms / 1000.0) : 0.0;
+    }
+};
+
+///@brief: Runs a continuous stream of frames through the kernel with bounded latency. The ring holds ring_depth
+/// pre-allocated buffer pairs. An ingest thread reads each frame straight into the mapped input buffer of the next
+/// ring slot (the raw layouts are the kernel's, so nothing is packed), syncs it and starts the run at once, so
+/// frames queue back to back on the device. The calling thread waits for the runs in ring order, reads the
+/// output back and hands the edge frame to the sink, then frees the slot. A frame therefore waits behind at
+/// most ring_depth - 1 others. When the device falls behind and every slot is taken, drop_when_full drops the
+/// newest frames instead of letting latency grow.
+class VideoStream {
+public:
+    ///@brief: Called in frame order, `edges` is (h - 2) x (w - 2) 8-bit and only valid during the call
+    typedef std::function<void(long long frame, const cv::Mat& edges)> FrameSink;
+
+    VideoStream(AccelDevice& accel_device, const StreamConfig& stream_config)
+        : device(accel_device), config(checked(stream_config)), ring(std::max(1, config.ring_depth)),
+          pool(accel_device, ring.size(), config.height, config.width, config.input_format, config.output_format, config.first_slot),
+          setup_allocations(pool.allocation_count())
+    {
+    }
+
+    StreamReport run(FrameSource& source, const FrameSink& on_frame) {
+        if (source.width() != config.width || source.height() != config.height || source.input_format() != config.input_format) {
+            throw std::runtime_error("frame source does not match the stream configuration");
+        }
+        StreamReport report;
+        report.setup_allocations = setup_allocations;
+        double interval_fps = config.pace_fps > 0.0 ? config.pace_fps : source.fps();
+        report.frame_interval_ms = interval_fps > 0.0 ? 1000.0 / interval_fps : 0.0;
+        for (RingSlot& slot : ring) {
+            slot.state = SLOT_FREE;
+        }
+        source_done = false;
+        stopping = false;
+        ingest_error = nullptr;
+
+        auto stream_start = std::chrono::high_resolution_clock::now();
+        std::thread ingest([&] {
+            trace_thread_name("stream ingest");
+            try {
+                ingest_frames(source, stream_start, report);
+            } catch (...) {
+                ingest_error = std::current_exception();
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                source_done = true;
+            }
+            changed.notify_all();
+        });
+
+        try {
+            consume_frames(report, on_frame);
+        } catch (...) {
+            stop_ingest(ingest);
+            throw;
+        }
+        ingest.join();
+        report.wall_time_ms = elapsed_ms(stream_start, std::chrono::high_resolution_clock::now());
+        if (ingest_error) {
+            std::rethrow_exception(ingest_error);
+        }
+        return report;
+    }
+
+private:
+    enum SlotState { SLOT_FREE, SLOT_SUBMITTED };
+
+    struct RingSlot {
+        SlotState state = SLOT_FREE;
+        long long frame = 0;
+        std::chrono::high_resolution_clock::time_point arrival;
+        std::chrono::high_resolution_clock::time_point start_time;
+        cv::Mat storage;            /// narrowed or decoded output, GRAY8 is handed over in place
+        uint64_t trace_start = 0;   /// trace_now_ns() at start(), the kernel span ends at the wait()
+    };
+
+    static const StreamConfig& checked(const StreamConfig& stream_config) {
+        if (stream_config.width < 3 || stream_config.height < 3 || stream_config.width > KERNEL_MAX_WIDTH) {
+            throw std::runtime_error("stream frames must be at least 3x3 and at most " + std::to_string(KERNEL_MAX_WIDTH) + " wide");
+        }
+        return stream_config;
+    }
+
+    ///@brief: Waits for the runs in ring order and hands each edge frame to on_frame, until the source is done
+    void consume_frames(StreamReport& report, const FrameSink& on_frame) {
+        int depth = ring.size();
+        int out_height = config.height - 2;
+        int out_width = config.width - 2;
+        for (int index = 0; ; index = (index + 1) % depth) {
+            RingSlot& slot = ring[index];
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] { return slot.state == SLOT_SUBMITTED || source_done; });
+                if (slot.state != SLOT_SUBMITTED) break;
+            }
+            device.wait(pool.device_slot(index));
+            trace_record("kernel", slot.trace_start, slot.frame);
+            auto kernel_stop = std::chrono::high_resolution_clock::now();
+            report.device.add(elapsed_ms(slot.start_time, kernel_stop));
+
+            uint64_t d2h_trace_start = trace_now_ns();
+            size_t d2h_bytes = report.d2h_bytes;
+            if (is_mask_output(config.output_format)) {
+                report.d2h_bytes += sync_edge_output(device, pool.device_slot(index), pool.output(index), 0, out_height, out_width,
+                                                     config.output_format);
+            } else {
+                size_t out_bytes = output_buffer_bytes(config.output_format, out_height * out_width);
+                device.sync_output(pool.device_slot(index), out_bytes);
+                report.d2h_bytes += out_bytes;
+            }
+            trace_record("d2h", d2h_trace_start, report.d2h_bytes - d2h_bytes);
+            size_t bytes_copied = 0;
+            cv::Mat edges;
+            {
+                TRACE_SPAN("unpack", slot.frame);
+                edges = output_image_view(pool.output(index), out_height, out_width, config.output_format, slot.storage, bytes_copied);
+            }
+            {
+                TRACE_SPAN("sink", slot.frame);
+                on_frame(slot.frame, edges);
+            }
+
+            double latency_ms = elapsed_ms(slot.arrival, std::chrono::high_resolution_clock::now());
+            report.latency.add(latency_ms);
+            if (report.frame_interval_ms > 0.0 && latency_ms > report.frame_interval_ms) {
+                report.late_frames++;
+            }
+            report.frames_processed++;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                slot.state = SLOT_FREE;
+            }
+            changed.notify_all();
+        }
+    }
+
+    ///@brief: After the sink or a device call threw: tells the ingest thread to stop, joins it and waits out the
+    /// runs still on the device so the ring can be reused. An ingest thread blocked in source.read() is only
+    /// joined once that read returns
+    void stop_ingest(std::thread& ingest) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        ingest.join();
+        for (size_t index = 0; index < ring.size(); index++) {
+            if (ring[index].state != SLOT_SUBMITTED) continue;
+            try {
+                device.wait(pool.device_slot(index));
+            } catch (...) {
+            }
+            ring[index].state = SLOT_FREE;
+        }
+    }
+
+    void ingest_frames(FrameSource& source, std::chrono::high_resolution_clock::time_point stream_start, StreamReport& report) {
+        KernelArgs args;
+        args.height = config.height;
+        args.width = config.width;
+        args.input_format = config.input_format;
+        args.output_format = config.output_format;
+        args.stages = config.stages;
+        /// The ring has no gradient buffers, frames carry only the edge output
+        args.stages.flags &= ~EDGE_STAGE_GRADIENTS;
+        size_t in_bytes = input_buffer_bytes(config.input_format, config.height * config.width);
+        std::vector<unsigned char> discard;
+        int depth = ring.size();
+
+        for (int index = 0; ; ) {
+            if (config.pace_fps > 0.0) {
+                std::this_thread::sleep_until(stream_start + std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(
+                                                                 std::chrono::duration<double>(report.frames_read / config.pace_fps)));
+            }
+            RingSlot& slot = ring[index];
+            bool slot_free;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (!config.drop_when_full) {
+                    changed.wait(lock, [&] { return slot.state == SLOT_FREE || stopping; });
+                }
+                if (stopping) break;
+                slot_free = slot.state == SLOT_FREE;
+            }
+            /// A dropped frame still has to be consumed, the source is a stream
+            if (!slot_free) discard.resize(source.frame_bytes());
+            {
+                TRACE_SPAN("read", report.frames_read);
+                if (!source.read(slot_free ? pool.input(index) : discard.data())) break;
+            }
+            auto arrival = std::chrono::high_resolution_clock::now();
+            long long frame = report.frames_read++;
+            if (!slot_free) {
+                report.frames_dropped++;
+                continue;
+            }
+
+            slot.frame = frame;
+            slot.arrival = arrival;
+            {
+                TRACE_SPAN("h2d", in_bytes);
+                device.sync_input(pool.device_slot(index), in_bytes);
+            }
+            slot.trace_start = trace_now_ns();
+            slot.start_time = std::chrono::high_resolution_clock::now();
+            device.start(pool.device_slot(index), args);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                slot.state = SLOT_SUBMITTED;
+            }
+            changed.notify_all();
+            index = (index + 1) % depth;
+        }
+    }
+
+    AccelDevice& device;
+    StreamConfig config;
+    std::vector<RingSlot> ring;
+    BufferPool pool;
+    int setup_allocations = 0;
+    bool source_done = false;
+    bool stopping = false;          /// run() is unwinding, the ingest thread starts no more frames
+    std::exception_ptr ingest_error;
+    std::mutex mutex;
+    std::condition_variable changed;
+};
+
+#endif